@@ -35,5 +35,4 @@ echo "$REQ" > "$CNF"
 %{_bindir}/uenv
 %{_bindir}/squashfs-mount
 %attr(4755, root, root) %{_bindir}/squashfs-mount
-/usr/libexec/oras
 /usr/share/bash-completion/completions/uenv
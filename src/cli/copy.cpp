@@ -1,7 +1,10 @@
 // vim: ts=4 sts=4 sw=4 et
 
+#include <algorithm>
 #include <filesystem>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <fmt/core.h>
 #include <fmt/ranges.h>
@@ -35,8 +38,16 @@ void image_copy_args::add_cli(CLI::App& cli,
         ->add_option("source-uenv", src_uenv_description,
                      "either name/version:tag, sha256 or id")
         ->required();
-    copy_cli->add_option("dest-uenv", dst_uenv_description, "label to copy to")
+    copy_cli
+        ->add_option("dest-uenv", dst_uenv_descriptions,
+                     "one or more labels to copy to")
         ->required();
+    copy_cli
+        ->add_option("--systems", systems,
+                     "copy to each of a comma separated list of systems")
+        ->delimiter(',');
+    copy_cli->add_option("--jobs", jobs,
+                         "the number of destinations to copy at the same time");
     copy_cli->add_option(
         "--token", token,
         "a path that contains a TOKEN file for accessing restricted uenv");
@@ -75,23 +86,40 @@ int image_copy([[maybe_unused]] const image_copy_args& args,
     }
     spdlog::debug("source label {}::{}", src_label.nspace, src_label.label);
 
-    uenv_nslabel dst_label{};
-    if (const auto parse = parse_uenv_nslabel(args.dst_uenv_description)) {
-        dst_label = *parse;
-    } else {
-        term::error("invalid destination: {}", parse.error().message());
+    if (args.jobs == 0) {
+        term::error("--jobs must be positive");
         return 1;
     }
-    spdlog::debug("destination label {}::{}", dst_label.nspace,
-                  dst_label.label);
-    if (!dst_label.nspace) {
-        term::error("the destination uenv {} must provide at least a "
-                    "namespace and name, e.g. 'deploy::'",
-                    args.dst_uenv_description);
-        return 1;
+
+    // parse the destinations, which are expanded over systems
+    std::vector<uenv_nslabel> dst_labels;
+    for (auto& description : args.dst_uenv_descriptions) {
+        uenv_nslabel dst_label{};
+        if (const auto parse = parse_uenv_nslabel(description)) {
+            dst_label = *parse;
+        } else {
+            term::error("invalid destination: {}", parse.error().message());
+            return 1;
+        }
+        spdlog::debug("destination label {}::{}", dst_label.nspace,
+                      dst_label.label);
+        if (!dst_label.nspace) {
+            term::error("the destination uenv {} must provide at least a "
+                        "namespace and name, e.g. 'deploy::'",
+                        description);
+            return 1;
+        }
+        if (args.systems.empty()) {
+            dst_labels.push_back(dst_label);
+        }
+        for (auto& system : args.systems) {
+            dst_labels.push_back(dst_label);
+            dst_labels.back().label.system = system;
+        }
     }
 
-    auto src_registry = site::registry_listing(*src_label.nspace);
+    // the source is resolved once for all of the destinations
+    auto src_registry = site::registry_listing(*src_label.nspace, src_label.label);
     if (!src_registry) {
         term::error("unable to get a listing of the uenv",
                     src_registry.error());
@@ -125,9 +153,10 @@ int image_copy([[maybe_unused]] const image_copy_args& args,
     const auto src_record = *(src_matches->begin());
     spdlog::info("source record: {} {}", src_record.sha, src_record);
 
-    // create the destination record
-    auto dst_record = src_record;
-    {
+    // create the destination records
+    std::vector<oras::copy_target> targets;
+    for (auto& dst_label : dst_labels) {
+        auto dst_record = src_record;
         const auto& dl = dst_label.label;
         if (dl.name) {
             dst_record.name = *(dl.name);
@@ -144,40 +173,84 @@ int image_copy([[maybe_unused]] const image_copy_args& args,
         if (dl.uarch) {
             dst_record.uarch = *(dl.uarch);
         }
-    }
 
-    if (dst_record == src_record) {
-        term::error("the source and destination are the same");
-        return 1;
+        if (dst_record == src_record) {
+            term::error("the source and destination are the same");
+            return 1;
+        }
+        const oras::copy_target target{*dst_label.nspace, dst_record};
+        if (std::find_if(targets.begin(), targets.end(), [&](auto& t) {
+                return t.nspace == target.nspace && t.uenv == target.uenv;
+            }) == targets.end()) {
+            spdlog::info("destination record: {}::{}", target.nspace,
+                         dst_record);
+            targets.push_back(target);
+        }
     }
 
-    spdlog::info("destination record: {} {}", dst_record.sha, dst_record);
-
-    // check whether the destination already exists
-    auto dst_registry = site::registry_listing(*dst_label.nspace);
-    if (dst_registry && dst_registry->contains(dst_record)) {
-        if (!args.force) {
-            term::error("the destination already exists - use the --force flag "
-                        "to copy anyway");
-            return 1;
+    // check whether the destinations already exist, with one listing of each
+    // namespace that is filtered on the fields that the destinations share
+    std::map<std::string, std::vector<uenv_record>> by_nspace;
+    for (auto& t : targets) {
+        by_nspace[t.nspace].push_back(t.uenv);
+    }
+    bool exists = false;
+    for (auto& [nspace, records] : by_nspace) {
+        uenv_label filter{.name = records[0].name,
+                          .version = records[0].version,
+                          .tag = records[0].tag,
+                          .system = records[0].system,
+                          .uarch = records[0].uarch};
+        for (auto& r : records) {
+            auto common = [](auto& field, const std::string& value) {
+                if (field && *field != value) {
+                    field = std::nullopt;
+                }
+            };
+            common(filter.name, r.name);
+            common(filter.version, r.version);
+            common(filter.tag, r.tag);
+            common(filter.system, r.system);
+            common(filter.uarch, r.uarch);
+        }
+        auto dst_registry = site::registry_listing(nspace, filter, true);
+        for (auto& r : records) {
+            if (dst_registry && dst_registry->contains(r)) {
+                term::error("the destination {}::{} already exists{}", nspace,
+                            r,
+                            args.force ? " and will be overwritten" : "");
+                exists = true;
+            }
         }
-        term::error("the destination already exists and will be overwritten");
+    }
+    if (exists && !args.force) {
+        term::error("use the --force flag to copy anyway");
+        return 1;
     }
 
     const auto rego_url = site::registry_url();
     spdlog::debug("registry url: {}", rego_url);
-    if (auto result =
-            oras::copy(rego_url, src_label.nspace.value(), src_record,
-                       dst_label.nspace.value(), dst_record, credentials);
-        !result) {
-        term::error("unable to copy uenv.\n{}", result.error().message);
-        return 1;
+    const auto results =
+        oras::copy(rego_url, src_label.nspace.value(), src_record, targets,
+                   args.jobs, credentials);
+    for (auto& [nspace, _] : by_nspace) {
+        site::expire_listing(nspace);
     }
 
+    // report the result of each destination
     term::msg("copied {}::{}", src_label.nspace.value(), src_record);
-    term::msg("to     {}::{}", dst_label.nspace.value(), dst_record);
+    int status = 0;
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        if (results[i]) {
+            term::msg("to     {}::{}", targets[i].nspace, targets[i].uenv);
+        } else {
+            term::error("unable to copy uenv to {}::{}.\n{}", targets[i].nspace,
+                        targets[i].uenv, results[i].error().message);
+            status = 1;
+        }
+    }
 
-    return 0;
+    return status;
 }
 
 std::string image_copy_footer() {
@@ -196,6 +269,11 @@ std::string image_copy_footer() {
         help::block{code,   "uenv image copy 7890d67458ce7deb deploy::@daint"},
         help::block{code,   "uenv image copy 7890d67458ce7deb @daint"},
         help::block{none, "in this case, the uenv will deployed with the current tag."},
+        help::linebreak{},
+        help::block{xmpl, "deploy a uenv to more than one vcluster"},
+        help::block{code,   "uenv image copy 7890d67458ce7deb deploy::@daint deploy::@clariden"},
+        help::block{code,   "uenv image copy 7890d67458ce7deb deploy:: --systems=daint,clariden,santis"},
+        help::block{none, "the destinations are copied concurrently, up to --jobs at a time."},
         // clang-format on
     };
 
@@ -3,6 +3,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <CLI/CLI.hpp>
 
@@ -12,10 +13,13 @@ namespace uenv {
 
 struct image_copy_args {
     std::string src_uenv_description;
-    std::string dst_uenv_description;
+    std::vector<std::string> dst_uenv_descriptions;
+    // copy each destination to each of these systems
+    std::vector<std::string> systems;
     std::optional<std::string> token;
     std::optional<std::string> username;
     bool force = false;
+    unsigned jobs = 4;
     void add_cli(CLI::App&, global_settings& settings);
 };
 
@@ -24,6 +28,7 @@ int image_copy(const image_copy_args& args, const global_settings& settings);
 } // namespace uenv
 
 #include <fmt/core.h>
+#include <fmt/ranges.h>
 
 template <> class fmt::formatter<uenv::image_copy_args> {
   public:
@@ -35,8 +40,10 @@ template <> class fmt::formatter<uenv::image_copy_args> {
     template <typename FmtContext>
     constexpr auto format(uenv::image_copy_args const& opts,
                           FmtContext& ctx) const {
-        return fmt::format_to(ctx.out(), "(image pull {} {} .token={})",
-                              opts.src_uenv_description,
-                              opts.dst_uenv_description, opts.token);
+        return fmt::format_to(
+            ctx.out(), "(image copy {} {} .systems={} .token={} .jobs={})",
+            opts.src_uenv_description,
+            fmt::join(opts.dst_uenv_descriptions, " "),
+            fmt::join(opts.systems, ","), opts.token, opts.jobs);
     }
 };
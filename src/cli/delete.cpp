@@ -1,6 +1,8 @@
 // vim: ts=4 sts=4 sw=4 et
 
+#include <chrono>
 #include <string>
+#include <vector>
 
 #include <fmt/core.h>
 #include <fmt/ranges.h>
@@ -13,6 +15,7 @@
 #include <uenv/parse.h>
 #include <uenv/print.h>
 #include <uenv/repository.h>
+#include <uenv/retention.h>
 #include <util/curl.h>
 #include <util/expected.h>
 #include <util/fs.h>
@@ -34,13 +37,19 @@ void image_delete_args::add_cli(CLI::App& cli,
         ->add_option("uenv", uenv_description,
                      "either name/version:tag, sha256 or id")
         ->required();
-    delete_cli
-        ->add_option(
-            "--token", token,
-            "a path that contains a TOKEN file for accessing restricted uenv")
-        ->required();
+    delete_cli->add_option(
+        "--token", token,
+        "a path that contains a TOKEN file for accessing restricted uenv");
     delete_cli->add_option("--username", username,
                            "user name for accessing restricted uenv.");
+    delete_cli->add_option(
+        "--retain", retain,
+        "delete the matching uenv except the newest N tags of each "
+        "name/version (e.g. 5), and those younger than an age (e.g. 30d)");
+    delete_cli->add_flag("--dry-run", dry_run,
+                         "list the uenv that would be deleted");
+    delete_cli->add_option("--jobs", jobs,
+                           "the number of uenv to delete at the same time");
     delete_cli->callback(
         [&settings]() { settings.mode = uenv::cli_mode::image_delete; });
 
@@ -49,12 +58,29 @@ void image_delete_args::add_cli(CLI::App& cli,
 
 int image_delete([[maybe_unused]] const image_delete_args& args,
                  [[maybe_unused]] const global_settings& settings) {
+    if (args.jobs == 0) {
+        term::error("--jobs must be positive");
+        return 1;
+    }
+    std::optional<retention_policy> policy;
+    if (args.retain) {
+        if (auto p = parse_retention_policy(*args.retain)) {
+            policy = *p;
+        } else {
+            term::error("{}", p.error());
+            return 1;
+        }
+    }
+
+    // credentials are not required to list the uenv that would be deleted
     uenv::oras::credentials credentials;
     if (auto c = site::get_credentials(args.username, args.token)) {
-        if (!*c) {
-            term::error("full credentials must be provided", c.error());
+        if (*c) {
+            credentials = (*c).value();
+        } else if (!args.dry_run) {
+            term::error("full credentials must be provided");
+            return 1;
         }
-        credentials = (*c).value();
     } else {
         term::error("{}", c.error());
         return 1;
@@ -65,7 +91,8 @@ int image_delete([[maybe_unused]] const image_delete_args& args,
     std::string nspace{};
     if (const auto parse = parse_uenv_nslabel(args.uenv_description)) {
         label = parse->label;
-        if (!label.name || !parse->nspace) {
+        // a retention policy can be applied to a whole namespace
+        if (!parse->nspace || (!label.name && !policy)) {
             term::error("the uenv {} must provide at least a namespace and "
                         "name, e.g. 'build::f7076704830c8de7'",
                         args.uenv_description);
@@ -78,7 +105,7 @@ int image_delete([[maybe_unused]] const image_delete_args& args,
     }
     spdlog::debug("requested to delete {}::{}", nspace, label);
 
-    auto registry = site::registry_listing(nspace);
+    auto registry = site::registry_listing(nspace, label, true);
     if (!registry) {
         term::error("unable to get a listing of the uenv", registry.error());
         return 1;
@@ -98,7 +125,7 @@ int image_delete([[maybe_unused]] const image_delete_args& args,
                     help::block(info, "try searching for the uenv to copy "
                                       "first using 'uenv image find'"));
         return 1;
-    } else if (!matches->unique_sha()) {
+    } else if (!policy && !matches->unique_sha()) {
         std::string errmsg =
             fmt::format("more than one sha found that matches '{}':\n",
                         args.uenv_description);
@@ -107,25 +134,39 @@ int image_delete([[maybe_unused]] const image_delete_args& args,
         return 1;
     }
 
-    const auto rego_url = site::registry_url();
-    spdlog::debug("registry url: {}", rego_url);
-    for (auto& record : *matches) {
-        auto url = fmt::format(
-            "https://jfrog.svc.cscs.ch/artifactory/uenv/{}/{}/{}/{}/{}/{}",
-            nspace, record.system, record.uarch, record.name, record.version,
-            record.tag);
-
-        if (auto result =
-                util::curl::del(url, credentials.username, credentials.token);
-            !result) {
-            term::error("unable to delete uenv: {}", result.error().message);
-            return 1;
-        }
+    // the plan is computed from the listing in one pass
+    const auto plan =
+        policy ? retention_plan(*matches, *policy,
+                                std::chrono::floor<std::chrono::seconds>(
+                                    std::chrono::system_clock::now()))
+               : std::vector<uenv_record>(matches->begin(), matches->end());
+    if (plan.empty()) {
+        term::msg("no uenv to delete: all {} matching uenv are retained",
+                  matches->size());
+        return 0;
+    }
+    if (args.dry_run) {
+        term::msg("{} of {} matching uenv would be deleted:\n{}", plan.size(),
+                  matches->size(), format_record_set_table(plan));
+        return 0;
+    }
 
-        term::msg("delete {}", url);
+    const auto results =
+        site::delete_uenv(nspace, plan, credentials, args.jobs);
+    // the cached listing is out of date once any of the records is deleted
+    site::expire_listing(nspace);
+
+    int status = 0;
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        if (results[i]) {
+            term::msg("deleted {}::{}", nspace, plan[i]);
+        } else {
+            term::error("unable to delete uenv: {}", results[i].error());
+            status = 1;
+        }
     }
 
-    return 0;
+    return status;
 }
 
 std::string image_delete_footer() {
@@ -141,6 +182,13 @@ std::string image_delete_footer() {
         help::block{code,   "uenv image delete deploy::prgenv-gnu/24.11:rc1@todi"},
         help::linebreak{},
         help::block{note, "the requested uenv must resolve to a unique sha."},
+        help::linebreak{},
+        help::block{xmpl, "keep the 5 newest builds of each uenv on daint"},
+        help::block{code,   "uenv image delete build::@daint --retain=5 --dry-run"},
+        help::block{code,   "uenv image delete build::@daint --retain=5"},
+        help::linebreak{},
+        help::block{xmpl, "delete builds of prgenv-gnu older than 30 days"},
+        help::block{code,   "uenv image delete build::prgenv-gnu --retain=30d"},
         // clang-format on
     };
 
@@ -14,6 +14,11 @@ struct image_delete_args {
     std::string uenv_description;
     std::optional<std::string> token;
     std::optional<std::string> username;
+    // delete the uenv that are not retained by a policy, see
+    // uenv::parse_retention_policy
+    std::optional<std::string> retain;
+    bool dry_run = false;
+    unsigned jobs = 8;
     void add_cli(CLI::App&, global_settings& settings);
 };
 
@@ -34,7 +39,10 @@ template <> class fmt::formatter<uenv::image_delete_args> {
     template <typename FmtContext>
     constexpr auto format(uenv::image_delete_args const& opts,
                           FmtContext& ctx) const {
-        return fmt::format_to(ctx.out(), "(image delete {} .token={})",
-                              opts.uenv_description, opts.token);
+        return fmt::format_to(
+            ctx.out(),
+            "(image delete {} .token={} .retain={} .dry_run={} .jobs={})",
+            opts.uenv_description, opts.token, opts.retain, opts.dry_run,
+            opts.jobs);
     }
 };
@@ -79,6 +79,8 @@ int image_find([[maybe_unused]] const image_find_args& args,
         site::get_system_name(label.system, settings.calling_environment);
     spdlog::info("image_find: {}::{}", nspace, label);
 
+    // request the full listing of the namespace without a filter, so that it
+    // is cached for the searches and pulls that typically follow a find.
     auto store = site::registry_listing(nspace);
     if (!store) {
         term::error("unable to get a listing of the uenv", store.error());
@@ -86,15 +88,21 @@ int image_find([[maybe_unused]] const image_find_args& args,
     }
 
     // search db for matching records
-    const auto result = store->query(label, !args.no_partials);
+    auto result = store->cursor(label, !args.no_partials);
     if (!result) {
-        term::error("invalid search term: {}", store.error());
+        term::error("invalid search term: {}", result.error());
         return 1;
     }
 
-    print_record_set(
-        result.value(), format.value(),
-        format.value() == record_set_format::list ? args.format.value() : "");
+    // print the records as they are read from the repository
+    if (auto r = print_record_set(
+            result.value(), format.value(),
+            format.value() == record_set_format::list ? args.format.value()
+                                                      : "");
+        !r) {
+        term::error("unable to read the listing: {}", r.error());
+        return 1;
+    }
 
     return 0;
 }
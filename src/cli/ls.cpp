@@ -80,15 +80,21 @@ int image_ls(const image_ls_args& args, const global_settings& settings) {
         site::get_system_name(label.system, settings.calling_environment);
 
     // query the repo
-    const auto result = store->query(label, !args.no_partials);
+    auto result = store->cursor(label, !args.no_partials);
     if (!result) {
-        term::error("invalid search term: {}", store.error());
+        term::error("invalid search term: {}", result.error());
         return 1;
     }
 
-    print_record_set(
-        result.value(), format.value(),
-        format.value() == record_set_format::list ? args.format.value() : "");
+    // print the records as they are read from the repository
+    if (auto r = print_record_set(
+            result.value(), format.value(),
+            format.value() == record_set_format::list ? args.format.value()
+                                                      : "");
+        !r) {
+        term::error("unable to read the repository: {}", r.error());
+        return 1;
+    }
 
     return 0;
 }
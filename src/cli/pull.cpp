@@ -1,8 +1,21 @@
 // vim: ts=4 sts=4 sw=4 et
 
+#include <algorithm>
+#include <atomic>
 #include <csignal>
 #include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <barkeep/barkeep.h>
 
 #include <fmt/core.h>
 #include <fmt/ranges.h>
@@ -14,11 +27,14 @@
 #include <uenv/oras.h>
 #include <uenv/parse.h>
 #include <uenv/print.h>
+#include <uenv/pull_lock.h>
 #include <uenv/repository.h>
+#include <uenv/seed.h>
 #include <util/curl.h>
 #include <util/expected.h>
 #include <util/fs.h>
 #include <util/signal.h>
+#include <util/strings.h>
 
 #include "help.h"
 #include "pull.h"
@@ -31,11 +47,12 @@ std::string image_pull_footer();
 void image_pull_args::add_cli(CLI::App& cli,
                               [[maybe_unused]] global_settings& settings) {
     auto* pull_cli =
-        cli.add_subcommand("pull", "download a uenv from a registry");
-    pull_cli
-        ->add_option("uenv", uenv_description,
-                     "the uenv to pull, either name/version:tag, sha256 or id")
-        ->required();
+        cli.add_subcommand("pull", "download uenv from a registry");
+    pull_cli->add_option(
+        "uenv", uenv_descriptions,
+        "the uenv to pull, each either name/version:tag, sha256 or id");
+    pull_cli->add_option("--from-file", from_file,
+                         "a file with a uenv to pull on each line");
     pull_cli->add_option(
         "--token", token,
         "a path that contains a TOKEN file for accessing restricted uenv");
@@ -44,6 +61,12 @@ void image_pull_args::add_cli(CLI::App& cli,
     pull_cli->add_flag("--only-meta", only_meta, "only download meta data");
     pull_cli->add_flag("--force", force,
                        "download and overwrite existing images");
+    pull_cli->add_option("--jobs", jobs,
+                         "the number of uenv to download at the same time");
+    pull_cli->add_option("--limit-rate", limit_rate,
+                         "the maximum total download rate in MB/s");
+    pull_cli->add_option("--max-connections", max_connections,
+                         "the maximum number of connections to the registry");
     pull_cli->add_flag("--build", build,
                        "invalid: replaced with 'build::' prefix on uenv label");
     pull_cli->callback(
@@ -52,6 +75,318 @@ void image_pull_args::add_cli(CLI::App& cli,
     pull_cli->footer(image_pull_footer);
 }
 
+namespace {
+
+// a uenv image to pull, identified by its sha256
+struct pull_job {
+    std::string nspace;
+    // the record used to pull the image
+    uenv_record record;
+    // the records of all labels that refer to the image, which are added to
+    // the repository once the image has been pulled
+    std::vector<uenv_record> records;
+    repository::pathset paths;
+    bool pull_meta = false;
+    bool pull_sqfs = false;
+    // an older version of the image in the repository, from which the
+    // unchanged parts of the image are copied
+    std::optional<uenv_record> delta_seed;
+    std::optional<std::filesystem::path> delta_path;
+    std::uint64_t seeded_bytes = 0;
+    // the image was copied from a seed repository, or could not be
+    std::optional<seed_result> seeded;
+    std::optional<std::string> seed_error;
+
+    // the progress of the download
+    std::atomic<std::size_t> downloaded_mb{0};
+    std::size_t total_mb = 0;
+    std::optional<std::string> error;
+};
+
+// read the uenv descriptions in a file, one per line.
+// empty lines and lines that start with # are ignored.
+util::expected<std::vector<std::string>, std::string>
+read_descriptions(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return util::unexpected(fmt::format("unable to open {}", path));
+    }
+    std::vector<std::string> descriptions;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = util::strip(line);
+        if (!line.empty() && line.front() != '#') {
+            descriptions.push_back(std::move(line));
+        }
+    }
+    return descriptions;
+}
+
+// the closest older version of record in the repository: the most recent uenv
+// with the same name, version, system and uarch that is not newer than record.
+// The data blocks of new tags of a uenv, e.g. v2 after v1, are mostly those of
+// the previous tag.
+std::optional<uenv_record> find_delta_seed(const uenv::repository& store,
+                                           const uenv_record& record) {
+    auto candidates = store.query({.name = record.name,
+                                   .version = record.version,
+                                   .system = record.system,
+                                   .uarch = record.uarch});
+    if (!candidates) {
+        return std::nullopt;
+    }
+    std::optional<uenv_record> seed;
+    for (auto& r : *candidates) {
+        if (r.sha != record.sha && r.date <= record.date &&
+            (!seed || r.date > seed->date) &&
+            std::filesystem::exists(store.uenv_paths(r.sha).squashfs)) {
+            seed = r;
+        }
+    }
+    return seed;
+}
+
+// Download the images with up to jobs downloads at a time. Images that are in
+// one of seed_repos are copied from it instead of downloaded.
+// If there is more than one image, the progress of each download and the total
+// throughput are shown in a composite display: otherwise oras::pull shows its
+// own progress bar.
+// The images are pulled from the first of registries that is reachable, see
+// oras::pull.
+// Throws util::signal_exception if the downloads were interrupted by a signal.
+void run_pull_jobs(std::vector<std::unique_ptr<pull_job>>& jobs,
+                   unsigned max_jobs,
+                   const std::vector<std::filesystem::path>& seed_repos,
+                   const std::vector<std::string>& registries,
+                   const std::optional<oras::credentials>& credentials) {
+    namespace bk = barkeep;
+
+    const bool composite = jobs.size() > 1;
+    std::atomic<std::size_t> total_mb{0};
+    // set the progress of a job, and advance the total by the same amount.
+    // Jobs that finish without reporting all of their progress, e.g. images
+    // copied from a seed repository or pulled by another process, are
+    // credited in full when they finish, so that the total reaches 100%.
+    // The difference is added modulo 2^64, which is exact for a decrease.
+    const auto set_progress = [&total_mb](pull_job* job, std::size_t mb) {
+        total_mb += mb - job->downloaded_mb.exchange(mb);
+    };
+    std::shared_ptr<bk::BaseDisplay> display;
+    if (composite) {
+        const auto style = color::use_color() ? bk::ProgressBarStyle::Rich
+                                              : bk::ProgressBarStyle::Bars;
+        const bool no_tty = !isatty(fileno(stdout));
+        std::vector<std::shared_ptr<bk::BaseDisplay>> bars;
+        std::size_t total = 0;
+        for (auto& job : jobs) {
+            total += job->total_mb;
+            bars.push_back(bk::ProgressBar(
+                &job->downloaded_mb,
+                {.total = job->total_mb,
+                 .message = fmt::format("{:<20}", job->record.id.string()),
+                 .speed = 0.1,
+                 .speed_unit = "MB/s",
+                 .style = style,
+                 .interval = 0.5,
+                 .no_tty = no_tty,
+                 .show = false}));
+        }
+        bars.push_back(bk::ProgressBar(&total_mb,
+                                       {.total = total,
+                                        .message = fmt::format("{:<20}", "total"),
+                                        .speed = 0.1,
+                                        .speed_unit = "MB/s",
+                                        .style = style,
+                                        .interval = 0.5,
+                                        .no_tty = no_tty,
+                                        .show = false}));
+        display = bk::Composite(bars, "\n");
+        display->show();
+    }
+
+    std::mutex mutex;
+    std::size_t next = 0;
+    std::optional<int> signal;
+    auto worker = [&]() {
+        while (true) {
+            pull_job* job;
+            {
+                std::lock_guard _(mutex);
+                if (util::signal_pending() && !signal) {
+                    signal = util::last_signal_raised();
+                }
+                if (next == jobs.size() || signal) {
+                    return;
+                }
+                job = jobs[next++].get();
+            }
+
+            // only one process pulls an image at a time: the others wait
+            // for it, showing its progress, and reuse the image that it
+            // pulled
+            std::atomic<std::size_t> holder_mb{0};
+            std::shared_ptr<bk::BaseDisplay> wait_bar;
+            const auto waiting = [&, job](const pull_status& holder) {
+                const auto mb =
+                    std::min(holder.bytes / (1024 * 1024), job->total_mb);
+                if (composite) {
+                    set_progress(job, mb);
+                    return;
+                }
+                holder_mb = mb;
+                if (!wait_bar) {
+                    term::msg("id={} is being pulled by {}: waiting for it "
+                              "to finish",
+                              job->record.id.string(), holder_string(holder));
+                    wait_bar = bk::ProgressBar(
+                        &holder_mb,
+                        {.total = job->total_mb,
+                         .message = fmt::format("waiting for {}",
+                                                job->record.id.string()),
+                         .speed = 0.1,
+                         .speed_unit = "MB/s",
+                         .style = color::use_color()
+                                      ? bk::ProgressBarStyle::Rich
+                                      : bk::ProgressBarStyle::Bars,
+                         .interval = 0.5,
+                         .no_tty = !isatty(fileno(stdout))});
+                }
+            };
+            std::optional<pull_lock> lock;
+            try {
+                auto r = acquire_pull_lock(
+                    job->paths.store,
+                    {.total = job->record.size_byte, .waiting = waiting});
+                if (wait_bar) {
+                    wait_bar->done();
+                }
+                if (!r) {
+                    job->error = r.error();
+                    continue;
+                }
+                lock.emplace(std::move(*r));
+            } catch (util::signal_exception& e) {
+                if (wait_bar) {
+                    wait_bar->done();
+                }
+                std::lock_guard _(mutex);
+                signal = e.signal;
+                continue;
+            }
+
+            if (auto& holder = lock->waited_for();
+                holder && (!job->pull_sqfs ||
+                           std::filesystem::exists(job->paths.squashfs)) &&
+                (!job->pull_meta || std::filesystem::exists(job->paths.meta))) {
+                spdlog::info("{} was pulled by {}", job->record.id,
+                             holder_string(*holder));
+                set_progress(job, job->total_mb);
+                lock->finish(true);
+                continue;
+            }
+
+            // images are copied from a seed repository instead of
+            // downloaded if possible
+            if (job->pull_sqfs && !seed_repos.empty()) {
+                auto seeded = seed_image(seed_repos, job->record.sha,
+                                         job->record.size_byte, job->paths);
+                if (!seeded) {
+                    job->seed_error = seeded.error();
+                } else if (*seeded) {
+                    job->seeded = **seeded;
+                    job->pull_sqfs = false;
+                    job->pull_meta = job->pull_meta && !(*seeded)->meta;
+                }
+                if (!job->pull_sqfs && !job->pull_meta) {
+                    set_progress(job, job->total_mb);
+                    lock->finish(true);
+                    continue;
+                }
+            }
+
+            if (auto& holder = lock->interrupted()) {
+                spdlog::info("{}: resuming the pull by {}, which stopped "
+                             "after {} of {} bytes",
+                             job->record.id, holder_string(*holder),
+                             holder->bytes, holder->total);
+                if (!composite) {
+                    term::msg("id={}: resuming a pull by {} that did not "
+                              "finish",
+                              job->record.id.string(), holder_string(*holder));
+                }
+            }
+
+            // the images that are read during the pull are locked, so
+            // that they are not replaced while they are read. The image is
+            // downloaded in full if the older version is locked, e.g.
+            // because it is being pulled again.
+            std::optional<util::file_lock> seed_lock;
+            if (!job->pull_sqfs) {
+                job->delta_seed = std::nullopt;
+                job->delta_path = std::nullopt;
+            } else if (job->delta_seed) {
+                auto seed_store = job->delta_path->parent_path();
+                if (auto l = util::make_file_lock(seed_store.string() + ".lock",
+                                                  util::lock_type::shared,
+                                                  read_lock_timeout)) {
+                    seed_lock.emplace(std::move(*l));
+                } else {
+                    spdlog::warn("{}: not pulled as a delta of {}: {}",
+                                 job->record.id, *job->delta_seed, l.error());
+                    job->delta_seed = std::nullopt;
+                    job->delta_path = std::nullopt;
+                }
+            }
+
+            oras::pull_options what{
+                .meta = job->pull_meta,
+                .squashfs = job->pull_sqfs,
+                .progress_bar = !composite,
+                .seed = job->delta_path};
+            what.progress = [&, job](std::uint64_t bytes) {
+                lock->update(bytes);
+                if (composite) {
+                    set_progress(job, std::min<std::size_t>(
+                                          bytes / (1024 * 1024), job->total_mb));
+                }
+                return true;
+            };
+
+            try {
+                auto r = oras::pull(registries, job->nspace, job->record,
+                                    job->paths.store, what, credentials);
+                if (!r) {
+                    job->error = r.error().message;
+                } else {
+                    set_progress(job, job->total_mb);
+                    job->seeded_bytes = r->seeded_bytes;
+                }
+                lock->finish(bool(r));
+            } catch (util::signal_exception& e) {
+                std::lock_guard _(mutex);
+                signal = e.signal;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<std::size_t>(max_jobs, jobs.size());
+         ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    if (display) {
+        display->done();
+    }
+    if (signal) {
+        throw util::signal_exception(*signal);
+    }
+}
+
+} // namespace
+
 int image_pull([[maybe_unused]] const image_pull_args& args,
                [[maybe_unused]] const global_settings& settings) {
     namespace fs = std::filesystem;
@@ -61,74 +396,138 @@ int image_pull([[maybe_unused]] const image_pull_args& args,
             "the --build flag has been removed.\nSpecify the build namespace "
             "as part of the uenv description, e.g.\n{}",
             color::yellow(fmt::format("uenv image pull build::{}",
-                                      args.uenv_description)));
+                                      fmt::join(args.uenv_descriptions, " "))));
         return 1;
     }
 
-    std::optional<uenv::oras::credentials> credentials;
-    if (auto c = site::get_credentials(args.username, args.token)) {
-        credentials = *c;
-    } else {
-        term::error("{}", c.error());
+    if (args.jobs == 0 || (args.limit_rate && *args.limit_rate <= 0) ||
+        (args.max_connections && *args.max_connections == 0)) {
+        term::error("--jobs, --limit-rate and --max-connections must be "
+                    "positive");
         return 1;
     }
 
-    // pull the search term that was provided by the user
-    uenv_label label{};
-    std::string nspace{site::default_namespace()};
-    if (const auto parse = parse_uenv_nslabel(args.uenv_description)) {
-        label = parse->label;
-        if (parse->nspace) {
-            nspace = *parse->nspace;
+    auto descriptions = args.uenv_descriptions;
+    if (args.from_file) {
+        auto r = read_descriptions(*args.from_file);
+        if (!r) {
+            term::error("{}", r.error());
+            return 1;
         }
-    } else {
-        term::error("invalid search term: {}", parse.error().message());
+        descriptions.insert(descriptions.end(), r->begin(), r->end());
+    }
+    if (descriptions.empty()) {
+        term::error("no uenv to pull: provide the uenv to pull as arguments, "
+                    "or in a file with --from-file");
         return 1;
     }
 
-    label.system =
-        site::get_system_name(label.system, settings.calling_environment);
-    if (!label.name) {
-        term::error(
-            "the uenv description '{}' must specify the name of the uenv",
-            args.uenv_description);
+    std::optional<uenv::oras::credentials> credentials;
+    if (auto c = site::get_credentials(args.username, args.token)) {
+        credentials = *c;
+    } else {
+        term::error("{}", c.error());
         return 1;
     }
 
-    spdlog::info("image_pull: {}::{}", nspace, label);
+    // parse the search terms that were provided by the user
+    std::vector<std::pair<std::string, uenv_label>> requests;
+    for (auto& description : descriptions) {
+        uenv_label label{};
+        std::string nspace{site::default_namespace()};
+        if (const auto parse = parse_uenv_nslabel(description)) {
+            label = parse->label;
+            if (parse->nspace) {
+                nspace = *parse->nspace;
+            }
+        } else {
+            term::error("invalid search term '{}': {}", description,
+                        parse.error().message());
+            return 1;
+        }
 
-    auto registry = site::registry_listing(nspace);
-    if (!registry) {
-        term::error("unable to get a listing of the uenv", registry.error());
-        return 1;
+        label.system =
+            site::get_system_name(label.system, settings.calling_environment);
+        if (!label.name) {
+            term::error(
+                "the uenv description '{}' must specify the name of the uenv",
+                description);
+            return 1;
+        }
+        spdlog::info("image_pull: {}::{}", nspace, label);
+        requests.emplace_back(std::move(nspace), std::move(label));
     }
 
-    // search db for matching records
-    const auto remote_matches = registry->query(label);
-    if (!remote_matches) {
-        term::error("invalid search term: {}", registry.error());
-        return 1;
-    }
-    // check that there is one record with a unique sha
-    if (remote_matches->empty()) {
-        using enum help::block::admonition;
-        term::error("no uenv found that matches '{}'\n\n{}",
-                    args.uenv_description,
-                    help::block(info, "try searching for the uenv to pull "
-                                      "first using 'uenv image find'"));
-        return 1;
-    } else if (!remote_matches->unique_sha()) {
-        std::string errmsg =
-            fmt::format("more than one uenv found that matches '{}':\n",
-                        args.uenv_description);
-        errmsg += format_record_set_table(*remote_matches);
-        term::error("{}", errmsg);
-        return 1;
+    // get one listing of each namespace. When more than one uenv is pulled
+    // from a namespace, the listing is only filtered by system.
+    std::map<std::string, uenv::repository> listings;
+    for (auto& [nspace, label] : requests) {
+        if (listings.contains(nspace)) {
+            continue;
+        }
+        auto filter = label;
+        const auto same_nspace = [&nspace](auto& r) { return r.first == nspace; };
+        if (std::count_if(requests.begin(), requests.end(), same_nspace) > 1) {
+            const bool same_system = std::all_of(
+                requests.begin(), requests.end(), [&](auto& r) {
+                    return !same_nspace(r) || r.second.system == label.system;
+                });
+            filter = {.system = same_system ? label.system : std::nullopt};
+        }
+        auto registry = site::registry_listing(nspace, filter);
+        if (!registry) {
+            term::error("unable to get a listing of the uenv: {}",
+                        registry.error());
+            return 1;
+        }
+        listings.emplace(nspace, std::move(*registry));
     }
 
-    // pick a record to use for pulling
-    const auto record = *(remote_matches->begin());
-    spdlog::info("pulling {} {}", record.sha, record);
+    // find the image of each search term, and pull each image once
+    std::vector<std::unique_ptr<pull_job>> jobs;
+    std::map<std::string, pull_job*> jobs_by_sha;
+    for (std::size_t i = 0; i < requests.size(); ++i) {
+        auto& [nspace, label] = requests[i];
+
+        // search db for matching records
+        const auto remote_matches = listings.at(nspace).query(label);
+        if (!remote_matches) {
+            term::error("invalid search term: {}", remote_matches.error());
+            return 1;
+        }
+        // check that there is one record with a unique sha
+        if (remote_matches->empty()) {
+            using enum help::block::admonition;
+            term::error("no uenv found that matches '{}'\n\n{}",
+                        descriptions[i],
+                        help::block(info, "try searching for the uenv to pull "
+                                          "first using 'uenv image find'"));
+            return 1;
+        } else if (!remote_matches->unique_sha()) {
+            std::string errmsg =
+                fmt::format("more than one uenv found that matches '{}':\n",
+                            descriptions[i]);
+            errmsg += format_record_set_table(*remote_matches);
+            term::error("{}", errmsg);
+            return 1;
+        }
+
+        // pick a record to use for pulling
+        const auto& record = *(remote_matches->begin());
+        auto& job = jobs_by_sha[record.sha.string()];
+        if (!job) {
+            spdlog::info("pulling {} {}", record.sha, record);
+            jobs.push_back(std::make_unique<pull_job>());
+            job = jobs.back().get();
+            job->nspace = nspace;
+            job->record = record;
+        } else {
+            spdlog::info("{} is the same image as {}", descriptions[i],
+                         job->record);
+        }
+        job->records.insert(job->records.end(), remote_matches->begin(),
+                            remote_matches->end());
+    }
 
     // require that a valid repo has been provided
     if (!settings.config.repo) {
@@ -144,129 +543,146 @@ int image_pull([[maybe_unused]] const image_pull_args& args,
         return 1;
     }
 
-    auto paths = store->uenv_paths(record.sha);
-
-    // acquire a file lock so that only one process can try to pull an image.
-    // TODO: how do we handle the case where we have many processes waiting, and
-    // there is a failure (e.g. file system problem), that causes the processes
-    // to attempt the pull one-after-the-other
-    auto lock = util::make_file_lock(paths.store.string() + ".lock");
-
-    bool meta_exists = fs::exists(paths.meta);
-    bool sqfs_exists = fs::exists(paths.squashfs);
-
-    auto in_repo = [&store](uenv_label label) -> bool {
-        return !(store->query(label)->empty());
-    };
-    const bool sha_in_repo = in_repo({.name = record.sha.string()});
-    const bool label_in_repo = in_repo({.name = record.name,
-                                        .version = record.version,
-                                        .tag = record.tag,
-                                        .system = record.system,
-                                        .uarch = record.uarch});
-
-    spdlog::debug("sha   in repo: {}", sha_in_repo);
-    spdlog::debug("label in repo: {}", label_in_repo);
-
-    const bool pull_sqfs = !args.only_meta && (args.force || !sqfs_exists);
-    const bool pull_meta = args.force || !meta_exists;
-    spdlog::debug("pull meta: {}", pull_meta);
-    spdlog::debug("pull sqfs: {}", pull_sqfs);
-
-    if (pull_sqfs || pull_meta) {
-        try {
-            auto rego_url = site::registry_url();
-            spdlog::debug("registry url: {}", rego_url);
-
-            if (pull_meta) {
-                // the digests returned by oras::discover is a list of artifacts
-                // that have been "oras attach"ed to our squashfs image. This
-                // would be empty if no meta data was attached - currently we
-                // assume that meta data has been attached
-                auto digests =
-                    oras::discover(rego_url, nspace, record, credentials);
-                if (!digests) {
-                    term::error("unable to pull meta digest.\n{}",
-                                digests.error().message);
-                    return 1;
-                }
-                if (digests->empty()) {
-                    term::error("unable to pull uenv: no metadata in manifest");
-                    return 1;
-                }
-                spdlog::debug("manifests: {}", fmt::join(*digests, ", "));
-
-                // We assume that there is one, and only, digest attached to the
-                // squashfs image: the meta data directory.
-                // pull_digetst will download the digest: in the case of meta
-                // data it will unpack the meta path into paths.store.
-                //
-                // This will change in the future, when we may attache multiple
-                // or zero items to the squashfs image.
-                const auto digest = *(digests->begin());
-
-                if (auto okay =
-                        oras::pull_digest(rego_url, nspace, record, digest,
-                                          paths.store, credentials);
-                    !okay) {
-                    term::error("unable to pull uenv.\n{}",
-                                okay.error().message);
-                    return 1;
-                }
+    // the global limits on bandwidth and connections apply to all downloads
+    auto config = oci::get_download_config();
+    if (args.limit_rate) {
+        config.max_rate = *args.limit_rate * 1e6;
+    }
+    if (args.max_connections) {
+        config.max_connections = *args.max_connections;
+    }
+    oci::set_download_config(config);
+
+    // images that are already in the repository are not downloaded
+    std::vector<std::unique_ptr<pull_job>> scheduled;
+    std::vector<std::unique_ptr<pull_job>> skipped;
+    for (auto& job : jobs) {
+        job->paths = store->uenv_paths(job->record.sha);
+        job->pull_sqfs = !args.only_meta &&
+                         (args.force || !fs::exists(job->paths.squashfs));
+        job->pull_meta = args.force || !fs::exists(job->paths.meta);
+
+        // new versions of a uenv are pulled as a delta of an older version
+        if (job->pull_sqfs && !args.force) {
+            if ((job->delta_seed = find_delta_seed(*store, job->record))) {
+                job->delta_path =
+                    store->uenv_paths(job->delta_seed->sha).squashfs;
+                spdlog::info("{}: delta pull from {}", job->record.id,
+                             *job->delta_seed);
             }
+        }
 
-            if (pull_sqfs) {
-                auto tag_result = oras::pull_tag(rego_url, nspace, record,
-                                                 paths.store, credentials);
-                if (!tag_result) {
-                    term::error("unable to pull uenv.\n{}",
-                                tag_result.error().message);
-                    return 1;
-                }
-            }
-        } catch (util::signal_exception& e) {
-            spdlog::info("cleaning up after interrupted download");
-            spdlog::debug("removing record {}", record);
-            store->remove(record.sha);
-            spdlog::debug("deleting path {}", paths.store);
-            std::filesystem::remove_all(paths.store);
-            // reraise the signal
-            raise(e.signal);
+        spdlog::debug("{}: pull meta {}, pull sqfs {}", job->record.id,
+                      job->pull_meta, job->pull_sqfs);
+        if (!job->pull_meta && !job->pull_sqfs) {
+            term::msg("id={} already exists in the repository, skipping pull.",
+                      job->record.id.string());
+            skipped.push_back(std::move(job));
+            continue;
         }
-    } else {
-        term::msg("id={} already exists in the repository, skipping pull.",
-                  record.id.string());
+        // force rounding up, so that total_mb is never zero
+        job->total_mb =
+            job->pull_sqfs
+                ? (job->record.size_byte + (1024 * 1024 - 1)) / (1024 * 1024)
+                : 1;
+        scheduled.push_back(std::move(job));
     }
 
-    // add the label to the repo, even if there was no download.
+    // the signal catcher is installed once for all of the downloads, which
+    // stop when a signal is raised
+    util::set_signal_catcher();
+    try {
+        if (!scheduled.empty()) {
+            run_pull_jobs(scheduled, args.jobs,
+                          args.force ? std::vector<fs::path>{}
+                                     : settings.config.seed_repos,
+                          site::pull_registries(), credentials);
+        }
+    } catch (util::signal_exception& e) {
+        // the squashfs images are downloaded to store.squashfs.partial,
+        // which are kept with a checkpoint so that the next pull resumes
+        // the downloads. The meta data directory is moved into place once
+        // it has been unpacked, and the records are only added to the
+        // repository after their downloads have finished, so there is
+        // nothing to remove.
+        spdlog::info("interrupted download");
+        term::msg("the download was interrupted: run the same command "
+                  "again to resume it");
+        // reraise the signal
+        raise(e.signal);
+    }
+
+    // add the labels to the repo, even if there was no download.
     // download may have been skipped if a squashfs with the same sha has
     // been downloaded, and this download uses a different label.
-    for (auto& r : *remote_matches) {
-        bool exists = in_repo({.name = r.name,
-                               .version = r.version,
-                               .tag = r.tag,
-                               .system = r.system,
-                               .uarch = r.uarch});
-        if (!exists) {
-            term::msg("updating {}", r);
-            store->add(r);
+    int status = 0;
+    std::vector<uenv_record> new_records;
+    for (auto* list : {&skipped, &scheduled}) {
+        for (auto& job : *list) {
+            if (job->error) {
+                term::error("unable to pull {}.\n{}", job->record,
+                            *job->error);
+                status = 1;
+                continue;
+            }
+            if (job->seed_error) {
+                term::warn("unable to copy {} from a seed repository: {}",
+                           job->record.id.string(), *job->seed_error);
+            }
+            if (job->seeded) {
+                using enum util::clone_method;
+                const auto method = job->seeded->method;
+                term::msg("id={} {} from {}", job->record.id.string(),
+                          method == reflink    ? "cloned"
+                          : method == hardlink ? "linked"
+                                               : "copied",
+                          job->seeded->repo);
+            }
+            if (job->seeded_bytes) {
+                term::msg("id={} {:.1f} of {:.1f} MB copied from {}, {:.1f} MB "
+                          "downloaded",
+                          job->record.id.string(), job->seeded_bytes / 1e6,
+                          job->record.size_byte / 1e6, *job->delta_seed,
+                          (job->record.size_byte - job->seeded_bytes) / 1e6);
+            }
+            for (auto& r : job->records) {
+                if (!store->contains(r) &&
+                    std::find(new_records.begin(), new_records.end(), r) ==
+                        new_records.end()) {
+                    term::msg("updating {}", r);
+                    new_records.push_back(r);
+                }
+            }
         }
     }
+    if (auto r = store->add_batch(new_records); !r) {
+        term::error("unable to add uenv to the repository: {}", r.error());
+        return 1;
+    }
 
-    return 0;
+    return status;
 }
 
 std::string image_pull_footer() {
     using enum help::block::admonition;
     std::vector<help::item> items{
         // clang-format off
-        help::block{none, "Download a uenv from a registry." },
+        help::block{none, "Download uenv from a registry." },
         help::linebreak{},
         help::linebreak{},
         help::block{xmpl, "pull a uenv"},
         help::block{code,   "uenv image pull prgenv-gnu"},
         help::block{code,   "uenv image pull prgenv-gnu/24.11:v1@todi"},
         help::linebreak{},
+        help::block{xmpl, "pull more than one uenv at the same time"},
+        help::block{code,   "uenv image pull prgenv-gnu/24.11:v1 linalg/24.11:v1"},
+        help::block{code,   "uenv image pull --from-file=uenv.txt"},
+        help::block{note, "the file has one uenv on each line: empty lines and lines" },
+        help::block{none, "that start with # are ignored." },
+        help::linebreak{},
+        help::block{xmpl, "limit the bandwidth and connections used by the download"},
+        help::block{code,   "uenv image pull --limit-rate=100 --max-connections=4 prgenv-gnu"},
+        help::linebreak{},
         help::block{xmpl, "use a token for the registry"},
         help::block{code,   "uenv image pull --token=/opt/cscs/uenv/tokens/vasp6 vasp/6.4.2:v1"},
         help::block{note, "this is only required when accessing uenv that require special" },
@@ -3,6 +3,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <CLI/CLI.hpp>
 
@@ -11,12 +12,17 @@
 namespace uenv {
 
 struct image_pull_args {
-    std::string uenv_description;
+    std::vector<std::string> uenv_descriptions;
+    std::optional<std::string> from_file;
     std::optional<std::string> token;
     std::optional<std::string> username;
     bool only_meta = false;
     bool force = false;
     bool build = false;
+    // limits on concurrent downloads
+    unsigned jobs = 4;
+    std::optional<double> limit_rate;
+    std::optional<unsigned> max_connections;
     void add_cli(CLI::App&, global_settings& settings);
 };
 
@@ -25,6 +31,8 @@ int image_pull(const image_pull_args& args, const global_settings& settings);
 } // namespace uenv
 
 #include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <fmt/std.h>
 
 template <> class fmt::formatter<uenv::image_pull_args> {
   public:
@@ -37,7 +45,10 @@ template <> class fmt::formatter<uenv::image_pull_args> {
     constexpr auto format(uenv::image_pull_args const& opts,
                           FmtContext& ctx) const {
         return fmt::format_to(
-            ctx.out(), "(image pull {} .only_meta={} .force={} .token={})",
-            opts.uenv_description, opts.only_meta, opts.force, opts.token);
+            ctx.out(),
+            "(image pull {} .from_file={} .only_meta={} .force={} .token={} "
+            ".jobs={})",
+            fmt::join(opts.uenv_descriptions, " "), opts.from_file,
+            opts.only_meta, opts.force, opts.token, opts.jobs);
     }
 };
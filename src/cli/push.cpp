@@ -83,7 +83,7 @@ int image_push([[maybe_unused]] const image_push_args& args,
                   dst_label.label);
 
     const auto nspace = dst_label.nspace.value();
-    auto registry = site::registry_listing(nspace);
+    auto registry = site::registry_listing(nspace, dst_label.label, true);
     if (!registry) {
         term::error("unable to get a listing of the uenv", registry.error());
         return 1;
@@ -121,32 +121,29 @@ int image_push([[maybe_unused]] const image_push_args& args,
         auto rego_url = site::registry_url();
         spdlog::debug("registry url: {}", rego_url);
 
-        // Push the SquashFS image
-        auto push_result = oras::push_tag(rego_url, nspace, dst_label.label,
-                                          sqfs->sqfs, credentials);
+        // Push the SquashFS image, with its meta data and the block index
+        // that lets users who have an older version of the uenv download
+        // only the parts of the image that have changed
+        if (sqfs->meta) {
+            spdlog::info("image_push: pushing metadata from {}",
+                         sqfs->meta.value().string());
+        }
+        auto push_result = oras::push(
+            rego_url, nspace, dst_label.label, sqfs->sqfs,
+            {.meta = sqfs->meta, .blocks = true, .digest = sqfs->hash},
+            credentials);
         if (!push_result) {
             term::error("unable to push uenv.\n{}",
                         push_result.error().message);
             return 1;
         }
+        site::expire_listing(nspace);
 
-        // Check for metadata and push if available
-        if (sqfs->meta) {
-            spdlog::info("image_push: pushing metadata from {}",
-                         sqfs->meta.value().string());
-
-            auto meta_result =
-                oras::push_meta(rego_url, nspace, dst_label.label,
-                                sqfs->meta.value(), credentials);
-            if (!meta_result) {
-                spdlog::warn("unable to push metadata.\n{}",
-                             meta_result.error().message);
-                term::warn("unable to push metadata.\n{}",
-                           meta_result.error().message);
-                // Continue even if metadata push fails
-            } else {
-                spdlog::info("successfully pushed metadata");
-            }
+        // Continue even if metadata push fails
+        if (sqfs->meta && !push_result->meta) {
+            term::warn("unable to push metadata.");
+        } else if (sqfs->meta) {
+            spdlog::info("successfully pushed metadata");
         }
 
         term::msg("successfully pushed {}", args.source);
@@ -12,6 +12,7 @@
 
 #include <uenv/parse.h>
 #include <uenv/repository.h>
+#include <util/defer.h>
 #include <util/expected.h>
 #include <util/lustre.h>
 
@@ -53,6 +54,9 @@ void repo_args::add_cli(CLI::App& cli,
     update_cli->add_option("path", update_args.path, "path of the repo");
     update_cli->add_flag("--lustre,!--no-lustre", update_args.lustre,
                          "apply lustre striping fix if applicable");
+    update_cli->add_flag("--wal,!--no-wal", update_args.wal,
+                         "enable write-ahead logging for the database - only "
+                         "use when all access is from a single node");
     update_cli->callback(
         [&settings]() { settings.mode = uenv::cli_mode::repo_update; });
 
@@ -126,7 +130,7 @@ repo_consistency check_repo_consistency(const uenv::repository& store) {
     namespace fs = std::filesystem;
 
     // an empty query will return all uenv for all systems
-    const auto query = store.query({});
+    auto query = store.cursor({});
     if (!query) {
         term::error("unable to query database: {}", query.error());
         return {};
@@ -164,6 +168,10 @@ repo_consistency check_repo_consistency(const uenv::repository& store) {
             }
         }
     }
+    if (auto e = query->error()) {
+        term::error("unable to query database: {}", *e);
+        return {};
+    }
 
     return R;
 }
@@ -232,6 +240,9 @@ int repo_status(const repo_status_args& args, const global_settings& settings) {
     // set to true when an update can be applied using `uenv repo update`
     std::optional<lustre::stripe_stats> lustre_state{};
     std::optional<repo_consistency> store_state{};
+    // set if the database schema can be upgraded
+    std::optional<int> schema_version{};
+    std::optional<journal_mode> journal{};
 
     if (valid_repo) {
         // check for lustre striping
@@ -247,6 +258,14 @@ int repo_status(const repo_status_args& args, const global_settings& settings) {
                 store_state = c;
                 update = true;
             }
+            if (auto v = store->schema_version();
+                v && *v < latest_schema_version()) {
+                schema_version = *v;
+                update = true;
+            }
+            if (auto j = store->journal()) {
+                journal = *j;
+            }
         } else {
             term::error("the repository at {} could not be opened {}",
                         path.value(), store.error());
@@ -260,10 +279,17 @@ int repo_status(const repo_status_args& args, const global_settings& settings) {
         json json_out;
         json_out["path"] = path.value();
         json_out["fstype"] = lustre_state ? "lustre" : "unknown";
+        if (journal) {
+            json_out["journal"] =
+                *journal == journal_mode::wal ? "wal" : "rollback";
+        }
         json_out["updates"] = json::array();
         if (lustre_state && !lustre_state.value()) {
             json_out["updates"].push_back("lustre-striping");
         }
+        if (schema_version) {
+            json_out["updates"].push_back("schema");
+        }
         json_out["digest-remove"] = json::array();
         json_out["status"] = fmt::format("{}", status);
         if (store_state) {
@@ -296,6 +322,14 @@ int repo_status(const repo_status_args& args, const global_settings& settings) {
                 term::msg("  - on a lustre file system");
             }
         }
+        if (journal == journal_mode::wal) {
+            term::msg("  - uses write-ahead logging");
+        }
+        if (schema_version) {
+            term::msg("  - has database schema version {} that can be "
+                      "upgraded to {}",
+                      *schema_version, latest_schema_version());
+        }
         if (store_state) {
             term::msg("  - has missing uenv images:");
             for (const auto& [digest, records] : store_state->no_storage) {
@@ -348,7 +382,36 @@ int repo_update(const repo_update_args& args, const global_settings& settings) {
 
     // check for inconsistencies between stored images and the database
     if (auto store = uenv::open_repository(*path, uenv::repo_mode::readwrite)) {
+        // upgrade the database schema
+        if (auto v = store->schema_version();
+            v && *v < latest_schema_version()) {
+            term::msg("upgrading the database schema from version {} to {}",
+                      *v, latest_schema_version());
+            if (auto r = store->upgrade_schema(); !r) {
+                term::error("{}", r.error());
+                return 1;
+            }
+        }
+        // WAL uses shared memory to coordinate between processes, which only
+        // works when every process that opens the database is on one node.
+        if (args.wal) {
+            const auto mode =
+                *args.wal ? journal_mode::wal : journal_mode::rollback;
+            if (mode == journal_mode::wal && lustre::is_lustre(*path)) {
+                term::error("write-ahead logging can not be enabled for a "
+                            "repository on a lustre file system");
+                return 1;
+            }
+            if (auto r = store->set_journal(mode); !r) {
+                term::error("{}", r.error());
+                return 1;
+            }
+            term::msg("write-ahead logging is {}",
+                      *args.wal ? "enabled" : "disabled");
+        }
         if (auto C = impl::check_repo_consistency(*store); !C) {
+            // the index is refreshed once after all stale refs are removed
+            store->defer_index_updates(true);
             term::msg("the repository at {} has missing uenv images:", *path);
             for (auto& [digest, records] : C.no_storage) {
                 term::msg("  removing stale ref {}", digest);
@@ -366,6 +429,8 @@ int repo_update(const repo_update_args& args, const global_settings& settings) {
                 spdlog::debug("removed record {}", digest);
             }
         }
+        store->refresh_index();
+        store->defer_index_updates(false);
     } else {
         term::error("the repository at {} could not be opened {}", *path,
                     store.error());
@@ -458,6 +523,12 @@ int repo_migrate(const repo_migrate_args& args,
             return 1;
         }
 
+        // the records are added one image at a time, and the flat index is
+        // written once when the migration finishes or fails
+        dst_store->defer_index_updates(true);
+        auto update_index = util::defer(
+            [&dst_store]() { dst_store->defer_index_updates(false); });
+
         // create the images path inside the target repo
         std::error_code ec;
         const fs::path dst_img_path = dst_store->path().value() / "images";
@@ -529,16 +600,14 @@ int repo_migrate(const repo_migrate_args& args,
             // Perform after the file copy is complete to ensure that uenv imges
             // exist before they are recorded in the database: important for
             // interrupted migrations.
-            for (auto r : records) {
-                spdlog::debug("adding record {}", r);
-                // add every record unconditionally.
-                // Records already in the destination DB are a noop, and it
-                // is possible that new records can added to images that
-                // already exist in the destination.
-                if (auto result = dst_store->add(r); !result) {
-                    term::error("unable to add record {}", r);
-                    return 1;
-                }
+            // Add every record unconditionally: records already in the
+            // destination DB are a noop, and it is possible that new records
+            // can added to images that already exist in the destination.
+            spdlog::debug("adding records {}", fmt::join(records, ", "));
+            if (auto result = dst_store->add_batch(records); !result) {
+                term::error("unable to add records for {}: {}", digest,
+                            result.error());
+                return 1;
             }
         }
     }
@@ -592,13 +661,22 @@ std::string repo_footer() {
         block{code,   "uenv repo update"},
         block{none, "will update the default repo."},
         linebreak{},
-        block{note, "Updates are used to upgrade or update a repository, when needed. Currently two upgrades"},
+        block{note, "Updates are used to upgrade or update a repository, when needed. Currently four upgrades"},
         block{none, "are applied:"},
+        block{none, "  - upgrade the database schema, e.g. to add indexes that speed up queries."},
         block{none, "  - apply Lustre striping if the repo is on a Lustre file system and no striping"},
         block{none, "    has already been applied."},
         block{none, "  - remove uenv from the database if their squashfs file does not exist"},
         block{none, "    which can occur to repos on non-default locations that are subject to"},
         block{none, "    clean up policies."},
+        block{none, "  - rewrite the index that is used to look up uenv labels without opening the"},
+        block{none, "    database, e.g. after the repo was modified by an older version of uenv."},
+        linebreak{},
+        block{xmpl, "Enable write-ahead logging, which lets uenv read from the repo while it is being"},
+        block{none, "updated, for a repo on a file system that is local to the node:"},
+        block{code,   "uenv repo update --wal /tmp/uenv-repo"},
+        block{note, "Write-ahead logging can not be used on shared file systems like Lustre, where the"},
+        block{none, "repo is accessed from more than one node."},
         linebreak{},
         block{xmpl, "The 'repo migrate' sub-command copies a repo to a new location:"},
         block{code,   "uenv repo migrate $SCRATCH/.uenv-images $HOME/uenv-repo"},
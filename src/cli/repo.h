@@ -22,6 +22,8 @@ struct repo_update_args {
     std::optional<std::string> path;
     // whether to apply lustre checks
     bool lustre = true;
+    // set the journal mode of the database: unset -> leave unchanged
+    std::optional<bool> wal;
 };
 struct repo_migrate_args {
     // takes two arguments: source and destination
@@ -6,8 +6,10 @@
 #include <fmt/std.h>
 #include <spdlog/spdlog.h>
 
+#include <site/site.h>
 #include <uenv/config.h>
 #include <uenv/log.h>
+#include <uenv/oci.h>
 #include <uenv/parse.h>
 #include <uenv/repository.h>
 #include <uenv/settings.h>
@@ -88,9 +90,6 @@ int main(int argc, char** argv) {
     if (auto bin = util::exe_path()) {
         spdlog::info("using uenv {}", bin->string());
     }
-    if (auto oras = util::oras_path()) {
-        spdlog::info("using oras {}", oras->string());
-    }
 
     // print the version and exit if the --version flag was passed
     if (print_version) {
@@ -120,6 +119,33 @@ int main(int argc, char** argv) {
                  (settings.config.color ? "enabled" : "disabled"));
     color::set_color(settings.config.color);
 
+    if (settings.config.busy_timeout) {
+        uenv::set_busy_timeout(
+            std::chrono::seconds(*settings.config.busy_timeout));
+    }
+
+    // cache listings of the registry in the user's cache directory
+    {
+        site::listing_config listing{
+            .mirrors = settings.config.listing_mirrors,
+            .cache = site::default_cache_path(settings.calling_environment)};
+        if (settings.config.listing_ttl) {
+            listing.ttl = std::chrono::seconds(*settings.config.listing_ttl);
+        }
+        site::set_listing_config(std::move(listing));
+    }
+    site::set_registry_config({.mirrors = settings.config.registry_mirrors});
+
+    if (settings.config.download_streams) {
+        uenv::oci::set_download_config(
+            {.max_streams = *settings.config.download_streams});
+    }
+    // save the state of chunked uploads, so that an interrupted push is
+    // resumed
+    if (auto cache = site::default_cache_path(settings.calling_environment)) {
+        uenv::oci::set_upload_config({.state_dir = *cache / "uploads"});
+    }
+
     // validate the user repository - attempt to create if it does not exist
     if (settings.config.repo) {
         using enum uenv::repo_state;
@@ -0,0 +1,404 @@
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/parse.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+#include "listing_parser.h"
+
+namespace site {
+
+listing_parser::listing_parser(std::string nspace) : nspace_(std::move(nspace)) {
+}
+
+bool listing_parser::feed(std::string_view chunk) {
+    if (error_) {
+        return false;
+    }
+    for (std::size_t i = 0; i < chunk.size();) {
+        // append runs of characters in strings that don't need to be escaped
+        // in one step
+        if (lex_ == lex_state::string) {
+            auto j = i;
+            while (j < chunk.size() && chunk[j] != '"' && chunk[j] != '\\' &&
+                   static_cast<unsigned char>(chunk[j]) >= 0x20) {
+                ++j;
+            }
+            if (j > i) {
+                token_.append(chunk.data() + i, j - i);
+                i = j;
+                continue;
+            }
+        }
+        if (!feed_char(chunk[i++])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+util::expected<listing, std::string> listing_parser::finish() {
+    if (!error_ && (lex_ == lex_state::number || lex_ == lex_state::literal)) {
+        const auto kind = std::exchange(lex_, lex_state::none);
+        token_end(kind);
+    }
+    if (error_) {
+        return util::unexpected(*error_);
+    }
+    if (lex_ != lex_state::none || expect_ != expect::done) {
+        return util::unexpected("unexpected end of input");
+    }
+    spdlog::debug("listing_parser: {} records, {} in other namespaces",
+                  result_.records.size(), num_dropped_);
+    return std::move(result_);
+}
+
+bool listing_parser::fail(std::string message) {
+    error_ = std::move(message);
+    return false;
+}
+
+bool listing_parser::feed_char(char c) {
+    switch (lex_) {
+    case lex_state::string:
+        if (c == '\\') {
+            lex_ = lex_state::escape;
+        } else if (c == '"') {
+            lex_ = lex_state::none;
+            return token_end(lex_state::string);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            return fail("control character in string");
+        } else {
+            token_ += c;
+        }
+        return true;
+    case lex_state::escape:
+        lex_ = lex_state::string;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            token_ += c;
+            return true;
+        case 'b':
+            token_ += '\b';
+            return true;
+        case 'f':
+            token_ += '\f';
+            return true;
+        case 'n':
+            token_ += '\n';
+            return true;
+        case 'r':
+            token_ += '\r';
+            return true;
+        case 't':
+            token_ += '\t';
+            return true;
+        case 'u':
+            lex_ = lex_state::unicode;
+            unicode_digits_ = 4;
+            code_point_ = 0;
+            return true;
+        }
+        return fail(fmt::format("invalid escape sequence '\\{}'", c));
+    case lex_state::unicode: {
+        std::uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return fail("invalid unicode escape sequence");
+        }
+        code_point_ = code_point_ * 16 + digit;
+        if (--unicode_digits_) {
+            return true;
+        }
+        lex_ = lex_state::string;
+        auto cp = code_point_;
+        if (cp >= 0xd800 && cp <= 0xdbff) {
+            high_surrogate_ = cp;
+            return true;
+        }
+        if (cp >= 0xdc00 && cp <= 0xdfff && high_surrogate_) {
+            cp = 0x10000 + ((high_surrogate_ - 0xd800) << 10) + (cp - 0xdc00);
+        }
+        high_surrogate_ = 0;
+        // encode the code point as UTF-8
+        if (cp < 0x80) {
+            token_ += char(cp);
+        } else if (cp < 0x800) {
+            token_ += char(0xc0 | (cp >> 6));
+            token_ += char(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            token_ += char(0xe0 | (cp >> 12));
+            token_ += char(0x80 | ((cp >> 6) & 0x3f));
+            token_ += char(0x80 | (cp & 0x3f));
+        } else {
+            token_ += char(0xf0 | (cp >> 18));
+            token_ += char(0x80 | ((cp >> 12) & 0x3f));
+            token_ += char(0x80 | ((cp >> 6) & 0x3f));
+            token_ += char(0x80 | (cp & 0x3f));
+        }
+        return true;
+    }
+    case lex_state::number:
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' ||
+            c == 'e' || c == 'E') {
+            token_ += c;
+            return true;
+        }
+        lex_ = lex_state::none;
+        if (!token_end(lex_state::number)) {
+            return false;
+        }
+        break;
+    case lex_state::literal:
+        if (c >= 'a' && c <= 'z') {
+            token_ += c;
+            return true;
+        }
+        lex_ = lex_state::none;
+        if (!token_end(lex_state::literal)) {
+            return false;
+        }
+        break;
+    case lex_state::none:
+        break;
+    }
+
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+        return true;
+    case '"':
+        is_key_ = expect_ == expect::key || expect_ == expect::key_or_end;
+        if (!is_key_ && !on_value()) {
+            return false;
+        }
+        token_.clear();
+        lex_ = lex_state::string;
+        return true;
+    case '{':
+    case '[':
+        return on_value() && on_open(c);
+    case '}':
+    case ']':
+        return on_close(c);
+    case ':':
+        if (expect_ != expect::colon) {
+            return fail("unexpected ':'");
+        }
+        expect_ = expect::value;
+        return true;
+    case ',':
+        if (expect_ != expect::comma_or_end) {
+            return fail("unexpected ','");
+        }
+        expect_ = stack_.back() == '{' ? expect::key : expect::value;
+        return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        if (!on_value()) {
+            return false;
+        }
+        token_.assign(1, c);
+        lex_ = lex_state::number;
+        return true;
+    }
+    if (c >= 'a' && c <= 'z') {
+        if (!on_value()) {
+            return false;
+        }
+        token_.assign(1, c);
+        lex_ = lex_state::literal;
+        return true;
+    }
+    return fail(fmt::format("unexpected character '{}'", c));
+}
+
+// called when a string, number or literal token has been read.
+// strings are terminated by a quote: numbers and literals are terminated by
+// the first character that is not part of the token.
+bool listing_parser::token_end(lex_state kind) {
+    if (kind == lex_state::string && is_key_) {
+        is_key_ = false;
+        expect_ = expect::colon;
+        return on_key(token_);
+    }
+    if (kind == lex_state::number) {
+        double value = 0;
+        const auto end = token_.data() + token_.size();
+        if (std::from_chars(token_.data(), end, value).ptr != end) {
+            return fail(fmt::format("invalid number '{}'", token_));
+        }
+        on_number(token_);
+    } else if (kind == lex_state::literal) {
+        if (token_ == "true" || token_ == "false") {
+            on_bool(token_ == "true");
+        } else if (token_ != "null") {
+            return fail(fmt::format("invalid literal '{}'", token_));
+        }
+    } else {
+        on_string(token_);
+    }
+    return true;
+}
+
+bool listing_parser::on_value() {
+    if (expect_ != expect::value && expect_ != expect::value_or_end) {
+        return fail("unexpected value");
+    }
+    expect_ = stack_.empty() ? expect::done : expect::comma_or_end;
+    return true;
+}
+
+namespace {
+// the records are the objects in the array "results" of the top level object
+bool in_results(std::string_view stack, std::string_view key) {
+    return stack == "{[{" && key == "results";
+}
+} // namespace
+
+bool listing_parser::on_open(char bracket) {
+    stack_ += bracket;
+    expect_ = bracket == '{' ? expect::key_or_end : expect::value_or_end;
+    if (in_results(stack_, key_)) {
+        clear_record();
+    }
+    return true;
+}
+
+bool listing_parser::on_close(char bracket) {
+    const char open = bracket == '}' ? '{' : '[';
+    if (stack_.empty() || stack_.back() != open) {
+        return fail(fmt::format("unexpected '{}'", bracket));
+    }
+    const auto empty = bracket == '}' ? expect::key_or_end
+                                      : expect::value_or_end;
+    if (expect_ != expect::comma_or_end && expect_ != empty) {
+        return fail(fmt::format("unexpected '{}'", bracket));
+    }
+    if (in_results(stack_, key_)) {
+        end_record();
+    }
+    stack_.pop_back();
+    expect_ = stack_.empty() ? expect::done : expect::comma_or_end;
+    return true;
+}
+
+bool listing_parser::on_key(std::string_view key) {
+    if (stack_.size() == 1) {
+        key_.assign(key);
+    } else if (in_results(stack_, key_)) {
+        field_ = key == "sha256"    ? field::sha256
+                 : key == "created" ? field::created
+                 : key == "path"    ? field::path
+                 : key == "size"    ? field::size
+                                    : field::other;
+    }
+    return true;
+}
+
+void listing_parser::on_string(std::string_view value) {
+    if (stack_.size() == 1) {
+        if (key_ == "version") {
+            result_.version = std::string(value);
+        }
+    } else if (stack_ == "{[" && key_ == "deleted") {
+        result_.deleted.emplace_back(value);
+    } else if (in_results(stack_, key_) && !drop_) {
+        switch (field_) {
+        case field::sha256:
+            sha_.assign(value);
+            break;
+        case field::created:
+            created_.assign(value);
+            break;
+        case field::path:
+            // paths have the form nspace/system/uarch/name/version/tag
+            if (value.size() > nspace_.size() && value.starts_with(nspace_) &&
+                value[nspace_.size()] == '/') {
+                path_.assign(value);
+            } else {
+                drop_ = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void listing_parser::on_number(std::string_view value) {
+    if (in_results(stack_, key_) && field_ == field::size && !drop_) {
+        std::uint64_t size = 0;
+        const auto end = value.data() + value.size();
+        if (std::from_chars(value.data(), end, size).ptr == end) {
+            size_ = size;
+        }
+    }
+}
+
+void listing_parser::on_bool(bool value) {
+    if (stack_.size() == 1 && key_ == "incremental") {
+        result_.incremental = value;
+    }
+}
+
+void listing_parser::clear_record() {
+    sha_.clear();
+    created_.clear();
+    path_.clear();
+    size_ = std::nullopt;
+    field_ = field::other;
+    drop_ = false;
+}
+
+void listing_parser::end_record() {
+    if (drop_) {
+        ++num_dropped_;
+        return;
+    }
+    if (path_.empty() || created_.empty() || !size_ ||
+        !uenv::is_sha(sha_, 64)) {
+        spdlog::warn("drop incomplete listing record {}", path_);
+        return;
+    }
+    const auto date = uenv::parse_uenv_date(created_);
+    if (!date) {
+        spdlog::warn("drop due to error: {}", date.error().message());
+        return;
+    }
+    const auto rg = uenv::parse_registry_entry(path_);
+    if (!rg) {
+        spdlog::warn("drop due to error: {}", rg.error().message());
+        return;
+    }
+    spdlog::trace("keep {} {}", sha_.substr(0, 16), *rg);
+    result_.records.push_back({
+        .system = rg->system,
+        .uarch = rg->uarch,
+        .name = rg->name,
+        .version = rg->version,
+        .tag = rg->tag,
+        .date = *date,
+        .size_byte = *size_,
+        .sha = uenv::sha256(sha_),
+        .id = uenv::uenv_id(sha_.substr(0, 16)),
+    });
+}
+
+} // namespace site
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+namespace site {
+
+// the contents of a response from the listing service
+struct listing {
+    // the records in the namespace
+    std::vector<uenv::uenv_record> records;
+    // for incremental listings: the sha256 of deleted images
+    std::vector<std::string> deleted;
+    // a token that identifies the version of the listing
+    std::optional<std::string> version;
+    // true if the listing contains the changes since a previous version
+    bool incremental = false;
+};
+
+// A streaming parser for the JSON listings returned by the listing service:
+//   {"results": [{"sha256": ..., "created": ..., "path": ..., "size": ...},
+//                ...],
+//    "version": ..., "incremental": ..., "deleted": [...]}
+// The input is passed to feed() in chunks as it is downloaded, and records
+// are parsed as soon as they are complete, without building a document for
+// the whole listing. Records in other namespaces are dropped as soon as their
+// path has been read, before any fields of the record are parsed.
+class listing_parser {
+  public:
+    explicit listing_parser(std::string nspace);
+
+    // parse the next chunk of input.
+    // returns false if the input is not valid JSON, after which the parser
+    // ignores any further input.
+    bool feed(std::string_view chunk);
+
+    // finish parsing, and return the listing, or a description of the error
+    // if the input was not a complete and valid listing.
+    util::expected<listing, std::string> finish();
+
+  private:
+    // the JSON tokenizer
+    enum class lex_state : std::uint8_t {
+        none,
+        string,
+        escape,
+        unicode,
+        number,
+        literal
+    };
+    // what the grammar expects next
+    enum class expect : std::uint8_t {
+        value,
+        value_or_end,
+        key,
+        key_or_end,
+        colon,
+        comma_or_end,
+        done
+    };
+    // the field of a record that is being parsed
+    enum class field : std::uint8_t { other, sha256, created, path, size };
+
+    bool feed_char(char c);
+    bool token_end(lex_state kind);
+    bool fail(std::string message);
+
+    // grammar events
+    bool on_open(char bracket);
+    bool on_close(char bracket);
+    bool on_key(std::string_view);
+    bool on_value();
+    void on_string(std::string_view);
+    void on_number(std::string_view);
+    void on_bool(bool);
+    void end_record();
+    void clear_record();
+
+    std::string nspace_;
+    listing result_;
+    std::optional<std::string> error_;
+
+    lex_state lex_ = lex_state::none;
+    expect expect_ = expect::value;
+    // the token being read
+    std::string token_;
+    // the remaining hex digits of a \u escape, and the code point
+    unsigned unicode_digits_ = 0;
+    std::uint32_t code_point_ = 0;
+    std::uint32_t high_surrogate_ = 0;
+    // true if the string being read is an object key
+    bool is_key_ = false;
+    // the open objects and arrays
+    std::string stack_;
+
+    // the key of the value being read in the top level object, and in a
+    // record in the results array
+    std::string key_;
+    field field_ = field::other;
+
+    // the fields of the record being read. The buffers are reused for every
+    // record, so that reading a record that is dropped does not allocate.
+    std::string sha_;
+    std::string created_;
+    std::string path_;
+    std::optional<std::uint64_t> size_;
+    bool drop_ = false;
+    std::size_t num_dropped_ = 0;
+};
+
+} // namespace site
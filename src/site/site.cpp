@@ -1,20 +1,35 @@
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <map>
 #include <optional>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <fmt/ranges.h>
+#include <fmt/std.h>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
 
+#include <uenv/oci.h>
 #include <uenv/oras.h>
-#include <uenv/parse.h>
 #include <uenv/repository.h>
 #include <util/curl.h>
+#include <util/defer.h>
 #include <util/envvars.h>
 #include <util/expected.h>
 #include <util/fs.h>
 
+#include "listing_parser.h"
 #include "site.h"
 
 namespace site {
@@ -49,73 +64,639 @@ std::string default_namespace() {
     return "deploy";
 }
 
+namespace fs = std::filesystem;
+
+namespace {
+
+listing_config listing_config_g;
+registry_config registry_config_g;
+
+// the time limit for the request that probes an endpoint
+constexpr long probe_timeout_ms = 2000;
+
+// the cache metadata of a listing, stored in meta.json alongside the listing
+// database.
+struct listing_meta {
+    std::optional<std::string> etag;
+    std::optional<std::string> last_modified;
+    // a token provided by the service that identifies the version of the
+    // listing, used to request the changes since that version
+    std::optional<std::string> version;
+    // the time when the listing was last fetched or revalidated
+    std::int64_t fetched = 0;
+};
+
+std::int64_t now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// the cached listing of a namespace is a directory in the cache, so only
+// namespaces that are a single path component are valid
+bool is_valid_namespace(const std::string& nspace) {
+    return !nspace.empty() && nspace != "." && nspace != ".." &&
+           nspace.find('/') == std::string::npos;
+}
+
+std::optional<listing_meta> read_listing_meta(const fs::path& path) {
+    using json = nlohmann::json;
+
+    std::ifstream fid(path);
+    if (!fid) {
+        return std::nullopt;
+    }
+    try {
+        const auto raw = json::parse(fid);
+        listing_meta meta;
+        auto get = [&raw](const char* key) -> std::optional<std::string> {
+            if (raw.contains(key) && raw[key].is_string()) {
+                return raw[key].get<std::string>();
+            }
+            return std::nullopt;
+        };
+        meta.etag = get("etag");
+        meta.last_modified = get("last_modified");
+        meta.version = get("version");
+        meta.fetched = raw.at("fetched").get<std::int64_t>();
+        return meta;
+    } catch (std::exception& e) {
+        spdlog::warn("invalid listing cache metadata {}: {}", path, e.what());
+        return std::nullopt;
+    }
+}
+
+// write the metadata to a temporary file that is renamed over path, so that
+// readers never see a partially written file.
+bool write_listing_meta(const fs::path& path, const listing_meta& meta) {
+    using json = nlohmann::json;
+
+    json raw{{"fetched", meta.fetched}};
+    if (meta.etag) {
+        raw["etag"] = *meta.etag;
+    }
+    if (meta.last_modified) {
+        raw["last_modified"] = *meta.last_modified;
+    }
+    if (meta.version) {
+        raw["version"] = *meta.version;
+    }
+
+    const auto tmp_path = fs::path(fmt::format("{}.{}", path.string(), getpid()));
+    {
+        std::ofstream fid(tmp_path, std::ios::trunc);
+        fid << raw.dump();
+        if (!fid) {
+            std::error_code ec;
+            fs::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+// return the constraints in label that are passed to the listing service:
+// name, version, system and uarch.
+// the name is not used if it could be an id or sha256.
+uenv::uenv_label listing_constraints(const uenv::uenv_label& label) {
+    uenv::uenv_label c{
+        .name = label.name,
+        .version = label.version,
+        .system = label.system,
+        .uarch = label.uarch,
+    };
+    if (label.only_name() &&
+        (uenv::is_sha(*label.name, 16) || uenv::is_sha(*label.name, 64))) {
+        c.name = std::nullopt;
+    }
+    return c;
+}
+
+// return the query string that requests the records that match constraints
+std::string listing_query(const uenv::uenv_label& constraints) {
+    std::string query;
+    auto add = [&query](const char* key, const std::optional<std::string>& v) {
+        if (v) {
+            query += fmt::format("&{}={}", key, util::curl::escape(*v));
+        }
+    };
+    add("cluster", constraints.system);
+    add("arch", constraints.uarch);
+    add("app", constraints.name);
+    add("version", constraints.version);
+    return query;
+}
+
+bool matches(const uenv::uenv_record& r, const uenv::uenv_label& constraints) {
+    auto match = [](const std::optional<std::string>& c, const std::string& v) {
+        return !c || *c == v;
+    };
+    return match(constraints.name, r.name) &&
+           match(constraints.version, r.version) &&
+           match(constraints.system, r.system) &&
+           match(constraints.uarch, r.uarch);
+}
+
 util::expected<uenv::repository, std::string>
-registry_listing(const std::string& nspace) {
+make_listing(const std::vector<uenv::uenv_record>& records) {
+    auto store = uenv::create_repository();
+    if (!store) {
+        return util::unexpected(store.error());
+    }
+    if (auto r = store->add_batch(records); !r) {
+        return util::unexpected(
+            fmt::format("unable to create listing: {}", r.error()));
+    }
+    return store;
+}
+
+// write records to the cached listing in path.
+// the database is created in a temporary directory, and moved into the cache
+// with a rename, so that other processes using the cached listing are not
+// affected.
+util::expected<void, std::string>
+write_listing_cache(const fs::path& path,
+                    const std::vector<uenv::uenv_record>& records,
+                    const listing_meta& meta) {
+    const auto tmp_path = path.parent_path() /
+                          fmt::format(".{}.{}", path.filename().string(), getpid());
+    auto cleanup = util::defer([&tmp_path]() {
+        std::error_code ec;
+        fs::remove_all(tmp_path, ec);
+    });
+    {
+        std::error_code ec;
+        fs::remove_all(tmp_path, ec);
+        fs::create_directories(path, ec);
+        if (ec) {
+            return util::unexpected(fmt::format(
+                "unable to create cache path {}: {}", path, ec.message()));
+        }
+    }
+    {
+        auto store = uenv::create_repository(tmp_path);
+        if (!store) {
+            return util::unexpected(store.error());
+        }
+        // the flat index is not written: cached listings are opened through
+        // the database, and only index.db is moved into the cache
+        store->defer_index_updates(true);
+        if (auto r = store->add_batch(records); !r) {
+            return util::unexpected(r.error());
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path / "index.db", path / "index.db", ec);
+    if (ec) {
+        return util::unexpected(fmt::format("unable to update {}: {}",
+                                            path / "index.db", ec.message()));
+    }
+    // a process that reads the cache between the two renames will see the new
+    // listing with the old metadata, which at worst causes an extra download.
+    if (!write_listing_meta(path / "meta.json", meta)) {
+        return util::unexpected(
+            fmt::format("unable to write {}", path / "meta.json"));
+    }
+    return {};
+}
+
+// the result of probing an endpoint, stored in endpoints.json in the cache
+// directory as {"<endpoint>": {"latency": <seconds or null>, "probed": <time>}}
+struct probe_result {
+    // unset if the endpoint did not respond
+    std::optional<double> latency;
+    // the time when the endpoint was probed
+    std::int64_t probed = 0;
+};
+
+using probe_cache = std::map<std::string, probe_result>;
+
+probe_cache read_probe_cache(const fs::path& path) {
+    using json = nlohmann::json;
+
+    probe_cache cache;
+    std::ifstream fid(path);
+    if (!fid) {
+        return cache;
+    }
+    try {
+        const auto raw = json::parse(fid);
+        for (auto& [endpoint, r] : raw.items()) {
+            probe_result result{.probed = r.at("probed").get<std::int64_t>()};
+            if (r.contains("latency") && r["latency"].is_number()) {
+                result.latency = r["latency"].get<double>();
+            }
+            cache[endpoint] = result;
+        }
+    } catch (std::exception& e) {
+        spdlog::warn("invalid endpoint cache {}: {}", path, e.what());
+        return {};
+    }
+    return cache;
+}
+
+void write_probe_cache(const fs::path& path, const probe_cache& cache) {
     using json = nlohmann::json;
 
+    json raw = json::object();
+    for (auto& [endpoint, r] : cache) {
+        raw[endpoint] = {{"probed", r.probed}};
+        raw[endpoint]["latency"] = r.latency ? json(*r.latency) : json(nullptr);
+    }
+
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    const auto tmp_path = fs::path(fmt::format("{}.{}", path.string(), getpid()));
+    {
+        std::ofstream fid(tmp_path, std::ios::trunc);
+        fid << raw.dump();
+        if (!fid) {
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        spdlog::debug("unable to write endpoint cache {}: {}", path,
+                      ec.message());
+        fs::remove(tmp_path, ec);
+    }
+}
+
+// a listing service is healthy if it responds without a server error
+bool probe_listing(const std::string& url) {
+    auto r = util::curl::perform({
+        .method = "HEAD",
+        .url = url,
+        .connect_timeout_ms = probe_timeout_ms,
+        .timeout_ms = probe_timeout_ms,
+    });
+    if (!r) {
+        spdlog::debug("unable to reach listing service {}: {}", url,
+                      r.error().message);
+        return false;
+    }
+    return r->status < 500;
+}
+
+bool probe_registry(const std::string& registry) {
+    auto r = uenv::oci::client(registry).ping(probe_timeout_ms);
+    if (!r) {
+        spdlog::debug("unable to reach registry {}: {}", registry,
+                      r.error().message);
+    }
+    return r.has_value();
+}
+
+} // namespace
+
+void set_listing_config(listing_config config) {
+    listing_config_g = std::move(config);
+}
+
+void set_registry_config(registry_config config) {
+    registry_config_g = std::move(config);
+}
+
+std::vector<std::string> rank_endpoints(const std::vector<std::string>& endpoints,
+                                        const probe_type& probe) {
+    if (endpoints.size() < 2) {
+        return endpoints;
+    }
+
+    const auto now = now_seconds();
+    std::optional<fs::path> cache_path;
+    probe_cache cache;
+    if (listing_config_g.cache) {
+        cache_path = *listing_config_g.cache / "endpoints.json";
+        cache = read_probe_cache(*cache_path);
+    }
+
+    // probe the endpoints without a recent result concurrently, so that
+    // unresponsive endpoints delay the ranking by at most one timeout
+    std::vector<std::pair<std::string, std::future<std::optional<double>>>>
+        probes;
+    for (auto& endpoint : endpoints) {
+        if (auto it = cache.find(endpoint); it != cache.end()) {
+            const auto age = now - it->second.probed;
+            if (age >= 0 && age < probe_ttl.count()) {
+                continue;
+            }
+        }
+        if (std::any_of(probes.begin(), probes.end(),
+                        [&](auto& p) { return p.first == endpoint; })) {
+            continue;
+        }
+        probes.emplace_back(
+            endpoint,
+            std::async(std::launch::async,
+                       [&probe, endpoint]() -> std::optional<double> {
+                           using clock = std::chrono::steady_clock;
+                           const auto start = clock::now();
+                           if (!probe(endpoint)) {
+                               return std::nullopt;
+                           }
+                           return std::chrono::duration<double>(clock::now() -
+                                                                start)
+                               .count();
+                       }));
+    }
+    for (auto& [endpoint, latency] : probes) {
+        auto& result = cache[endpoint] = {.latency = latency.get(),
+                                          .probed = now};
+        if (result.latency) {
+            spdlog::debug("rank_endpoints: {} responded in {:.3f}s", endpoint,
+                          *result.latency);
+        } else {
+            spdlog::debug("rank_endpoints: {} did not respond", endpoint);
+        }
+    }
+    if (cache_path && !probes.empty()) {
+        write_probe_cache(*cache_path, cache);
+    }
+
+    auto ranked = endpoints;
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [&cache](const std::string& a, const std::string& b) {
+                         const auto& la = cache[a].latency;
+                         const auto& lb = cache[b].latency;
+                         if (la && lb) {
+                             return *la < *lb;
+                         }
+                         return la.has_value() && !lb.has_value();
+                     });
+    spdlog::debug("rank_endpoints: {}", fmt::join(ranked, ", "));
+    return ranked;
+}
+
+std::optional<fs::path> default_cache_path(const envvars::state& env) {
+    if (auto p = env.get("XDG_CACHE_HOME"); p && fs::path(*p).is_absolute()) {
+        return fs::path(*p) / "uenv";
+    }
+    if (auto p = env.get("HOME"); p && fs::path(*p).is_absolute()) {
+        return fs::path(*p) / ".cache" / "uenv";
+    }
+    return std::nullopt;
+}
+
+void expire_listing(const std::string& nspace) {
+    const auto& config = listing_config_g;
+    if (!config.cache) {
+        return;
+    }
+    if (!is_valid_namespace(nspace)) {
+        return;
+    }
+    const auto meta_path = *config.cache / "listings" / nspace / "meta.json";
+    if (auto meta = read_listing_meta(meta_path)) {
+        meta->fetched = 0;
+        write_listing_meta(meta_path, *meta);
+        spdlog::debug("expire_listing: {}", meta_path);
+    }
+}
+
+util::expected<uenv::repository, std::string>
+registry_listing(const std::string& nspace, const uenv::uenv_label& filter,
+                 bool revalidate) {
+    const auto& config = listing_config_g;
+
+    // the namespace is used as a directory name in the cache
+    if (!is_valid_namespace(nspace)) {
+        return util::unexpected(fmt::format("invalid namespace '{}'", nspace));
+    }
+
     // perform curl call against middleware end point
     // example of full url end point call:
     //   https://uenv-list.svc.cscs.ch/list?namespace=deploy&cluster=todi&arch=gh200&app=prgenv-gnu&version=24.7
-    // we only filter on namespace, and use the database to do more querying
-    // later
-    const auto url =
-        fmt::format("https://uenv-list.svc.cscs.ch/list?namespace={}", nspace);
-    spdlog::debug("registry_listing: {}", url);
-    auto raw_records = util::curl::get(url);
+    auto query = fmt::format("?namespace={}", util::curl::escape(nspace));
 
-    if (!raw_records) {
-        int ec = raw_records.error().code;
-        spdlog::error("curl error {}: {}", ec, raw_records.error().message);
-        return util::unexpected{"unable to reach uenv-list.svc.cscs.ch to get "
-                                "list of available uenv"};
+    // look for a cached listing
+    std::optional<fs::path> cache_path;
+    std::optional<listing_meta> meta;
+    std::optional<uenv::repository> cached;
+    if (config.cache) {
+        cache_path = *config.cache / "listings" / nspace;
+        meta = read_listing_meta(*cache_path / "meta.json");
+        if (meta) {
+            if (auto r = uenv::open_repository(*cache_path)) {
+                cached.emplace(std::move(*r));
+            } else {
+                spdlog::debug("registry_listing: unable to open cache: {}",
+                              r.error());
+            }
+        }
     }
 
-    std::vector<uenv::uenv_record> records;
-    try {
-        auto raw = json::parse(*raw_records);
-
-        for (auto& j : raw["results"]) {
-            const std::string sha = j["sha256"];
-            const auto date = uenv::parse_uenv_date(j["created"]);
-            auto rg = uenv::parse_registry_entry(j["path"]);
-            if (!rg) {
-                spdlog::warn("drop due to error: {}", rg.error().message());
-            } else if (rg->nspace == nspace) {
-                spdlog::trace("keep {} {}", sha.substr(0, 16), *rg);
-                records.push_back({
-                    .system = rg->system,
-                    .uarch = rg->uarch,
-                    .name = rg->name,
-                    .version = rg->version,
-                    .tag = rg->tag,
-                    .date = *date,
-                    .size_byte = j["size"],
-                    .sha = uenv::sha256(sha),
-                    .id = uenv::uenv_id(sha.substr(0, 16)),
-                });
-            } else {
-                spdlog::trace("drop {} {}", sha.substr(0, 16), *rg);
+    const auto now = now_seconds();
+    std::vector<std::string> headers;
+    if (cached) {
+        const auto age = now - meta->fetched;
+        if (!revalidate && age >= 0 && age < config.ttl.count()) {
+            spdlog::debug("registry_listing: using cached listing {} ({}s old)",
+                          *cache_path, age);
+            return std::move(*cached);
+        }
+        if (meta->etag) {
+            headers.push_back(fmt::format("If-None-Match: {}", *meta->etag));
+        }
+        if (meta->last_modified) {
+            headers.push_back(
+                fmt::format("If-Modified-Since: {}", *meta->last_modified));
+        }
+        if (meta->version) {
+            query +=
+                fmt::format("&since={}", util::curl::escape(*meta->version));
+        }
+    }
+
+    // without a cached listing to revalidate, only request the records that
+    // match the filter. The filtered listing is not cached, because it can't
+    // be used for other queries.
+    const auto constraints = listing_constraints(filter);
+    const bool filtered = !cached && !listing_query(constraints).empty();
+    if (filtered) {
+        query += listing_query(constraints);
+    }
+
+    // request the listing from the service and its mirrors in order of
+    // latency, until one of them responds without a server error.
+    std::vector<std::string> endpoints{config.url};
+    endpoints.insert(endpoints.end(), config.mirrors.begin(),
+                     config.mirrors.end());
+    endpoints = rank_endpoints(endpoints, probe_listing);
+
+    // parse the listing as it is downloaded
+    std::optional<listing_parser> parser;
+    util::expected<util::curl::response, util::curl::error> response =
+        util::unexpected{
+            util::curl::error{CURLE_FAILED_INIT, "no listing service"}};
+    std::vector<std::string> tried;
+    for (auto& endpoint : endpoints) {
+        tried.push_back(endpoint);
+        const auto url = endpoint + query;
+        spdlog::debug("registry_listing: {}", url);
+        parser.emplace(nspace);
+        response = util::curl::get(url, headers, [&parser](auto data) {
+            return parser->feed(data);
+        });
+        if (response ? response->status < 500
+                     : response.error().code == CURLE_WRITE_ERROR) {
+            break;
+        }
+        spdlog::warn("unable to get listing from {}", endpoint);
+    }
+
+    // the transfer is aborted if the listing is invalid
+    if (!response && response.error().code == CURLE_WRITE_ERROR) {
+        const auto error = parser->finish().error();
+        spdlog::error("error results returned from uenv listing: {}", error);
+        return util::unexpected(
+            fmt::format("invalid listing of available uenv: {}", error));
+    }
+
+    if (!response || (response->status >= 400)) {
+        std::string error;
+        if (!response) {
+            int ec = response.error().code;
+            spdlog::error("curl error {}: {}", ec, response.error().message);
+            error = response.error().message;
+        } else {
+            spdlog::error("registry_listing: http status {}", response->status);
+            error = fmt::format("http status {}", response->status);
+        }
+        if (cached) {
+            spdlog::warn("unable to reach {} - using cached listing of {}",
+                         fmt::join(tried, ", "), nspace);
+            return std::move(*cached);
+        }
+        return util::unexpected{
+            fmt::format("unable to reach {} to get list of available uenv: {}",
+                        fmt::join(tried, ", "), error)};
+    }
+
+    if (response->status == 304 && cached) {
+        spdlog::debug("registry_listing: cached listing {} is up to date",
+                      *cache_path);
+        meta->fetched = now;
+        write_listing_meta(*cache_path / "meta.json", *meta);
+        return std::move(*cached);
+    }
+
+    auto parsed = parser->finish();
+    if (!parsed) {
+        spdlog::error("error results returned from uenv listing: {}",
+                      parsed.error());
+        return util::unexpected(fmt::format(
+            "invalid listing of available uenv: {}", parsed.error()));
+    }
+    auto& records = parsed->records;
+
+    // the service might not support all of the filters
+    if (filtered) {
+        std::erase_if(records, [&constraints](const uenv::uenv_record& r) {
+            return !matches(r, constraints);
+        });
+    }
+
+    // a response to a "since" request contains the records that have been
+    // added since that version, and the sha256 of deleted images.
+    // services that do not support incremental updates ignore the request and
+    // return the full listing.
+    if (cached && parsed->incremental) {
+        const std::set<std::string> deleted(parsed->deleted.begin(),
+                                            parsed->deleted.end());
+        auto previous = cached->query({});
+        if (!previous) {
+            return util::unexpected(previous.error());
+        }
+        for (auto& r : *previous) {
+            if (!deleted.contains(r.sha.string())) {
+                records.push_back(r);
             }
         }
-    } catch (std::exception& e) {
-        spdlog::error("error results returned from uenv listing: {}", e.what());
-        return util::unexpected(fmt::format("", e.what()));
+        std::sort(records.begin(), records.end());
+        records.erase(std::unique(records.begin(), records.end()),
+                      records.end());
+        spdlog::debug("registry_listing: merged changes since {}",
+                      meta->version.value_or("unknown"));
     }
 
-    //   generate list of records from json
-    auto store = uenv::create_repository();
-    for (auto r : records) {
-        store->add(r);
+    listing_meta new_meta{.version = parsed->version, .fetched = now};
+    if (auto it = response->headers.find("etag");
+        it != response->headers.end()) {
+        new_meta.etag = it->second;
+    }
+    if (auto it = response->headers.find("last-modified");
+        it != response->headers.end()) {
+        new_meta.last_modified = it->second;
     }
 
     spdlog::debug("registry_listing: {} records found in namespace {}",
                   records.size(), nspace);
 
-    return store;
+    if (cache_path && !filtered) {
+        // release the old listing before it is replaced
+        cached.reset();
+        if (auto r = write_listing_cache(*cache_path, records, new_meta); !r) {
+            spdlog::warn("unable to cache listing: {}", r.error());
+        } else if (auto store = uenv::open_repository(*cache_path)) {
+            return store;
+        }
+    }
+
+    //   generate list of records from json
+    return make_listing(records);
 }
 
 std::string registry_url() {
-    return "jfrog.svc.cscs.ch/uenv";
+    return registry_config_g.url;
+}
+
+std::vector<std::string> pull_registries() {
+    std::vector<std::string> endpoints{registry_config_g.url};
+    endpoints.insert(endpoints.end(), registry_config_g.mirrors.begin(),
+                     registry_config_g.mirrors.end());
+    return rank_endpoints(endpoints, probe_registry);
+}
+
+std::vector<util::expected<void, std::string>>
+delete_uenv(const std::string& nspace,
+            const std::vector<uenv::uenv_record>& records,
+            const uenv::oras::credentials& credentials, unsigned jobs) {
+    std::vector<util::expected<void, std::string>> results(records.size());
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (auto i = next++; i < records.size(); i = next++) {
+            const auto& r = records[i];
+            const auto url =
+                fmt::format("{}/{}/{}/{}/{}/{}/{}", registry_config_g.api,
+                            nspace, r.system, r.uarch, r.name, r.version, r.tag);
+            if (auto result = util::curl::del(url, credentials.username,
+                                              credentials.token);
+                !result) {
+                results[i] = util::unexpected(
+                    fmt::format("{}: {}", url, result.error().message));
+            } else {
+                spdlog::info("deleted {}", url);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<std::size_t>(jobs, records.size());
+         ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& w : workers) {
+        w.join();
+    }
+    return results;
 }
 
 util::expected<std::optional<uenv::oras::credentials>, std::string>
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <filesystem>
+#include <functional>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <uenv/oras.h>
 #include <uenv/repository.h>
+#include <uenv/uenv.h>
 #include <util/envvars.h>
 #include <util/expected.h>
 
@@ -20,11 +25,87 @@ std::optional<std::string> get_username();
 // default namespace for image deployment
 std::string default_namespace();
 
+// Listings of the registry are cached per user, with a repository database
+// for each namespace in the cache directory, e.g.
+//   ~/.cache/uenv/listings/deploy/index.db
+// A cached listing is used without contacting the listing service for ttl
+// seconds after it was fetched. After that it is revalidated with a
+// conditional request (ETag/Last-Modified), and if the service provides a
+// version token with the listing, only the changes since that version are
+// requested and merged into the cached listing.
+struct listing_config {
+    // the url of the listing service
+    std::string url = "https://uenv-list.svc.cscs.ch/list";
+    // mirrors of the listing service: the listing is requested from the
+    // fastest of url and the mirrors, see rank_endpoints
+    std::vector<std::string> mirrors;
+    // the cache directory: listings are not cached if not set
+    std::optional<std::filesystem::path> cache;
+    // the time for which a cached listing is used without revalidation
+    std::chrono::seconds ttl{60};
+};
+
+void set_listing_config(listing_config);
+
+// The registry that uenv are pushed to, and mirrors of it that serve the same
+// images, e.g. pull-through caches close to the system. Images are pulled from
+// the fastest of the registry and its mirrors, and are only pushed, copied and
+// deleted in the registry.
+struct registry_config {
+    std::string url = "jfrog.svc.cscs.ch/uenv";
+    std::vector<std::string> mirrors;
+    // the artifactory API of the registry, with which uenv are deleted
+    std::string api = "https://jfrog.svc.cscs.ch/artifactory/uenv";
+};
+
+void set_registry_config(registry_config);
+
+// Order endpoints that provide the same service by latency, fastest first.
+// Each endpoint is probed with one request, timed by calling probe, which
+// returns false if the endpoint did not respond or is unhealthy. Unhealthy
+// endpoints are placed last in their original order, so that they are still
+// tried if the others fail. The probe results are cached in the cache
+// directory of the listing config for probe_ttl, so that endpoints are probed
+// at most once per probe_ttl. A single endpoint is returned without a probe.
+using probe_type = std::function<bool(const std::string&)>;
+inline constexpr std::chrono::seconds probe_ttl{600};
+std::vector<std::string> rank_endpoints(const std::vector<std::string>& endpoints,
+                                        const probe_type& probe);
+
+// the default cache directory:
+// - $XDG_CACHE_HOME/uenv if XDG_CACHE_HOME is set
+// - $HOME/.cache/uenv otherwise
+std::optional<std::filesystem::path>
+default_cache_path(const envvars::state& env);
+
+// get a listing of the uenv in a namespace of the registry.
+// The listing contains at least the uenv that match filter: if there is no
+// cached listing of the namespace, only the uenv that match the name, version,
+// system and uarch of filter are requested from the listing service.
+// Set revalidate to check a cached listing with the listing service
+// regardless of its age, e.g. before modifying the registry.
 util::expected<uenv::repository, std::string>
-registry_listing(const std::string& nspace);
+registry_listing(const std::string& nspace,
+                 const uenv::uenv_label& filter = {}, bool revalidate = false);
+
+// mark the cached listing of nspace as out of date, e.g. after modifying the
+// registry, so that it is revalidated the next time that it is used.
+void expire_listing(const std::string& nspace);
 
+// the registry that uenv are pushed to
 std::string registry_url();
 
+// the registry and its mirrors, ordered by latency, to pull uenv from
+std::vector<std::string> pull_registries();
+
+// Delete uenv in a namespace of the registry, with up to jobs requests at a
+// time over the pooled connections of util::curl.
+// Returns the result of each deletion, in the same order as records.
+std::vector<util::expected<void, std::string>>
+delete_uenv(const std::string& nspace,
+            const std::vector<uenv::uenv_record>& records,
+            const uenv::oras::credentials& credentials, unsigned jobs = 8);
+
 util::expected<std::optional<uenv::oras::credentials>, std::string>
 get_credentials(std::optional<std::string> username,
                 std::optional<std::string> token);
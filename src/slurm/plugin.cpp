@@ -302,6 +302,9 @@ int init_post_opt_local_allocator(spank_t sp [[maybe_unused]]) {
 
     config_g = uenv::generate_configuration(uenv::load_config(
         {.repo = args.repo_description}, calling_environment));
+    if (config_g.busy_timeout) {
+        uenv::set_busy_timeout(std::chrono::seconds(*config_g.busy_timeout));
+    }
 
     const auto env =
         uenv::concretise_env(*args.uenv_description, args.view_description,
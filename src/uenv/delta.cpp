@@ -0,0 +1,223 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/delta.h>
+#include <util/defer.h>
+#include <util/expected.h>
+#include <util/sha256.h>
+
+namespace uenv {
+
+namespace {
+
+constexpr std::string_view index_magic = "uenvblk1";
+constexpr std::size_t header_size = 24;
+constexpr std::size_t entry_size = 40;
+
+// the base of the polynomial rolling hash, which is computed modulo 2^64
+constexpr std::uint64_t rolling_base = 0x100000001b3;
+
+std::uint64_t rolling_power(std::uint64_t n) {
+    std::uint64_t p = 1;
+    for (std::uint64_t i = 0; i < n; ++i) {
+        p *= rolling_base;
+    }
+    return p;
+}
+
+void put_u64(std::string& out, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(char(v >> (8 * i)));
+    }
+}
+
+std::uint64_t get_u64(const char* p) {
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v |= std::uint64_t(std::uint8_t(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+} // namespace
+
+std::uint64_t index_block_size(std::uint64_t size) {
+    constexpr std::uint64_t min_block_size = 64 * 1024;
+    constexpr std::uint64_t max_blocks = 64 * 1024;
+    return std::max(min_block_size,
+                    std::bit_ceil((size + max_blocks - 1) / max_blocks));
+}
+
+std::uint64_t rolling_hash(const void* data, std::size_t n) {
+    auto p = static_cast<const std::uint8_t*>(data);
+    std::uint64_t h = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        h = h * rolling_base + p[i];
+    }
+    return h;
+}
+
+util::expected<block_index, std::string>
+make_block_index(const std::filesystem::path& path, std::uint64_t block_size) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return util::unexpected(
+            fmt::format("unable to read {}: {}", path, ec.message()));
+    }
+    block_index index{
+        .block_size = block_size ? block_size : index_block_size(size),
+        .size = size};
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buffer(index.block_size);
+    std::uint64_t total = 0;
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        const auto n = std::size_t(in.gcount());
+        index.rolling.push_back(rolling_hash(buffer.data(), n));
+        util::sha256 h;
+        h.update(buffer.data(), n);
+        index.strong.push_back(h.finish());
+        total += n;
+    }
+    if (in.bad() || total != size) {
+        return util::unexpected(fmt::format("unable to read {}", path));
+    }
+    return index;
+}
+
+std::string serialize(const block_index& index) {
+    std::string out;
+    out.reserve(header_size + index.blocks() * entry_size);
+    out += index_magic;
+    put_u64(out, index.block_size);
+    put_u64(out, index.size);
+    for (std::size_t i = 0; i < index.blocks(); ++i) {
+        put_u64(out, index.rolling[i]);
+        out.append(reinterpret_cast<const char*>(index.strong[i].data()),
+                   index.strong[i].size());
+    }
+    return out;
+}
+
+util::expected<block_index, std::string> parse_block_index(std::string_view raw) {
+    if (raw.size() < header_size || !raw.starts_with(index_magic)) {
+        return util::unexpected("not a block index");
+    }
+    block_index index{.block_size = get_u64(raw.data() + 8),
+                      .size = get_u64(raw.data() + 16)};
+    if (index.block_size == 0) {
+        return util::unexpected("invalid block size 0");
+    }
+    const auto blocks =
+        (index.size + index.block_size - 1) / index.block_size;
+    if ((raw.size() - header_size) / entry_size != blocks ||
+        (raw.size() - header_size) % entry_size) {
+        return util::unexpected(fmt::format(
+            "expected {} blocks in an index of {} bytes", blocks, raw.size()));
+    }
+    index.rolling.reserve(blocks);
+    index.strong.resize(blocks);
+    for (std::size_t i = 0; i < blocks; ++i) {
+        const auto entry = raw.data() + header_size + i * entry_size;
+        index.rolling.push_back(get_u64(entry));
+        std::memcpy(index.strong[i].data(), entry + 8, 32);
+    }
+    return index;
+}
+
+util::expected<std::vector<block_match>, std::string>
+find_blocks(const block_index& index, const std::filesystem::path& seed) {
+    const auto L = index.block_size;
+
+    // the full blocks, by rolling hash
+    std::unordered_map<std::uint64_t, std::vector<std::uint64_t>> blocks;
+    const auto full_blocks = index.size / L;
+    for (std::uint64_t i = 0; i < full_blocks; ++i) {
+        blocks[index.rolling[i]].push_back(i);
+    }
+
+    const int fd = open(seed.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return util::unexpected(
+            fmt::format("unable to open {}: {}", seed, std::strerror(errno)));
+    }
+    auto close_fd = util::defer([fd]() { close(fd); });
+    struct stat st;
+    if (fstat(fd, &st)) {
+        return util::unexpected(
+            fmt::format("unable to stat {}: {}", seed, std::strerror(errno)));
+    }
+    const std::uint64_t n = st.st_size;
+    std::vector<block_match> matches;
+    if (n < L || blocks.empty()) {
+        return matches;
+    }
+    void* map = mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return util::unexpected(
+            fmt::format("unable to map {}: {}", seed, std::strerror(errno)));
+    }
+    auto unmap = util::defer([map, n]() { munmap(map, n); });
+    madvise(map, n, MADV_SEQUENTIAL);
+    const auto data = static_cast<const std::uint8_t*>(map);
+
+    std::vector<bool> found(full_blocks, false);
+    std::uint64_t remaining = full_blocks;
+    const auto power = rolling_power(L - 1);
+    std::uint64_t pos = 0;
+    std::uint64_t h = rolling_hash(data, L);
+    while (remaining) {
+        if (auto it = blocks.find(h); it != blocks.end()) {
+            util::sha256 hasher;
+            hasher.update(data + pos, L);
+            const auto digest = hasher.finish();
+            bool hit = false;
+            for (auto b : it->second) {
+                if (!found[b] && index.strong[b] == digest) {
+                    matches.push_back({b, pos});
+                    found[b] = true;
+                    --remaining;
+                    hit = true;
+                }
+            }
+            // the next block is most likely to follow the one that was
+            // found, as in an unchanged part of the file
+            if (hit) {
+                pos += L;
+                if (pos + L > n) {
+                    break;
+                }
+                h = rolling_hash(data + pos, L);
+                continue;
+            }
+        }
+        if (pos + L >= n) {
+            break;
+        }
+        h = (h - data[pos] * power) * rolling_base + data[pos + L];
+        ++pos;
+    }
+
+    spdlog::debug("find_blocks: found {} of {} blocks of {} bytes in {}",
+                  matches.size(), index.blocks(), L, seed);
+    return matches;
+}
+
+} // namespace uenv
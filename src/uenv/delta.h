@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <util/expected.h>
+#include <util/sha256.h>
+
+// Delta transfer of squashfs images, in the style of zsync: a new version of
+// an image usually shares most of its data blocks with the previous version,
+// at different offsets.
+//
+// The publisher attaches a block index to the image, with a rolling hash and
+// the sha256 of each block of the image. A client that has an older version
+// of the image slides a window over it, looks up the rolling hash at every
+// offset in the index, and confirms candidate blocks with their sha256. The
+// blocks that are found are copied from the old image, and only the rest of
+// the new image is downloaded.
+
+namespace uenv {
+
+struct block_index {
+    std::uint64_t block_size = 0;
+    // the size of the indexed file: the last block may be shorter than
+    // block_size
+    std::uint64_t size = 0;
+    std::vector<std::uint64_t> rolling;
+    std::vector<util::sha256::digest_type> strong;
+
+    std::size_t blocks() const {
+        return rolling.size();
+    }
+};
+
+// the block size used to index a file of size bytes: at least 64 KiB, and
+// large enough that there are at most 64Ki blocks.
+std::uint64_t index_block_size(std::uint64_t size);
+
+// the rolling hash of n bytes
+std::uint64_t rolling_hash(const void* data, std::size_t n);
+
+// create the block index of a file.
+// the block size is index_block_size() of the file size if block_size is 0.
+util::expected<block_index, std::string>
+make_block_index(const std::filesystem::path& path,
+                 std::uint64_t block_size = 0);
+
+// the binary encoding of a block index, stored in the registry:
+//   "uenvblk1", block size, file size (little endian uint64)
+//   for each block: rolling hash (little endian uint64), sha256 (32 bytes)
+std::string serialize(const block_index& index);
+util::expected<block_index, std::string> parse_block_index(std::string_view raw);
+
+// a block of the indexed file that was found at offset in another file
+struct block_match {
+    std::uint64_t block;
+    std::uint64_t offset;
+};
+
+// find the blocks of index in the file seed, at any offset.
+// only full blocks are matched, i.e. the last block is not matched if it is
+// shorter than the block size.
+util::expected<std::vector<block_match>, std::string>
+find_blocks(const block_index& index, const std::filesystem::path& seed);
+
+} // namespace uenv
@@ -15,6 +15,7 @@
 
 #include <site/site.h>
 #include <uenv/env.h>
+#include <uenv/flat_index.h>
 #include <uenv/meta.h>
 #include <uenv/parse.h>
 #include <uenv/print.h>
@@ -127,24 +128,27 @@ resolve_uenv(const uenv_description& desc,
                               "or by setting the UENV_REPO_PATH "
                               "environment variable");
         }
-        auto store = uenv::open_repository(*repo_arg);
-        if (!store) {
-            return unexpected(
-                fmt::format("unable to open repo: {}", store.error()));
-        }
-
         // set label->system to the current cluster name if it has not
         // already been set.
         label->system = site::get_system_name(label->system, calling_env);
 
-        // search for label in the repo
-        const auto result = store->query(*label);
-        if (!result) {
-            return unexpected(fmt::format("{}", store.error()));
+        // search for label in the flat index of the repo, and fall back to
+        // querying the repo database if the index is missing or stale.
+        auto results = flat_index_query(*repo_arg, *label);
+        if (!results) {
+            auto store = uenv::open_repository(*repo_arg);
+            if (!store) {
+                return unexpected(
+                    fmt::format("unable to open repo: {}", store.error()));
+            }
+            auto result = store->query(*label);
+            if (!result) {
+                return unexpected(result.error());
+            }
+            results = std::move(*result);
         }
-        const auto results = *result;
 
-        if (results.empty()) {
+        if (results->empty()) {
             return unexpected(fmt::format(
                 "no uenv matches '{}' in the repo '{}'.\n"
                 "See available uenv using {}.\n"
@@ -155,18 +159,18 @@ resolve_uenv(const uenv_description& desc,
         }
 
         // ensure that all results share a unique sha
-        if (!results.unique_sha()) {
+        if (!results->unique_sha()) {
             auto errmsg =
                 fmt::format("more than one uenv matches the uenv description "
                             "'{}':\n",
                             desc.label().value());
-            errmsg += format_record_set_table(results);
+            errmsg += format_record_set_table(*results);
             return unexpected(errmsg);
         }
 
         // set sqfs_path and digest
-        const auto& r = *results.begin();
-        sqfs_path = store->uenv_paths(r.sha).squashfs;
+        const auto& r = *results->begin();
+        sqfs_path = uenv_paths(*repo_arg, r.sha).squashfs;
         info.record = r;
         label_string = fmt::format("{}", r);
     }
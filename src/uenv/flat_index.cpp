@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/flat_index.h>
+#include <uenv/parse.h>
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+namespace uenv {
+
+namespace fs = std::filesystem;
+
+// The file layout is
+//   header | entry[count] | string table
+// with native byte order: the magic bytes are followed by a known integer to
+// detect files written on a machine with a different byte order.
+namespace index_format {
+
+constexpr char magic[8] = {'u', 'e', 'n', 'v', 'i', 'd', 'x', '\0'};
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t byte_order = 0x01020304;
+
+struct header {
+    char magic[8];
+    std::uint32_t byte_order;
+    std::uint32_t version;
+    // the generation of index.db that the index was written for
+    std::uint32_t generation;
+    std::uint32_t padding;
+    // the number of entries
+    std::uint64_t count;
+    // the size of the string table in bytes
+    std::uint64_t strings;
+};
+
+// a string in the string table
+struct string_ref {
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+struct entry {
+    string_ref name;
+    string_ref version;
+    string_ref tag;
+    string_ref system;
+    string_ref uarch;
+    string_ref date;
+    std::uint64_t size;
+    char sha[64];
+    char id[16];
+};
+
+static_assert(std::is_trivially_copyable_v<header>);
+static_assert(std::is_trivially_copyable_v<entry>);
+static_assert(sizeof(header) == 40);
+static_assert(sizeof(entry) == 136);
+
+} // namespace index_format
+
+fs::path flat_index_path(const fs::path& repo_path) {
+    return repo_path / "index.bin";
+}
+
+std::optional<std::uint32_t> database_generation(const fs::path& db_path) {
+    int fd = open(db_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    unsigned char buffer[100];
+    const auto n = pread(fd, buffer, sizeof(buffer), 0);
+    close(fd);
+    if (n != sizeof(buffer)) {
+        return std::nullopt;
+    }
+
+    // see https://www.sqlite.org/fileformat.html#the_database_header
+    if (std::memcmp(buffer, "SQLite format 3", 16) != 0) {
+        return std::nullopt;
+    }
+    // bytes 18 and 19 are the file format write and read versions:
+    // 1 for rollback journal and 2 for WAL.
+    if (buffer[18] != 1 || buffer[19] != 1) {
+        return std::nullopt;
+    }
+    // bytes 24-27 are the file change counter, stored big-endian
+    return (std::uint32_t(buffer[24]) << 24) |
+           (std::uint32_t(buffer[25]) << 16) |
+           (std::uint32_t(buffer[26]) << 8) | std::uint32_t(buffer[27]);
+}
+
+util::expected<void, std::string> write_flat_index(const fs::path& repo_path,
+                                                   const record_set& records,
+                                                   std::uint32_t generation) {
+    using namespace index_format;
+
+    std::string strings;
+    auto add_string = [&strings](std::string_view s) -> string_ref {
+        string_ref ref{static_cast<std::uint32_t>(strings.size()),
+                       static_cast<std::uint32_t>(s.size())};
+        strings += s;
+        return ref;
+    };
+
+    std::vector<entry> entries;
+    entries.reserve(records.size());
+    for (const auto& r : records) {
+        entry e{
+            .name = add_string(r.name),
+            .version = add_string(r.version),
+            .tag = add_string(r.tag),
+            .system = add_string(r.system),
+            .uarch = add_string(r.uarch),
+            .date = add_string(fmt::format("{}", r.date)),
+            .size = r.size_byte,
+            .sha = {},
+            .id = {},
+        };
+        std::memcpy(e.sha, r.sha.string().data(), sizeof(e.sha));
+        std::memcpy(e.id, r.id.string().data(), sizeof(e.id));
+        entries.push_back(e);
+    }
+    if (strings.size() > UINT32_MAX) {
+        return util::unexpected("the flat index string table is too large");
+    }
+
+    header h{};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.byte_order = byte_order;
+    h.version = version;
+    h.generation = generation;
+    h.count = entries.size();
+    h.strings = strings.size();
+
+    // write to a temporary file that is renamed over the index, so that
+    // readers never see a partially written index.
+    const auto path = flat_index_path(repo_path);
+    const auto tmp_path =
+        fs::path(fmt::format("{}.{}", path.string(), getpid()));
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(entries.data()),
+                  entries.size() * sizeof(entry));
+        out.write(strings.data(), strings.size());
+        if (!out) {
+            std::error_code ec;
+            fs::remove(tmp_path, ec);
+            return util::unexpected(
+                fmt::format("unable to write {}", tmp_path));
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return util::unexpected(
+            fmt::format("unable to write {}: {}", path, ec.message()));
+    }
+    spdlog::debug("write_flat_index: wrote {} records to {} (generation {})",
+                  entries.size(), path, generation);
+
+    return {};
+}
+
+namespace {
+
+// a read only memory mapping of a file
+struct mapped_file {
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    mapped_file(const fs::path& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat s;
+        if (fstat(fd, &s) == 0 && s.st_size > 0) {
+            void* ptr = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                data = static_cast<const char*>(ptr);
+                size = s.st_size;
+            }
+        }
+        close(fd);
+    }
+    mapped_file(const mapped_file&) = delete;
+    ~mapped_file() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+};
+
+// a view of the entries and strings in a mapped index file
+struct index_view {
+    const index_format::entry* entries = nullptr;
+    std::size_t count = 0;
+    std::string_view strings;
+    // set if a string reference is out of bounds
+    mutable bool corrupt = false;
+
+    std::string_view str(index_format::string_ref s) const {
+        if (std::uint64_t(s.offset) + s.size > strings.size()) {
+            corrupt = true;
+            return {};
+        }
+        return strings.substr(s.offset, s.size);
+    }
+
+    std::optional<uenv_record> record(const index_format::entry& e) const {
+        auto date = parse_uenv_date(std::string(str(e.date)));
+        if (!date || corrupt) {
+            corrupt = true;
+            return std::nullopt;
+        }
+        return uenv_record{std::string(str(e.system)),
+                           std::string(str(e.uarch)),
+                           std::string(str(e.name)),
+                           std::string(str(e.version)),
+                           std::string(str(e.tag)),
+                           *date,
+                           static_cast<std::size_t>(e.size),
+                           sha256(std::string(e.sha, sizeof(e.sha))),
+                           uenv_id(std::string(e.id, sizeof(e.id)))};
+    }
+};
+
+std::optional<index_view> make_view(const mapped_file& file,
+                                    std::uint32_t generation) {
+    using namespace index_format;
+
+    if (!file.data || file.size < sizeof(header)) {
+        return std::nullopt;
+    }
+    header h;
+    std::memcpy(&h, file.data, sizeof(h));
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 ||
+        h.byte_order != byte_order || h.version != version) {
+        spdlog::debug("flat_index: invalid header");
+        return std::nullopt;
+    }
+    if (h.generation != generation) {
+        spdlog::debug("flat_index: stale index (generation {}, database {})",
+                      h.generation, generation);
+        return std::nullopt;
+    }
+    const auto available = file.size - sizeof(header);
+    if (h.count > available / sizeof(entry) ||
+        h.strings != available - h.count * sizeof(entry)) {
+        spdlog::debug("flat_index: invalid size");
+        return std::nullopt;
+    }
+
+    const char* entries = file.data + sizeof(header);
+    return index_view{
+        .entries = reinterpret_cast<const entry*>(entries),
+        .count = h.count,
+        .strings = {entries + h.count * sizeof(entry), h.strings},
+    };
+}
+
+} // namespace
+
+std::optional<record_set> flat_index_query(const fs::path& repo_path,
+                                           const uenv_label& label) {
+    const auto generation = database_generation(repo_path / "index.db");
+    if (!generation) {
+        return std::nullopt;
+    }
+    const mapped_file file(flat_index_path(repo_path));
+    const auto view = make_view(file, *generation);
+    if (!view) {
+        return std::nullopt;
+    }
+
+    auto match = [&](const std::optional<std::string>& value,
+                     index_format::string_ref s) {
+        return !value || *value == view->str(s);
+    };
+
+    const auto* first = view->entries;
+    const auto* last = view->entries + view->count;
+
+    std::vector<uenv_record> results;
+    auto add = [&](const index_format::entry& e) {
+        if (auto r = view->record(e)) {
+            results.push_back(std::move(*r));
+        }
+    };
+
+    // the entries are sorted by name first, so the entries with a matching
+    // name are found with a binary search
+    using index_format::entry;
+    struct by_name {
+        const index_view& view;
+        bool operator()(const entry& e, std::string_view n) const {
+            return view.str(e.name) < n;
+        }
+        bool operator()(std::string_view n, const entry& e) const {
+            return n < view.str(e.name);
+        }
+    };
+    auto [lo, hi] = label.name ? std::equal_range(first, last,
+                                                  std::string_view(*label.name),
+                                                  by_name{*view})
+                               : std::pair{first, last};
+    for (auto it = lo; it != hi; ++it) {
+        if (match(label.version, it->version) && match(label.tag, it->tag) &&
+            match(label.system, it->system) && match(label.uarch, it->uarch)) {
+            add(*it);
+        }
+    }
+
+    // a name could also be an id or sha256
+    if (label.only_name()) {
+        std::optional<std::string> id, sha;
+        if (is_sha(*label.name, 16)) {
+            id = uenv_id(*label.name).string();
+        } else if (is_sha(*label.name, 64)) {
+            sha = sha256(*label.name).string();
+        }
+        if (id || sha) {
+            for (auto it = first; it != last; ++it) {
+                const bool hit =
+                    id ? std::string_view(it->id, sizeof(it->id)) == *id
+                       : std::string_view(it->sha, sizeof(it->sha)) == *sha;
+                if (hit && match(label.system, it->system) &&
+                    match(label.uarch, it->uarch)) {
+                    add(*it);
+                }
+            }
+            std::sort(results.begin(), results.end());
+            results.erase(std::unique(results.begin(), results.end()),
+                          results.end());
+        }
+    }
+
+    if (view->corrupt) {
+        spdlog::debug("flat_index: corrupt index {}",
+                      flat_index_path(repo_path));
+        return std::nullopt;
+    }
+
+    spdlog::debug("flat_index: {} matches for {}", results.size(), label);
+    return record_set(std::move(results));
+}
+
+} // namespace uenv
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+namespace uenv {
+
+// The flat index is a compact copy of the records in a repository, stored in
+// the file index.bin alongside index.db. The records are sorted by label, so
+// that labels can be looked up with a binary search of the memory mapped file,
+// without opening the database with SQLite.
+//
+// The index is tagged with the generation of the database when it was written:
+// the file change counter in the header of index.db, which SQLite increments
+// every time that a transaction modifies the database. The index is stale if
+// the database has been modified since, e.g. by an older version of uenv that
+// does not maintain the index, and readers fall back to querying the database.
+
+// returns the path of the flat index of the repository at repo_path
+std::filesystem::path flat_index_path(const std::filesystem::path& repo_path);
+
+// returns the generation of the database file db_path.
+// returns nullopt if the file can't be read, or if it uses WAL journaling,
+// which does not update the file change counter.
+std::optional<std::uint32_t>
+database_generation(const std::filesystem::path& db_path);
+
+// write the flat index of the repository at repo_path.
+// the records must be sorted and unique, as returned by repository::query.
+util::expected<void, std::string>
+write_flat_index(const std::filesystem::path& repo_path,
+                 const record_set& records, std::uint32_t generation);
+
+// search the flat index of the repository at repo_path for records that match
+// label, with the same result as repository::query(label).
+// returns nullopt if there is no valid index that is up to date with the
+// database, in which case the database has to be queried.
+std::optional<record_set>
+flat_index_query(const std::filesystem::path& repo_path,
+                 const uenv_label& label);
+
+} // namespace uenv
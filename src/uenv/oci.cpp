@@ -0,0 +1,1876 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <uenv/oci.h>
+#include <util/curl.h>
+#include <util/defer.h>
+#include <util/expected.h>
+#include <util/sha256.h>
+
+namespace uenv {
+namespace oci {
+
+using json = nlohmann::json;
+namespace curl = util::curl;
+
+namespace {
+
+// registries describe errors in the body of the response:
+//   {"errors": [{"code": "BLOB_UNKNOWN", "message": "..."}]}
+error http_error(const curl::response& r, std::string_view what) {
+    const errc code = r.status == 401   ? errc::unauthorized
+                      : r.status == 403 ? errc::forbidden
+                      : r.status == 404 ? errc::not_found
+                      : r.status >= 500 ? errc::server
+                                        : errc::invalid_response;
+    std::string detail;
+    try {
+        const auto j = json::parse(r.body);
+        for (auto& e : j.at("errors")) {
+            detail += fmt::format(" {}: {}", e.value("code", ""),
+                                  e.value("message", ""));
+        }
+    } catch (...) {
+    }
+    return {code, r.status,
+            fmt::format("{}: HTTP status {}{}", what, r.status, detail)};
+}
+
+error curl_error(const curl::error& e) {
+    if (e.code == CURLE_ABORTED_BY_CALLBACK) {
+        return {errc::cancelled, 0, "the transfer was cancelled"};
+    }
+    if (e.code == CURLE_RANGE_ERROR) {
+        return {errc::unsupported, 0, e.message};
+    }
+    return {errc::network, 0, e.message};
+}
+
+std::string base64(std::string_view in) {
+    constexpr char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (std::size_t i = 0; i < in.size(); i += 3) {
+        std::uint32_t v = std::uint8_t(in[i]) << 16;
+        if (i + 1 < in.size()) {
+            v |= std::uint8_t(in[i + 1]) << 8;
+        }
+        if (i + 2 < in.size()) {
+            v |= std::uint8_t(in[i + 2]);
+        }
+        out += table[(v >> 18) & 63];
+        out += table[(v >> 12) & 63];
+        out += i + 1 < in.size() ? table[(v >> 6) & 63] : '=';
+        out += i + 2 < in.size() ? table[v & 63] : '=';
+    }
+    return out;
+}
+
+std::string lower(std::string_view in) {
+    std::string out(in);
+    for (auto& c : out) {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+    return out;
+}
+
+// a WWW-Authenticate challenge, e.g.
+//   Bearer realm="https://auth.example.com/token",service="registry"
+struct challenge {
+    std::string scheme;
+    std::map<std::string, std::string> params;
+};
+
+challenge parse_challenge(std::string_view header) {
+    challenge c;
+    const auto space = header.find(' ');
+    c.scheme = lower(header.substr(0, space));
+    if (space == std::string_view::npos) {
+        return c;
+    }
+    auto in = header.substr(space + 1);
+    while (!in.empty()) {
+        while (!in.empty() && (in.front() == ' ' || in.front() == ',')) {
+            in.remove_prefix(1);
+        }
+        const auto eq = in.find('=');
+        if (eq == std::string_view::npos) {
+            break;
+        }
+        const auto key = lower(in.substr(0, eq));
+        in.remove_prefix(eq + 1);
+        std::string value;
+        if (!in.empty() && in.front() == '"') {
+            in.remove_prefix(1);
+            while (!in.empty() && in.front() != '"') {
+                if (in.front() == '\\' && in.size() > 1) {
+                    in.remove_prefix(1);
+                }
+                value += in.front();
+                in.remove_prefix(1);
+            }
+            if (!in.empty()) {
+                in.remove_prefix(1);
+            }
+        } else {
+            const auto end = in.find(',');
+            value = in.substr(0, end);
+            in.remove_prefix(end == std::string_view::npos ? in.size() : end);
+        }
+        c.params[key] = std::move(value);
+    }
+    return c;
+}
+
+descriptor parse_descriptor(const json& j) {
+    descriptor d{
+        .media_type = j.value("mediaType", ""),
+        .digest = j.at("digest"),
+        .size = j.at("size"),
+    };
+    if (j.contains("artifactType")) {
+        d.artifact_type = j["artifactType"];
+    }
+    if (j.contains("annotations")) {
+        d.annotations = j["annotations"].get<std::map<std::string, std::string>>();
+    }
+    return d;
+}
+
+json to_json(const descriptor& d) {
+    json j{{"mediaType", d.media_type}, {"digest", d.digest}, {"size", d.size}};
+    if (d.artifact_type) {
+        j["artifactType"] = *d.artifact_type;
+    }
+    if (!d.annotations.empty()) {
+        j["annotations"] = d.annotations;
+    }
+    return j;
+}
+
+bool is_sha256_digest(std::string_view digest) {
+    return digest.starts_with("sha256:") && digest.size() == 71;
+}
+
+std::string pull_scope(const std::string& name) {
+    return fmt::format("repository:{}:pull", name);
+}
+
+std::string push_scope(const std::string& name) {
+    return fmt::format("repository:{}:pull,push", name);
+}
+
+// the scopes, separated by spaces, to mount a blob of src in dst
+std::string mount_scope(const std::string& src, const std::string& dst) {
+    return fmt::format("{} {}", push_scope(dst), pull_scope(src));
+}
+
+// downloads are checkpointed after every checkpoint_interval bytes
+constexpr std::uint64_t checkpoint_interval = 64 << 20;
+
+download_config download_config_g;
+upload_config upload_config_g;
+
+// The limits shared by all blob downloads in the process: the number of
+// concurrent requests, and the total rate at which bytes are received.
+class download_limits {
+  public:
+    void configure(unsigned max_connections, std::uint64_t max_rate) {
+        std::lock_guard _(mutex_);
+        max_connections_ = max_connections;
+        max_rate_ = max_rate;
+        cv_.notify_all();
+    }
+
+    // wait for a connection to become free.
+    // returns false if keep_waiting returns false before then.
+    bool acquire(const std::function<bool()>& keep_waiting) {
+        std::unique_lock lock(mutex_);
+        while (max_connections_ && connections_ >= max_connections_) {
+            if (!keep_waiting()) {
+                return false;
+            }
+            cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        ++connections_;
+        return true;
+    }
+
+    void release() {
+        std::lock_guard _(mutex_);
+        --connections_;
+        cv_.notify_one();
+    }
+
+    // called when n bytes have been received: waits until the bytes would
+    // have been received at the maximum rate, which stops reading from the
+    // connection so that the server slows down.
+    void throttle(std::uint64_t n) {
+        using clock = std::chrono::steady_clock;
+        std::unique_lock lock(mutex_);
+        if (!max_rate_) {
+            return;
+        }
+        const auto now = clock::now();
+        next_ = std::max(next_, now) +
+                std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(double(n) / max_rate_));
+        const auto until = next_;
+        lock.unlock();
+        std::this_thread::sleep_until(until);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    unsigned max_connections_ = 0;
+    unsigned connections_ = 0;
+    std::uint64_t max_rate_ = 0;
+    // the time at which the bytes received so far are within the rate limit
+    std::chrono::steady_clock::time_point next_{};
+};
+
+download_limits download_limits_g;
+
+// byte ranges [first, last) of a blob, sorted and disjoint
+using range_list = std::vector<std::pair<std::uint64_t, std::uint64_t>>;
+
+// add the range [first, last) to ranges, merging it with adjacent ranges
+void add_range(range_list& ranges, std::uint64_t first, std::uint64_t last) {
+    auto it = std::lower_bound(
+        ranges.begin(), ranges.end(), first,
+        [](const auto& r, std::uint64_t value) { return r.second < value; });
+    while (it != ranges.end() && it->first <= last) {
+        first = std::min(first, it->first);
+        last = std::max(last, it->second);
+        it = ranges.erase(it);
+    }
+    ranges.insert(it, {first, last});
+}
+
+// the ranges in [0, size) that are not covered by ranges
+range_list missing_ranges(const range_list& ranges, std::uint64_t size) {
+    range_list missing;
+    std::uint64_t pos = 0;
+    for (auto [first, last] : ranges) {
+        if (first > pos) {
+            missing.emplace_back(pos, first);
+        }
+        pos = last;
+    }
+    if (pos < size) {
+        missing.emplace_back(pos, size);
+    }
+    return missing;
+}
+
+// The checkpoint of an interrupted download is saved next to the partial
+// file as JSON:
+//   {"digest": "sha256:...", "size": 1234, "ranges": [[0, 512]],
+//    "sha256": "<hasher state>"}
+// where ranges are the byte ranges [begin, end) of the partial file that have
+// been written and flushed to disk. The optional hasher state is that after
+// hashing the bytes at the start of the first range.
+struct checkpoint {
+    range_list ranges;
+    std::optional<util::sha256> hash;
+
+    std::uint64_t bytes() const {
+        std::uint64_t n = 0;
+        for (auto [first, last] : ranges) {
+            n += last - first;
+        }
+        return n;
+    }
+};
+
+// returns nothing if there is no valid checkpoint for blob
+std::optional<checkpoint> read_checkpoint(const std::filesystem::path& path,
+                                          const descriptor& blob) {
+    std::ifstream in(path);
+    if (!in) {
+        return std::nullopt;
+    }
+    try {
+        const auto j = json::parse(in);
+        if (j.at("digest").get<std::string>() != blob.digest ||
+            j.at("size").get<std::uint64_t>() != blob.size) {
+            return std::nullopt;
+        }
+        checkpoint c;
+        std::uint64_t end = 0;
+        for (auto& r : j.at("ranges")) {
+            const auto first = r.at(0).get<std::uint64_t>();
+            const auto last = r.at(1).get<std::uint64_t>();
+            if (first < end || last <= first || last > blob.size) {
+                throw std::runtime_error("invalid ranges");
+            }
+            c.ranges.emplace_back(first, last);
+            end = last;
+        }
+        if (j.contains("sha256")) {
+            c.hash =
+                util::sha256::deserialize(j.at("sha256").get<std::string>());
+            if (!c.hash || c.ranges.empty() || c.ranges[0].first != 0 ||
+                c.hash->size() > c.ranges[0].second) {
+                throw std::runtime_error("invalid hasher state");
+            }
+        }
+        return c;
+    } catch (...) {
+        spdlog::warn("oci: ignoring invalid checkpoint {}", path.string());
+        return std::nullopt;
+    }
+}
+
+// save a checkpoint atomically, by writing it to a temporary file that is
+// renamed.
+void write_checkpoint(const std::filesystem::path& path,
+                      const descriptor& blob, const checkpoint& c) {
+    json j{{"digest", blob.digest},
+           {"size", blob.size},
+           {"ranges", json::array()}};
+    for (auto [first, last] : c.ranges) {
+        j["ranges"].push_back({first, last});
+    }
+    if (c.hash) {
+        j["sha256"] = c.hash->serialize();
+    }
+    auto tmp = path;
+    tmp += ".tmp";
+    std::ofstream(tmp) << j.dump();
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        spdlog::warn("oci: unable to write checkpoint {}: {}", path.string(),
+                     ec.message());
+    }
+}
+
+// Hashes the bytes of a blob that is downloaded out of order, so that its
+// digest is known when the last byte has been received, without reading the
+// downloaded file again.
+//
+// Bytes at the hashing offset are hashed as soon as they are received. Bytes
+// received ahead of the offset are kept in memory, and merged into the hash
+// once the bytes before them have been hashed. If more than max_buffered
+// bytes are waiting, further bytes are only recorded, and are read back from
+// the partial file, where they are still in the page cache, when the hash
+// reaches them. Bytes that were downloaded before a download was resumed
+// are read back in the same way.
+class ordered_hasher {
+  public:
+    ordered_hasher(util::sha256 hash, int fd, std::uint64_t max_buffered)
+        : hash_(std::move(hash)), fd_(fd), max_buffered_(max_buffered) {
+    }
+
+    // add bytes that have been written to the file at offset.
+    // returns false if bytes could not be read back from the file.
+    bool add(std::uint64_t offset, std::string_view data) {
+        std::lock_guard _(mutex_);
+        if (offset == hash_.size()) {
+            hash_.update(data);
+            return drain();
+        }
+        const bool keep = buffered_ + data.size() <= max_buffered_;
+        buffered_ += keep ? data.size() : 0;
+        // extend the segment that ends at offset, which is usually the
+        // previous data received for the same range
+        if (auto it = pending_.lower_bound(offset); it != pending_.begin()) {
+            --it;
+            auto& s = it->second;
+            if (it->first + s.size == offset && keep == !s.data.empty()) {
+                s.size += data.size();
+                s.data.insert(s.data.end(), data.begin(),
+                              keep ? data.end() : data.begin());
+                return true;
+            }
+        }
+        pending_[offset] = {
+            data.size(),
+            keep ? std::vector<char>(data.begin(), data.end())
+                 : std::vector<char>{}};
+        return true;
+    }
+
+    // add bytes [first, last) that are already in the file
+    bool add_written(std::uint64_t first, std::uint64_t last) {
+        std::lock_guard _(mutex_);
+        first = std::max(first, hash_.size());
+        if (first < last) {
+            pending_[first] = {last - first, {}};
+        }
+        return drain();
+    }
+
+    // the state of the hasher, which has hashed the bytes [0, size())
+    util::sha256 state() {
+        std::lock_guard _(mutex_);
+        return hash_;
+    }
+
+  private:
+    struct segment {
+        std::uint64_t size;
+        // empty if the bytes have to be read from the file
+        std::vector<char> data;
+    };
+
+    // hash the pending segments that start at the hashing offset
+    bool drain() {
+        while (!pending_.empty() && pending_.begin()->first == hash_.size()) {
+            auto node = pending_.extract(pending_.begin());
+            auto& s = node.mapped();
+            if (!s.data.empty()) {
+                hash_.update(s.data.data(), s.data.size());
+                buffered_ -= s.size;
+                continue;
+            }
+            std::vector<char> buffer(std::min<std::uint64_t>(s.size, 1 << 20));
+            for (auto left = s.size; left;) {
+                const auto n =
+                    pread(fd_, buffer.data(),
+                          std::min<std::uint64_t>(left, buffer.size()),
+                          hash_.size());
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                hash_.update(buffer.data(), n);
+                left -= n;
+            }
+        }
+        return true;
+    }
+
+    std::mutex mutex_;
+    util::sha256 hash_;
+    const int fd_;
+    const std::uint64_t max_buffered_;
+    std::uint64_t buffered_ = 0;
+    // segments received ahead of the hashing offset, by offset
+    std::map<std::uint64_t, segment> pending_;
+};
+
+// request a range of a blob, or the whole blob
+using fetch_type = std::function<util::expected<curl::response, error>(
+    std::optional<curl::byte_range>, const curl::sink_type&,
+    const curl::progress_type&)>;
+
+// the download of a blob to a partial file
+struct blob_download {
+    const descriptor& blob;
+    const int fd;
+    const std::filesystem::path partial;
+    const std::filesystem::path checkpoint_path;
+    const fetch_type fetch;
+    const progress_type& progress;
+    // the parts of the blob that have been downloaded
+    checkpoint state;
+
+    // flush the partial file and save the checkpoint
+    void save() {
+        if (fdatasync(fd) == 0) {
+            write_checkpoint(checkpoint_path, blob, state);
+        }
+    }
+
+    util::unexpected<error> io_error(std::string_view what) const {
+        return util::unexpected(
+            error{errc::io, 0,
+                  fmt::format("unable to {} {}: {}", what, partial.string(),
+                              std::strerror(errno))});
+    }
+};
+
+// download a blob with a single request, resuming from a checkpoint that
+// has the hasher state of the downloaded bytes.
+// on success state.hash has hashed the downloaded blob.
+util::expected<void, error> download_sequential(blob_download& d) {
+    auto& state = d.state;
+    if (!state.hash || state.ranges.size() != 1 ||
+        state.hash->size() != state.ranges[0].second) {
+        state = {.ranges = {}, .hash = util::sha256{}};
+    }
+    auto& hash = *state.hash;
+
+    // the bytes written after the last checkpoint are discarded, because they
+    // may not have been flushed to disk
+    auto restart = [&d](std::uint64_t offset) {
+        return ftruncate(d.fd, offset) == 0 &&
+               lseek(d.fd, offset, SEEK_SET) == off_t(offset);
+    };
+    if (!restart(hash.size())) {
+        return d.io_error("truncate");
+    }
+
+    std::uint64_t checkpointed = hash.size();
+    auto checkpoint = [&]() {
+        if (hash.size() != checkpointed) {
+            state.ranges = {{0, hash.size()}};
+            d.save();
+            checkpointed = hash.size();
+        }
+    };
+
+    std::optional<int> write_errno;
+    auto sink = [&](std::string_view data) {
+        hash.update(data);
+        while (!data.empty()) {
+            const auto n = write(d.fd, data.data(), data.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                write_errno = errno;
+                return false;
+            }
+            data.remove_prefix(n);
+        }
+        if (hash.size() - checkpointed >= checkpoint_interval) {
+            checkpoint();
+        }
+        return true;
+    };
+
+    const auto& blob = d.blob;
+    for (int attempt = 0; hash.size() < blob.size; ++attempt) {
+        const auto offset = hash.size();
+        std::optional<curl::byte_range> range;
+        if (offset) {
+            range = curl::byte_range{offset};
+        }
+        auto r = d.fetch(range, sink, [&d, &hash](std::uint64_t, std::uint64_t) {
+            return !d.progress || d.progress(hash.size());
+        });
+        // the registry ignored the range request, or rejected the range: start
+        // again from the beginning
+        const bool range_failed =
+            offset && ((!r && r.error().code == errc::unsupported) ||
+                       (r && r->status == 416));
+        if (range_failed && attempt == 0) {
+            spdlog::warn("oci: unable to resume download of {}, restarting",
+                         blob.digest);
+            hash = {};
+            checkpointed = 0;
+            std::error_code ec;
+            std::filesystem::remove(d.checkpoint_path, ec);
+            if (!restart(0)) {
+                return d.io_error("truncate");
+            }
+            continue;
+        }
+        if (write_errno) {
+            errno = *write_errno;
+            return d.io_error("write");
+        }
+        if (!r) {
+            checkpoint();
+            return util::unexpected(r.error());
+        }
+        if (r->status != 200 && r->status != 206) {
+            checkpoint();
+            return util::unexpected(http_error(*r, "blob " + blob.digest));
+        }
+        if (hash.size() < blob.size) {
+            // the response ended early: make one more request for the rest
+            checkpoint();
+            if (hash.size() == offset || attempt > 0) {
+                return util::unexpected(error{
+                    errc::invalid_response, r->status,
+                    fmt::format("blob {} was truncated at {} of {} bytes",
+                                blob.digest, hash.size(), blob.size)});
+            }
+        }
+    }
+    return {};
+}
+
+// download a blob in chunks that are requested concurrently, and written to
+// their offset in the partial file, resuming from a checkpoint of any ranges.
+//
+// The download starts with two streams, and the measured throughput decides
+// how many streams are used: the number of streams is doubled, up to
+// config.max_streams, each time the throughput over an interval improves on
+// the best throughput seen so far. This finds the number of streams needed to
+// saturate the link when the bandwidth of each connection is limited, without
+// opening more connections than needed.
+//
+// The blob is hashed while it is downloaded: on success state.hash has hashed
+// the downloaded blob.
+// Returns an error with errc::unsupported if the registry does not respond
+// to range requests, in which case the download has to be restarted with
+// download_sequential().
+util::expected<void, error> download_parallel(blob_download& d,
+                                              const download_config& config) {
+    using clock = std::chrono::steady_clock;
+
+    const auto& blob = d.blob;
+    // allocate the whole file, so that a full file system is detected before
+    // anything is downloaded, and writes do not fragment the file
+    if (fallocate(d.fd, 0, 0, blob.size) && errno != EOPNOTSUPP &&
+        errno != ENOSYS) {
+        return d.io_error("allocate");
+    }
+    if (ftruncate(d.fd, blob.size)) {
+        return d.io_error("truncate");
+    }
+
+    // hash the bytes that have already been downloaded, which are read back
+    // from the file beyond the bytes covered by the saved hasher state
+    ordered_hasher hasher(d.state.hash.value_or(util::sha256{}), d.fd,
+                          config.chunk_size * config.max_streams);
+    for (auto [first, last] : d.state.ranges) {
+        if (!hasher.add_written(first, last)) {
+            return d.io_error("read");
+        }
+    }
+    // save the state of the hasher with the checkpoint. The bytes that have
+    // been hashed have been written to the file.
+    auto save = [&d, &hasher]() {
+        d.state.hash = hasher.state();
+        add_range(d.state.ranges, 0, d.state.hash->size());
+        d.save();
+    };
+
+    std::deque<std::pair<std::uint64_t, std::uint64_t>> chunks;
+    for (auto [first, last] : missing_ranges(d.state.ranges, blob.size)) {
+        for (auto pos = first; pos < last; pos += config.chunk_size) {
+            chunks.emplace_back(pos, std::min(last, pos + config.chunk_size));
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<std::uint64_t> received = d.state.bytes();
+    std::atomic<bool> stop = false;
+    std::optional<error> failure;
+    unsigned running = 0;
+
+    auto fail = [&](error e) {
+        if (!failure) {
+            failure = std::move(e);
+        }
+        stop = true;
+    };
+
+    auto worker = [&]() {
+        std::unique_lock lock(mutex);
+        while (!stop && !chunks.empty()) {
+            const auto [first, last] = chunks.front();
+            chunks.pop_front();
+            lock.unlock();
+
+            auto pos = first;
+            std::optional<error> e;
+            auto sink = [&](std::string_view data) {
+                if (data.size() > last - pos) {
+                    e = error{errc::invalid_response, 206,
+                              fmt::format("blob {}: more data than requested",
+                                          blob.digest)};
+                    return false;
+                }
+                for (auto buffer = data; !buffer.empty();) {
+                    const auto n =
+                        pwrite(d.fd, buffer.data(), buffer.size(),
+                               pos + (data.size() - buffer.size()));
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n < 0) {
+                        e = d.io_error("write").value();
+                        return false;
+                    }
+                    buffer.remove_prefix(n);
+                }
+                if (!hasher.add(pos, data)) {
+                    e = d.io_error("read").value();
+                    return false;
+                }
+                pos += data.size();
+                received += data.size();
+                return !stop;
+            };
+            // network errors and responses that end early are retried from
+            // the last byte that was received
+            for (int attempt = 0; pos < last && !e && attempt < 3; ++attempt) {
+                auto r = d.fetch(curl::byte_range{pos, last - 1}, sink,
+                                 [&stop](std::uint64_t, std::uint64_t) {
+                                     return !stop;
+                                 });
+                if (e) {
+                    break;
+                }
+                if (!r) {
+                    e = r.error();
+                    if (e->code == errc::network && !stop) {
+                        spdlog::debug("oci: retrying bytes {}-{} of {}: {}",
+                                      pos, last, blob.digest, e->message);
+                        e = std::nullopt;
+                        continue;
+                    }
+                } else if (r->status != 206) {
+                    e = http_error(*r, "blob " + blob.digest);
+                }
+            }
+
+            lock.lock();
+            if (pos > first) {
+                add_range(d.state.ranges, first, pos);
+            }
+            if (pos < last) {
+                fail(e.value_or(error{
+                    errc::invalid_response, 206,
+                    fmt::format("blob {} was truncated at byte {}",
+                                blob.digest, pos)}));
+            }
+            cv.notify_all();
+        }
+        --running;
+        cv.notify_all();
+    };
+
+    std::vector<std::thread> workers;
+    auto spawn = [&]() {
+        ++running;
+        workers.emplace_back(worker);
+    };
+
+    std::unique_lock lock(mutex);
+    for (unsigned i = 0; i < std::min(2u, config.max_streams); ++i) {
+        spawn();
+    }
+    spdlog::debug("oci: downloading {} in {} chunks", blob.digest,
+                  chunks.size());
+
+    std::uint64_t checkpointed = received;
+    double best_rate = 0;
+    auto window_start = clock::now();
+    std::uint64_t window_bytes = received;
+    while (running) {
+        cv.wait_for(lock, std::chrono::milliseconds(100));
+        if (d.progress && !d.progress(received)) {
+            fail({errc::cancelled, 0, "the transfer was cancelled"});
+        }
+        if (received - checkpointed >= checkpoint_interval) {
+            save();
+            checkpointed = received;
+        }
+
+        const auto now = clock::now();
+        const std::chrono::duration<double> elapsed = now - window_start;
+        if (elapsed.count() >= 0.25) {
+            const double rate = (received - window_bytes) / elapsed.count();
+            if (rate > 1.1 * best_rate && !stop) {
+                const auto n = std::min<std::size_t>(
+                    {workers.size(), config.max_streams - workers.size(),
+                     chunks.size()});
+                for (std::size_t i = 0; i < n; ++i) {
+                    spawn();
+                }
+                spdlog::debug("oci: {:.1f} MB/s, using {} streams", rate / 1e6,
+                              workers.size());
+            }
+            best_rate = std::max(best_rate, rate);
+            window_start = now;
+            window_bytes = received;
+        }
+    }
+    lock.unlock();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    d.state.hash = hasher.state();
+    if (failure) {
+        save();
+        return util::unexpected(*failure);
+    }
+    return {};
+}
+
+// The state of a chunked upload is saved in the state directory of the
+// upload config as JSON:
+//   {"name": "<repository>", "digest": "sha256:...", "location": "<url>",
+//    "offset": 1234}
+// where offset is the number of bytes accepted by the registry.
+struct upload_state {
+    std::string location;
+    std::uint64_t offset = 0;
+};
+
+std::optional<std::filesystem::path>
+upload_state_path(const std::string& base, const std::string& name,
+                  const descriptor& blob) {
+    if (!upload_config_g.state_dir) {
+        return std::nullopt;
+    }
+    const auto key = util::sha256_hex(fmt::format("{}/{}@{}", base, name,
+                                                  blob.digest));
+    return *upload_config_g.state_dir / (key + ".json");
+}
+
+std::optional<upload_state> read_upload_state(const std::filesystem::path& path,
+                                              const std::string& name,
+                                              const descriptor& blob) {
+    std::ifstream in(path);
+    if (!in) {
+        return std::nullopt;
+    }
+    try {
+        const auto j = json::parse(in);
+        if (j.at("name").get<std::string>() != name ||
+            j.at("digest").get<std::string>() != blob.digest) {
+            return std::nullopt;
+        }
+        return upload_state{j.at("location").get<std::string>(),
+                            j.at("offset").get<std::uint64_t>()};
+    } catch (...) {
+        spdlog::warn("oci: ignoring invalid upload state {}", path.string());
+        return std::nullopt;
+    }
+}
+
+void write_upload_state(const std::filesystem::path& path,
+                        const std::string& name, const descriptor& blob,
+                        const upload_state& state) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    const json j{{"name", name},
+                 {"digest", blob.digest},
+                 {"location", state.location},
+                 {"offset", state.offset}};
+    auto tmp = path;
+    tmp += ".tmp";
+    std::ofstream(tmp) << j.dump();
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        spdlog::warn("oci: unable to save upload state {}: {}", path.string(),
+                     ec.message());
+    }
+}
+
+// the number of bytes that the registry has received, from the Range header
+// "0-<last byte>" of a response to an upload request
+std::optional<std::uint64_t> upload_offset(const curl::response& r) {
+    const auto it = r.headers.find("range");
+    if (it == r.headers.end()) {
+        return std::nullopt;
+    }
+    const auto dash = it->second.find('-');
+    if (dash == std::string::npos) {
+        return std::nullopt;
+    }
+    // some registries report "0--1" for an upload that has no data
+    if (it->second.substr(dash + 1).starts_with('-')) {
+        return 0;
+    }
+    std::uint64_t last = 0;
+    const auto first = it->second.data() + dash + 1;
+    const auto end = it->second.data() + it->second.size();
+    if (std::from_chars(first, end, last).ec != std::errc{}) {
+        return std::nullopt;
+    }
+    return last + 1;
+}
+
+} // namespace
+
+void set_upload_config(upload_config config) {
+    upload_config_g = std::move(config);
+}
+
+upload_config get_upload_config() {
+    return upload_config_g;
+}
+
+void set_download_config(download_config config) {
+    download_config_g = config;
+    download_limits_g.configure(config.max_connections, config.max_rate);
+}
+
+download_config get_download_config() {
+    return download_config_g;
+}
+
+util::expected<std::uint64_t, error>
+seed_blob(const descriptor& blob, const std::filesystem::path& destination,
+          const std::filesystem::path& source,
+          const std::vector<local_range>& ranges) {
+    auto partial = destination;
+    partial += ".partial";
+    auto checkpoint_path = destination;
+    checkpoint_path += ".checkpoint";
+    auto io_error = [](std::string_view what,
+                       const std::filesystem::path& path) {
+        return util::unexpected(error{
+            errc::io, 0,
+            fmt::format("unable to {} {}: {}", what, path.string(),
+                        std::strerror(errno))});
+    };
+
+    const int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return io_error("open", source);
+    }
+    auto close_in = util::defer([in]() { close(in); });
+    const int out = open(partial.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return io_error("open", partial);
+    }
+    auto close_out = util::defer([out]() { close(out); });
+
+    // keep the parts of an earlier attempt that are still in the file
+    checkpoint state;
+    struct stat st;
+    if (fstat(out, &st)) {
+        return io_error("stat", partial);
+    }
+    if (auto saved = read_checkpoint(checkpoint_path, blob);
+        saved && !saved->ranges.empty() &&
+        std::uint64_t(st.st_size) >= saved->ranges.back().second) {
+        state = std::move(*saved);
+    }
+    if (ftruncate(out, std::max<std::uint64_t>(st.st_size, blob.size))) {
+        return io_error("truncate", partial);
+    }
+
+    std::uint64_t copied = 0;
+    for (auto& r : ranges) {
+        if (r.offset + r.size > blob.size) {
+            continue;
+        }
+        // copy_file_range shares the data blocks on file systems that
+        // support it, and avoids copying through user space otherwise
+        loff_t src = r.source_offset;
+        loff_t dst = r.offset;
+        std::uint64_t left = r.size;
+        while (left) {
+            const auto n = copy_file_range(in, &src, out, &dst, left, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            left -= n;
+        }
+        std::vector<char> buffer(std::min<std::uint64_t>(left, 1 << 20));
+        while (left) {
+            const auto n = pread(in, buffer.data(),
+                                 std::min<std::uint64_t>(left, buffer.size()),
+                                 src);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0 || pwrite(out, buffer.data(), n, dst) != n) {
+                return io_error("copy to", partial);
+            }
+            src += n;
+            dst += n;
+            left -= n;
+        }
+        add_range(state.ranges, r.offset, r.offset + r.size);
+        copied += r.size;
+    }
+
+    if (fdatasync(out)) {
+        return io_error("sync", partial);
+    }
+    write_checkpoint(checkpoint_path, blob, state);
+    return copied;
+}
+
+descriptor empty_config() {
+    return {.media_type = empty_media_type,
+            .digest = digest_of("{}"),
+            .size = 2};
+}
+
+std::string digest_of(const std::string& content) {
+    return "sha256:" + util::sha256_hex(content);
+}
+
+std::string to_json(const manifest& m) {
+    json j{{"schemaVersion", 2}, {"mediaType", m.media_type}};
+    if (m.artifact_type) {
+        j["artifactType"] = *m.artifact_type;
+    }
+    j["config"] = to_json(m.config);
+    j["layers"] = json::array();
+    for (auto& l : m.layers) {
+        j["layers"].push_back(to_json(l));
+    }
+    if (m.subject) {
+        j["subject"] = to_json(*m.subject);
+    }
+    if (!m.annotations.empty()) {
+        j["annotations"] = m.annotations;
+    }
+    return j.dump();
+}
+
+util::expected<manifest, error> parse_manifest(const std::string& raw) {
+    try {
+        const auto j = json::parse(raw);
+        manifest m;
+        m.media_type = j.value("mediaType", manifest_media_type);
+        if (j.contains("artifactType")) {
+            m.artifact_type = j["artifactType"];
+        }
+        if (j.contains("config")) {
+            m.config = parse_descriptor(j["config"]);
+        }
+        // the media type is optional in indexes
+        const bool is_index = m.media_type == index_media_type ||
+                              (!j.contains("mediaType") &&
+                               j.contains("manifests"));
+        if (is_index) {
+            m.media_type = index_media_type;
+        }
+        const auto layers = is_index ? "manifests" : "layers";
+        if (j.contains(layers)) {
+            for (auto& l : j[layers]) {
+                m.layers.push_back(parse_descriptor(l));
+            }
+        }
+        if (j.contains("subject")) {
+            m.subject = parse_descriptor(j["subject"]);
+        }
+        if (j.contains("annotations")) {
+            m.annotations =
+                j["annotations"].get<std::map<std::string, std::string>>();
+        }
+        return m;
+    } catch (std::exception& e) {
+        return util::unexpected(error{
+            errc::invalid_response, 0,
+            fmt::format("unable to parse manifest: {}", e.what())});
+    }
+}
+
+client::client(const std::string& registry, std::optional<credentials> creds)
+    : creds_(std::move(creds)) {
+    std::string_view r = registry;
+    std::string scheme = "https";
+    if (const auto p = r.find("://"); p != std::string_view::npos) {
+        scheme = r.substr(0, p);
+        r.remove_prefix(p + 3);
+    }
+    const auto slash = r.find('/');
+    base_ = fmt::format("{}://{}", scheme, r.substr(0, slash));
+    if (slash != std::string_view::npos) {
+        prefix_ = r.substr(slash + 1);
+        while (!prefix_.empty() && prefix_.back() == '/') {
+            prefix_.pop_back();
+        }
+    }
+}
+
+std::string client::name(const std::string& repo) const {
+    return prefix_.empty() ? repo : fmt::format("{}/{}", prefix_, repo);
+}
+
+std::string client::url(const std::string& repo,
+                        const std::string& path) const {
+    return fmt::format("{}/v2/{}/{}", base_, name(repo), path);
+}
+
+util::expected<void, error> client::ping(long timeout_ms) {
+    auto r = curl::perform({
+        .url = fmt::format("{}/v2/", base_),
+        .connect_timeout_ms = timeout_ms,
+        .timeout_ms = timeout_ms,
+    });
+    if (!r) {
+        return util::unexpected{curl_error(r.error())};
+    }
+    if (r->status != 200 && r->status != 401) {
+        return util::unexpected{
+            error{errc::server, r->status,
+                  fmt::format("{}/v2/: HTTP status {}", base_, r->status)}};
+    }
+    return {};
+}
+
+std::optional<std::string> client::authorization(const std::string& scope) {
+    std::lock_guard _(mutex_);
+    if (auto it = auth_.find(scope); it != auth_.end()) {
+        return it->second;
+    }
+    // basic authorization is used for every scope
+    if (auto it = auth_.find(""); it != auth_.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+util::expected<void, error> client::authorize(const std::string& header,
+                                              const std::string& scope) {
+    const auto c = parse_challenge(header);
+    const auto basic =
+        creds_ ? std::optional{fmt::format(
+                     "Authorization: Basic {}",
+                     base64(creds_->username + ":" + creds_->token))}
+               : std::nullopt;
+
+    if (c.scheme == "basic") {
+        if (!basic) {
+            return util::unexpected(error{errc::unauthorized, 401,
+                                          "the registry requires credentials"});
+        }
+        std::lock_guard _(mutex_);
+        auth_[""] = *basic;
+        return {};
+    }
+    if (c.scheme != "bearer" || !c.params.contains("realm")) {
+        return util::unexpected(error{
+            errc::invalid_response, 401,
+            fmt::format("unsupported authentication challenge '{}'", header)});
+    }
+
+    // request a token from the authorization service, with a scope parameter
+    // for each of the space separated scopes
+    const auto& realm = c.params.at("realm");
+    auto token_url = realm;
+    char sep = realm.find('?') == std::string::npos ? '?' : '&';
+    for (std::size_t b = 0; b < scope.size();) {
+        const auto e = std::min(scope.find(' ', b), scope.size());
+        token_url += fmt::format("{}scope={}", sep,
+                                 curl::escape(scope.substr(b, e - b)));
+        sep = '&';
+        b = e + 1;
+    }
+    if (auto it = c.params.find("service"); it != c.params.end()) {
+        token_url += fmt::format("&service={}", curl::escape(it->second));
+    }
+    curl::request req{.url = token_url, .timeout_ms = 30000};
+    if (basic) {
+        req.headers.push_back(*basic);
+    }
+    spdlog::debug("oci: requesting token for {}", scope);
+    auto r = curl::perform(req);
+    if (!r) {
+        return util::unexpected(curl_error(r.error()));
+    }
+    if (r->status != 200) {
+        return util::unexpected(http_error(*r, "token request"));
+    }
+
+    std::string token;
+    try {
+        const auto j = json::parse(r->body);
+        token = j.contains("token") ? j["token"] : j.at("access_token");
+    } catch (std::exception& e) {
+        return util::unexpected(error{
+            errc::invalid_response, r->status,
+            fmt::format("unable to parse token response: {}", e.what())});
+    }
+    std::lock_guard _(mutex_);
+    auth_[scope] = fmt::format("Authorization: Bearer {}", token);
+    return {};
+}
+
+util::expected<curl::response, error>
+client::send(curl::request req, const std::string& scope,
+             const curl::sink_type& sink, const curl::progress_type& progress) {
+    const auto headers = req.headers;
+    for (int attempt = 0;; ++attempt) {
+        req.headers = headers;
+        if (auto auth = authorization(scope)) {
+            req.headers.push_back(*auth);
+        }
+        spdlog::trace("oci: {} {}", req.method, req.url);
+        auto r = curl::perform(req, sink, progress);
+        if (!r) {
+            return util::unexpected(curl_error(r.error()));
+        }
+        // respond to the challenge of an authorization error, and retry once
+        if (r->status != 401 || attempt > 0) {
+            return std::move(*r);
+        }
+        const auto challenge = r->headers.find("www-authenticate");
+        if (challenge == r->headers.end()) {
+            return std::move(*r);
+        }
+        if (auto a = authorize(challenge->second, scope); !a) {
+            return util::unexpected(a.error());
+        }
+    }
+}
+
+util::expected<stored_manifest, error>
+client::get_manifest(const std::string& repo, const std::string& reference) {
+    auto r = send({.url = url(repo, "manifests/" + reference),
+                   .headers = {fmt::format("Accept: {}, {}, {}",
+                                           manifest_media_type,
+                                           index_media_type,
+                                           "application/vnd.docker."
+                                           "distribution.manifest.v2+json")}},
+                  pull_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 200) {
+        return util::unexpected(
+            http_error(*r, fmt::format("manifest {}:{}", name(repo), reference)));
+    }
+
+    auto m = parse_manifest(r->body);
+    if (!m) {
+        return util::unexpected(m.error());
+    }
+    const auto digest = digest_of(r->body);
+    if (reference.starts_with("sha256:") && reference != digest) {
+        return util::unexpected(error{
+            errc::invalid_digest, r->status,
+            fmt::format("manifest {} has digest {}", reference, digest)});
+    }
+    auto media_type = m->media_type;
+    if (auto it = r->headers.find("content-type"); it != r->headers.end()) {
+        media_type = it->second.substr(0, it->second.find(';'));
+    }
+    const descriptor desc{.media_type = media_type,
+                          .digest = digest,
+                          .size = r->body.size(),
+                          .artifact_type = m->artifact_type};
+    return stored_manifest{std::move(*m), desc, std::move(r->body)};
+}
+
+util::expected<descriptor, error>
+client::put_manifest(const std::string& repo, const std::string& reference,
+                     const std::string& raw, const std::string& media_type) {
+    auto m = parse_manifest(raw);
+    if (!m) {
+        return util::unexpected(m.error());
+    }
+    auto r = send({.method = "PUT",
+                   .url = url(repo, "manifests/" + reference),
+                   .headers = {fmt::format("Content-Type: {}", media_type)},
+                   .data = raw},
+                  push_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 201 && r->status != 200) {
+        return util::unexpected(
+            http_error(*r, fmt::format("put manifest {}:{}", name(repo),
+                                       reference)));
+    }
+    const descriptor desc{.media_type = media_type,
+                          .digest = digest_of(raw),
+                          .size = raw.size(),
+                          .artifact_type = m->artifact_type};
+
+    // registries that support the referrers API set the OCI-Subject header
+    if (m->subject && !r->headers.contains("oci-subject")) {
+        if (auto a = add_referrer(repo, m->subject->digest, desc); !a) {
+            return util::unexpected(a.error());
+        }
+    }
+    return desc;
+}
+
+util::expected<std::vector<descriptor>, error>
+client::referrers(const std::string& repo, const std::string& digest,
+                  const std::optional<std::string>& artifact_type) {
+    if (!is_sha256_digest(digest)) {
+        return util::unexpected(error{errc::invalid_response, 0,
+                                      fmt::format("invalid digest {}", digest)});
+    }
+    auto path = "referrers/" + digest;
+    if (artifact_type) {
+        path += "?artifactType=" + curl::escape(*artifact_type);
+    }
+    auto r = send({.url = url(repo, path),
+                   .headers = {fmt::format("Accept: {}", index_media_type)}},
+                  pull_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+
+    std::vector<descriptor> result;
+    if (r->status == 200) {
+        auto index = parse_manifest(r->body);
+        if (!index) {
+            return util::unexpected(index.error());
+        }
+        result = std::move(index->layers);
+    } else if (r->status == 401 || r->status == 403 || r->status >= 500) {
+        return util::unexpected(http_error(*r, "referrers"));
+    } else {
+        // the registry does not support the referrers API: use the index
+        // with the tag sha256-<hex>
+        spdlog::debug("oci: referrers API returned {}, using tag schema",
+                      r->status);
+        auto index = get_manifest(repo, "sha256-" + digest.substr(7));
+        if (!index) {
+            if (index.error().code == errc::not_found) {
+                return result;
+            }
+            return util::unexpected(index.error());
+        }
+        result = std::move(index->content.layers);
+    }
+
+    if (artifact_type) {
+        std::erase_if(result, [&artifact_type](const descriptor& d) {
+            return d.artifact_type != artifact_type;
+        });
+    }
+    return result;
+}
+
+util::expected<void, error> client::add_referrer(const std::string& repo,
+                                                 const std::string& digest,
+                                                 const descriptor& referrer) {
+    const auto tag = "sha256-" + digest.substr(7);
+    manifest index{.media_type = index_media_type};
+    if (auto current = get_manifest(repo, tag)) {
+        index.layers = std::move(current->content.layers);
+    } else if (current.error().code != errc::not_found) {
+        return util::unexpected(current.error());
+    }
+    std::erase_if(index.layers, [&referrer](const descriptor& d) {
+        return d.digest == referrer.digest;
+    });
+    index.layers.push_back(referrer);
+
+    // an index has a list of manifests instead of config and layers
+    json j{{"schemaVersion", 2},
+           {"mediaType", index_media_type},
+           {"manifests", json::array()}};
+    for (auto& d : index.layers) {
+        j["manifests"].push_back(to_json(d));
+    }
+    spdlog::debug("oci: adding referrer {} to {}", referrer.digest, tag);
+    auto r = put_manifest(repo, tag, j.dump(), index_media_type);
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    return {};
+}
+
+util::expected<void, error>
+client::get_blob(const std::string& repo, const descriptor& blob,
+                 const std::filesystem::path& destination,
+                 const progress_type& progress) {
+    namespace fs = std::filesystem;
+
+    if (!is_sha256_digest(blob.digest)) {
+        return util::unexpected(error{
+            errc::invalid_response, 0,
+            fmt::format("unsupported digest {}", blob.digest)});
+    }
+    auto partial = destination;
+    partial += ".partial";
+    auto checkpoint_path = destination;
+    checkpoint_path += ".checkpoint";
+
+    const int fd = open(partial.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return util::unexpected(
+            error{errc::io, 0,
+                  fmt::format("unable to open {}: {}", partial.string(),
+                              std::strerror(errno))});
+    }
+    auto close_fd = util::defer([fd]() { close(fd); });
+
+    blob_download d{
+        .blob = blob,
+        .fd = fd,
+        .partial = partial,
+        .checkpoint_path = checkpoint_path,
+        .fetch =
+            [&](std::optional<curl::byte_range> range,
+                const curl::sink_type& sink,
+                const curl::progress_type& progress)
+            -> util::expected<curl::response, error> {
+                auto& limits = download_limits_g;
+                if (!limits.acquire([&progress]() {
+                        return !progress || progress(0, 0);
+                    })) {
+                    return util::unexpected(error{
+                        errc::cancelled, 0, "the transfer was cancelled"});
+                }
+                auto _ = util::defer([&limits]() { limits.release(); });
+                return send({.url = url(repo, "blobs/" + blob.digest),
+                             .range = range,
+                             .compressed = false},
+                            pull_scope(name(repo)),
+                            [&sink, &limits](std::string_view data) {
+                                limits.throttle(data.size());
+                                return sink(data);
+                            },
+                            progress);
+            },
+        .progress = progress,
+        .state = {}};
+
+    // resume from the checkpoint if the partial file holds the bytes that it
+    // covers, otherwise start from the beginning
+    struct stat st;
+    if (fstat(fd, &st)) {
+        return d.io_error("stat");
+    }
+    if (auto saved = read_checkpoint(checkpoint_path, blob);
+        saved && !saved->ranges.empty() &&
+        std::uint64_t(st.st_size) >= saved->ranges.back().second) {
+        d.state = std::move(*saved);
+        spdlog::info("oci: resuming download of {} with {} of {} bytes",
+                     blob.digest, d.state.bytes(), blob.size);
+    }
+
+    // a download with gaps, e.g. of a blob seeded with seed_blob(), can only
+    // be completed with range requests
+    const auto& config = download_config_g;
+    const auto& ranges = d.state.ranges;
+    const bool gaps = !ranges.empty() &&
+                      !(ranges.size() == 1 && ranges[0].first == 0 &&
+                        d.state.hash && d.state.hash->size() == ranges[0].second);
+    const bool parallel =
+        gaps || (config.max_streams > 1 && blob.size > config.chunk_size);
+    auto r = parallel ? download_parallel(d, config) : download_sequential(d);
+    if (!r && parallel && r.error().code == errc::unsupported) {
+        spdlog::warn("oci: the registry does not support range requests, "
+                     "downloading {} in a single request",
+                     blob.digest);
+        d.state = {};
+        r = download_sequential(d);
+    }
+    if (!r) {
+        return r;
+    }
+
+    // the blob has been hashed as it was downloaded
+    std::error_code ec;
+    const auto received = d.state.hash->size();
+    const auto digest = "sha256:" + d.state.hash->hex_digest();
+    if (digest != blob.digest || received != blob.size) {
+        fs::remove(partial, ec);
+        fs::remove(checkpoint_path, ec);
+        return util::unexpected(error{
+            errc::invalid_digest, 0,
+            fmt::format("blob {} was downloaded with {} bytes and digest {}",
+                        blob.digest, received, digest)});
+    }
+    if (fdatasync(fd)) {
+        return d.io_error("sync");
+    }
+    fs::rename(partial, destination, ec);
+    if (ec) {
+        return util::unexpected(
+            error{errc::io, 0,
+                  fmt::format("unable to rename {}: {}", partial.string(),
+                              ec.message())});
+    }
+    fs::remove(checkpoint_path, ec);
+    return {};
+}
+
+util::expected<std::string, error> client::get_blob(const std::string& repo,
+                                                    const descriptor& blob) {
+    auto r = send({.url = url(repo, "blobs/" + blob.digest),
+                   .compressed = false},
+                  pull_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 200) {
+        return util::unexpected(http_error(*r, "blob " + blob.digest));
+    }
+    if (const auto digest = digest_of(r->body); digest != blob.digest) {
+        return util::unexpected(error{
+            errc::invalid_digest, r->status,
+            fmt::format("blob {} was downloaded with digest {}", blob.digest,
+                        digest)});
+    }
+    return std::move(r->body);
+}
+
+util::expected<bool, error> client::has_blob(const std::string& repo,
+                                             const std::string& digest) {
+    auto r = send({.method = "HEAD", .url = url(repo, "blobs/" + digest)},
+                  pull_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status == 200) {
+        return true;
+    }
+    if (r->status == 404) {
+        return false;
+    }
+    return util::unexpected(http_error(*r, "blob " + digest));
+}
+
+util::expected<void, error> client::upload(const std::string& repo,
+                                           const descriptor& blob,
+                                           curl::request req,
+                                           const progress_type& progress) {
+    const auto scope = push_scope(name(repo));
+
+    auto location = start_upload(repo);
+    if (!location) {
+        return util::unexpected(location.error());
+    }
+
+    // upload the blob in a single request
+    req.method = "PUT";
+    req.url = fmt::format("{}{}digest={}", *location,
+                          location->find('?') == std::string::npos ? '?' : '&',
+                          curl::escape(blob.digest));
+    req.headers.push_back("Content-Type: application/octet-stream");
+    auto r = send(std::move(req), scope, {},
+             [&progress](std::uint64_t, std::uint64_t uploaded) {
+                 return !progress || progress(uploaded);
+             });
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 201) {
+        return util::unexpected(http_error(*r, "upload blob " + blob.digest));
+    }
+    return {};
+}
+
+util::expected<std::string, error>
+client::start_upload(const std::string& repo) {
+    auto r = send({.method = "POST",
+                   .url = url(repo, "blobs/uploads/"),
+                   .data = std::string{}},
+                  push_scope(name(repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 202 || !r->headers.contains("location")) {
+        return util::unexpected(http_error(*r, "start upload"));
+    }
+    auto location = r->headers["location"];
+    if (location.starts_with("/")) {
+        location = base_ + location;
+    }
+    return location;
+}
+
+util::expected<bool, error>
+client::mount_blob(const std::string& src_repo, const std::string& dst_repo,
+                   const descriptor& blob) {
+    auto r = send({.method = "POST",
+                   .url = url(dst_repo,
+                              fmt::format("blobs/uploads/?mount={}&from={}",
+                                          curl::escape(blob.digest),
+                                          curl::escape(name(src_repo)))),
+                   .data = std::string{}},
+                  mount_scope(name(src_repo), name(dst_repo)));
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status == 201) {
+        return true;
+    }
+    // the registry does not support mounting, or the blob can't be mounted
+    // from the source, and an upload session was started instead. The
+    // session is not used, because a streamed upload can't be repeated when
+    // it is challenged for authorization: registries expire unused sessions.
+    if (r->status == 202) {
+        return false;
+    }
+    return util::unexpected(http_error(*r, "mount blob " + blob.digest));
+}
+
+util::expected<void, error>
+client::upload_chunked(const std::string& repo, const descriptor& blob,
+                       const std::filesystem::path& source,
+                       const progress_type& progress) {
+    const auto scope = push_scope(name(repo));
+    const auto chunk_size = std::max<std::uint64_t>(upload_config_g.chunk_size, 1);
+    const auto state_path = upload_state_path(base_, name(repo), blob);
+
+    // the registry reports how much of an upload it has received
+    auto query = [&](const std::string& location)
+        -> std::optional<std::uint64_t> {
+        auto r = send({.url = location}, scope);
+        if (!r || r->status != 204) {
+            return std::nullopt;
+        }
+        return upload_offset(*r);
+    };
+
+    upload_state state;
+    if (state_path) {
+        if (auto saved = read_upload_state(*state_path, name(repo), blob)) {
+            // registries report "0-0" for an upload that has no data
+            auto offset = query(saved->location);
+            if (offset && *offset == 1 && saved->offset == 0) {
+                offset = 0;
+            }
+            if (offset && *offset <= blob.size) {
+                state = {saved->location, *offset};
+                spdlog::info("oci: resuming upload of {} at byte {}",
+                             blob.digest, state.offset);
+            }
+        }
+    }
+    if (state.location.empty()) {
+        auto location = start_upload(repo);
+        if (!location) {
+            return util::unexpected(location.error());
+        }
+        state = {*location, 0};
+    }
+    auto save = [&]() {
+        if (state_path) {
+            write_upload_state(*state_path, name(repo), blob, state);
+        }
+    };
+    save();
+
+    const int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return util::unexpected(
+            error{errc::io, 0,
+                  fmt::format("unable to open {}: {}", source.string(),
+                              std::strerror(errno))});
+    }
+    auto close_fd = util::defer([fd]() { close(fd); });
+
+    int failures = 0;
+    while (state.offset < blob.size) {
+        const auto first = state.offset;
+        const auto size = std::min(chunk_size, blob.size - first);
+        auto pos = first;
+        curl::request req{
+            .method = "PATCH",
+            .url = state.location,
+            .headers = {"Content-Type: application/octet-stream",
+                        fmt::format("Content-Range: {}-{}", first,
+                                    first + size - 1)},
+            .source = [fd, &pos](char* buffer, std::size_t n) -> std::size_t {
+                const auto r = pread(fd, buffer, n, pos);
+                if (r <= 0) {
+                    return 0;
+                }
+                pos += r;
+                return r;
+            },
+            .size = size};
+        auto r = send(std::move(req), scope, {},
+                      [&](std::uint64_t, std::uint64_t uploaded) {
+                          return !progress || progress(first + uploaded);
+                      });
+        if (r && r->status == 202) {
+            if (auto it = r->headers.find("location"); it != r->headers.end()) {
+                state.location = it->second.starts_with("/")
+                                     ? base_ + it->second
+                                     : it->second;
+            }
+            state.offset = first + size;
+            failures = 0;
+            save();
+            continue;
+        }
+        auto e = r ? http_error(*r, "upload blob " + blob.digest) : r.error();
+        // after a network error, continue from the offset that the registry
+        // has received
+        if (e.code != errc::network || ++failures > 3) {
+            return util::unexpected(std::move(e));
+        }
+        auto offset = query(state.location);
+        if (!offset || *offset > blob.size) {
+            return util::unexpected(std::move(e));
+        }
+        spdlog::debug("oci: retrying upload of {} from byte {}: {}",
+                      blob.digest, *offset, e.message);
+        state.offset = *offset == 1 && first == 0 ? 0 : *offset;
+    }
+
+    // close the upload with the digest of the blob
+    auto r = send({.method = "PUT",
+                   .url = fmt::format("{}{}digest={}", state.location,
+                                      state.location.find('?') ==
+                                              std::string::npos
+                                          ? '?'
+                                          : '&',
+                                      curl::escape(blob.digest)),
+                   .headers = {"Content-Type: application/octet-stream"},
+                   .data = std::string{}},
+                  scope);
+    if (!r) {
+        return util::unexpected(r.error());
+    }
+    if (r->status != 201) {
+        return util::unexpected(http_error(*r, "upload blob " + blob.digest));
+    }
+    if (state_path) {
+        std::error_code ec;
+        std::filesystem::remove(*state_path, ec);
+    }
+    return {};
+}
+
+util::expected<void, error>
+client::put_blob(const std::string& repo, const descriptor& blob,
+                 const std::filesystem::path& source,
+                 const progress_type& progress) {
+    auto exists = has_blob(repo, blob.digest);
+    if (!exists) {
+        return util::unexpected(exists.error());
+    }
+    if (*exists) {
+        spdlog::debug("oci: blob {} already exists", blob.digest);
+        return {};
+    }
+    if (blob.size > upload_config_g.chunk_size) {
+        return upload_chunked(repo, blob, source, progress);
+    }
+    return upload(repo, blob, {.file = source}, progress);
+}
+
+util::expected<void, error> client::put_blob(const std::string& repo,
+                                             const descriptor& blob,
+                                             const std::string& content) {
+    auto exists = has_blob(repo, blob.digest);
+    if (!exists) {
+        return util::unexpected(exists.error());
+    }
+    if (*exists) {
+        return {};
+    }
+    return upload(repo, blob, {.data = content}, {});
+}
+
+util::expected<void, error> client::copy_blob(const std::string& src_repo,
+                                              const std::string& dst_repo,
+                                              const descriptor& blob,
+                                              const progress_type& progress) {
+    auto exists = has_blob(dst_repo, blob.digest);
+    if (!exists) {
+        return util::unexpected(exists.error());
+    }
+    if (*exists) {
+        spdlog::debug("oci: blob {} already exists in {}", blob.digest,
+                      dst_repo);
+        return {};
+    }
+
+    // a blob that is mounted is not transferred
+    auto mounted = mount_blob(src_repo, dst_repo, blob);
+    if (!mounted) {
+        return util::unexpected(mounted.error());
+    }
+    if (*mounted) {
+        spdlog::debug("oci: mounted blob {} from {} in {}", blob.digest,
+                      src_repo, dst_repo);
+        if (progress) {
+            progress(blob.size);
+        }
+        return {};
+    }
+    spdlog::debug("oci: unable to mount blob {} from {}, streaming it",
+                  blob.digest, src_repo);
+
+    // the blob is downloaded by a thread that writes it to a socket, from
+    // which it is read by the upload
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+        return util::unexpected(
+            error{errc::io, 0,
+                  fmt::format("unable to create socket: {}",
+                              std::strerror(errno))});
+    }
+    util::expected<void, error> download;
+    std::thread downloader([&]() {
+        util::sha256 hash;
+        std::uint64_t received = 0;
+        auto sink = [&](std::string_view data) {
+            hash.update(data);
+            received += data.size();
+            while (!data.empty()) {
+                // fails when the upload has finished or failed
+                const auto n =
+                    ::send(fds[1], data.data(), data.size(), MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    return false;
+                }
+                data.remove_prefix(n);
+            }
+            return true;
+        };
+        auto r = send({.url = url(src_repo, "blobs/" + blob.digest),
+                       .compressed = false},
+                      pull_scope(name(src_repo)), sink);
+        shutdown(fds[1], SHUT_WR);
+        if (!r) {
+            download = util::unexpected(r.error());
+        } else if (r->status != 200) {
+            download = util::unexpected(http_error(*r, "blob " + blob.digest));
+        } else if ("sha256:" + hash.hex_digest() != blob.digest ||
+                   received != blob.size) {
+            download = util::unexpected(
+                error{errc::invalid_digest, r->status,
+                      fmt::format("blob {} did not match its digest",
+                                  blob.digest)});
+        }
+    });
+
+    const int in = fds[0];
+    auto uploaded = upload(
+        dst_repo, blob,
+        {.source =
+             [in](char* buffer, std::size_t n) -> std::size_t {
+                 while (true) {
+                     const auto m = recv(in, buffer, n, 0);
+                     if (m < 0 && errno == EINTR) {
+                         continue;
+                     }
+                     return m < 0 ? CURL_READFUNC_ABORT : m;
+                 }
+             },
+         .size = blob.size},
+        progress);
+    // stop the download if the upload failed
+    shutdown(fds[0], SHUT_RDWR);
+    downloader.join();
+    close(fds[0]);
+    close(fds[1]);
+
+    if (!download) {
+        return download;
+    }
+    return uploaded;
+}
+
+} // namespace oci
+} // namespace uenv
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <util/curl.h>
+#include <util/expected.h>
+
+// A client for registries that implement the OCI distribution specification.
+// https://github.com/opencontainers/distribution-spec/blob/main/spec.md
+
+namespace uenv {
+namespace oci {
+
+struct credentials {
+    std::string username;
+    std::string token;
+};
+
+enum class errc {
+    // the registry could not be contacted, or the connection failed
+    network,
+    // the registry requires credentials, or rejected the credentials
+    unauthorized,
+    // the credentials do not give permission for the request
+    forbidden,
+    // the repository, manifest or blob does not exist
+    not_found,
+    // downloaded content did not match its digest
+    invalid_digest,
+    // the registry returned a response that could not be interpreted
+    invalid_response,
+    // the registry reported an error
+    server,
+    // reading or writing a local file failed
+    io,
+    // the transfer was cancelled by the caller
+    cancelled,
+    // the registry does not support the request, e.g. a range request
+    unsupported,
+};
+
+struct error {
+    errc code;
+    // the HTTP status of the response, or 0 if there was no response
+    long status = 0;
+    std::string message;
+};
+
+constexpr auto manifest_media_type =
+    "application/vnd.oci.image.manifest.v1+json";
+constexpr auto index_media_type = "application/vnd.oci.image.index.v1+json";
+constexpr auto empty_media_type = "application/vnd.oci.empty.v1+json";
+
+struct descriptor {
+    std::string media_type;
+    std::string digest;
+    std::uint64_t size = 0;
+    std::optional<std::string> artifact_type = std::nullopt;
+    std::map<std::string, std::string> annotations = {};
+};
+
+// the descriptor of the empty config "{}" used by artifacts
+descriptor empty_config();
+
+struct manifest {
+    std::string media_type = manifest_media_type;
+    std::optional<std::string> artifact_type;
+    descriptor config;
+    std::vector<descriptor> layers;
+    std::optional<descriptor> subject;
+    std::map<std::string, std::string> annotations;
+};
+
+// a manifest as it is stored in a registry
+struct stored_manifest {
+    manifest content;
+    // the media type, digest and size of the stored manifest
+    descriptor desc;
+    // the manifest exactly as it is stored, which must be copied verbatim to
+    // preserve its digest
+    std::string raw;
+};
+
+// serialise a manifest to JSON
+std::string to_json(const manifest& m);
+
+// parse a manifest, or an index, in which case the manifests in the index
+// are returned as layers.
+util::expected<manifest, error> parse_manifest(const std::string& raw);
+
+// the digest "sha256:<hex>" of a string
+std::string digest_of(const std::string& content);
+
+// called with the number of bytes transferred so far. The transfer is
+// cancelled if it returns false.
+using progress_type = std::function<bool(std::uint64_t)>;
+
+// Blobs larger than chunk_size are downloaded in chunks of chunk_size bytes,
+// which are requested concurrently over up to max_streams connections. The
+// number of connections that are used is adapted to the throughput that is
+// measured during the download. Up to chunk_size*max_streams bytes that are
+// received out of order are kept in memory until they can be hashed.
+struct download_config {
+    std::uint64_t chunk_size = 16 << 20;
+    // blobs are downloaded with a single request if max_streams is 1
+    unsigned max_streams = 8;
+    // limits on all blob downloads in the process, e.g. when several images
+    // are pulled at once: the number of concurrent requests, and the total
+    // number of bytes received per second. 0 for no limit.
+    unsigned max_connections = 0;
+    std::uint64_t max_rate = 0;
+};
+
+void set_download_config(download_config);
+download_config get_download_config();
+
+// Blobs larger than chunk_size are uploaded in chunks of chunk_size bytes
+// with the chunked upload protocol, in which the registry accepts the chunks
+// of a blob in order. The upload location and the number of bytes that have
+// been accepted are saved in state_dir after each chunk, and an interrupted
+// upload of the blob to the same repository is resumed from the offset that
+// the registry reports for the saved location.
+struct upload_config {
+    std::uint64_t chunk_size = 64 << 20;
+    // uploads can't be resumed if not set
+    std::optional<std::filesystem::path> state_dir;
+};
+
+void set_upload_config(upload_config);
+upload_config get_upload_config();
+
+// size bytes at offset in a blob, which are available in a local file at
+// source_offset
+struct local_range {
+    std::uint64_t offset;
+    std::uint64_t source_offset;
+    std::uint64_t size;
+};
+
+// Copy the parts of a blob that are available in the local file source to
+// the partial file of a download of the blob to destination, and record them
+// in the checkpoint of the download, so that client::get_blob() only
+// downloads the rest of the blob. The copied parts are verified with the
+// digest of the blob when the download is complete.
+// Returns the number of bytes that were copied.
+util::expected<std::uint64_t, error>
+seed_blob(const descriptor& blob, const std::filesystem::path& destination,
+          const std::filesystem::path& source,
+          const std::vector<local_range>& ranges);
+
+// A connection to a registry, which is addressed as
+//      [scheme://]host[:port][/prefix]
+// e.g. "jfrog.svc.cscs.ch/uenv". The scheme is https by default.
+// Repository names passed to the methods are relative to the prefix.
+//
+// Authorization follows the token protocol used by registries: requests are
+// sent without credentials, and on a 401 response the challenge in the
+// WWW-Authenticate header is answered with a bearer token requested from the
+// realm of the challenge, or with basic authentication. Tokens are cached for
+// the lifetime of the client.
+//
+// The methods can be called concurrently.
+class client {
+  public:
+    client(const std::string& registry,
+           std::optional<credentials> creds = std::nullopt);
+
+    // check that the registry is reachable and serves the registry API, with
+    // an unauthenticated request to /v2/ that fails if there is no response
+    // within timeout_ms. A response that requests authentication is success.
+    util::expected<void, error> ping(long timeout_ms);
+
+    // get the manifest with a tag or digest
+    util::expected<stored_manifest, error>
+    get_manifest(const std::string& repo, const std::string& reference);
+
+    // put a manifest, and return its descriptor.
+    // referrers, i.e. manifests with a subject, are added to the referrers
+    // tag schema index of the subject if the registry does not support the
+    // referrers API.
+    util::expected<descriptor, error>
+    put_manifest(const std::string& repo, const std::string& reference,
+                 const std::string& raw,
+                 const std::string& media_type = manifest_media_type);
+
+    // the manifests that refer to the manifest with digest, optionally
+    // filtered by artifact type.
+    // uses the referrers API if the registry supports it, otherwise the
+    // referrers tag schema, i.e. an index tagged "sha256-<hex>".
+    util::expected<std::vector<descriptor>, error>
+    referrers(const std::string& repo, const std::string& digest,
+              const std::optional<std::string>& artifact_type = std::nullopt);
+
+    // download a blob to a file, verifying its digest.
+    // the blob is downloaded to "<destination>.partial", which is renamed to
+    // destination once the digest has been verified. If the download fails
+    // or is cancelled, the partial file is kept along with a checkpoint
+    // "<destination>.checkpoint", and the next call resumes the download
+    // from the checkpoint with a range request.
+    util::expected<void, error>
+    get_blob(const std::string& repo, const descriptor& blob,
+             const std::filesystem::path& destination,
+             const progress_type& progress = {});
+
+    // download a small blob to memory, verifying its digest
+    util::expected<std::string, error> get_blob(const std::string& repo,
+                                                const descriptor& blob);
+
+    util::expected<bool, error> has_blob(const std::string& repo,
+                                         const std::string& digest);
+
+    // upload a blob from a file or from memory.
+    // nothing is uploaded if the blob is already in the repository.
+    util::expected<void, error>
+    put_blob(const std::string& repo, const descriptor& blob,
+             const std::filesystem::path& source,
+             const progress_type& progress = {});
+    util::expected<void, error> put_blob(const std::string& repo,
+                                         const descriptor& blob,
+                                         const std::string& content);
+
+    // copy a blob between repositories in the registry. The blob is mounted
+    // in the destination if the registry supports cross repository mounts,
+    // otherwise it is streamed from the source to the destination without
+    // storing it locally.
+    util::expected<void, error> copy_blob(const std::string& src_repo,
+                                          const std::string& dst_repo,
+                                          const descriptor& blob,
+                                          const progress_type& progress = {});
+
+  private:
+    // send a request to the registry, authorizing it for scope
+    util::expected<util::curl::response, error>
+    send(util::curl::request req, const std::string& scope,
+         const util::curl::sink_type& sink = {},
+         const util::curl::progress_type& progress = {});
+
+    util::expected<void, error>
+    authorize(const std::string& challenge, const std::string& scope);
+
+    std::optional<std::string> authorization(const std::string& scope);
+
+    util::expected<void, error> add_referrer(const std::string& repo,
+                                             const std::string& digest,
+                                             const descriptor& referrer);
+
+    // upload a blob in a single request, with the body of req
+    util::expected<void, error> upload(const std::string& repo,
+                                       const descriptor& blob,
+                                       util::curl::request req,
+                                       const progress_type& progress);
+
+    // upload a file in chunks, resuming a saved upload (see upload_config)
+    util::expected<void, error> upload_chunked(
+        const std::string& repo, const descriptor& blob,
+        const std::filesystem::path& source, const progress_type& progress);
+
+    // start an upload session, and return the location to upload to
+    util::expected<std::string, error> start_upload(const std::string& repo);
+
+    // mount a blob of src_repo in dst_repo, without transferring it.
+    // returns false if the registry started an upload session instead.
+    util::expected<bool, error>
+    mount_blob(const std::string& src_repo, const std::string& dst_repo,
+               const descriptor& blob);
+
+    std::string url(const std::string& repo, const std::string& path) const;
+    std::string name(const std::string& repo) const;
+
+    // scheme://host[:port]
+    std::string base_;
+    // the prefix of repository names
+    std::string prefix_;
+    std::optional<credentials> creds_;
+
+    std::mutex mutex_;
+    // the Authorization header for each scope
+    std::unordered_map<std::string, std::string> auth_;
+};
+
+} // namespace oci
+} // namespace uenv
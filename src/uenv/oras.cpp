@@ -1,19 +1,28 @@
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <ctime>
 #include <filesystem>
+#include <future>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <barkeep/barkeep.h>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
-#include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
 
+#include <uenv/delta.h>
+#include <uenv/oci.h>
 #include <uenv/oras.h>
 #include <uenv/uenv.h>
 #include <util/color.h>
 #include <util/fs.h>
+#include <util/sha256.h>
 #include <util/signal.h>
 #include <util/subprocess.h>
 
@@ -22,17 +31,19 @@ namespace oras {
 
 using opt_creds = std::optional<credentials>;
 
-// stores the "result" of calling the oras cli tool as an external process.
-struct oras_output {
-    // return code of the oras call
-    int returncode = -1;
+// the annotations that oras uses to describe layers
+constexpr auto title_annotation = "org.opencontainers.image.title";
+constexpr auto created_annotation = "org.opencontainers.image.created";
+// directories are stored as tar.gz layers, which are unpacked on pull
+constexpr auto unpack_annotation = "io.deis.oras.content.unpack";
+constexpr auto content_digest_annotation = "io.deis.oras.content.digest";
 
-    // the full captured stdout output
-    std::string stdout;
-
-    // the full captured stderr output
-    std::string stderr;
-};
+constexpr auto file_media_type = "application/vnd.oci.image.layer.v1.tar";
+constexpr auto directory_media_type =
+    "application/vnd.oci.image.layer.v1.tar+gzip";
+// the block index of a squashfs image, see uenv/delta.h
+constexpr auto blocks_artifact_type = "uenv/blocks";
+constexpr auto blocks_media_type = "application/vnd.uenv.blocks.v1";
 
 constexpr auto generic_error_message =
     "unknown error - rerun with the -vvv flag and send an error report to the "
@@ -42,147 +53,295 @@ error generic_error(std::string err) {
     return {-1, std::move(err), generic_error_message};
 }
 
-// Convert oras_output to a uenv::oras::error.
-// oras returns 1 for all errors that it bothers signalling (from what we
-// observe - there is no documentation). sometimes it returns 0, and you have to
-// parse stderr to double check.
-// Hence, parse stderr & stdout for hints about
-// what went wrong to generate the user-friendly message
-error create_error(const oras_output& result) {
-    std::string message = generic_error_message;
-
-    auto contains = [](std::string_view string,
-                       std::string_view contents) -> bool {
-        return string.find(contents) != std::string_view::npos;
-    };
-    std::string_view err = result.stderr;
-    if (contains(err, "403") && contains(err, "Forbidden")) {
+// Convert an error returned by the registry client to a uenv::oras::error with
+// a user-friendly message.
+error create_error(const oci::error& e) {
+    spdlog::error("registry error: {}", e.message);
+    const int code = e.status ? e.status : -1;
+    switch (e.code) {
+    case oci::errc::forbidden:
         return {
-            403, result.stderr,
+            403, e.message,
             "Invalid credentials were provided, or you may not have permission "
             "to perform the requested action.\nTry using the --token flag if "
-            "you are trying to access restricted software.\nCSCS staff can "
-            "configure oras to use their credentials."};
+            "you are trying to access restricted software."};
+    case oci::errc::unauthorized:
+        return {code, e.message,
+                "no authorization: provide valid --token and --username "
+                "arguments."};
+    case oci::errc::not_found:
+        return {code, e.message,
+                fmt::format("the uenv was not found in the registry: {}",
+                            e.message)};
+    case oci::errc::network: {
+        error err{code, e.message,
+                  fmt::format("unable to connect to the registry: {}",
+                              e.message)};
+        err.network = true;
+        return err;
     }
-    if (contains(err, "Token failed verification: parse") &&
-        contains(err, "Error response from registry")) {
-        return {
-            403, result.stderr,
-            "The token failed parsing. It may be invalid, the wrong token,\n"
-            "or need to be regenerated."};
-    }
-    if (contains(err, "Wrong username was used") &&
-        contains(err, "Error response from registry")) {
-        return {403, result.stderr,
-                "Invalid username was provided. Check the --username flag."};
-    }
-    if (contains(err, "unauthorized") &&
-        contains(err, "Error response from registry")) {
-        return {403, result.stderr,
-                fmt::format("no authorization: provide valid --token and "
-                            "--username arguments.",
-                            err)};
-    }
-    if (result.returncode == 0) {
-        return {0, {}, {}};
-    }
-    return {result.returncode, result.stderr, std::move(message)};
-};
-
-std::vector<std::string>
-redact_arguments(const std::vector<std::string>& args) {
-    std::vector<std::string> redacted_args{};
-    bool redact_next = false;
-    for (auto arg : args) {
-        if (redact_next) {
-            redacted_args.push_back(std::string(arg.size(), 'X'));
-            redact_next = false;
-        } else if (arg.find("password") != std::string::npos) {
-            if (auto eqpos = arg.find("="); eqpos != std::string::npos) {
-                redacted_args.push_back(
-                    std::string(arg.begin(), arg.begin() + eqpos + 1) +
-                    std::string(arg.size() - eqpos, 'X'));
-            } else {
-                redacted_args.push_back(arg);
-                redact_next = true;
-            }
-        } else {
-            redacted_args.push_back(arg);
-        }
+    case oci::errc::invalid_digest:
+        return {code, e.message,
+                "the downloaded data was corrupted - try again later."};
+    case oci::errc::io:
+        return {code, e.message, e.message};
+    default:
+        return {code, e.message, generic_error_message};
     }
+}
+
+namespace {
+
+// the repository of a uenv, relative to the registry
+template <typename R>
+std::string repository(const std::string& nspace, const R& r) {
+    return fmt::format("{}/{}/{}/{}/{}", nspace, r.system, r.uarch, r.name,
+                       r.version);
+}
+
+std::string label_repository(const std::string& nspace,
+                             const uenv_label& label) {
+    return fmt::format("{}/{}/{}/{}/{}", nspace, *label.system, *label.uarch,
+                       *label.name, *label.version);
+}
 
-    return redacted_args;
+std::string now_rfc3339() {
+    const auto t = std::time(nullptr);
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buffer;
 }
 
-oras_output
-run_oras(std::vector<std::string> args,
-         std::optional<std::filesystem::path> runpath = std::nullopt) {
-    auto oras = util::oras_path();
-    if (!oras) {
-        spdlog::error("no oras executable found");
-        return {.returncode = -1};
+util::expected<void, error> run(const std::vector<std::string>& args) {
+    spdlog::trace("oras: {}", fmt::join(args, " "));
+    auto proc = util::run(args);
+    if (!proc) {
+        return util::unexpected(generic_error(proc.error()));
     }
+    if (proc->wait()) {
+        const auto err = proc->err.string();
+        spdlog::error("{} failed: {}", args[0], err);
+        return util::unexpected(generic_error(err));
+    }
+    return {};
+}
+
+// download the layers of a manifest to destination.
+// layers are saved to a file named by their title annotation: directories are
+// stored as tar.gz archives, which are unpacked.
+util::expected<void, error> pull_layers(oci::client& client,
+                                        const std::string& repo,
+                                        const oci::manifest& manifest,
+                                        const std::filesystem::path& destination,
+                                        const oci::progress_type& progress) {
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    fs::create_directories(destination, ec);
+    for (auto& layer : manifest.layers) {
+        const auto title = layer.annotations.find(title_annotation);
+        if (title == layer.annotations.end()) {
+            spdlog::warn("skipping layer {} without a title", layer.digest);
+            continue;
+        }
+        // the title is used as a file name in destination
+        const fs::path name = title->second;
+        if (name.empty() || name.has_parent_path() || name == "." ||
+            name == "..") {
+            return util::unexpected(
+                generic_error(fmt::format("invalid layer title '{}'",
+                                          name.string())));
+        }
 
-    args.insert(args.begin(), oras->string());
-    spdlog::trace("run_oras: {}", fmt::join(redact_arguments(args), " "));
-    auto proc = util::run(args, runpath);
+        const auto unpack = layer.annotations.find(unpack_annotation);
+        if (unpack == layer.annotations.end() || unpack->second != "true") {
+            spdlog::debug("oras: pull {} to {}", layer.digest,
+                          (destination / name).string());
+            if (auto r = client.get_blob(repo, layer, destination / name,
+                                         progress);
+                !r) {
+                return util::unexpected(create_error(r.error()));
+            }
+            continue;
+        }
+
+        const auto archive = util::make_temp_dir() / "layer.tar.gz";
+        spdlog::debug("oras: pull {} to {}", layer.digest, archive.string());
+        if (auto r = client.get_blob(repo, layer, archive, progress); !r) {
+            return util::unexpected(create_error(r.error()));
+        }
+        // unpack into a staging directory that is moved into place, so that
+        // an interrupted pull does not leave a partial directory behind
+        const auto staging =
+            destination / fmt::format(".{}.unpack", layer.digest.substr(7));
+        fs::remove_all(staging, ec);
+        fs::create_directories(staging, ec);
+        auto r = run({"tar", "--no-same-owner", "-xzf", archive.string(), "-C",
+                      staging.string()});
+        fs::remove(archive, ec);
+        if (r) {
+            for (auto& entry : fs::directory_iterator(staging, ec)) {
+                const auto target = destination / entry.path().filename();
+                fs::remove_all(target, ec);
+                fs::rename(entry.path(), target, ec);
+                if (ec) {
+                    r = util::unexpected(generic_error(
+                        fmt::format("unable to move {} to {}: {}",
+                                    entry.path().string(), target.string(),
+                                    ec.message())));
+                    break;
+                }
+            }
+        }
+        fs::remove_all(staging, ec);
+        if (!r) {
+            return r;
+        }
+    }
+    return {};
+}
 
-    auto result = proc->wait();
+// the squashfs image is verified against its digest while it is downloaded,
+// so the digest in the manifest has to be the sha256 of the record, otherwise
+// the tag refers to a different image.
+util::expected<void, error> check_image_digest(const std::string& repo,
+                                               const uenv_record& uenv,
+                                               const oci::manifest& manifest) {
+    const auto digest = "sha256:" + uenv.sha.string();
+    for (auto& layer : manifest.layers) {
+        const auto title = layer.annotations.find(title_annotation);
+        if (title != layer.annotations.end() &&
+            title->second.ends_with(".squashfs") && layer.digest != digest) {
+            return util::unexpected{generic_error(fmt::format(
+                "the image {}:{} in the registry has digest {}, expected {}",
+                repo, uenv.tag, layer.digest, digest))};
+        }
+    }
+    return {};
+}
 
-    return {.returncode = result,
-            .stdout = proc->out.string(),
-            .stderr = proc->err.string()};
+// the manifest of the meta data attached to the image with digest
+util::expected<oci::manifest, error> find_meta(oci::client& client,
+                                               const std::string& repo,
+                                               const std::string& digest) {
+    auto referrers = client.referrers(repo, digest, "uenv/meta");
+    if (!referrers) {
+        return util::unexpected{create_error(referrers.error())};
+    }
+    // we assume that there is one, and only one, artifact attached to the
+    // squashfs image: the meta data directory.
+    if (referrers->empty()) {
+        return util::unexpected{
+            error{-1, "no referrers", "no metadata in manifest"}};
+    }
+    spdlog::debug("oras: meta data manifest {}", referrers->front().digest);
+    auto manifest = client.get_manifest(repo, referrers->front().digest);
+    if (!manifest) {
+        return util::unexpected{create_error(manifest.error())};
+    }
+    return manifest->content;
 }
 
-util::expected<util::subprocess, std::string>
-run_oras_async(std::vector<std::string> args,
-               std::optional<std::filesystem::path> runpath = std::nullopt) {
-    auto oras = util::oras_path();
-    if (!oras) {
-        return util::unexpected{"no oras executable found"};
+// copy the blocks of the squashfs image in the manifest that are also in
+// seed, an older version of the image, to the partial download of the image
+// in destination, using the block index attached to the image.
+// returns the number of bytes copied, which is zero if the image has no
+// block index. Errors are not fatal, because the image can be downloaded
+// without the seed.
+std::uint64_t seed_image_blocks(oci::client& client, const std::string& repo,
+                                const oci::stored_manifest& image,
+                                const std::filesystem::path& seed,
+                                const std::filesystem::path& destination) {
+    const auto layer = std::find_if(
+        image.content.layers.begin(), image.content.layers.end(),
+        [](const oci::descriptor& d) {
+            const auto title = d.annotations.find(title_annotation);
+            return title != d.annotations.end() &&
+                   title->second.ends_with(".squashfs");
+        });
+    if (layer == image.content.layers.end()) {
+        return 0;
     }
+    const auto target = destination / layer->annotations.at(title_annotation);
 
-    args.insert(args.begin(), oras->string());
-    spdlog::trace("run_oras_async: {}", fmt::join(redact_arguments(args), " "));
+    auto referrers =
+        client.referrers(repo, image.desc.digest, blocks_artifact_type);
+    if (!referrers || referrers->empty()) {
+        spdlog::debug("oras: no block index for {}", image.desc.digest);
+        return 0;
+    }
+    auto manifest = client.get_manifest(repo, referrers->front().digest);
+    if (!manifest || manifest->content.layers.empty()) {
+        spdlog::warn("unable to get the block index of {}", repo);
+        return 0;
+    }
+    auto raw = client.get_blob(repo, manifest->content.layers.front());
+    if (!raw) {
+        spdlog::warn("unable to get the block index of {}: {}", repo,
+                     raw.error().message);
+        return 0;
+    }
+    auto index = parse_block_index(*raw);
+    if (!index || index->size != layer->size) {
+        spdlog::warn("invalid block index for {}", repo);
+        return 0;
+    }
+    auto matches = find_blocks(*index, seed);
+    if (!matches) {
+        spdlog::warn("unable to read {}: {}", seed.string(), matches.error());
+        return 0;
+    }
 
-    return util::run(args, runpath);
+    // copy runs of consecutive blocks with one range
+    std::sort(matches->begin(), matches->end(),
+              [](auto& a, auto& b) { return a.block < b.block; });
+    std::vector<oci::local_range> ranges;
+    for (auto& m : *matches) {
+        const auto offset = m.block * index->block_size;
+        if (!ranges.empty() && ranges.back().offset + ranges.back().size ==
+                                   offset &&
+            ranges.back().source_offset + ranges.back().size == m.offset) {
+            ranges.back().size += index->block_size;
+        } else {
+            ranges.push_back({offset, m.offset, index->block_size});
+        }
+    }
+    auto copied = oci::seed_blob(*layer, target, seed, ranges);
+    if (!copied) {
+        spdlog::warn("unable to copy blocks from {}: {}", seed.string(),
+                     copied.error().message);
+        return 0;
+    }
+    spdlog::info("oras: copied {} of {} bytes of {} from {}", *copied,
+                 layer->size, layer->digest, seed.string());
+    return *copied;
 }
 
+} // namespace
+
 util::expected<std::vector<std::string>, error>
 discover(const std::string& registry, const std::string& nspace,
          const uenv_record& uenv, const opt_creds token) {
-    auto address =
-        fmt::format("{}/{}/{}/{}/{}/{}:{}", registry, nspace, uenv.system,
-                    uenv.uarch, uenv.name, uenv.version, uenv.tag);
+    const auto repo = repository(nspace, uenv);
+    spdlog::debug("oras::discover: {}:{}", repo, uenv.tag);
 
-    std::vector<std::string> args = {"discover",        "--format",  "json",
-                                     "--artifact-type", "uenv/meta", address};
-    if (token) {
-        args.push_back("--password");
-        args.push_back(token->token);
-        args.push_back("--username");
-        args.push_back(token->username);
+    oci::client client(registry, token);
+    auto manifest = client.get_manifest(repo, uenv.tag);
+    if (!manifest) {
+        return util::unexpected{create_error(manifest.error())};
     }
-    auto result = run_oras(args);
-
-    if (result.returncode) {
-        spdlog::error("oras discover returncode={} stderr='{}'",
-                      result.returncode, result.stderr);
-        return util::unexpected{create_error(result)};
+    auto referrers =
+        client.referrers(repo, manifest->desc.digest, "uenv/meta");
+    if (!referrers) {
+        return util::unexpected{create_error(referrers.error())};
     }
 
     std::vector<std::string> manifests;
-    using json = nlohmann::json;
-    try {
-        const auto raw = json::parse(result.stdout);
-        for (const auto& j : raw["manifests"]) {
-            manifests.push_back(j["digest"]);
-        }
-    } catch (std::exception& e) {
-        spdlog::error("unable to parse oras discover json: {}", e.what());
-        return util::unexpected(generic_error(e.what()));
+    for (auto& r : *referrers) {
+        manifests.push_back(r.digest);
     }
-
     return manifests;
 }
 
@@ -190,28 +349,191 @@ util::expected<void, error>
 pull_digest(const std::string& registry, const std::string& nspace,
             const uenv_record& uenv, const std::string& digest,
             const std::filesystem::path& destination, const opt_creds token) {
-    auto address =
-        fmt::format("{}/{}/{}/{}/{}/{}@{}", registry, nspace, uenv.system,
-                    uenv.uarch, uenv.name, uenv.version, digest);
+    const auto repo = repository(nspace, uenv);
+    spdlog::debug("oras::pull_digest: {}@{}", repo, digest);
+
+    oci::client client(registry, token);
+    auto manifest = client.get_manifest(repo, digest);
+    if (!manifest) {
+        return util::unexpected{create_error(manifest.error())};
+    }
+    if (auto r = pull_layers(client, repo, manifest->content, destination, {});
+        !r) {
+        return r;
+    }
+
+    return {};
+}
+
+util::expected<pull_result, error> pull(const std::string& registry,
+                                        const std::string& nspace,
+                                        const uenv_record& uenv,
+                                        const std::filesystem::path& destination,
+                                        const pull_options& what,
+                                        const opt_creds token) {
+    namespace bk = barkeep;
 
-    spdlog::debug("oras::pull_digest: {}", address);
+    const auto repo = repository(nspace, uenv);
+    spdlog::debug("oras::pull: {}:{} (meta {}, squashfs {})", repo, uenv.tag,
+                  what.meta, what.squashfs);
 
-    std::vector<std::string> args{"pull", "--output", destination.string(),
-                                  address};
-    if (token) {
-        args.push_back("--password");
-        args.push_back(token->token);
-        args.push_back("--username");
-        args.push_back(token->username);
+    oci::client client(registry, token);
+    auto manifest = client.get_manifest(repo, uenv.tag);
+    if (!manifest) {
+        return util::unexpected{create_error(manifest.error())};
     }
-    auto proc = run_oras(args);
+    if (what.squashfs) {
+        if (auto r = check_image_digest(repo, uenv, manifest->content); !r) {
+            return util::unexpected{r.error()};
+        }
+    }
+
+    // the downloads are cancelled when a signal, usually SIGTERM or SIGINT,
+    // is raised, or when the other download fails. The signal catcher is
+    // installed by the caller, so that a signal raised between the pulls of
+    // several images is not cleared.
+    std::mutex error_mutex;
+    std::optional<error> first_error;
+    std::atomic<bool> failed{false};
+    auto fail = [&](error e) {
+        std::lock_guard _(error_mutex);
+        if (!first_error) {
+            first_error = std::move(e);
+        }
+        failed = true;
+    };
 
-    if (proc.returncode) {
-        spdlog::error("unable to pull digest with oras: {}", proc.stderr);
-        return util::unexpected{create_error(proc)};
+    std::atomic<std::uint64_t> meta_bytes{0};
+    std::atomic<std::uint64_t> image_bytes{0};
+    std::atomic<std::size_t> downloaded_mb{0};
+    std::mutex progress_mutex;
+    auto progress = [&](std::atomic<std::uint64_t>& bytes) {
+        return [&, counter = &bytes](std::uint64_t n) {
+            *counter = n;
+            const std::uint64_t total = meta_bytes + image_bytes;
+            downloaded_mb = total / (1024 * 1024);
+            if (what.progress) {
+                std::lock_guard _(progress_mutex);
+                if (!what.progress(total)) {
+                    fail(error{-1, "cancelled", "the download was cancelled"});
+                }
+            }
+            return !failed && !util::signal_pending();
+        };
+    };
+
+    // the meta data is found and downloaded in parallel with the image, with
+    // a separate connection to the registry. The size of the meta data is
+    // passed back to show the progress of both downloads in one bar.
+    std::promise<std::uint64_t> meta_size;
+    std::thread meta_thread;
+    if (what.meta) {
+        meta_thread = std::thread([&, digest = manifest->desc.digest]() {
+            oci::client meta_client(registry, token);
+            auto meta = find_meta(meta_client, repo, digest);
+            std::uint64_t size = 0;
+            if (meta) {
+                for (auto& layer : meta->layers) {
+                    size += layer.size;
+                }
+            }
+            meta_size.set_value(size);
+            if (!meta) {
+                fail(meta.error());
+                return;
+            }
+            if (auto r = pull_layers(meta_client, repo, *meta, destination,
+                                     progress(meta_bytes));
+                !r) {
+                fail(r.error());
+            }
+        });
+    } else {
+        meta_size.set_value(0);
     }
 
-    return {};
+    pull_result result;
+    std::thread image_thread;
+    if (what.squashfs) {
+        image_thread = std::thread([&]() {
+            if (what.seed) {
+                result.seeded_bytes = seed_image_blocks(
+                    client, repo, *manifest, *what.seed, destination);
+            }
+            if (auto r = pull_layers(client, repo, manifest->content,
+                                     destination, progress(image_bytes));
+                !r) {
+                fail(r.error());
+            }
+        });
+    }
+    auto join = [&]() {
+        for (auto* t : {&image_thread, &meta_thread}) {
+            if (t->joinable()) {
+                t->join();
+            }
+        }
+    };
+
+    if (what.squashfs && (!what.progress || what.progress_bar)) {
+        // the bar is shown once the size of the meta data is known, which
+        // is a few round trips after the image download has started
+        const auto total = uenv.size_byte + meta_size.get_future().get();
+        // force rounding up, so that total_mb is never zero
+        const std::size_t total_mb =
+            (total + (1024 * 1024 - 1)) / (1024 * 1024);
+        const unsigned interval_ms = 500;
+        spdlog::info("byte {} MB {}", total, total_mb);
+        auto bar = bk::ProgressBar(
+            &downloaded_mb,
+            {
+                .total = total_mb,
+                .message = fmt::format("pulling {}", uenv.id.string()),
+                .speed = 0.1,
+                .speed_unit = "MB/s",
+                .style = color::use_color() ? bk::ProgressBarStyle::Rich
+                                            : bk::ProgressBarStyle::Bars,
+                .interval = interval_ms / 1000.,
+                .no_tty = !isatty(fileno(stdout)),
+            });
+        join();
+        if (!failed) {
+            downloaded_mb = total_mb;
+        }
+    } else {
+        join();
+    }
+
+    if (util::signal_pending()) {
+        spdlog::error("signal raised - interrupting download");
+        throw util::signal_exception(util::last_signal_raised());
+    }
+    if (first_error) {
+        spdlog::error("unable to pull {}:{}: {}", repo, uenv.tag,
+                      first_error->stderr);
+        return util::unexpected{*first_error};
+    }
+
+    return result;
+}
+
+util::expected<pull_result, error>
+pull(const std::vector<std::string>& registries, const std::string& nspace,
+     const uenv_record& uenv, const std::filesystem::path& destination,
+     const pull_options& what, const opt_creds token) {
+    util::expected<pull_result, error> result =
+        util::unexpected{generic_error("no registry to pull from")};
+    for (std::size_t i = 0; i < registries.size(); ++i) {
+        result = pull(registries[i], nspace, uenv, destination, what, token);
+        if (result || !result.error().network) {
+            return result;
+        }
+        if (i + 1 < registries.size()) {
+            spdlog::warn("unable to pull {} from {}, trying {}",
+                         uenv.id.string(), registries[i], registries[i + 1]);
+        }
+    }
+    return result;
 }
 
 util::expected<void, error> pull_tag(const std::string& registry,
@@ -219,74 +541,323 @@ util::expected<void, error> pull_tag(const std::string& registry,
                                      const uenv_record& uenv,
                                      const std::filesystem::path& destination,
                                      const opt_creds token) {
-    using namespace std::chrono_literals;
+    auto r = pull(registry, nspace, uenv, destination,
+                  {.meta = false, .squashfs = true}, token);
+    if (!r) {
+        return util::unexpected{r.error()};
+    }
+    return {};
+}
+
+namespace {
+
+// the squashfs image is a single layer, titled with its file name.
+// The sha256 of the image is calculated unless it is provided.
+util::expected<oci::descriptor, error>
+squashfs_layer(const std::filesystem::path& source,
+               std::optional<std::string> digest = std::nullopt) {
     namespace fs = std::filesystem;
-    namespace bk = barkeep;
 
-    auto address =
-        fmt::format("{}/{}/{}/{}/{}/{}:{}", registry, nspace, uenv.system,
-                    uenv.uarch, uenv.name, uenv.version, uenv.tag);
+    if (!digest) {
+        auto hash = util::sha256_file(source);
+        if (!hash) {
+            return util::unexpected{generic_error(hash.error())};
+        }
+        digest = std::move(*hash);
+    }
+    return oci::descriptor{
+        .media_type = file_media_type,
+        .digest = "sha256:" + *digest,
+        .size = fs::file_size(source),
+        .annotations = {{title_annotation, source.filename().string()}}};
+}
+
+// the meta data directory packed as a tar.gz archive, annotated with the
+// digest of the uncompressed tar, in the same format as oras
+struct packed_meta {
+    std::filesystem::path archive;
+    oci::descriptor layer;
+};
+
+util::expected<packed_meta, error>
+pack_meta(const std::filesystem::path& meta_path) {
+    namespace fs = std::filesystem;
 
-    spdlog::debug("oras::pull_tag: {}", address);
-    std::vector<std::string> args{"pull",     "--concurrency",      "10",
-                                  "--output", destination.string(), address};
-    if (token) {
-        args.push_back("--password");
-        args.push_back(token->token);
-        args.push_back("--username");
-        args.push_back(token->username);
+    if (!fs::exists(meta_path) || !fs::is_directory(meta_path)) {
+        spdlog::error(
+            "metadata directory {} does not exist or is not a directory",
+            meta_path.string());
+        return util::unexpected{error(
+            1, "metadata directory not found",
+            fmt::format(
+                "metadata directory {} does not exist or is not a directory",
+                meta_path.string()))};
     }
-    auto proc = run_oras_async(args);
 
-    if (!proc) {
-        spdlog::error("unable to pull tag with oras: {}", proc.error());
-        return util::unexpected{generic_error(proc.error())};
+    const auto name = meta_path.filename().string();
+    const auto tar = util::make_temp_dir() / "meta.tar";
+    if (auto r = run({"tar", "-cf", tar.string(), "-C",
+                      meta_path.parent_path().string(), name});
+        !r) {
+        return util::unexpected{r.error()};
+    }
+    auto tar_digest = util::sha256_file(tar);
+    if (!tar_digest) {
+        return util::unexpected{generic_error(tar_digest.error())};
+    }
+    if (auto r = run({"gzip", "-n", tar.string()}); !r) {
+        return util::unexpected{r.error()};
+    }
+    const auto archive = fs::path(tar.string() + ".gz");
+    auto digest = util::sha256_file(archive);
+    if (!digest) {
+        return util::unexpected{generic_error(digest.error())};
+    }
+    return packed_meta{
+        archive,
+        {.media_type = directory_media_type,
+         .digest = "sha256:" + *digest,
+         .size = fs::file_size(archive),
+         .annotations = {{title_annotation, name},
+                         {content_digest_annotation, "sha256:" + *tar_digest},
+                         {unpack_annotation, "true"}}}};
+}
+
+// the block index of the squashfs image, see uenv/delta.h
+struct packed_blocks {
+    std::string raw;
+    oci::descriptor layer;
+};
+
+util::expected<packed_blocks, error>
+pack_blocks(const std::filesystem::path& source) {
+    auto index = make_block_index(source);
+    if (!index) {
+        return util::unexpected{generic_error(index.error())};
+    }
+    auto raw = serialize(*index);
+    oci::descriptor layer{.media_type = blocks_media_type,
+                          .digest = oci::digest_of(raw),
+                          .size = raw.size()};
+    spdlog::debug("oras: block index with {} blocks of {} bytes",
+                  index->blocks(), index->block_size);
+    return packed_blocks{std::move(raw), std::move(layer)};
+}
+
+// write the manifest of the squashfs image with tag
+util::expected<void, error> put_image(oci::client& client,
+                                      const std::string& repo,
+                                      const std::string& tag,
+                                      const oci::descriptor& layer) {
+    const oci::manifest manifest{
+        .artifact_type = "application/x-squashfs",
+        .config = oci::empty_config(),
+        .layers = {layer},
+        .annotations = {{created_annotation, now_rfc3339()}}};
+    if (auto r = client.put_manifest(repo, tag, oci::to_json(manifest)); !r) {
+        return util::unexpected{create_error(r.error())};
+    }
+    return {};
+}
+
+// attach an artifact with one layer to the manifest subject
+util::expected<void, error> put_referrer(oci::client& client,
+                                         const std::string& repo,
+                                         const oci::descriptor& subject,
+                                         const std::string& artifact_type,
+                                         const oci::descriptor& layer) {
+    const oci::manifest manifest{
+        .artifact_type = artifact_type,
+        .config = oci::empty_config(),
+        .layers = {layer},
+        .subject = subject,
+        .annotations = {{created_annotation, now_rfc3339()}}};
+    const auto raw = oci::to_json(manifest);
+    if (auto r = client.put_manifest(repo, oci::digest_of(raw), raw); !r) {
+        return util::unexpected{create_error(r.error())};
+    }
+    return {};
+}
+
+// upload the empty config and a layer
+util::expected<void, error> put_layer(oci::client& client,
+                                      const std::string& repo,
+                                      const oci::descriptor& layer,
+                                      const std::filesystem::path& source,
+                                      const oci::progress_type& progress = {}) {
+    auto r = client.put_blob(repo, oci::empty_config(), std::string{"{}"});
+    if (r) {
+        r = client.put_blob(repo, layer, source, progress);
     }
+    if (!r) {
+        return util::unexpected{create_error(r.error())};
+    }
+    return {};
+}
+
+} // namespace
+
+util::expected<push_result, error> push(const std::string& registry,
+                                        const std::string& nspace,
+                                        const uenv_label& label,
+                                        const std::filesystem::path& squashfs,
+                                        const push_options& what,
+                                        const opt_creds token) {
+    namespace bk = barkeep;
 
-    const fs::path& sqfs = destination / "store.squashfs";
+    const auto repo = label_repository(nspace, label);
+    spdlog::debug("oras::push: {}:{} (meta {}, blocks {})", repo, *label.tag,
+                  what.meta.value_or("").string(), what.blocks);
 
-    std::size_t downloaded_mb{0u};
-    // force rounding up, so that total_mb is never zero
-    std::size_t total_mb{(uenv.size_byte + (1024 * 1024 - 1)) / (1024 * 1024)};
-    const unsigned interval_ms = 500;
-    spdlog::info("byte {} MB {}", uenv.size_byte, total_mb);
+    // the uploads are cancelled when a signal is raised, or when the upload
+    // of the squashfs image fails
+    util::set_signal_catcher();
+    std::atomic<bool> failed{false};
+    // the bar shows the progress of the squashfs image, which is most of the
+    // data that is uploaded
+    std::atomic<std::size_t> uploaded_mb{0};
+    auto image_progress = [&](std::uint64_t n) {
+        uploaded_mb = n / (1024 * 1024);
+        return !failed && !util::signal_pending();
+    };
+    auto meta_progress = [&](std::uint64_t) {
+        return !failed && !util::signal_pending();
+    };
+
+    std::error_code ec;
+    const auto total = std::filesystem::file_size(squashfs, ec);
+    if (ec) {
+        return util::unexpected{generic_error(
+            fmt::format("unable to read {}: {}", squashfs.string(),
+                        ec.message()))};
+    }
     auto bar = bk::ProgressBar(
-        &downloaded_mb,
+        &uploaded_mb,
         {
-            .total = total_mb,
-            .message = fmt::format("pulling {}", uenv.id.string()),
+            .total = (total + (1024 * 1024 - 1)) / (1024 * 1024),
+            .message = fmt::format("pushing {}", squashfs.filename().string()),
             .speed = 0.1,
             .speed_unit = "MB/s",
             .style = color::use_color() ? bk::ProgressBarStyle::Rich
                                         : bk::ProgressBarStyle::Bars,
-            .interval = interval_ms / 1000.,
+            .interval = 0.5,
             .no_tty = !isatty(fileno(stdout)),
         });
 
-    util::set_signal_catcher();
-    while (!proc->finished()) {
-        std::this_thread::sleep_for(1ms * interval_ms);
-        // handle a signal, usually SIGTERM or SIGINT
-        if (util::signal_raised()) {
-            spdlog::error("signal raised - interrupting download");
-            proc->kill();
-            throw util::signal_exception(util::last_signal_raised());
+    // the blobs of the image, meta data and block index are prepared and
+    // uploaded concurrently, each with its own connection to the registry
+    std::optional<error> image_error;
+    std::optional<oci::descriptor> image_layer;
+    std::thread image_thread([&]() {
+        oci::client client(registry, token);
+        auto layer = squashfs_layer(squashfs, what.digest);
+        if (!layer) {
+            image_error = layer.error();
+        } else if (auto r = put_layer(client, repo, *layer, squashfs,
+                                      image_progress);
+                   !r) {
+            image_error = r.error();
+        } else {
+            image_layer = *layer;
         }
-        if (fs::is_regular_file(sqfs)) {
-            auto downloaded_bytes = fs::file_size(sqfs);
-            downloaded_mb = downloaded_bytes / (1024 * 1024);
+        if (image_error) {
+            failed = true;
         }
+    });
+
+    std::optional<oci::descriptor> meta_layer;
+    std::thread meta_thread;
+    if (what.meta) {
+        meta_thread = std::thread([&]() {
+            oci::client client(registry, token);
+            auto meta = pack_meta(*what.meta);
+            if (!meta) {
+                spdlog::warn("unable to pack metadata: {}",
+                             meta.error().message);
+                return;
+            }
+            auto r = put_layer(client, repo, meta->layer, meta->archive,
+                               meta_progress);
+            std::filesystem::remove(meta->archive, ec);
+            if (!r) {
+                spdlog::warn("unable to push metadata: {}", r.error().message);
+                return;
+            }
+            meta_layer = meta->layer;
+        });
+    }
+
+    std::optional<oci::descriptor> blocks_layer;
+    std::thread blocks_thread;
+    if (what.blocks) {
+        blocks_thread = std::thread([&]() {
+            oci::client client(registry, token);
+            auto blocks = pack_blocks(squashfs);
+            if (!blocks) {
+                spdlog::warn("unable to index {}: {}", squashfs.string(),
+                             blocks.error().message);
+                return;
+            }
+            auto r = client.put_blob(repo, oci::empty_config(),
+                                     std::string{"{}"});
+            if (r) {
+                r = client.put_blob(repo, blocks->layer, blocks->raw);
+            }
+            if (!r) {
+                spdlog::warn("unable to push block index: {}",
+                             r.error().message);
+                return;
+            }
+            blocks_layer = blocks->layer;
+        });
     }
-    downloaded_mb = total_mb;
 
-    if (proc->rvalue()) {
-        spdlog::error("unable to pull tag with oras: {}", proc->err.string());
-        return util::unexpected{create_error({.returncode = proc->rvalue(),
-                                              .stdout = proc->out.string(),
-                                              .stderr = proc->err.string()})};
+    for (auto* t : {&image_thread, &meta_thread, &blocks_thread}) {
+        if (t->joinable()) {
+            t->join();
+        }
+    }
+    if (util::signal_pending()) {
+        spdlog::error("signal raised - interrupting upload");
+        throw util::signal_exception(util::last_signal_raised());
+    }
+    if (image_error) {
+        return util::unexpected{*image_error};
+    }
+    uploaded_mb = (total + (1024 * 1024 - 1)) / (1024 * 1024);
+    bar->done();
+
+    // the manifests are written once all of their blobs are in the registry:
+    // the artifacts are attached to the image manifest
+    oci::client client(registry, token);
+    if (auto r = put_image(client, repo, *label.tag, *image_layer); !r) {
+        return util::unexpected{r.error()};
+    }
+    auto subject = client.get_manifest(repo, *label.tag);
+    if (!subject) {
+        return util::unexpected{create_error(subject.error())};
+    }
+    push_result result;
+    if (meta_layer) {
+        if (auto r = put_referrer(client, repo, subject->desc, "uenv/meta",
+                                  *meta_layer);
+            !r) {
+            spdlog::warn("unable to push metadata: {}", r.error().message);
+        } else {
+            result.meta = true;
+        }
+    }
+    if (blocks_layer) {
+        if (auto r = put_referrer(client, repo, subject->desc,
+                                  blocks_artifact_type, *blocks_layer);
+            !r) {
+            spdlog::warn("unable to push block index: {}", r.error().message);
+        } else {
+            result.blocks = true;
+        }
     }
 
-    return {};
+    return result;
 }
 
 util::expected<void, error> push_tag(const std::string& registry,
@@ -294,79 +865,43 @@ util::expected<void, error> push_tag(const std::string& registry,
                                      const uenv_label& label,
                                      const std::filesystem::path& source,
                                      const std::optional<credentials> token) {
-    using namespace std::chrono_literals;
-    namespace fs = std::filesystem;
     namespace bk = barkeep;
 
-    // Format the registry address with the appropriate path structure
-    auto address =
-        fmt::format("{}/{}/{}/{}/{}/{}:{}", registry, nspace, *label.system,
-                    *label.uarch, *label.name, *label.version, *label.tag);
-
-    spdlog::debug("oras::push_tag: {}", address);
-
-    // Prepare the arguments for the push command
-    std::vector<std::string> args{"push", "--concurrency", "10"};
-
-    if (token) {
-        args.push_back("--password");
-        args.push_back(token->token);
-        args.push_back("--username");
-        args.push_back(token->username);
-    }
-
-    // Add artifact type and annotations
-    args.push_back("--artifact-type");
-    args.push_back("application/x-squashfs");
-
-    // Add the destination address
-    args.push_back(address);
-    // Add the file to push - note that we strip the absolute and relative path
-    args.push_back("./" + source.filename().string());
-
-    // Run the oras command asynchronously
-    // Note: oras must be called in the path of the file
-    auto proc = run_oras_async(args, source.parent_path());
-
-    if (!proc) {
-        spdlog::error("unable to push tag with oras: {}", proc.error());
-        return util::unexpected{generic_error(proc.error())};
-    }
+    const auto repo = label_repository(nspace, label);
+    spdlog::debug("oras::push_tag: {}:{}", repo, *label.tag);
 
     // Create a spinner to show upload progress
     auto spinner = bk::Animation({
         .message = fmt::format("pushing {} to registry",
-                               fs::path(source).filename().string()),
+                               source.filename().string()),
         .style = bk::Ellipsis,
         .no_tty = !isatty(fileno(stdout)),
     });
 
+    auto layer = squashfs_layer(source);
+    if (!layer) {
+        return util::unexpected{layer.error()};
+    }
+
     // Handle signals during upload (e.g., Ctrl+C)
     util::set_signal_catcher();
+    auto progress = [](std::uint64_t) { return !util::signal_pending(); };
 
-    // Loop until the upload process completes
-    while (!proc->finished()) {
-        std::this_thread::sleep_for(100ms);
-
-        // Handle interruption signals
-        if (util::signal_raised()) {
-            spdlog::error("signal raised - interrupting upload");
-            proc->kill();
-            throw util::signal_exception(util::last_signal_raised());
-        }
+    oci::client client(registry, token);
+    auto result = put_layer(client, repo, *layer, source, progress);
+    if (util::signal_pending()) {
+        spdlog::error("signal raised - interrupting upload");
+        throw util::signal_exception(util::last_signal_raised());
+    }
+    if (!result) {
+        return result;
+    }
+    if (auto r = put_image(client, repo, *label.tag, *layer); !r) {
+        return r;
     }
 
     spinner->done();
 
-    // Check if the upload was successful
-    auto err = create_error({.returncode = proc->rvalue(),
-                             .stdout = proc->out.string(),
-                             .stderr = proc->err.string()});
-    if (err.returncode) {
-        spdlog::error("unable to push tag with oras: {}", proc->err.string());
-        return util::unexpected{err};
-    }
-
     return {};
 }
 
@@ -375,56 +910,15 @@ util::expected<void, error> push_meta(const std::string& registry,
                                       const uenv_label& label,
                                       const std::filesystem::path& meta_path,
                                       const std::optional<credentials> token) {
-    using namespace std::chrono_literals;
-    namespace fs = std::filesystem;
     namespace bk = barkeep;
 
-    // Check if the meta path exists and is a directory
-    if (!fs::exists(meta_path) || !fs::is_directory(meta_path)) {
-        spdlog::error(
-            "metadata directory {} does not exist or is not a directory",
-            meta_path.string());
-        return util::unexpected{error(
-            1, "metadata directory not found",
-            fmt::format(
-                "metadata directory {} does not exist or is not a directory",
-                meta_path.string()))};
-    }
-
-    // Format the registry address with the appropriate path structure
-    auto address =
-        fmt::format("{}/{}/{}/{}/{}/{}:{}", registry, nspace, *label.system,
-                    *label.uarch, *label.name, *label.version, *label.tag);
-
-    spdlog::debug("oras::push_meta: {}", address);
-
-    // Prepare the arguments for the attach command
-    std::vector<std::string> args{"attach"};
-
-    if (token) {
-        args.push_back("--password");
-        args.push_back(token->token);
-        args.push_back("--username");
-        args.push_back(token->username);
+    auto meta = pack_meta(meta_path);
+    if (!meta) {
+        return util::unexpected{meta.error()};
     }
 
-    // Add artifact type and annotations for metadata
-    args.push_back("--artifact-type");
-    args.push_back("uenv/meta");
-
-    // Add destination address
-    args.push_back(address);
-    // Add the meta data path - strip relative/absolute path from the path
-    args.push_back("./" + meta_path.filename().string());
-
-    // Run the oras command asynchronously
-    // Note: oras must be called in the path of the file
-    auto proc = run_oras_async(args, meta_path.parent_path());
-
-    if (!proc) {
-        spdlog::error("unable to push metadata with oras: {}", proc.error());
-        return util::unexpected{generic_error(proc.error())};
-    }
+    const auto repo = label_repository(nspace, label);
+    spdlog::debug("oras::push_meta: {}:{}", repo, *label.tag);
 
     // Create a spinner to show upload progress
     auto spinner = bk::Animation({
@@ -433,64 +927,171 @@ util::expected<void, error> push_meta(const std::string& registry,
         .no_tty = !isatty(fileno(stdout)),
     });
 
-    // Handle signals during upload (e.g., Ctrl+C)
-    util::set_signal_catcher();
+    // the meta data is attached to the squashfs image
+    oci::client client(registry, token);
+    auto subject = client.get_manifest(repo, *label.tag);
+    if (!subject) {
+        return util::unexpected{create_error(subject.error())};
+    }
+    if (auto r = put_layer(client, repo, meta->layer, meta->archive); !r) {
+        return r;
+    }
+    if (auto r = put_referrer(client, repo, subject->desc, "uenv/meta",
+                              meta->layer);
+        !r) {
+        return r;
+    }
 
-    // Loop until the upload process completes
-    while (!proc->finished()) {
-        std::this_thread::sleep_for(100ms);
+    spinner->done();
 
-        // Handle interruption signals
-        if (util::signal_raised()) {
-            spdlog::error("signal raised - interrupting metadata upload");
-            proc->kill();
-            throw util::signal_exception(util::last_signal_raised());
-        }
+    return {};
+}
+
+util::expected<void, error> push_blocks(const std::string& registry,
+                                        const std::string& nspace,
+                                        const uenv_label& label,
+                                        const std::filesystem::path& source,
+                                        const std::optional<credentials> token) {
+    const auto repo = label_repository(nspace, label);
+    spdlog::debug("oras::push_blocks: {}:{}", repo, *label.tag);
+
+    auto blocks = pack_blocks(source);
+    if (!blocks) {
+        return util::unexpected{blocks.error()};
     }
 
-    spinner->done();
+    // the block index is attached to the squashfs image
+    oci::client client(registry, token);
+    auto subject = client.get_manifest(repo, *label.tag);
+    if (!subject) {
+        return util::unexpected{create_error(subject.error())};
+    }
+    auto result = client.put_blob(repo, oci::empty_config(), std::string{"{}"});
+    if (result) {
+        result = client.put_blob(repo, blocks->layer, blocks->raw);
+    }
+    if (!result) {
+        return util::unexpected{create_error(result.error())};
+    }
+    return put_referrer(client, repo, subject->desc, blocks_artifact_type,
+                        blocks->layer);
+}
 
-    // Check if the upload was successful
-    auto err = create_error({.returncode = proc->rvalue(),
-                             .stdout = proc->out.string(),
-                             .stderr = proc->err.string()});
-    if (err.returncode) {
-        spdlog::error("unable to metadata with oras: {}", proc->err.string());
-        return util::unexpected{err};
+namespace {
+
+// the manifests of a uenv in the registry: the image and the artifacts that
+// are attached to it, i.e. the meta data and block index
+struct copy_source {
+    oci::stored_manifest image;
+    std::vector<oci::stored_manifest> referrers;
+};
+
+util::expected<copy_source, error> resolve_copy_source(oci::client& client,
+                                                       const std::string& repo,
+                                                       const std::string& tag) {
+    auto manifest = client.get_manifest(repo, tag);
+    if (!manifest) {
+        return util::unexpected{create_error(manifest.error())};
+    }
+    copy_source source{*manifest, {}};
+    auto referrers = client.referrers(repo, manifest->desc.digest);
+    if (!referrers) {
+        return util::unexpected{create_error(referrers.error())};
     }
+    for (auto& referrer : *referrers) {
+        auto m = client.get_manifest(repo, referrer.digest);
+        if (!m) {
+            return util::unexpected{create_error(m.error())};
+        }
+        source.referrers.push_back(std::move(*m));
+    }
+    return source;
+}
 
+// copy the blobs of a manifest, then the manifest
+util::expected<void, error> copy_manifest(oci::client& client,
+                                          const std::string& src_repo,
+                                          const std::string& dst_repo,
+                                          const oci::stored_manifest& m,
+                                          const std::string& reference) {
+    if (m.desc.media_type == oci::index_media_type) {
+        return util::unexpected{generic_error(
+            fmt::format("unable to copy index {}", m.desc.digest))};
+    }
+    auto blobs = m.content.layers;
+    blobs.push_back(m.content.config);
+    for (auto& blob : blobs) {
+        if (auto r = client.copy_blob(src_repo, dst_repo, blob); !r) {
+            return util::unexpected{create_error(r.error())};
+        }
+    }
+    if (auto r =
+            client.put_manifest(dst_repo, reference, m.raw, m.desc.media_type);
+        !r) {
+        return util::unexpected{create_error(r.error())};
+    }
     return {};
 }
 
-util::expected<void, error>
+} // namespace
+
+std::vector<util::expected<void, error>>
 copy(const std::string& registry, const std::string& src_nspace,
-     const uenv_record& src_uenv, const std::string& dst_nspace,
-     const uenv_record& dst_uenv, const std::optional<credentials> token) {
+     const uenv_record& src_uenv, const std::vector<copy_target>& targets,
+     unsigned jobs, const std::optional<credentials> token) {
+    const auto src_repo = repository(src_nspace, src_uenv);
+    spdlog::debug("oras::copy: {}:{} to {} destinations", src_repo,
+                  src_uenv.tag, targets.size());
+
+    // the source is resolved once for all of the destinations
+    oci::client client(registry, token);
+    const auto source = resolve_copy_source(client, src_repo, src_uenv.tag);
+    if (!source) {
+        return std::vector<util::expected<void, error>>(
+            targets.size(), util::unexpected{source.error()});
+    }
 
-    auto address = [&registry](auto& nspace, auto& record) -> std::string {
-        return fmt::format("{}/{}/{}/{}/{}/{}:{}", registry, nspace,
-                           record.system, record.uarch, record.name,
-                           record.version, record.tag);
+    std::vector<util::expected<void, error>> results(targets.size());
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        oci::client client(registry, token);
+        for (auto i = next++; i < targets.size(); i = next++) {
+            const auto& target = targets[i];
+            const auto dst_repo = repository(target.nspace, target.uenv);
+            spdlog::debug("oras::copy: {}:{} to {}:{}", src_repo, src_uenv.tag,
+                          dst_repo, target.uenv.tag);
+            auto r = copy_manifest(client, src_repo, dst_repo, source->image,
+                                   target.uenv.tag);
+            // the artifacts are attached to the image by their subject, and
+            // are written after it
+            for (auto& m : source->referrers) {
+                if (!r) {
+                    break;
+                }
+                r = copy_manifest(client, src_repo, dst_repo, m, m.desc.digest);
+            }
+            results[i] = std::move(r);
+        }
     };
-    const auto src_url = address(src_nspace, src_uenv);
-    const auto dst_url = address(dst_nspace, dst_uenv);
-
-    std::vector<std::string> args = {"cp",          "--concurrency", "10",
-                                     "--recursive", src_url,         dst_url};
-    if (token) {
-        args.push_back(fmt::format("--from-password={}", token->token));
-        args.push_back(fmt::format("--from-username={}", token->username));
-        args.push_back(fmt::format("--to-password={}", token->token));
-        args.push_back(fmt::format("--to-username={}", token->username));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<std::size_t>(jobs, targets.size());
+         ++i) {
+        workers.emplace_back(worker);
     }
-    auto result = run_oras(args);
-
-    if (result.returncode) {
-        spdlog::error("oras cp {}: {}", result.returncode, result.stderr);
-        return util::unexpected{create_error(result)};
+    worker();
+    for (auto& w : workers) {
+        w.join();
     }
 
-    return {};
+    return results;
+}
+
+util::expected<void, error>
+copy(const std::string& registry, const std::string& src_nspace,
+     const uenv_record& src_uenv, const std::string& dst_nspace,
+     const uenv_record& dst_uenv, const std::optional<credentials> token) {
+    const std::vector<copy_target> targets{{dst_nspace, dst_uenv}};
+    return copy(registry, src_nspace, src_uenv, targets, 1, token).front();
 }
 
 } // namespace oras
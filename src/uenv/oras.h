@@ -1,19 +1,26 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include <uenv/oci.h>
 #include <uenv/uenv.h>
 #include <util/expected.h>
 
+// Operations on uenv images in an OCI registry, which were originally
+// implemented by calling the oras CLI tool, and are now implemented using the
+// native client in uenv/oci.h.
+// The images are stored in the repository
+//      <registry>/<nspace>/<system>/<uarch>/<name>/<version>:<tag>
+// with the meta data directory attached as an artifact of type uenv/meta.
+
 namespace uenv {
 namespace oras {
 
-struct credentials {
-    std::string username;
-    std::string token;
-};
+using credentials = oci::credentials;
 
 struct error {
     error(std::string_view msg) : message(msg) {
@@ -26,13 +33,56 @@ struct error {
     int returncode = 0;
     std::string stderr = {};
     std::string message = {};
+    // the registry could not be reached, or the connection to it failed
+    bool network = false;
 
     operator bool() const {
         return returncode == 0;
     };
 };
 
-bool pull(std::string rego, std::string nspace);
+// the parts of a uenv to download in pull()
+struct pull_options {
+    bool meta = true;
+    bool squashfs = true;
+    // if set, called with the number of bytes downloaded so far instead of
+    // showing a progress bar. The downloads are cancelled if it returns false.
+    oci::progress_type progress = {};
+    // show the progress bar even if progress is set, e.g. when progress is
+    // used to publish the progress to other processes
+    bool progress_bar = false;
+    // an older version of the squashfs image: if the image has a block
+    // index, the blocks that are in the older version are copied from it,
+    // and only the rest of the image is downloaded (see uenv/delta.h)
+    std::optional<std::filesystem::path> seed = std::nullopt;
+};
+
+struct pull_result {
+    // the bytes of the squashfs image that were copied from the seed
+    std::uint64_t seeded_bytes = 0;
+};
+
+// Download the meta data directory and/or the squashfs image of a uenv to
+// destination. The meta data is discovered and downloaded concurrently with
+// the squashfs image, and the progress of both is shown in one bar.
+// If either download fails, the other is cancelled. If a signal is raised,
+// both downloads are cancelled and util::signal_exception is thrown: the
+// caller installs the signal catcher with util::set_signal_catcher().
+util::expected<pull_result, error>
+pull(const std::string& registry, const std::string& nspace,
+     const uenv_record& uenv, const std::filesystem::path& destination,
+     const pull_options& what,
+     const std::optional<credentials> token = std::nullopt);
+
+// Pull from the first of a list of registries that serve the same images, e.g.
+// a registry and its mirrors ordered by preference. If a registry can't be
+// reached, or the connection fails during the pull, the pull fails over to
+// the next registry, which resumes the partial downloads.
+util::expected<pull_result, error>
+pull(const std::vector<std::string>& registries, const std::string& nspace,
+     const uenv_record& uenv, const std::filesystem::path& destination,
+     const pull_options& what,
+     const std::optional<credentials> token = std::nullopt);
 
 util::expected<std::vector<std::string>, error>
 discover(const std::string& registry, const std::string& nspace,
@@ -50,6 +100,38 @@ pull_tag(const std::string& registry, const std::string& nspace,
          const uenv_record& uenv, const std::filesystem::path& destination,
          const std::optional<credentials> token = std::nullopt);
 
+// the artifacts that are attached to the squashfs image in push()
+struct push_options {
+    // the meta data directory of the uenv
+    std::optional<std::filesystem::path> meta = std::nullopt;
+    // the block index of the squashfs image (see uenv/delta.h)
+    bool blocks = true;
+    // the sha256 of the squashfs image, if it is already known, which
+    // avoids reading the image to calculate it again
+    std::optional<std::string> digest = std::nullopt;
+};
+
+// the artifacts that were attached to the squashfs image
+struct push_result {
+    bool meta = false;
+    bool blocks = false;
+};
+
+// Push the squashfs image of a uenv with its artifacts. The blobs of the
+// image, meta data and block index are uploaded concurrently, and the
+// manifests are written once all of the blobs have been uploaded. Blobs that
+// are already in the registry are not uploaded, and large blobs are uploaded
+// in chunks that are resumed if the push is interrupted (see
+// oci::upload_config).
+// Failure to push the meta data or block index is reported as a warning, and
+// in the result. If a signal is raised, the uploads are cancelled and
+// util::signal_exception is thrown.
+util::expected<push_result, error>
+push(const std::string& registry, const std::string& nspace,
+     const uenv_label& label, const std::filesystem::path& squashfs,
+     const push_options& what,
+     const std::optional<credentials> token = std::nullopt);
+
 util::expected<void, error>
 push_tag(const std::string& registry, const std::string& nspace,
          const uenv_label& label, const std::filesystem::path& source,
@@ -60,6 +142,29 @@ push_meta(const std::string& registry, const std::string& nspace,
           const uenv_label& label, const std::filesystem::path& meta_path,
           const std::optional<credentials> token = std::nullopt);
 
+// attach the block index of the squashfs image source to the image, with
+// which clients that have an older version of the image can download only
+// the parts that have changed.
+util::expected<void, error>
+push_blocks(const std::string& registry, const std::string& nspace,
+            const uenv_label& label, const std::filesystem::path& source,
+            const std::optional<credentials> token = std::nullopt);
+
+// a destination of copy()
+struct copy_target {
+    std::string nspace;
+    uenv_record uenv;
+};
+
+// Copy a uenv to several destinations in the registry. The source is resolved
+// once, and up to jobs destinations are written at a time.
+// Returns the result of the copy to each destination, in the same order as
+// targets.
+std::vector<util::expected<void, error>>
+copy(const std::string& registry, const std::string& src_nspace,
+     const uenv_record& src_uenv, const std::vector<copy_target>& targets,
+     unsigned jobs = 4, const std::optional<credentials> token = std::nullopt);
+
 util::expected<void, error>
 copy(const std::string& registry, const std::string& src_nspace,
      const uenv_record& src_uenv, const std::string& dst_nspace,
@@ -92,24 +92,46 @@ std::string format_record_set_list(const record_set& records) {
     return result;
 }
 
+namespace impl {
+
+std::string format_record(const uenv_record& r, std::string_view fmtstring) {
+    // clang-format off
+    return fmt::format(
+        fmt::runtime(fmtstring),
+        fmt::arg("name",    r.name),
+        fmt::arg("version", r.version),
+        fmt::arg("tag",     r.tag),
+        fmt::arg("system",  r.system),
+        fmt::arg("uarch",   r.uarch),
+        fmt::arg("id",      r.id),
+        fmt::arg("digest",  r.sha),
+        fmt::arg("size",    r.size_byte),
+        fmt::arg("date",    r.date)
+    );
+    // clang-format on
+}
+
+nlohmann::json record_json(const uenv_record& r) {
+    return {
+        {"name", r.name},
+        {"version", r.version},
+        {"tag", r.tag},
+        {"system", r.system},
+        {"uarch", r.uarch},
+        {"id", r.id.string()},
+        {"digest", r.sha.string()},
+        {"size", r.size_byte},
+        {"date", fmt::format("{}", r.date)},
+    };
+}
+
+} // namespace impl
+
 std::string format_record_set_format(const record_set& records,
                                      std::string_view fmtstring) {
     std::string result;
     for (auto& r : records) {
-        // clang-format off
-        result += fmt::format(
-            fmt::runtime(fmtstring),
-            fmt::arg("name",    r.name),
-            fmt::arg("version", r.version),
-            fmt::arg("tag",     r.tag),
-            fmt::arg("system",  r.system),
-            fmt::arg("uarch",   r.uarch),
-            fmt::arg("id",      r.id),
-            fmt::arg("digest",  r.sha),
-            fmt::arg("size",    r.size_byte),
-            fmt::arg("date",    r.date)
-        );
-        // clang-format on
+        result += impl::format_record(r, fmtstring);
         result += "\n";
     }
 
@@ -120,17 +142,7 @@ std::string format_record_set_json(const record_set& records) {
     using nlohmann::json;
     std::vector<json> jrecords;
     for (auto& r : records) {
-        jrecords.push_back(json{
-            {"name", r.name},
-            {"version", r.version},
-            {"tag", r.tag},
-            {"system", r.system},
-            {"uarch", r.uarch},
-            {"id", r.id.string()},
-            {"digest", r.sha.string()},
-            {"size", r.size_byte},
-            {"date", fmt::format("{}", r.date)},
-        });
+        jrecords.push_back(impl::record_json(r));
     }
     return json{{"records", jrecords}}.dump();
 }
@@ -153,4 +165,40 @@ void print_record_set(const record_set& records, record_set_format f,
     }
 }
 
+util::expected<void, std::string> print_record_set(record_cursor& records,
+                                                   record_set_format f,
+                                                   std::string_view fmtstring) {
+    switch (f) {
+    case record_set_format::json: {
+        // the same output as format_record_set_json
+        fmt::print("{{\"records\":[");
+        bool first = true;
+        for (auto& r : records) {
+            fmt::print("{}{}", first ? "" : ",", impl::record_json(r).dump());
+            first = false;
+        }
+        fmt::print("]}}");
+        break;
+    }
+    case record_set_format::list:
+        for (auto& r : records) {
+            fmt::print("{}\n", impl::format_record(r, fmtstring));
+        }
+        break;
+    case record_set_format::table:
+    case record_set_format::table_no_header:
+        if (auto all = records.collect()) {
+            print_record_set(*all, f, fmtstring);
+        } else {
+            return util::unexpected(all.error());
+        }
+        break;
+    }
+
+    if (auto e = records.error()) {
+        return util::unexpected(*e);
+    }
+    return {};
+}
+
 } // namespace uenv
@@ -13,6 +13,13 @@ void print_record_set(
     const record_set& result, record_set_format format,
     std::string_view fmtstring = "{name}/{version}:{tag}@{system}%{uarch}");
 
+// print records as they are read from a cursor.
+// The table formats have to read all of the records before printing, to
+// determine the column widths.
+util::expected<void, std::string> print_record_set(
+    record_cursor& records, record_set_format format,
+    std::string_view fmtstring = "{name}/{version}:{tag}@{system}%{uarch}");
+
 std::string format_record_set_table(const record_set& records,
                                     bool no_header = true);
 std::string format_record_set_json(const record_set& records);
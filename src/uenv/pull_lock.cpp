@@ -0,0 +1,304 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#include <fmt/core.h>
+#include <fmt/std.h>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <uenv/pull_lock.h>
+#include <util/defer.h>
+#include <util/expected.h>
+#include <util/fs.h>
+#include <util/signal.h>
+
+namespace uenv {
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+namespace {
+
+// the time to wait for an inotify event before checking the lock again:
+// changes made on other hosts of a network file system are not notified
+constexpr int recheck_ms = 2000;
+
+std::string hostname() {
+    char name[HOST_NAME_MAX + 1] = {};
+    gethostname(name, sizeof(name) - 1);
+    return name;
+}
+
+std::int64_t unix_time() {
+    using namespace std::chrono;
+    return duration_cast<seconds>(system_clock::now().time_since_epoch())
+        .count();
+}
+
+bool process_exists(long pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+constexpr const char* state_name(pull_state s) {
+    switch (s) {
+    case pull_state::pulling:
+        return "pulling";
+    case pull_state::done:
+        return "done";
+    case pull_state::failed:
+        return "failed";
+    }
+    return "failed";
+}
+
+// the reason that the holder of a status is stale, if it is
+std::optional<std::string> stale_reason(const pull_status& status,
+                                        std::chrono::seconds stale_after) {
+    if (status.state != pull_state::pulling) {
+        return std::nullopt;
+    }
+    if (status.host == hostname()) {
+        if (!process_exists(status.pid)) {
+            return "is not running";
+        }
+        return std::nullopt;
+    }
+    const auto age = unix_time() - status.updated;
+    if (age > stale_after.count()) {
+        return fmt::format("has not updated its status for {} seconds", age);
+    }
+    return std::nullopt;
+}
+
+bool operator==(const pull_status& l, const pull_status& r) {
+    return l.host == r.host && l.pid == r.pid && l.state == r.state &&
+           l.bytes == r.bytes && l.updated == r.updated;
+}
+
+} // namespace
+
+util::expected<pull_status, std::string>
+read_pull_status(const fs::path& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return util::unexpected(fmt::format("unable to read {}", path));
+    }
+    try {
+        const auto j = json::parse(in);
+        pull_status status{.host = j.at("host"),
+                           .pid = j.at("pid"),
+                           .bytes = j.at("bytes"),
+                           .total = j.at("total"),
+                           .updated = j.at("updated")};
+        const std::string state = j.at("state");
+        status.state = state == "pulling" ? pull_state::pulling
+                       : state == "done"  ? pull_state::done
+                                          : pull_state::failed;
+        return status;
+    } catch (std::exception& e) {
+        return util::unexpected(
+            fmt::format("invalid pull status {}: {}", path, e.what()));
+    }
+}
+
+util::expected<void, std::string> write_pull_status(const fs::path& path,
+                                                    const pull_status& status) {
+    const json j{{"host", status.host},       {"pid", status.pid},
+                 {"state", state_name(status.state)},
+                 {"bytes", status.bytes},     {"total", status.total},
+                 {"updated", status.updated}};
+    // the status is replaced atomically, which is notified to waiters as
+    // IN_MOVED_TO
+    auto tmp = path;
+    tmp += fmt::format(".{}", getpid());
+    std::ofstream(tmp) << j.dump();
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return util::unexpected(
+            fmt::format("unable to write {}: {}", path, ec.message()));
+    }
+    return {};
+}
+
+std::string holder_string(const pull_status& status) {
+    return fmt::format("pid {} on {}", status.pid, status.host);
+}
+
+pull_lock::pull_lock(util::file_lock lock, fs::path status_path,
+                     pull_status status)
+    : lock_(std::move(lock)), status_path_(std::move(status_path)),
+      status_(std::move(status)), last_update_(std::chrono::steady_clock::now()) {
+}
+
+pull_lock::pull_lock(pull_lock&& other) noexcept
+    : lock_(std::move(other.lock_)),
+      status_path_(std::move(other.status_path_)),
+      status_(std::move(other.status_)), last_update_(other.last_update_),
+      finished_(other.finished_), interrupted_(std::move(other.interrupted_)),
+      waited_for_(std::move(other.waited_for_)) {
+    other.finished_ = true;
+}
+
+pull_lock::~pull_lock() {
+    if (!finished_) {
+        finish(false);
+    }
+}
+
+void pull_lock::update(std::uint64_t bytes) {
+    status_.bytes = bytes;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_update_ < pull_update_interval) {
+        return;
+    }
+    last_update_ = now;
+    status_.updated = unix_time();
+    if (auto r = write_pull_status(status_path_, status_); !r) {
+        spdlog::debug("pull_lock: {}", r.error());
+    }
+}
+
+void pull_lock::finish(bool success) {
+    finished_ = true;
+    status_.state = success ? pull_state::done : pull_state::failed;
+    if (success) {
+        status_.bytes = status_.total;
+    }
+    status_.updated = unix_time();
+    if (auto r = write_pull_status(status_path_, status_); !r) {
+        spdlog::warn("{}", r.error());
+    }
+}
+
+util::expected<pull_lock, std::string>
+acquire_pull_lock(const fs::path& store, const pull_lock_options& options) {
+    const auto lock_path = fs::path(store.string() + ".lock");
+    const auto status_path = fs::path(store.string() + ".status");
+
+    // waiters are woken when the status is replaced, or the lock file is
+    // closed by a process that opened it, e.g. the holder when it exits
+    const int in = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    auto close_in = util::defer([in]() {
+        if (in >= 0) {
+            close(in);
+        }
+    });
+    if (in < 0 || inotify_add_watch(in, lock_path.parent_path().c_str(),
+                                    IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        spdlog::debug("pull_lock: inotify is not available: {}",
+                      std::strerror(errno));
+    }
+
+    // the lock file is kept open while waiting, so that waiters do not wake
+    // each other by closing it
+    const int fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return util::unexpected(fmt::format("unable to open {} for locking: {}",
+                                            lock_path, std::strerror(errno)));
+    }
+    bool locked = false;
+    auto close_fd = util::defer([&]() {
+        if (!locked) {
+            close(fd);
+        }
+    });
+
+    const auto deadline = std::chrono::steady_clock::now() + options.timeout;
+    bool waited = false;
+    std::optional<pull_status> holder;
+    while (true) {
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            locked = true;
+            const auto previous = read_pull_status(status_path);
+            pull_lock result(util::adopt_file_lock(fd), status_path,
+                             {.host = hostname(),
+                              .pid = getpid(),
+                              .total = options.total,
+                              .updated = unix_time()});
+            if (previous && previous->state == pull_state::pulling) {
+                result.interrupted_ = *previous;
+            } else if (previous && waited &&
+                       previous->state == pull_state::done) {
+                result.waited_for_ = *previous;
+            }
+            if (auto r = write_pull_status(status_path, result.status_); !r) {
+                spdlog::warn("{}", r.error());
+            }
+            return result;
+        }
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            return util::unexpected(fmt::format("unable to lock {}: {}",
+                                                lock_path,
+                                                std::strerror(errno)));
+        }
+
+        waited = true;
+        if (auto status = read_pull_status(status_path)) {
+            // a stale status is only reported once it has been seen twice,
+            // because the holder may have taken the lock and not yet
+            // replaced the status of the last pull
+            auto reason = stale_reason(*status, options.stale_after);
+            if (reason && holder && *holder == *status) {
+                // a process on this host that does not exist can't hold the
+                // lock, so it is held by another process that did not
+                // publish its status: removing the lock file would let a
+                // second process pull the image at the same time
+                if (status->host == hostname()) {
+                    return util::unexpected(fmt::format(
+                        "the image is locked by a process that did not "
+                        "publish its status: the status was written by {}, "
+                        "which {}",
+                        holder_string(*status), *reason));
+                }
+                return util::unexpected(fmt::format(
+                    "the image is locked by {}, which {}: remove {} if there "
+                    "is no pull of the image in progress",
+                    holder_string(*status), *reason, lock_path));
+            }
+            if (options.waiting && (!holder || !(*holder == *status))) {
+                options.waiting(*status);
+            }
+            holder = *status;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return util::unexpected(fmt::format(
+                "timed out after {} seconds waiting for {} to pull the image",
+                options.timeout.count(),
+                holder ? holder_string(*holder) : "another process"));
+        }
+        const auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                                  now)
+                .count();
+        pollfd p{.fd = in, .events = POLLIN, .revents = 0};
+        if (poll(&p, in >= 0 ? 1 : 0,
+                 int(std::min<std::int64_t>(recheck_ms, remaining))) > 0) {
+            // drain the events: the lock and status are checked again
+            char buffer[4096];
+            while (read(in, buffer, sizeof(buffer)) > 0) {
+            }
+        }
+        if (util::signal_pending()) {
+            throw util::signal_exception(util::last_signal_raised());
+        }
+    }
+}
+
+} // namespace uenv
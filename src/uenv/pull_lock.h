@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include <util/expected.h>
+#include <util/fs.h>
+
+// Pulls of an image into a repository are coordinated between the processes
+// that share the repository, e.g. the tasks of a job array that all pull the
+// same image, so that the image is downloaded once.
+//
+// The process that pulls an image holds an exclusive lock on <store>.lock,
+// and publishes its progress in the status file <store>.status, which is
+// replaced atomically. The other processes wait for the lock, and are woken
+// by inotify when the status file changes or the lock file is closed, to
+// show the progress of the pull and to reuse the image once it is finished.
+// The status of a pull that is not finished identifies a holder that stopped
+// without releasing the status, e.g. one that crashed, or one on another node
+// that no longer responds.
+
+namespace uenv {
+
+enum class pull_state { pulling, done, failed };
+
+struct pull_status {
+    std::string host;
+    long pid = 0;
+    pull_state state = pull_state::pulling;
+    // the bytes downloaded so far, of total
+    std::uint64_t bytes = 0;
+    std::uint64_t total = 0;
+    // the last time that the status was written, in seconds since the epoch
+    std::int64_t updated = 0;
+};
+
+util::expected<pull_status, std::string>
+read_pull_status(const std::filesystem::path& path);
+
+util::expected<void, std::string>
+write_pull_status(const std::filesystem::path& path, const pull_status& status);
+
+struct pull_lock_options {
+    // the size of the image
+    std::uint64_t total = 0;
+    // the maximum time to wait for another process to finish a pull
+    std::chrono::seconds timeout{3600};
+    // a holder of the lock on another host is considered to be stale if it
+    // has not published its progress for this long
+    std::chrono::seconds stale_after{300};
+    // called with the status of the process that holds the lock while
+    // waiting for it
+    std::function<void(const pull_status&)> waiting = {};
+};
+
+inline constexpr std::chrono::milliseconds pull_update_interval{500};
+
+// the maximum time to wait for a shared lock on an image that is read during
+// a pull, e.g. the image in a seed repository. An image that is locked for
+// longer, because it is being pulled, is not used.
+inline constexpr std::chrono::seconds read_lock_timeout{10};
+
+// the holder of the lock of a pull
+class pull_lock {
+  public:
+    pull_lock(const pull_lock&) = delete;
+    pull_lock(pull_lock&& other) noexcept;
+    // a pull that is not finished is recorded as failed
+    ~pull_lock();
+
+    // publish the progress of the pull: the status file is written at most
+    // once per pull_update_interval
+    void update(std::uint64_t bytes);
+    // publish the end of the pull
+    void finish(bool success);
+
+    // the status of a pull that was interrupted before it finished, which
+    // left a partial download that this pull resumes
+    const std::optional<pull_status>& interrupted() const {
+        return interrupted_;
+    }
+    // the status of the pull of another process that finished while this
+    // process was waiting for the lock
+    const std::optional<pull_status>& waited_for() const {
+        return waited_for_;
+    }
+
+  private:
+    friend util::expected<pull_lock, std::string>
+    acquire_pull_lock(const std::filesystem::path& store,
+                      const pull_lock_options& options);
+    pull_lock(util::file_lock lock, std::filesystem::path status_path,
+              pull_status status);
+
+    util::file_lock lock_;
+    std::filesystem::path status_path_;
+    pull_status status_;
+    std::chrono::steady_clock::time_point last_update_;
+    bool finished_ = false;
+    std::optional<pull_status> interrupted_;
+    std::optional<pull_status> waited_for_;
+};
+
+// Take the lock to pull the image in store. While another process holds the
+// lock, wait for it at most options.timeout, calling options.waiting with its
+// status when it changes. Waiting fails early if the holder is stale: if the
+// process that published the status is on this host and does not exist, in
+// which case another process holds the lock, or if it is a process on another
+// host that has not updated its status for options.stale_after.
+util::expected<pull_lock, std::string>
+acquire_pull_lock(const std::filesystem::path& store,
+                  const pull_lock_options& options);
+
+// a description of the process that published a status, e.g.
+// "pid 1234 on nid001234"
+std::string holder_string(const pull_status& status);
+
+} // namespace uenv
@@ -1,10 +1,18 @@
-#include <any>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <memory>
+#include <random>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <uenv/flat_index.h>
 #include <uenv/parse.h>
 #include <uenv/repository.h>
 #include <uenv/uenv.h>
@@ -170,25 +178,88 @@ struct sqlite_database {
     db_ptr_type data;
 };
 
+// the maximum time in milliseconds that a connection waits for a lock held by
+// another connection, before the operation fails with SQLITE_BUSY.
+std::atomic<std::int64_t> busy_timeout_ms{30'000};
+
+void set_busy_timeout(std::chrono::milliseconds timeout) {
+    busy_timeout_ms = timeout.count();
+}
+
+// A busy handler that retries with exponential backoff: the delay before the
+// nth retry is 2^n ms, capped at 128 ms. A random jitter is applied to each
+// delay so that many processes contending for the same lock, e.g. a job array
+// that pulls images into a shared repository, do not retry in lock step.
+// Returns 0 (give up) once the sum of delays exceeds the busy timeout.
+int busy_handler(void*, int count) {
+    using std::chrono::milliseconds;
+    auto delay = [](int n) { return milliseconds(1 << std::min(n, 7)); };
+
+    milliseconds waited{0};
+    for (int i = 0; i < count; ++i) {
+        waited += delay(i);
+    }
+    if (waited.count() >= busy_timeout_ms) {
+        spdlog::warn("database is locked: gave up after {} attempts", count);
+        return 0;
+    }
+
+    thread_local std::minstd_rand gen{std::random_device{}()};
+    const auto d = delay(count).count();
+    std::uniform_int_distribution<milliseconds::rep> jitter(d / 2, d);
+    std::this_thread::sleep_for(milliseconds(jitter(gen)));
+    return 1;
+}
+
+// returns a URI filename for a database file that sets the immutable flag.
+// characters in the path with special meaning in URIs are escaped.
+std::string immutable_uri(const fs::path& path) {
+    std::string uri = "file:";
+    for (char c : fs::absolute(path).string()) {
+        if (c == '%' || c == '?' || c == '#') {
+            uri += fmt::format("%{:02X}", static_cast<unsigned char>(c));
+        } else {
+            uri += c;
+        }
+    }
+    return uri + "?immutable=1";
+}
+
+// Open an existing database file.
+// If immutable is true, the database is opened read only with the immutable
+// flag, which tells sqlite that the file can not change while it is open:
+// sqlite takes no locks, and does not check for a journal or WAL file. This is
+// only safe for database files that no process has permission to write.
 hopefully<sqlite_database> open_sqlite_database(const fs::path path,
-                                                repo_mode mode) {
+                                                repo_mode mode,
+                                                bool immutable = false) {
     using enum repo_mode;
 
     if (!fs::exists(path)) {
         return unexpected(
             fmt::format("database file {} does not exist", path.string()));
     }
+    if (immutable && mode == readwrite) {
+        return unexpected(fmt::format(
+            "database file {} can not be opened immutable and readwrite",
+            path.string()));
+    }
 
-    const int flags =
-        mode == readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+    int flags = mode == readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+    const auto filename = immutable ? immutable_uri(path) : path.string();
+    if (immutable) {
+        flags |= SQLITE_OPEN_URI;
+    }
     spdlog::debug("open_sqlite_database: attempting to open {} in {} mode.",
-                  path, mode == readonly ? "readonly" : "readwrite");
+                  filename, mode == readonly ? "readonly" : "readwrite");
     sqlite3* db;
-    if (sqlite3_open_v2(path.string().c_str(), &db, flags, NULL) != SQLITE_OK) {
-        return unexpected(fmt::format("did not open database file {}: {}",
-                                      path.string(), sqlite3_errmsg(db)));
+    if (sqlite3_open_v2(filename.c_str(), &db, flags, NULL) != SQLITE_OK) {
+        auto msg = fmt::format("did not open database file {}: {}",
+                               path.string(), sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return unexpected(msg);
     }
-    spdlog::info("open_sqlite_database: {}", path);
+    spdlog::info("open_sqlite_database: {}", filename);
 
     // double check that the database can be written if in readwrite
     // mode
@@ -200,6 +271,11 @@ hopefully<sqlite_database> open_sqlite_database(const fs::path path,
             fmt::format("the repo {} is read only", path.string()));
     }
 
+    // an immutable database is never locked, so it doesn't need a handler
+    if (!immutable) {
+        sqlite3_busy_handler(db, busy_handler, nullptr);
+    }
+
     return sqlite_database(db);
 }
 
@@ -227,6 +303,7 @@ create_sqlite_database(const std::optional<fs::path> path = {}) {
                 fmt::format("unable to create database file {}: {}",
                             path->string(), sqlite3_errmsg(db)));
         }
+        sqlite3_busy_handler(db, busy_handler, nullptr);
         spdlog::info("create_sqlite3_database: created db {}", path);
     } else {
         const int flags =
@@ -244,13 +321,11 @@ create_sqlite_database(const std::optional<fs::path> path = {}) {
 struct statement {
     // type definitions
     using db_ptr_type = sqlite_database::db_ptr_type;
-    using stmt_ptr_type =
-        std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)>;
+    using stmt_ptr_type = std::shared_ptr<sqlite3_stmt>;
 
     // constructor
-    statement(std::string text, sqlite_database& db, sqlite3_stmt* statement)
-        : text(std::move(text)), db(db.data),
-          wrap(statement, &sqlite3_finalize) {
+    statement(sqlite_database& db, stmt_ptr_type statement)
+        : db(db.data), wrap(std::move(statement)) {
     }
 
     // perform the statement.
@@ -259,10 +334,29 @@ struct statement {
         return SQLITE_DONE == sqlite3_step(wrap.get());
     }
 
+    // bind a value to the parameter at index i.
+    // parameter indexes start at 1, following the sqlite3 convention.
+    // return false if there was an error
+    bool bind(int i, std::string_view value) {
+        return SQLITE_OK == sqlite3_bind_text(wrap.get(), i, value.data(),
+                                              value.size(), SQLITE_TRANSIENT);
+    }
+    bool bind(int i, std::int64_t value) {
+        return SQLITE_OK == sqlite3_bind_int64(wrap.get(), i, value);
+    }
+    // bind values to the parameters ?1, ?2, ... in order
+    template <typename... Args> bool bind_values(Args&&... values) {
+        int i = 0;
+        return (bind(++i, std::forward<Args>(values)) && ...);
+    }
+
+    // the text of the statement, e.g. "SELECT * FROM mytable WHERE id = ?"
+    std::string_view text() const {
+        return sqlite3_sql(wrap.get());
+    }
+
     // state
 
-    // the text of the statement, e.g. "SELECT * FROM mytable"
-    const std::string text;
     // the underlying database object
     db_ptr_type db;
     // the underlying statement object
@@ -271,75 +365,53 @@ struct statement {
 
 // extend the statement interface for queries
 struct query : private statement {
+    using statement::bind;
+    using statement::bind_values;
     using statement::statement;
-
-    struct column {
-        int index;
-        std::string name;
-        std::any value;
-
-        operator std::int64_t() const {
-            return std::any_cast<std::int64_t>(value);
-        }
-        operator std::size_t() const {
-            return std::any_cast<std::int64_t>(value);
-        }
-        operator std::string() const {
-            return std::any_cast<std::string>(value);
-        }
-    };
+    using statement::text;
 
     // functions
+    // return true if a row was returned: done() distinguishes between
+    // reaching the end of the results and an error when false is returned.
     bool step() {
-        return SQLITE_ROW == sqlite3_step(wrap.get());
-    }
-
-    hopefully<column> operator[](int i) const {
-        if (i >= sqlite3_column_count(wrap.get()) || i < 0) {
-            return unexpected(fmt::format("sqlite3_column_count out of range"));
-        }
-
-        column result;
-        result.index = i;
-        result.name = sqlite3_column_name(wrap.get(), i);
-        std::string_view type = sqlite3_column_decltype(wrap.get(), i);
-        if (type == "TEXT") {
-            result.value = std::string(reinterpret_cast<const char*>(
-                sqlite3_column_text(wrap.get(), i)));
-        } else if (type == "INTEGER") {
-            // sqlite3 stores integers in the database using between 1-8
-            // bytes (according to the size of the value) but when they
-            // are loaded into memory, it always stores them as a signed
-            // 8 byte value. So always convert from int64.
-            result.value =
-                static_cast<std::int64_t>(sqlite3_column_int64(wrap.get(), i));
-        } else {
-            return unexpected(fmt::format("unknown column type {}", type));
-        }
-
-        return result;
+        rc = sqlite3_step(wrap.get());
+        return SQLITE_ROW == rc;
+    }
+    bool done() const {
+        return SQLITE_DONE == rc;
+    }
+    std::string error() const {
+        return sqlite3_errmsg(db.get());
     }
 
-    hopefully<column> operator[](const std::string& name) const {
-        int num_cols = sqlite3_column_count(wrap.get());
-
-        for (int col = 0; col < num_cols; ++col) {
-            if (sqlite3_column_name(wrap.get(), col) == name) {
-                return operator[](col);
-            }
+    // typed access to the columns of the current row by index.
+    // sqlite3 stores integers in the database using between 1-8 bytes
+    // (according to the size of the value) but when they are loaded into
+    // memory, it always stores them as a signed 8 byte value.
+    std::int64_t integer(int i) const {
+        return sqlite3_column_int64(wrap.get(), i);
+    }
+    std::string_view string(int i) const {
+        const auto ptr = sqlite3_column_text(wrap.get(), i);
+        if (ptr == nullptr) {
+            return {};
         }
-
-        return unexpected(fmt::format(
-            "sqlite3 query does not have a column named '{}'", name));
+        return {reinterpret_cast<const char*>(ptr),
+                static_cast<std::size_t>(sqlite3_column_bytes(wrap.get(), i))};
     }
+
+  private:
+    // the return code of the last call to sqlite3_step
+    int rc = SQLITE_OK;
 };
 
-hopefully<sqlite3_stmt*> create_sqlite3_stmt(const std::string& text,
-                                             sqlite_database& db) {
+hopefully<sqlite3_stmt*> create_sqlite3_stmt(std::string_view text,
+                                             sqlite_database& db,
+                                             unsigned flags = 0) {
     sqlite3_stmt* ptr;
     sqlite3* D = db.data.get();
     int rc =
-        sqlite3_prepare_v2(D, text.c_str(), text.size() + 1, &ptr, nullptr);
+        sqlite3_prepare_v3(D, text.data(), text.size(), flags, &ptr, nullptr);
     if (SQLITE_OK != rc) {
         return unexpected(
             fmt::format("unable to create prepared statement:\n{}\n\n{}",
@@ -356,7 +428,7 @@ hopefully<statement> create_statement(const std::string& text,
         return unexpected(ptr.error());
     }
 
-    return statement{text, db, *ptr};
+    return statement{db, {*ptr, &sqlite3_finalize}};
 }
 
 // create a statement and execute it.
@@ -383,28 +455,133 @@ hopefully<query> create_query(const std::string& text, sqlite_database& db) {
         return unexpected(ptr.error());
     }
 
-    return query{text, db, *ptr};
+    return query{db, {*ptr, &sqlite3_finalize}};
 }
 
+// A per-connection cache of prepared statements, keyed on the SQL text.
+// Statements are compiled once with SQLITE_PREPARE_PERSISTENT, and the
+// handles returned by get() reset the statement and clear its bindings when
+// they go out of scope, ready for the next caller.
+// The cache owns the statements, so it must not outlive the connection.
+struct statement_cache {
+    using owner_type = std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)>;
+
+    hopefully<query> get(const std::string& text, sqlite_database& db) {
+        auto it = statements.find(text);
+        if (it == statements.end()) {
+            spdlog::trace("statement_cache: prepare {}", text);
+            auto ptr = create_sqlite3_stmt(text, db, SQLITE_PREPARE_PERSISTENT);
+            if (!ptr) {
+                return unexpected(ptr.error());
+            }
+            it = statements.emplace(text, owner_type{*ptr, &sqlite3_finalize})
+                     .first;
+        }
+        // the cached statement is being stepped by a record_cursor: return a
+        // new statement that is finalized when it goes out of scope.
+        else if (sqlite3_stmt_busy(it->second.get())) {
+            spdlog::trace("statement_cache: statement is busy {}", text);
+            return create_query(text, db);
+        }
+
+        // a non-owning handle that returns the statement to the cache
+        auto release = [](sqlite3_stmt* s) {
+            sqlite3_reset(s);
+            sqlite3_clear_bindings(s);
+        };
+        return query{db, {it->second.get(), release}};
+    }
+
+    // finalize all statements
+    void clear() {
+        statements.clear();
+    }
+
+    std::unordered_map<std::string, owner_type> statements;
+};
+
 struct repository_impl {
     repository_impl(sqlite_database db, std::optional<fs::path> path,
                     bool readonly = true)
         : db(std::move(db)), path(std::move(path)), is_readonly(readonly) {
+        // foreign key support is set per connection, so it is enabled once
+        // here instead of at the start of every transaction.
+        if (auto r = exec_statement("PRAGMA foreign_keys = ON", this->db);
+            !r) {
+            spdlog::error("repository_impl: {}", r.error());
+        }
     }
     repository_impl(repository_impl&&) = default;
     mutable sqlite_database db;
+    // declared after db so that the statements are finalized before the
+    // connection is closed.
+    mutable statement_cache statements;
     std::optional<fs::path> path;
 
-    util::expected<std::vector<uenv_record>, std::string>
+    util::expected<record_set, std::string>
     query(const uenv_label&, bool partial_name = false) const;
+    util::expected<record_cursor, std::string>
+    cursor(const uenv_label&, bool partial_name = false) const;
     repository::pathset uenv_paths(sha256) const;
 
     bool contains(const uenv_record&) const;
 
-    util::expected<void, std::string> add(const uenv_record&);
+    // add records in a single transaction
+    util::expected<void, std::string> add(std::span<const uenv_record>);
     util::expected<record_set, std::string> remove(const uenv_record&);
     util::expected<record_set, std::string> remove(const sha256&);
 
+    // insert a record without starting a transaction
+    util::expected<void, std::string> insert(const uenv_record&);
+
+    // rewrite the flat index after the database has been modified
+    void refresh_index() const;
+    // rewrite the flat index after records have been added or removed, or
+    // record that it is stale if updates are deferred
+    void update_index() const;
+    bool defer_index = false;
+    mutable bool index_stale = false;
+
+    util::expected<int, std::string> schema_version() const;
+    util::expected<void, std::string> upgrade_schema();
+
+    util::expected<journal_mode, std::string> journal() const;
+    util::expected<void, std::string> set_journal(journal_mode);
+
+    // return a prepared statement from the statement cache
+    hopefully<uenv::query> prepare(const std::string& text) const {
+        return statements.get(text, db);
+    }
+
+    // execute a cached statement that returns no rows
+    hopefully<void> exec(const std::string& text) const {
+        auto stmt = prepare(text);
+        if (!stmt) {
+            return unexpected(stmt.error());
+        }
+        return finish(*stmt);
+    }
+
+    // bind values to the parameters ?1, ?2, ... of a statement
+    template <typename... Args>
+    hopefully<void> bind(uenv::query& stmt, Args&&... values) const {
+        if (!stmt.bind_values(std::forward<Args>(values)...)) {
+            return unexpected(fmt::format("SQL error '{}' binding {}",
+                                          db.error(), stmt.text()));
+        }
+        return {};
+    }
+
+    // step a statement that returns no rows to completion
+    hopefully<void> finish(uenv::query& stmt) const {
+        stmt.step();
+        if (!stmt.done()) {
+            return unexpected(fmt::format("SQL error '{}' executing {}",
+                                          db.error(), stmt.text()));
+        }
+        return {};
+    }
+
     const bool is_readonly;
 };
 
@@ -473,19 +650,88 @@ open_repository(const fs::path& repo_path, repo_mode mode) {
         break;
     }
 
-    // open the sqlite database
+    // open the sqlite database.
+    // nobody has permission to modify a readonly repository, e.g. a site-wide
+    // repository, so it can be opened immutable to avoid the cost of taking
+    // file locks, which are slow on shared file systems like Lustre.
+    const bool immutable = initial_state == repo_state::readonly;
     auto db_path = repo_path / "index.db";
-    auto db = open_sqlite_database(db_path, mode);
+    auto db = open_sqlite_database(db_path, mode, immutable);
     if (!db) {
         return unexpected(db.error());
     }
 
-    return repository(
-        std::make_unique<repository_impl>(std::move(*db), repo_path, true));
+    return repository(std::make_unique<repository_impl>(
+        std::move(*db), repo_path, mode == readonly));
 }
 
 std::vector<std::string> schema_tables();
 
+// A schema migration upgrades the database from version-1 to version.
+// The schema version is stored in the database file using PRAGMA user_version,
+// where version 0 is the original schema created by schema_tables().
+struct schema_migration {
+    int version;
+    std::string description;
+    std::vector<std::string> statements;
+};
+
+std::vector<schema_migration> schema_migrations();
+
+int latest_schema_version() {
+    return schema_migrations().back().version;
+}
+
+hopefully<int> read_schema_version(sqlite_database& db) {
+    auto q = create_query("PRAGMA user_version", db);
+    if (!q) {
+        return unexpected(q.error());
+    }
+    if (!q->step()) {
+        return unexpected(
+            fmt::format("unable to read schema version: {}", db.error()));
+    }
+    return static_cast<int>(q->integer(0));
+}
+
+// apply all migrations newer than version: must be called inside a
+// transaction.
+hopefully<void> apply_schema_migrations(int version, sqlite_database& db) {
+    for (const auto& m : schema_migrations()) {
+        if (m.version <= version) {
+            continue;
+        }
+        spdlog::info("schema migration {}: {}", m.version, m.description);
+        for (const auto& stmt : m.statements) {
+            if (auto r = exec_statement(stmt, db); !r) {
+                return unexpected(fmt::format("schema migration {} failed: {}",
+                                              m.version, r.error()));
+            }
+        }
+        version = m.version;
+    }
+    // PRAGMA statements do not accept bound parameters
+    return exec_statement(fmt::format("PRAGMA user_version = {}", version), db);
+}
+
+// create the tables of a new database at the latest schema version
+hopefully<void> create_schema(sqlite_database& db) {
+    if (auto r = exec_statement("BEGIN", db); !r) {
+        return r;
+    }
+    for (const auto& table : schema_tables()) {
+        if (auto r = exec_statement(table, db); !r) {
+            exec_statement("ROLLBACK", db);
+            return r;
+        }
+    }
+    if (auto r = apply_schema_migrations(0, db); !r) {
+        exec_statement("ROLLBACK", db);
+        return r;
+    }
+    return exec_statement("COMMIT", db);
+}
+
 util::expected<repository, std::string>
 create_repository(const fs::path& repo_path) {
     using enum repo_state;
@@ -533,27 +779,13 @@ create_repository(const fs::path& repo_path) {
         return unexpected(fmt::format("unable to create repository"));
     }
 
-    if (auto r = exec_statement("PRAGMA foreign_keys = ON", *db); !r) {
-        spdlog::error(r.error());
-        return unexpected("unable to create repository");
-    }
-    if (auto r = exec_statement("BEGIN", *db); !r) {
-        spdlog::error(r.error());
-        return unexpected("unable to create repository");
-    }
-    for (const auto& table : schema_tables()) {
-        if (auto r = exec_statement(table, *db); !r) {
-            spdlog::error(r.error());
-            return unexpected("unable to create repository");
-        }
-    }
-    if (auto r = exec_statement("COMMIT", *db); !r) {
+    if (auto r = create_schema(*db); !r) {
         spdlog::error(r.error());
         return unexpected("unable to create repository");
     }
 
-    return repository(
-        std::make_unique<repository_impl>(std::move(*db), abs_repo_path, true));
+    return repository(std::make_unique<repository_impl>(
+        std::move(*db), abs_repo_path, false));
 }
 
 util::expected<repository, std::string> create_repository() {
@@ -566,35 +798,17 @@ util::expected<repository, std::string> create_repository() {
         return unexpected(fmt::format("unable to create repository"));
     }
 
-    if (auto r = exec_statement("PRAGMA foreign_keys = ON", *db); !r) {
-        spdlog::error(r.error());
-        return unexpected("unable to create repository");
-    }
-    if (auto r = exec_statement("BEGIN", *db); !r) {
-        spdlog::error(r.error());
-        return unexpected("unable to create repository");
-    }
-    for (const auto& table : schema_tables()) {
-        if (auto r = exec_statement(table, *db); !r) {
-            spdlog::error(r.error());
-            return unexpected("unable to create repository");
-        }
-    }
-    if (auto r = exec_statement("COMMIT", *db); !r) {
+    if (auto r = create_schema(*db); !r) {
         spdlog::error(r.error());
         return unexpected("unable to create repository");
     }
 
     return repository(
-        std::make_unique<repository_impl>(std::move(*db), std::nullopt, true));
+        std::make_unique<repository_impl>(std::move(*db), std::nullopt, false));
 }
 
-repository::pathset repository_impl::uenv_paths(sha256 sha) const {
-    namespace fs = std::filesystem;
-
+repository::pathset uenv_paths(const fs::path& repo_root, const sha256& sha) {
     const auto lit = sha.string();
-
-    const fs::path repo_root = path ? *path : fs::path(".");
     const fs::path repo_store_root = repo_root / "images";
 
     return {.root = repo_root,
@@ -604,27 +818,83 @@ repository::pathset repository_impl::uenv_paths(sha256 sha) const {
             .squashfs = repo_store_root / lit / "store.squashfs"};
 }
 
+repository::pathset repository_impl::uenv_paths(sha256 sha) const {
+    return uenv::uenv_paths(path ? *path : fs::path("."), sha);
+}
+
+void repository_impl::refresh_index() const {
+    if (!path || is_readonly) {
+        return;
+    }
+    index_stale = false;
+
+    // read the records and the generation of the database in one read
+    // transaction: the shared lock that it holds stops other processes from
+    // modifying the database in between.
+    std::optional<record_set> records;
+    std::optional<std::uint32_t> generation;
+    if (exec("BEGIN")) {
+        if (auto r = query({})) {
+            records = std::move(*r);
+            generation = database_generation(*path / "index.db");
+        }
+        exec("COMMIT");
+    }
+
+    // remove the old index if a new one can't be written, e.g. because the
+    // database uses WAL journaling.
+    if (!records || !generation ||
+        !write_flat_index(*path, *records, *generation)) {
+        std::error_code ec;
+        fs::remove(flat_index_path(*path), ec);
+        spdlog::debug("repository_impl::refresh_index: removed {}",
+                      flat_index_path(*path));
+    }
+}
+
+void repository_impl::update_index() const {
+    if (defer_index) {
+        index_stale = true;
+        return;
+    }
+    refresh_index();
+}
+
+// insert a record: must be called inside a transaction.
+// Adding a record that is already in the database is a noop, and if another
+// image has the same label, the label is updated to refer to the new image.
 util::expected<void, std::string>
-repository_impl::add(const uenv::uenv_record& r) {
-    std::vector<std::string> statements{
-        // begin the transaction
-        "PRAGMA foreign_keys = ON",
-        "BEGIN",
-        // insert the image information to images
-        fmt::format("INSERT OR IGNORE INTO images (sha256, id, date, size) "
-                    "VALUES ('{}', '{}', '{}', {})",
-                    r.sha, r.id, r.date, r.size_byte),
-        // insert the uenv information to uenv
-        fmt::format("INSERT OR IGNORE INTO uenv (system, uarch, name, version) "
-                    "VALUES ('{}', '{}', "
-                    "'{}', '{}')",
-                    r.system, r.uarch, r.name, r.version),
-    };
+repository_impl::insert(const uenv::uenv_record& r) {
+    // insert the image information to images
+    {
+        auto stmt = prepare("INSERT OR IGNORE INTO images (sha256, id, date, "
+                            "size) VALUES (?1, ?2, ?3, ?4)");
+        if (!stmt) {
+            return unexpected(stmt.error());
+        }
+        if (auto rv = bind(*stmt, r.sha.string(), r.id.string(),
+                           fmt::format("{}", r.date), r.size_byte);
+            !rv) {
+            return unexpected(rv.error());
+        }
+        if (auto rv = finish(*stmt); !rv) {
+            return unexpected(rv.error());
+        }
+    }
 
-    for (auto stmt : statements) {
-        if (auto r = exec_statement(stmt, db); !r) {
-            spdlog::error("repository_impl::add: {}", r.error());
-            return unexpected("unable to update database");
+    // insert the uenv information to uenv
+    {
+        auto stmt = prepare("INSERT OR IGNORE INTO uenv (system, uarch, name, "
+                            "version) VALUES (?1, ?2, ?3, ?4)");
+        if (!stmt) {
+            return unexpected(stmt.error());
+        }
+        if (auto rv = bind(*stmt, r.system, r.uarch, r.name, r.version);
+            !rv) {
+            return unexpected(rv.error());
+        }
+        if (auto rv = finish(*stmt); !rv) {
+            return unexpected(rv.error());
         }
     }
 
@@ -633,42 +903,65 @@ repository_impl::add(const uenv::uenv_record& r) {
     // version_id whether or not a new row was added in the last INSERT
     std::int64_t version_id;
     {
-        auto stmt = fmt::format("SELECT version_id FROM uenv WHERE "
-                                "system = '{}' AND uarch = '{}' "
-                                "AND name = '{}' AND version = '{}'",
-                                r.system, r.uarch, r.name, r.version);
-        auto result = create_query(stmt, db);
-        result->step();
-
-        version_id = (*result)["version_id"].value();
+        auto stmt = prepare("SELECT version_id FROM uenv WHERE system = ?1 AND "
+                            "uarch = ?2 AND name = ?3 AND version = ?4");
+        if (!stmt) {
+            return unexpected(stmt.error());
+        }
+        if (auto rv = bind(*stmt, r.system, r.uarch, r.name, r.version);
+            !rv) {
+            return unexpected(rv.error());
+        }
+        if (!stmt->step()) {
+            return unexpected(fmt::format("no version_id for {}", r));
+        }
+        version_id = stmt->integer(0);
     }
 
-    bool tag_exists;
+    // insert the tag, or point an existing tag at the new image
     {
-        auto stmt = fmt::format("SELECT tag FROM tags WHERE version_id "
-                                "= '{}' AND tag = '{}'",
-                                version_id, r.tag);
-
-        auto result = create_query(stmt, db);
-        tag_exists = result->step();
+        auto stmt = prepare("INSERT INTO tags (version_id, tag, sha256) "
+                            "VALUES (?1, ?2, ?3) "
+                            "ON CONFLICT (version_id, tag) "
+                            "DO UPDATE SET sha256 = excluded.sha256");
+        if (!stmt) {
+            return unexpected(stmt.error());
+        }
+        if (auto rv = bind(*stmt, version_id, r.tag, r.sha.string()); !rv) {
+            return unexpected(rv.error());
+        }
+        if (auto rv = finish(*stmt); !rv) {
+            return unexpected(rv.error());
+        }
     }
 
-    auto stmt = tag_exists ? fmt::format("UPDATE tags SET sha256 = '{}' WHERE "
-                                         "version_id = {} AND tag = '{}'",
-                                         r.sha, version_id, r.tag)
-                           : fmt::format("INSERT INTO tags (version_id, tag, "
-                                         "sha256) VALUES ('{}', '{}', '{}')",
-                                         version_id, r.tag, r.sha);
+    return {};
+}
 
-    if (auto r = exec_statement(stmt, db); !r) {
-        spdlog::error("repository_impl::add: {}", r.error());
-        return unexpected(r.error());
-    }
+util::expected<void, std::string>
+repository_impl::add(std::span<const uenv_record> records) {
+    auto fail = [this](const std::string& msg) -> hopefully<void> {
+        spdlog::error("repository_impl::add: {}", msg);
+        exec("ROLLBACK");
+        return unexpected("unable to update database");
+    };
 
-    if (auto r = exec_statement("COMMIT", db); !r) {
-        spdlog::error("repository_impl::add: {}", r.error());
-        return unexpected(r.error());
+    // take the write lock at the start of the transaction, so that the busy
+    // handler can wait for other writers: a deferred transaction that has to
+    // upgrade its lock part way through fails immediately with SQLITE_BUSY
+    // if another connection is writing.
+    if (auto rv = exec("BEGIN IMMEDIATE"); !rv) {
+        return fail(rv.error());
+    }
+    for (auto& r : records) {
+        if (auto rv = insert(r); !rv) {
+            return fail(rv.error());
+        }
+    }
+    if (auto rv = exec("COMMIT"); !rv) {
+        return fail(rv.error());
     }
+    update_index();
 
     return {};
 }
@@ -676,19 +969,26 @@ repository_impl::add(const uenv::uenv_record& r) {
 util::expected<record_set, std::string>
 repository_impl::remove(const sha256& sha) {
     auto matches = query(uenv_label{.name = sha.string()});
-    std::vector<std::string> statements{
-        // begin the transaction
-        "PRAGMA foreign_keys = ON", "BEGIN",
-        // delete the image from images
-        fmt::format("DELETE FROM images WHERE sha256 = '{}'", sha.string()),
-        "COMMIT"};
-
-    for (auto stmt : statements) {
-        if (auto r = exec_statement(stmt, db); !r) {
-            spdlog::error("repository_impl::remove: {}", r.error());
-            return unexpected("unable to update database");
-        }
+    if (!matches) {
+        return unexpected(matches.error());
+    }
+
+    // the delete cascades to the tags, and from there to the uenv, table.
+    auto stmt = prepare("DELETE FROM images WHERE sha256 = ?1");
+    if (!stmt) {
+        spdlog::error("repository_impl::remove: {}", stmt.error());
+        return unexpected("unable to update database");
+    }
+    if (auto r = bind(*stmt, sha.string()); !r) {
+        spdlog::error("repository_impl::remove: {}", r.error());
+        return unexpected("unable to update database");
+    }
+    if (auto r = finish(*stmt); !r) {
+        spdlog::error("repository_impl::remove: {}", r.error());
+        return unexpected("unable to update database");
     }
+    update_index();
+
     return *matches;
 }
 
@@ -698,7 +998,7 @@ bool repository_impl::contains(const uenv_record& record) const {
                           .tag = record.tag,
                           .system = record.system,
                           .uarch = record.uarch});
-    return !matches->empty();
+    return matches && !matches->empty();
 }
 
 util::expected<record_set, std::string>
@@ -708,136 +1008,179 @@ repository_impl::remove(const uenv_record& record) {
                           .tag = record.tag,
                           .system = record.system,
                           .uarch = record.uarch});
+    if (!matches) {
+        return unexpected(matches.error());
+    }
 
     if (!matches->empty()) {
-        // clang-format off
-        std::vector<std::string> statements{
-            // begin the transaction
-            "BEGIN",
-            "PRAGMA foreign_keys = ON",
-            // delete the image from images
-            // clang-format off
-            fmt::format(
-//WHERE sha256 = '{}' AND version_id IN ("
-R"(
+        auto stmt = prepare(R"(
 DELETE FROM tags
-WHERE sha256='{}' AND tag='{}' AND version_id IN (
+WHERE sha256 = ?1 AND tag = ?2 AND version_id IN (
     SELECT version_id FROM uenv
-    WHERE system='{}' AND uarch='{}' AND name='{}' AND version='{}')
-)",
-                record.sha, record.tag, record.system, record.uarch, record.name, record.version),
-            "COMMIT"};
-        // clang-format on
-
-        for (auto stmt : statements) {
-            if (auto r = exec_statement(stmt, db); !r) {
-                spdlog::error("repository_impl::remove: {}", r.error());
-                return unexpected("unable to update database");
-            }
+    WHERE system = ?3 AND uarch = ?4 AND name = ?5 AND version = ?6)
+)");
+        if (!stmt) {
+            spdlog::error("repository_impl::remove: {}", stmt.error());
+            return unexpected("unable to update database");
+        }
+        if (auto r = bind(*stmt, record.sha.string(), record.tag,
+                          record.system, record.uarch, record.name,
+                          record.version);
+            !r) {
+            spdlog::error("repository_impl::remove: {}", r.error());
+            return unexpected("unable to update database");
         }
+        if (auto r = finish(*stmt); !r) {
+            spdlog::error("repository_impl::remove: {}", r.error());
+            return unexpected("unable to update database");
+        }
+        update_index();
     }
     return *matches;
 }
 
-util::expected<std::vector<uenv_record>, std::string>
-repository_impl::query(const uenv_label& label, bool partial_name) const {
-    std::vector<uenv_record> results;
+// the columns of the records view, in the order that they are read by
+// record_from_query.
+constexpr auto records_select =
+    "SELECT system, uarch, name, version, tag, date, size, sha256, id "
+    "FROM records";
+
+hopefully<uenv_record> record_from_query(const query& stmnt) {
+    auto date = parse_uenv_date(std::string(stmnt.string(5)));
+    if (!date) {
+        return unexpected(
+            fmt::format("invalid date {}", date.error().message()));
+    }
+    return uenv_record{std::string(stmnt.string(0)),
+                       std::string(stmnt.string(1)),
+                       std::string(stmnt.string(2)),
+                       std::string(stmnt.string(3)),
+                       std::string(stmnt.string(4)),
+                       date.value(),
+                       static_cast<std::size_t>(stmnt.integer(6)),
+                       sha256(std::string(stmnt.string(7))),
+                       uenv_id(std::string(stmnt.string(8)))};
+}
+
+struct record_cursor_impl {
+    record_cursor_impl(uenv::query q) : stmt(std::move(q)) {
+        next();
+    }
 
-    std::vector<std::string> query_terms;
+    void next() {
+        record.reset();
+        if (!stmt) {
+            return;
+        }
+        if (stmt->step()) {
+            if (auto r = record_from_query(*stmt)) {
+                record = std::move(*r);
+                return;
+            } else {
+                error = r.error();
+            }
+        } else if (!stmt->done()) {
+            error = fmt::format("SQL error '{}' executing {}", stmt->error(),
+                                stmt->text());
+        }
+        // release the statement as soon as the results have been read, so
+        // that the statement cache can reuse it.
+        stmt.reset();
+    }
+
+    std::optional<uenv::query> stmt;
+    std::optional<uenv_record> record;
+    std::optional<std::string> error;
+};
+
+util::expected<record_cursor, std::string>
+repository_impl::cursor(const uenv_label& label, bool partial_name) const {
+    // build the WHERE clause with a parameter for each field in the label.
+    // The SQL text only depends on which fields are set, so there are a small
+    // number of variations that are each prepared once and cached.
+    std::vector<std::string> name_terms;
+    std::vector<std::string> terms;
+    std::vector<std::string> values;
+    auto add_term = [&](std::vector<std::string>& t, const char* term,
+                        const std::string& value) {
+        values.push_back(value);
+        t.push_back(fmt::format("{} ?{}", term, values.size()));
+    };
     if (label.name) {
         if (partial_name) {
-            query_terms.push_back(fmt::format("name  LIKE '{}%'", *label.name));
+            add_term(name_terms, "name LIKE", *label.name + "%");
         } else {
-            query_terms.push_back(fmt::format("name  = '{}'", *label.name));
+            add_term(name_terms, "name =", *label.name);
         }
     }
     if (label.tag) {
-        query_terms.push_back(fmt::format("tag  = '{}'", *label.tag));
+        add_term(name_terms, "tag =", *label.tag);
     }
     if (label.version) {
-        query_terms.push_back(fmt::format("version  = '{}'", *label.version));
+        add_term(name_terms, "version =", *label.version);
     }
     if (label.uarch) {
-        query_terms.push_back(fmt::format("uarch  = '{}'", *label.uarch));
+        add_term(terms, "uarch =", *label.uarch);
     }
     if (label.system) {
-        query_terms.push_back(fmt::format("system  = '{}'", *label.system));
+        add_term(terms, "system =", *label.system);
     }
-    const std::string query =
-        query_terms.empty() ? "SELECT * FROM records"
-                            : fmt::format("SELECT * FROM records WHERE {}",
-                                          fmt::join(query_terms, " AND "));
 
-    auto s = create_query(query, db);
-    if (!s) {
-        return unexpected(
-            fmt::format("creating database query: {}", s.error()));
-    }
-
-    auto record_from_query = [](auto& stmnt) -> hopefully<uenv_record> {
-        // unsafe: unwrap using .value() without checking for errors.
-        // the best way to do this would be to "validate" the database
-        // beforehand by checking the columns exist. Even better,
-        // validate that column 0 -> 'system', etc, and use integer
-        // indexes to look up more effiently.
-        auto date =
-            parse_uenv_date(static_cast<std::string>(stmnt["date"].value()));
-        if (!date) {
-            fmt::println("date: {}", date.error().message());
-            return unexpected(
-                fmt::format("invalid date {}", date.error().message()));
-        }
-        return uenv_record{
-            stmnt["system"].value(),     stmnt["uarch"].value(),
-            stmnt["name"].value(),       stmnt["version"].value(),
-            stmnt["tag"].value(),        date.value(),
-            stmnt["size"].value(),       sha256(stmnt["sha256"].value()),
-            uenv_id(stmnt["id"].value())};
+    // select from records with the terms combined using AND
+    auto select = [](std::vector<std::string> t,
+                     const std::vector<std::string>& shared) {
+        t.insert(t.end(), shared.begin(), shared.end());
+        if (t.empty()) {
+            return std::string(records_select);
+        }
+        return fmt::format("{} WHERE {}", records_select,
+                           fmt::join(t, " AND "));
     };
+    std::string text = select(name_terms, terms);
 
-    while (s->step()) {
-        results.push_back(record_from_query(*s).value());
-    }
-
-    // now check for id and sha search terms
+    // a name could also be an id or sha256: the matches for both
+    // interpretations are combined with a UNION, which also removes duplicate
+    // rows. Each half of the union is evaluated with the index on its search
+    // term. Otherwise the rows are unique, because (system, uarch, name,
+    // version, tag) is unique.
     if (label.only_name()) {
-        query_terms.erase(query_terms.begin());
-        // search for an if name could also be an id
-        if (is_sha(*label.name, 16)) {
-            query_terms.push_back(
-                fmt::format("id = '{}'", uenv_id(*label.name).string()));
-            auto result =
-                create_query(fmt::format("SELECT * FROM records WHERE {}",
-                                         fmt::join(query_terms, " AND ")),
-                             db);
-            if (result) {
-                while (result->step()) {
-                    results.push_back(record_from_query(*result).value());
-                }
-            }
+        const auto& name = *label.name;
+        std::vector<std::string> sha_terms;
+        if (is_sha(name, 16)) {
+            add_term(sha_terms, "id =", uenv_id(name).string());
+        } else if (is_sha(name, 64)) {
+            add_term(sha_terms, "sha256 =", sha256(name).string());
         }
-        // search for a sha if name could also be a sha256
-        else if (is_sha(*label.name, 64)) {
-            query_terms.push_back(
-                fmt::format("sha256 = '{}'", sha256(*label.name).string()));
-            auto result =
-                create_query(fmt::format("SELECT * FROM records WHERE {}",
-                                         fmt::join(query_terms, " AND ")),
-                             db);
-            if (result) {
-                while (result->step()) {
-                    results.push_back(record_from_query(*result).value());
-                }
-            }
+        if (!sha_terms.empty()) {
+            text = fmt::format("{} UNION {}", text, select(sha_terms, terms));
+        }
+    }
+
+    // the same order as operator< for uenv_record
+    text += " ORDER BY name, version, tag, system, uarch, date, sha256";
+
+    auto s = prepare(text);
+    if (!s) {
+        return unexpected(
+            fmt::format("creating database query: {}", s.error()));
+    }
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        if (!s->bind(static_cast<int>(i + 1), values[i])) {
+            return unexpected(fmt::format("SQL error '{}' binding {}",
+                                          db.error(), s->text()));
         }
     }
 
-    // sort the results
-    std::sort(results.begin(), results.end());
-    // remove duplicates
-    results.erase(std::unique(results.begin(), results.end()), results.end());
+    return record_cursor(std::make_unique<record_cursor_impl>(std::move(*s)));
+}
 
-    return results;
+util::expected<record_set, std::string>
+repository_impl::query(const uenv_label& label, bool partial_name) const {
+    auto c = cursor(label, partial_name);
+    if (!c) {
+        return unexpected(c.error());
+    }
+    return c->collect();
 }
 
 // schema
@@ -906,6 +1249,125 @@ std::vector<std::string> schema_tables() {
     };
 }
 
+std::vector<schema_migration> schema_migrations() {
+    return {
+        {1,
+         "add indexes and per-row orphan triggers",
+         {
+             // images(id) already has an index, created implicitly by its
+             // UNIQUE constraint.
+             "CREATE INDEX IF NOT EXISTS uenv_name ON uenv (name)",
+             "CREATE INDEX IF NOT EXISTS tags_sha256 ON tags (sha256)",
+             // only check whether the version_id and sha256 of the deleted
+             // tag are still referenced, instead of scanning the whole table
+             // for every deleted row.
+             "DROP TRIGGER IF EXISTS delete_orphan_uenv",
+             "DROP TRIGGER IF EXISTS delete_orphan_image",
+             R"(CREATE TRIGGER delete_orphan_uenv
+                AFTER DELETE ON tags
+                FOR EACH ROW
+                WHEN NOT EXISTS
+                    (SELECT 1 FROM tags WHERE version_id = OLD.version_id)
+                BEGIN
+                    DELETE FROM uenv WHERE version_id = OLD.version_id;
+                END;
+             )",
+             R"(CREATE TRIGGER delete_orphan_image
+                AFTER DELETE ON tags
+                FOR EACH ROW
+                WHEN NOT EXISTS
+                    (SELECT 1 FROM tags WHERE sha256 = OLD.sha256)
+                BEGIN
+                    DELETE FROM images WHERE sha256 = OLD.sha256;
+                END;
+             )",
+             "ANALYZE",
+         }},
+    };
+}
+
+util::expected<int, std::string> repository_impl::schema_version() const {
+    return read_schema_version(db);
+}
+
+util::expected<void, std::string> repository_impl::upgrade_schema() {
+    if (auto r = exec_statement("BEGIN IMMEDIATE", db); !r) {
+        spdlog::error("repository_impl::upgrade_schema: {}", r.error());
+        return unexpected("unable to upgrade the database schema");
+    }
+    auto fail = [this](const std::string& msg) -> hopefully<void> {
+        spdlog::error("repository_impl::upgrade_schema: {}", msg);
+        exec_statement("ROLLBACK", db);
+        return unexpected("unable to upgrade the database schema");
+    };
+
+    // read the version inside the transaction, in case another process
+    // upgraded the schema concurrently.
+    auto version = read_schema_version(db);
+    if (!version) {
+        return fail(version.error());
+    }
+    if (*version >= latest_schema_version()) {
+        exec_statement("ROLLBACK", db);
+        return {};
+    }
+    // the statements in the cache may refer to triggers and indexes that are
+    // about to be replaced.
+    statements.clear();
+    if (auto r = apply_schema_migrations(*version, db); !r) {
+        return fail(r.error());
+    }
+    if (auto r = exec_statement("COMMIT", db); !r) {
+        return fail(r.error());
+    }
+    spdlog::info("upgraded schema from version {} to {}", *version,
+                 latest_schema_version());
+    refresh_index();
+
+    return {};
+}
+
+util::expected<journal_mode, std::string> repository_impl::journal() const {
+    auto q = create_query("PRAGMA journal_mode", db);
+    if (!q) {
+        return unexpected(q.error());
+    }
+    if (!q->step()) {
+        return unexpected(
+            fmt::format("unable to read journal mode: {}", db.error()));
+    }
+    return q->string(0) == "wal" ? journal_mode::wal : journal_mode::rollback;
+}
+
+util::expected<void, std::string>
+repository_impl::set_journal(journal_mode mode) {
+    if (is_readonly) {
+        return unexpected("the repository is read only");
+    }
+
+    // the journal mode is stored in the database file, so it applies to all
+    // connections that open the database after it has been set.
+    // PRAGMA journal_mode returns the journal mode after the statement has
+    // been applied, which is unchanged if the mode could not be set.
+    const std::string name = mode == journal_mode::wal ? "wal" : "delete";
+    {
+        auto q =
+            create_query(fmt::format("PRAGMA journal_mode = {}", name), db);
+        if (!q) {
+            return unexpected(q.error());
+        }
+        if (!q->step() || q->string(0) != name) {
+            spdlog::error("repository_impl::set_journal: {}", db.error());
+            return unexpected(
+                fmt::format("unable to set the journal mode to {}", name));
+        }
+    }
+    // the statement has to be finalized before the index is refreshed, in
+    // order for the new journal mode to be written to the database file.
+    refresh_index();
+    return {};
+}
+
 bool record_set::empty() const {
     return records_.empty();
 }
@@ -948,6 +1410,36 @@ record_set::const_iterator record_set::cend() const {
     return records_.cend();
 }
 
+record_cursor::record_cursor(std::unique_ptr<record_cursor_impl> impl)
+    : impl_(std::move(impl)) {
+}
+record_cursor::record_cursor(record_cursor&&) = default;
+record_cursor& record_cursor::operator=(record_cursor&&) = default;
+record_cursor::~record_cursor() = default;
+
+const uenv_record* record_cursor::current() const {
+    return impl_->record ? &*impl_->record : nullptr;
+}
+
+void record_cursor::next() {
+    impl_->next();
+}
+
+std::optional<std::string> record_cursor::error() const {
+    return impl_->error;
+}
+
+util::expected<record_set, std::string> record_cursor::collect() {
+    std::vector<uenv_record> records;
+    for (auto& r : *this) {
+        records.push_back(r);
+    }
+    if (impl_->error) {
+        return unexpected(*impl_->error);
+    }
+    return record_set(std::move(records));
+}
+
 // wrapping the pimpled implementation
 
 repository::~repository() = default;
@@ -961,8 +1453,18 @@ repository::query(const uenv_label& label, bool partial_name) const {
     return impl_->query(label, partial_name);
 }
 
+util::expected<record_cursor, std::string>
+repository::cursor(const uenv_label& label, bool partial_name) const {
+    return impl_->cursor(label, partial_name);
+}
+
 util::expected<void, std::string> repository::add(const uenv_record& r) {
-    return impl_->add(r);
+    return impl_->add({&r, 1});
+}
+
+util::expected<void, std::string>
+repository::add_batch(const record_set& records) {
+    return impl_->add({records.begin(), records.end()});
 }
 
 util::expected<record_set, std::string>
@@ -990,4 +1492,31 @@ bool repository::contains(const uenv_record& r) const {
     return impl_->contains(r);
 }
 
+util::expected<int, std::string> repository::schema_version() const {
+    return impl_->schema_version();
+}
+
+util::expected<void, std::string> repository::upgrade_schema() {
+    return impl_->upgrade_schema();
+}
+
+void repository::refresh_index() const {
+    impl_->refresh_index();
+}
+
+void repository::defer_index_updates(bool defer) {
+    impl_->defer_index = defer;
+    if (!defer && impl_->index_stale) {
+        impl_->refresh_index();
+    }
+}
+
+util::expected<journal_mode, std::string> repository::journal() const {
+    return impl_->journal();
+}
+
+util::expected<void, std::string> repository::set_journal(journal_mode mode) {
+    return impl_->set_journal(mode);
+}
+
 } // namespace uenv
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <filesystem>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -38,6 +42,75 @@ class record_set {
     const_iterator cend() const;
 };
 
+// An input range over the records that match a repository query.
+// Records are read from the database as the cursor is advanced, in the same
+// order as they are returned by repository::query, so that the first results
+// can be used before the whole query has been evaluated.
+// If there is an error reading a record the range ends early, and error()
+// returns a description of the error.
+// A cursor must not outlive the repository that created it.
+struct record_cursor_impl;
+class record_cursor {
+  public:
+    class iterator {
+      public:
+        using value_type = uenv_record;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(record_cursor* c) : cursor_(c) {
+        }
+
+        const uenv_record& operator*() const {
+            return *cursor_->current();
+        }
+        const uenv_record* operator->() const {
+            return cursor_->current();
+        }
+        iterator& operator++() {
+            cursor_->next();
+            return *this;
+        }
+        void operator++(int) {
+            ++*this;
+        }
+        friend bool operator==(const iterator& i, std::default_sentinel_t) {
+            return i.at_end();
+        }
+
+      private:
+        bool at_end() const {
+            return !cursor_ || !cursor_->current();
+        }
+        record_cursor* cursor_ = nullptr;
+    };
+
+    record_cursor(std::unique_ptr<record_cursor_impl>);
+    record_cursor(record_cursor&&);
+    record_cursor& operator=(record_cursor&&);
+    ~record_cursor();
+
+    iterator begin() {
+        return iterator{this};
+    }
+    std::default_sentinel_t end() const {
+        return {};
+    }
+
+    // returns the error that ended the range, if any
+    std::optional<std::string> error() const;
+
+    // read all remaining records
+    util::expected<record_set, std::string> collect();
+
+  private:
+    // returns nullptr when there are no more records
+    const uenv_record* current() const;
+    void next();
+
+    std::unique_ptr<record_cursor_impl> impl_;
+};
+
 /// get the default location for the user's repository.
 /// - use $SCRATCH/.uenv-images if $SCRATCH is set
 /// - use $HOME/.uenv/images
@@ -62,6 +135,17 @@ repo_state validate_repository(const std::filesystem::path& repo_path);
 
 enum class repo_mode : std::uint8_t { readonly, readwrite };
 
+// the journal mode of the repository database.
+// - rollback: the default sqlite rollback journal.
+// - wal: write-ahead logging, which lets readers and a writer proceed
+//   concurrently. All processes that access the database must run on the same
+//   node, so it must not be used for repositories on shared file systems.
+enum class journal_mode : std::uint8_t { rollback, wal };
+
+// set the maximum time that operations on repository databases wait for locks
+// held by other processes before failing. The default is 30 seconds.
+void set_busy_timeout(std::chrono::milliseconds);
+
 struct repository_impl;
 struct repository {
   private:
@@ -94,12 +178,40 @@ struct repository {
     // label.name field, which is useful for `image ls`  `image find` searches.
     query(const uenv_label& label, bool partial_name = false) const;
 
+    // the same search as query, that returns a cursor over the results
+    util::expected<record_cursor, std::string>
+    cursor(const uenv_label& label, bool partial_name = false) const;
+
     bool contains(const uenv_record&) const;
 
     util::expected<void, std::string> add(const uenv_record&);
+    // add all records in a single transaction: either all of the records are
+    // added, or none are if there is an error.
+    util::expected<void, std::string> add_batch(const record_set&);
     util::expected<record_set, std::string> remove(const uenv_record&);
     util::expected<record_set, std::string> remove(const sha256&);
 
+    // return the schema version of the repository database
+    util::expected<int, std::string> schema_version() const;
+
+    // apply schema migrations to upgrade the database to the latest schema
+    // version. This is a noop if the schema is already up to date.
+    util::expected<void, std::string> upgrade_schema();
+
+    // rewrite the flat index of the repository (see flat_index.h), which is
+    // updated automatically when records are added or removed.
+    void refresh_index() const;
+
+    // defer the updates of the flat index while many records are added or
+    // removed one at a time, each of which would rewrite the whole index.
+    // The index is rewritten once when the updates are no longer deferred:
+    // until then it is stale, and queries read the database instead.
+    void defer_index_updates(bool defer);
+
+    // get and set the journal mode of the repository database
+    util::expected<journal_mode, std::string> journal() const;
+    util::expected<void, std::string> set_journal(journal_mode);
+
     // return true if the repository is readonly
     bool is_readonly() const;
 
@@ -127,6 +239,15 @@ create_repository(const std::filesystem::path& repo_path);
 
 util::expected<repository, std::string> create_repository();
 
+// the schema version of databases created by this version of uenv
+int latest_schema_version();
+
+// return the paths of the uenv image with sha256 in the repository at
+// repo_root: the same as repository::uenv_paths, without opening the
+// repository.
+repository::pathset uenv_paths(const std::filesystem::path& repo_root,
+                               const sha256&);
+
 } // namespace uenv
 
 template <> class fmt::formatter<uenv::repo_state> {
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <uenv/repository.h>
+#include <uenv/retention.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+namespace uenv {
+
+namespace {
+
+std::chrono::sys_seconds to_sys_seconds(const uenv_date& d) {
+    using namespace std::chrono;
+    return sys_days{year(d.year) / month(d.month) / day(d.day)} +
+           hours(d.hour) + minutes(d.minute) + seconds(d.second);
+}
+
+// the uenv that are versions of the same image
+auto image_key(const uenv_record& r) {
+    return std::tie(r.name, r.version, r.system, r.uarch);
+}
+
+} // namespace
+
+util::expected<retention_policy, std::string>
+parse_retention_policy(std::string_view arg) {
+    retention_policy policy;
+    while (!arg.empty()) {
+        const auto term = arg.substr(0, arg.find(','));
+        arg.remove_prefix(std::min(arg.size(), term.size() + 1));
+
+        unsigned n = 0;
+        const auto [end, ec] =
+            std::from_chars(term.data(), term.data() + term.size(), n);
+        const auto unit = std::string_view(end, term.data() + term.size());
+        if (ec != std::errc{} || unit.size() > 1) {
+            return util::unexpected(fmt::format(
+                "invalid retention policy '{}': expected a number of tags, "
+                "or an age like 30d",
+                term));
+        }
+        if (unit.empty()) {
+            if (policy.newest) {
+                return util::unexpected(
+                    fmt::format("the number of tags to retain is repeated"));
+            }
+            policy.newest = n;
+            continue;
+        }
+        if (policy.max_age) {
+            return util::unexpected(
+                fmt::format("the age to retain is repeated"));
+        }
+        using namespace std::chrono;
+        switch (unit[0]) {
+        case 's':
+            policy.max_age = seconds(n);
+            break;
+        case 'm':
+            policy.max_age = minutes(n);
+            break;
+        case 'h':
+            policy.max_age = hours(n);
+            break;
+        case 'd':
+            policy.max_age = days(n);
+            break;
+        case 'w':
+            policy.max_age = weeks(n);
+            break;
+        default:
+            return util::unexpected(fmt::format(
+                "invalid unit '{}' in retention policy: use one of s, m, h, "
+                "d, w",
+                unit));
+        }
+    }
+    if (!policy.newest && !policy.max_age) {
+        return util::unexpected("the retention policy is empty");
+    }
+    return policy;
+}
+
+std::vector<uenv_record> retention_plan(const record_set& records,
+                                        const retention_policy& policy,
+                                        std::chrono::sys_seconds now) {
+    std::vector<uenv_record> sorted(records.begin(), records.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& l, auto& r) {
+        if (image_key(l) != image_key(r)) {
+            return image_key(l) < image_key(r);
+        }
+        return std::tie(l.date, l.tag) > std::tie(r.date, r.tag);
+    });
+
+    std::vector<uenv_record> plan;
+    unsigned rank = 0;
+    for (std::size_t i = 0; i < sorted.size(); ++i) {
+        const auto& r = sorted[i];
+        rank = (i > 0 && image_key(sorted[i - 1]) == image_key(r)) ? rank + 1
+                                                                   : 0;
+        const bool keep_newest = policy.newest && rank < *policy.newest;
+        const bool keep_young =
+            policy.max_age && to_sys_seconds(r.date) + *policy.max_age > now;
+        if (!keep_newest && !keep_young) {
+            plan.push_back(r);
+        }
+    }
+    return plan;
+}
+
+} // namespace uenv
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+
+// Retention policies for namespaces of the registry, e.g. the build namespace,
+// which accumulates an image for every pipeline run.
+
+namespace uenv {
+
+// The uenv to keep in a namespace: a uenv is kept if either of the rules
+// keeps it, and deleted otherwise.
+struct retention_policy {
+    // keep the newest tags of each name/version on each system and uarch
+    std::optional<unsigned> newest;
+    // keep uenv that were created less than max_age ago
+    std::optional<std::chrono::seconds> max_age;
+};
+
+// parse a retention policy, which is a comma separated list of
+//   N: keep the newest N tags
+//   N{s,m,h,d,w}: keep uenv younger than N seconds, minutes, ... weeks
+// e.g. "5", "30d" or "5,30d"
+util::expected<retention_policy, std::string>
+parse_retention_policy(std::string_view arg);
+
+// the records that the policy deletes, at the time now, ordered by
+// name/version, system, uarch and newest first
+std::vector<uenv_record> retention_plan(const record_set& records,
+                                        const retention_policy& policy,
+                                        std::chrono::sys_seconds now);
+
+} // namespace uenv
@@ -0,0 +1,84 @@
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/pull_lock.h>
+#include <uenv/repository.h>
+#include <uenv/seed.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+#include <util/fs.h>
+
+namespace uenv {
+
+util::expected<std::optional<seed_result>, std::string>
+seed_image(const std::vector<std::filesystem::path>& seeds, const sha256& sha,
+           std::uint64_t size, const repository::pathset& dst) {
+    namespace fs = std::filesystem;
+
+    for (auto& seed : seeds) {
+        const auto src = uenv_paths(seed, sha);
+        std::error_code ec;
+        if (fs::equivalent(src.squashfs, dst.squashfs, ec)) {
+            continue;
+        }
+        const auto src_size = fs::file_size(src.squashfs, ec);
+        if (ec) {
+            spdlog::trace("seed_image: {} not in {}", sha, seed);
+            continue;
+        }
+        if (size && src_size != size) {
+            spdlog::warn("seed_image: {} has size {}, expected {}",
+                         src.squashfs, src_size, size);
+            continue;
+        }
+
+        // the seed repository may be read only, in which case the image is
+        // copied without a lock if there is no lock file. An image that is
+        // being pulled into the seed repository is not used.
+        auto lock = util::make_file_lock(src.store.string() + ".lock",
+                                         util::lock_type::shared,
+                                         read_lock_timeout);
+        if (!lock && fs::exists(src.store.string() + ".lock")) {
+            spdlog::warn("seed_image: {} is not used: {}", src.squashfs,
+                         lock.error());
+            continue;
+        }
+
+        spdlog::info("seed_image: copying {} from {}", sha, seed);
+        fs::create_directories(dst.store, ec);
+        auto method = util::clone_file(src.squashfs, dst.squashfs);
+        if (!method) {
+            return util::unexpected(method.error());
+        }
+        seed_result result{.repo = seed, .method = *method};
+
+        // the meta data directory is small, and is copied into a temporary
+        // path that is moved into place, so that it is never partial
+        if (!fs::exists(dst.meta) && fs::is_directory(src.meta)) {
+            auto tmp = dst.meta;
+            tmp += ".seed";
+            fs::remove_all(tmp, ec);
+            fs::copy(src.meta, tmp, fs::copy_options::recursive, ec);
+            if (!ec) {
+                fs::rename(tmp, dst.meta, ec);
+            }
+            if (ec) {
+                spdlog::warn("seed_image: unable to copy {}: {}", src.meta,
+                             ec.message());
+                fs::remove_all(tmp, ec);
+            } else {
+                result.meta = true;
+            }
+        }
+        return result;
+    }
+    return std::nullopt;
+}
+
+} // namespace uenv
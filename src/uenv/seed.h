@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/expected.h>
+#include <util/fs.h>
+
+// Images are stored in a repository by their sha256, so an image that is
+// already in another repository on the system, e.g. a site-wide read-only
+// repository, a project repository or an old repository of the user, can be
+// copied into the repository instead of being downloaded.
+
+namespace uenv {
+
+struct seed_result {
+    // the repository that the image was copied from
+    std::filesystem::path repo;
+    // how the squashfs image was copied
+    util::clone_method method;
+    // whether the meta data was copied
+    bool meta = false;
+};
+
+// search the seed repositories in order for the squashfs image with sha256,
+// and copy the first that is found, and its meta data if it is not in dst,
+// into the store of dst.
+// An image is only used if its size matches size, unless size is zero.
+// Returns nullopt if none of the seed repositories has the image.
+util::expected<std::optional<seed_result>, std::string>
+seed_image(const std::vector<std::filesystem::path>& seeds, const sha256& sha,
+           std::uint64_t size, const repository::pathset& dst);
+
+} // namespace uenv
@@ -1,4 +1,5 @@
 #include "util/expected.h"
+#include <charconv>
 #include <filesystem>
 #include <fstream>
 #include <optional>
@@ -27,6 +28,33 @@ const std::string config_file_default =
 # by default uenv will choose whether to use color based on your environment.
 #color=true
 #color=false
+
+# the time in seconds to wait for another uenv process that has locked the
+# repository database, e.g. when many jobs pull images at the same time.
+#busy_timeout = 30
+
+# the time in seconds for which a listing of the registry cached in
+# $XDG_CACHE_HOME/uenv is used by 'uenv image find' and 'uenv image pull'
+# without checking the registry for changes. Set to 0 to always check.
+#listing_ttl = 60
+
+# the maximum number of connections used to download an image from the
+# registry. Large images are downloaded in chunks over several connections,
+# and the number of connections is increased while it improves throughput.
+#download_streams = 8
+
+# a colon separated list of other uenv repositories, e.g. a site-wide or a
+# project repository, that are searched for an image before it is downloaded.
+# Images that are found are copied, or linked if possible, into the repo.
+#seed_repos = /capstor/store/cscs/uenv:${HOME}/.uenv/repo
+
+# comma separated lists of mirrors of the registry and of the listing service,
+# e.g. pull-through caches close to the system. Images and listings are
+# fetched from whichever of the service and its mirrors responds fastest, and
+# pulls fail over to the next mirror if one becomes unreachable. Images are
+# only pushed to the registry itself.
+#registry_mirrors = registry-cache.example.com/uenv
+#listing_mirrors = https://uenv-list-mirror.example.com/list
 )";
 
 // merge two config_base items
@@ -40,7 +68,25 @@ config_base merge(const config_base& lhs, const config_base& rhs) {
                                  : std::nullopt,
             .elastic_config = lhs.elastic_config   ? lhs.elastic_config
                               : rhs.elastic_config ? rhs.elastic_config
-                                                   : std::nullopt};
+                                                   : std::nullopt,
+            .busy_timeout = lhs.busy_timeout   ? lhs.busy_timeout
+                            : rhs.busy_timeout ? rhs.busy_timeout
+                                               : std::nullopt,
+            .listing_ttl = lhs.listing_ttl   ? lhs.listing_ttl
+                           : rhs.listing_ttl ? rhs.listing_ttl
+                                             : std::nullopt,
+            .download_streams = lhs.download_streams   ? lhs.download_streams
+                                : rhs.download_streams ? rhs.download_streams
+                                                       : std::nullopt,
+            .seed_repos = lhs.seed_repos   ? lhs.seed_repos
+                          : rhs.seed_repos ? rhs.seed_repos
+                                           : std::nullopt,
+            .registry_mirrors = lhs.registry_mirrors   ? lhs.registry_mirrors
+                                : rhs.registry_mirrors ? rhs.registry_mirrors
+                                                       : std::nullopt,
+            .listing_mirrors = lhs.listing_mirrors   ? lhs.listing_mirrors
+                               : rhs.listing_mirrors ? rhs.listing_mirrors
+                                                     : std::nullopt};
 }
 
 config_base default_config(const envvars::state& env) {
@@ -107,6 +153,35 @@ configuration generate_configuration(const config_base& base) {
 
     config.elastic_config = base.elastic_config;
 
+    config.busy_timeout = base.busy_timeout;
+    config.listing_ttl = base.listing_ttl;
+    config.download_streams = base.download_streams;
+
+    if (base.seed_repos) {
+        for (auto& p : util::split(*base.seed_repos, ':', true)) {
+            if (auto path = parse_path(p)) {
+                config.seed_repos.push_back(path.value());
+            } else {
+                spdlog::warn("invalid seed repo path {}",
+                             path.error().message());
+            }
+        }
+    }
+
+    auto mirrors = [](const std::optional<std::string>& list) {
+        std::vector<std::string> urls;
+        if (list) {
+            for (auto& url : util::split(*list, ',', true)) {
+                if (auto u = util::strip(url); !u.empty()) {
+                    urls.push_back(std::move(u));
+                }
+            }
+        }
+        return urls;
+    };
+    config.registry_mirrors = mirrors(base.registry_mirrors);
+    config.listing_mirrors = mirrors(base.listing_mirrors);
+
     return config;
 }
 
@@ -274,8 +349,39 @@ read_config_file(const std::filesystem::path& path,
                                 "muste be true or false",
                                 key, value));
             }
+        } else if (key == "seed_repos") {
+            config.seed_repos =
+                calling_env.expand(value, envvars::expand_delim::curly);
+        } else if (key == "registry_mirrors") {
+            config.registry_mirrors = value;
+        } else if (key == "listing_mirrors") {
+            config.listing_mirrors = value;
         } else if (key == "elasticsearch") {
             config.elastic_config = value;
+        } else if (key == "busy_timeout" || key == "listing_ttl") {
+            unsigned seconds;
+            auto [ptr, ec] = std::from_chars(
+                value.data(), value.data() + value.size(), seconds);
+            if (ec != std::errc{} || ptr != value.data() + value.size()) {
+                return util::unexpected(
+                    fmt::format("invalid configuration value '{}={}': "
+                                "{} must be a non-negative integer",
+                                key, value, key));
+            }
+            (key == "busy_timeout" ? config.busy_timeout
+                                   : config.listing_ttl) = seconds;
+        } else if (key == "download_streams") {
+            unsigned streams;
+            auto [ptr, ec] = std::from_chars(
+                value.data(), value.data() + value.size(), streams);
+            if (ec != std::errc{} || ptr != value.data() + value.size() ||
+                streams == 0) {
+                return util::unexpected(
+                    fmt::format("invalid configuration value '{}={}': "
+                                "{} must be a positive integer",
+                                key, value, key));
+            }
+            config.download_streams = streams;
         } else {
             return util::unexpected(
                 fmt::format("invalid configuration parameter '{}'", key));
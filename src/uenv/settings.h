@@ -3,6 +3,7 @@
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <util/envvars.h>
 
@@ -12,6 +13,20 @@ struct config_base {
     std::optional<std::string> repo;
     std::optional<bool> color;
     std::optional<std::string> elastic_config;
+    // seconds to wait for a locked repository database
+    std::optional<unsigned> busy_timeout;
+    // seconds for which a cached registry listing is used without
+    // revalidation
+    std::optional<unsigned> listing_ttl;
+    // the maximum number of connections used to download an image
+    std::optional<unsigned> download_streams;
+    // a colon separated list of repositories that are searched for an image
+    // before it is downloaded
+    std::optional<std::string> seed_repos;
+    // comma separated lists of mirrors of the registry and of the listing
+    // service
+    std::optional<std::string> registry_mirrors;
+    std::optional<std::string> listing_mirrors;
 };
 
 // the result of parsing a line in a configuration file
@@ -37,6 +52,12 @@ struct configuration {
     std::optional<std::filesystem::path> repo;
     bool color;
     std::optional<std::string> elastic_config;
+    std::optional<unsigned> busy_timeout;
+    std::optional<unsigned> listing_ttl;
+    std::optional<unsigned> download_streams;
+    std::vector<std::filesystem::path> seed_repos;
+    std::vector<std::string> registry_mirrors;
+    std::vector<std::string> listing_mirrors;
     configuration& operator=(const configuration&) = default;
 };
 
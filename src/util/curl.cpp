@@ -1,10 +1,17 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <spdlog/spdlog.h>
+#include <unistd.h>
 
 #include <filesystem>
 #include <util/curl.h>
@@ -31,6 +38,131 @@ std::string http_message(long code) {
     return messages.count(code) ? messages.at(code) : default_message;
 }
 
+std::string escape(std::string_view in) {
+    std::string out;
+    for (unsigned char c : in) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += c;
+        } else {
+            out += fmt::format("%{:02X}", c);
+        }
+    }
+    return out;
+}
+
+namespace {
+
+// the process-wide HTTP client: a share for DNS and TLS session caches, and a
+// pool of idle easy handles, which keep their connections open.
+struct client {
+    // keep enough idle handles for the parallel transfers in a pull
+    static constexpr std::size_t max_idle = 16;
+
+    const pid_t pid = getpid();
+    CURLSH* share = nullptr;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> locks;
+    std::mutex pool_mutex;
+    std::vector<CURL*> pool;
+
+    client() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        share = curl_share_init();
+        if (!share) {
+            return;
+        }
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        // the connection cache is not shared, because libcurl does not
+        // support handles that use a shared connection cache concurrently in
+        // different threads. Instead, each handle in the pool keeps its
+        // connections open for the next request made with it.
+    }
+
+    ~client() {
+        for (auto h : pool) {
+            curl_easy_cleanup(h);
+        }
+        if (share) {
+            curl_share_cleanup(share);
+        }
+    }
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* c) {
+        static_cast<client*>(c)->locks[data].lock();
+    }
+    static void unlock(CURL*, curl_lock_data data, void* c) {
+        static_cast<client*>(c)->locks[data].unlock();
+    }
+
+    CURL* get() {
+        {
+            std::lock_guard _(pool_mutex);
+            if (!pool.empty()) {
+                auto h = pool.back();
+                pool.pop_back();
+                return h;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    void put(CURL* h) {
+        curl_easy_reset(h);
+        std::lock_guard _(pool_mutex);
+        if (pool.size() < max_idle) {
+            pool.push_back(h);
+        } else {
+            curl_easy_cleanup(h);
+        }
+    }
+};
+
+std::mutex client_mutex;
+std::unique_ptr<client> client_g;
+
+client& get_client() {
+    std::lock_guard _(client_mutex);
+    if (!client_g) {
+        client_g = std::make_unique<client>();
+    } else if (client_g->pid != getpid()) {
+        // a child process must not use the connections of its parent, which
+        // are still in use by the parent: abandon them without cleaning up,
+        // which would close the parent's TLS sessions.
+        client_g.release();
+        client_g = std::make_unique<client>();
+    }
+    return *client_g;
+}
+
+} // namespace
+
+handle::~handle() {
+    if (h_) {
+        get_client().put(h_);
+    }
+}
+
+expected<handle, error> acquire() {
+    auto& c = get_client();
+    auto h = c.get();
+    if (!h) {
+        return unexpected{
+            error{CURLE_FAILED_INIT, "unable to initialise curl"}};
+    }
+    if (c.share) {
+        curl_easy_setopt(h, CURLOPT_SHARE, c.share);
+    }
+    // use HTTP/2 for https connections to servers that support it. Each
+    // handle has its own connections, so concurrent requests made with
+    // different handles are not multiplexed on one connection.
+    curl_easy_setopt(h, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+    return handle{h};
+}
+
 #define CURL_EASY(CMD)                                                         \
     if (auto rval__ = CMD; rval__ != CURLE_OK) {                               \
         return util::unexpected(error{rval__, errbuf});                        \
@@ -54,13 +186,14 @@ expected<std::string, error> post(const std::string& data, std::string url,
     errbuf[0] = 0;
     spdlog::trace("curl::post enter");
 
-    CURL* h = curl_easy_init();
-    if (!h) {
-        return unexpected{
-            error{CURLE_FAILED_INIT, "unable to initialise curl"}};
+    auto handle = acquire();
+    if (!handle) {
+        return unexpected{handle.error()};
     }
-    auto _ = defer([h]() { curl_easy_cleanup(h); });
-    spdlog::trace("curl::upload easy init");
+    CURL* h = handle->get();
+    struct curl_slist* headers = nullptr;
+    auto _ = defer([&headers]() { curl_slist_free_all(headers); });
+    spdlog::trace("curl::post acquired handle");
 
     // configure error message buffer
     CURL_EASY(curl_easy_setopt(h, CURLOPT_ERRORBUFFER, errbuf));
@@ -73,11 +206,12 @@ expected<std::string, error> post(const std::string& data, std::string url,
     spdlog::trace("curl::post set data {}", data);
     // Headers
     if (content_type) {
-        struct curl_slist* headers = NULL;
         headers = curl_slist_append(
             headers, fmt::format("Content-Type: {}", *content_type).c_str());
         CURL_EASY(curl_easy_setopt(h, CURLOPT_HTTPHEADER, headers));
     }
+    // accept compressed responses, using all encodings supported by libcurl
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, ""));
 
     // Set callback function to capture response
     CURL_EASY(curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, memory_callback));
@@ -100,51 +234,279 @@ expected<std::string, error> post(const std::string& data, std::string url,
     return std::string{result.data(), result.data() + result.size()};
 }
 
+size_t header_callback(char* source, size_t size, size_t n, void* target) {
+    const size_t realsize = size * n;
+    auto& headers =
+        *static_cast<std::unordered_map<std::string, std::string>*>(target);
+    std::string_view line(source, realsize);
+
+    // the status line of each response starts a new set of headers, e.g.
+    // after following a redirect
+    if (line.starts_with("HTTP/")) {
+        headers.clear();
+        return realsize;
+    }
+    const auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return realsize;
+    }
+    std::string name(line.substr(0, colon));
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    auto value = line.substr(colon + 1);
+    while (!value.empty() && std::isspace((unsigned char)value.front())) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && std::isspace((unsigned char)value.back())) {
+        value.remove_suffix(1);
+    }
+    headers[name] = std::string(value);
+
+    return realsize;
+}
+
 expected<std::string, error> get(std::string url) {
+    auto r = get(std::move(url), {});
+    if (!r) {
+        return unexpected{r.error()};
+    }
+    return std::move(r->body);
+}
+
+// the target of the write callback for get requests with a sink
+struct sink_target {
+    CURL* handle;
+    const sink_type& sink;
+    // the body of a response with an error status, which is not passed to
+    // the sink
+    std::vector<char> body;
+    std::size_t size = 0;
+    // the first byte of a range request, and the headers of the response
+    std::optional<std::uint64_t> range_first = std::nullopt;
+    const std::unordered_map<std::string, std::string>* headers = nullptr;
+    bool checked_range = false;
+    bool range_error = false;
+};
+
+// returns true if the response to a range request is the requested range,
+// i.e. it has status 206 and a header "Content-Range: bytes <first>-..."
+bool check_range(const sink_target& t, long status) {
+    if (status != 206) {
+        return false;
+    }
+    const auto it = t.headers->find("content-range");
+    return it != t.headers->end() &&
+           it->second.starts_with(fmt::format("bytes {}-", *t.range_first));
+}
+
+size_t sink_callback(void* source, size_t size, size_t n, void* target) {
+    const size_t realsize = size * n;
+    auto& t = *static_cast<sink_target*>(target);
+    t.size += realsize;
+
+    // the headers have been received when the first data is written
+    long status = 0;
+    curl_easy_getinfo(t.handle, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 300) {
+        char* src = static_cast<char*>(source);
+        t.body.insert(t.body.end(), src, src + realsize);
+        return realsize;
+    }
+    // servers may ignore the Range header and return the whole body
+    if (t.range_first && !t.checked_range) {
+        t.checked_range = true;
+        if (!check_range(t, status)) {
+            t.range_error = true;
+            return 0;
+        }
+    }
+
+    // returning a value other than realsize aborts the transfer
+    return t.sink({static_cast<char*>(source), realsize}) ? realsize : 0;
+}
+
+expected<response, error> get(std::string url,
+                              const std::vector<std::string>& headers) {
+    std::vector<char> result;
+    // when this was written, calls to the jfrog API returned roughly 100k
+    // bytes
+    result.reserve(200000);
+    auto r = get(std::move(url), headers, [&result](std::string_view data) {
+        result.insert(result.end(), data.begin(), data.end());
+        return true;
+    });
+    if (r && r->body.empty()) {
+        r->body = std::string{result.data(), result.data() + result.size()};
+    }
+    return r;
+}
+
+expected<response, error> get(std::string url,
+                              const std::vector<std::string>& headers,
+                              const sink_type& sink) {
+    // set a reasonable time out - wait 4 seconds for connection, and no more
+    // than 5 seconds for the whole operation.
+    return perform({.url = std::move(url),
+                    .headers = headers,
+                    .follow_redirects = false,
+                    .connect_timeout_ms = 4000L,
+                    .timeout_ms = 5000L},
+                   sink);
+}
+
+int progress_callback(void* target, curl_off_t dltotal, curl_off_t dlnow,
+                      curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal;
+    (void)ultotal;
+    auto& progress = *static_cast<const progress_type*>(target);
+    // returning a non-zero value aborts the transfer
+    return progress(dlnow, ulnow) ? 0 : 1;
+}
+
+size_t source_callback(char* target, size_t size, size_t n, void* source) {
+    return (*static_cast<const source_type*>(source))(target, size * n);
+}
+
+expected<response, error> perform(const request& req, const sink_type& sink,
+                                  const progress_type& progress) {
     char errbuf[CURL_ERROR_SIZE];
     errbuf[0] = 0;
 
-    auto h = curl_easy_init();
-    if (!h) {
-        return unexpected{
-            error{CURLE_FAILED_INIT, "unable to initialise curl"}};
+    auto handle = acquire();
+    if (!handle) {
+        return unexpected{handle.error()};
     }
-    auto _ = defer([h]() { curl_easy_cleanup(h); });
+    CURL* h = handle->get();
+    struct curl_slist* header_list = nullptr;
+    auto _ = defer([&header_list]() { curl_slist_free_all(header_list); });
 
     CURL_EASY(curl_easy_setopt(h, CURLOPT_ERRORBUFFER, errbuf));
 
-    CURL_EASY(curl_easy_setopt(h, CURLOPT_URL, url.c_str()));
-    spdlog::trace("curl::get set url {}", url);
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_URL, req.url.c_str()));
+    spdlog::trace("curl::perform {} {}", req.method, req.url);
 
-    // send all data to this function
-    CURL_EASY(curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, memory_callback));
-    spdlog::trace("curl::get set memory callback");
+    for (auto& header : req.headers) {
+        header_list = curl_slist_append(header_list, header.c_str());
+    }
+    if (header_list) {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_HTTPHEADER, header_list));
+    }
+    if (req.compressed) {
+        // accept compressed responses, e.g. the JSON listings, using all
+        // encodings supported by libcurl (gzip, zstd, ...)
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, ""));
+    }
+    if (req.follow_redirects) {
+        // libcurl does not send the Authorization header to other hosts
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_FOLLOWLOCATION, 1L));
+    }
 
-    // we pass our 'chunk' struct to the callback function
+    // the body of the request
+    FILE* file = nullptr;
+    auto close_file = defer([&file]() {
+        if (file) {
+            fclose(file);
+        }
+    });
+    if (req.file) {
+        file = fopen(req.file->c_str(), "rb");
+        if (!file) {
+            return unexpected{error{
+                CURLE_READ_ERROR,
+                fmt::format("unable to open {}", req.file->string())}};
+        }
+        std::error_code ec;
+        const curl_off_t size = std::filesystem::file_size(*req.file, ec);
+        if (ec) {
+            return unexpected{error{CURLE_READ_ERROR, ec.message()}};
+        }
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_UPLOAD, 1L));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_READDATA, file));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_INFILESIZE_LARGE, size));
+    } else if (req.source) {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_UPLOAD, 1L));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_READFUNCTION, source_callback));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_READDATA, &req.source));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_INFILESIZE_LARGE,
+                                   curl_off_t(req.size)));
+    } else if (req.data) {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_POSTFIELDS, req.data->data()));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE_LARGE,
+                                   curl_off_t(req.data->size())));
+    }
+    if (req.method == "HEAD") {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_NOBODY, 1L));
+    } else if (!(req.method == "GET" && !req.file && !req.data) &&
+               !(req.method == "POST" && req.data) &&
+               !(req.method == "PUT" && (req.file || req.source))) {
+        CURL_EASY(
+            curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, req.method.c_str()));
+    }
+
+    // pass the data to the sink as it is received
     std::vector<char> result;
-    // when this was written, calls to the jfrog API returned roughly 100k
-    // bytes
-    result.reserve(200000);
-    CURL_EASY(curl_easy_setopt(h, CURLOPT_WRITEDATA, (void*)&result));
-    spdlog::trace("curl::get set memory target");
+    const sink_type store = [&result](std::string_view data) {
+        result.insert(result.end(), data.begin(), data.end());
+        return true;
+    };
+    response r;
+    sink_target target{.handle = h, .sink = sink ? sink : store};
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, sink_callback));
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_WRITEDATA, (void*)&target));
+
+    std::string range;
+    if (req.range) {
+        range = req.range->last
+                    ? fmt::format("{}-{}", req.range->first, *req.range->last)
+                    : fmt::format("{}-", req.range->first);
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_RANGE, range.c_str()));
+        target.range_first = req.range->first;
+        target.headers = &r.headers;
+    }
+
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, header_callback));
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_HEADERDATA, (void*)&r.headers));
+
+    if (progress) {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0L));
+        CURL_EASY(
+            curl_easy_setopt(h, CURLOPT_XFERINFOFUNCTION, progress_callback));
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_XFERINFODATA, &progress));
+    }
 
     // some servers do not like requests that are made without a user-agent
     // field, so we provide one
     CURL_EASY(curl_easy_setopt(h, CURLOPT_USERAGENT, "libcurl-agent/1.0"));
-    spdlog::trace("curl::get set user agent");
 
-    // set a reasonable time out - wait 1 second for connection, and no more
-    // than 2 seconds for the whole operation.
-    CURL_EASY(curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS, 4000L));
-    CURL_EASY(curl_easy_setopt(h, CURLOPT_TIMEOUT_MS, 5000L));
-    spdlog::trace("curl::get set timeout");
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS,
+                               req.connect_timeout_ms));
+    CURL_EASY(curl_easy_setopt(h, CURLOPT_TIMEOUT_MS, req.timeout_ms));
+    if (req.stall_timeout_s) {
+        CURL_EASY(curl_easy_setopt(h, CURLOPT_LOW_SPEED_LIMIT, 1L));
+        CURL_EASY(
+            curl_easy_setopt(h, CURLOPT_LOW_SPEED_TIME, req.stall_timeout_s));
+    }
 
-    CURL_EASY(curl_easy_perform(h));
+    if (auto rc = curl_easy_perform(h); rc != CURLE_OK) {
+        if (target.range_error) {
+            return unexpected(error{CURLE_RANGE_ERROR,
+                                    "the server does not support ranges"});
+        }
+        return unexpected(error{rc, errbuf});
+    }
 
-    spdlog::trace("curl::get finished and retrieved data of size {}",
-                  result.size());
+    CURL_EASY(curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &r.status));
+    spdlog::trace("curl::perform finished with status {} and retrieved data "
+                  "of size {}",
+                  r.status, target.size);
 
-    return std::string{result.data(), result.data() + result.size()};
+    if (!target.body.empty()) {
+        r.body = std::string{target.body.data(),
+                             target.body.data() + target.body.size()};
+    } else if (!sink) {
+        r.body = std::string{result.data(), result.data() + result.size()};
+    }
+    return r;
 }
 
 expected<std::string, error> upload(std::string url,
@@ -159,14 +521,14 @@ expected<std::string, error> upload(std::string url,
         return unexpected{error{CURLE_FAILED_INIT, "Failed to open file"}};
     }
 
-    // Initialize curl
-    auto h = curl_easy_init();
-    if (!h) {
-        return unexpected{
-            error{CURLE_FAILED_INIT, "Unable to initialize curl."}};
+    auto _ = defer([file]() { fclose(file); });
+
+    auto handle = acquire();
+    if (!handle) {
+        return unexpected{handle.error()};
     }
-    auto _ = defer([h]() { curl_easy_cleanup(h); });
-    spdlog::trace("curl::upload easy init");
+    CURL* h = handle->get();
+    spdlog::trace("curl::upload acquired handle");
 
     // configure error message buffer
     CURL_EASY(curl_easy_setopt(h, CURLOPT_ERRORBUFFER, errbuf));
@@ -215,9 +577,6 @@ expected<std::string, error> upload(std::string url,
     CURL_EASY(curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &http_code));
     spdlog::trace("curl::upload http_code: {}", http_code);
 
-    // Clean up
-    fclose(file);
-
     // store stdout
     std::string curl_stdout{result.data(), result.data() + result.size()};
 
@@ -236,12 +595,11 @@ expected<void, error> del(std::string url, std::string username,
     char errbuf[CURL_ERROR_SIZE];
     errbuf[0] = 0;
 
-    auto h = curl_easy_init();
-    if (!h) {
-        return unexpected{
-            error{CURLE_FAILED_INIT, "unable to initialise curl"}};
+    auto handle = acquire();
+    if (!handle) {
+        return unexpected{handle.error()};
     }
-    auto _ = defer([h]() { curl_easy_cleanup(h); });
+    CURL* h = handle->get();
 
     CURL_EASY(curl_easy_setopt(h, CURLOPT_ERRORBUFFER, errbuf));
 
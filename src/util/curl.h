@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <util/expected.h>
 
@@ -17,8 +22,41 @@ struct error {
     std::string message;
 };
 
+// An easy handle from the pool of the process-wide HTTP client.
+// The handles of the client share a DNS cache and TLS sessions, and keep
+// their connections open when they are returned to the pool, so that requests
+// to a server that has already been contacted skip name resolution, and reuse
+// an open connection or resume the TLS session.
+// The options of the handle are reset and the handle is returned to the pool
+// when it goes out of scope.
+class handle {
+  public:
+    explicit handle(CURL* h) : h_(h) {
+    }
+    handle(handle&& other) noexcept : h_(other.h_) {
+        other.h_ = nullptr;
+    }
+    handle(const handle&) = delete;
+    handle& operator=(const handle&) = delete;
+    ~handle();
+
+    CURL* get() const {
+        return h_;
+    }
+
+  private:
+    CURL* h_;
+};
+
+// get a handle from the pool, configured to use the shared DNS and TLS
+// session caches, HTTP/2 when the server supports it, and TCP keep-alive.
+expected<handle, error> acquire();
+
 std::string curl_get(std::string url);
 
+// percent-encode a string for use in a URL
+std::string escape(std::string_view in);
+
 expected<std::string, error>
 post(const std::string& data, std::string url,
      std::optional<std::string> content_type = std::nullopt,
@@ -26,6 +64,77 @@ post(const std::string& data, std::string url,
 
 expected<std::string, error> get(std::string url);
 
+struct response {
+    long status;
+    // the response headers, with lower case names
+    std::unordered_map<std::string, std::string> headers;
+    std::string body;
+};
+
+// perform a GET request with additional request headers, e.g.
+// "If-None-Match: <etag>".
+// Unlike get(url), the HTTP status and headers of the response are returned,
+// and responses with an HTTP error status are not an error.
+expected<response, error> get(std::string url,
+                              const std::vector<std::string>& headers);
+
+// perform a GET request, passing the body of a successful response to sink as
+// it is received, instead of storing it in response::body. The transfer is
+// aborted if sink returns false.
+using sink_type = std::function<bool(std::string_view)>;
+expected<response, error> get(std::string url,
+                              const std::vector<std::string>& headers,
+                              const sink_type& sink);
+
+// reads up to n bytes of the body of a request into a buffer, and returns the
+// number of bytes read
+using source_type = std::function<std::size_t(char*, std::size_t n)>;
+
+// the bytes [first, last] of a resource, or [first, end) if last is not set
+struct byte_range {
+    std::uint64_t first;
+    std::optional<std::uint64_t> last = std::nullopt;
+};
+
+// a request made by perform()
+struct request {
+    std::string method = "GET";
+    std::string url;
+    // additional request headers, e.g. "Authorization: Bearer <token>"
+    std::vector<std::string> headers;
+    // the body of the request: a string, the contents of a file,
+    std::optional<std::string> data = std::nullopt;
+    std::optional<std::filesystem::path> file = std::nullopt;
+    // or size bytes read from a source
+    source_type source = {};
+    std::uint64_t size = 0;
+    // request a range of the resource. If the server does not respond with
+    // the range, e.g. because it does not support range requests, the
+    // request fails with CURLE_RANGE_ERROR.
+    std::optional<byte_range> range = std::nullopt;
+    // follow redirects, e.g. registries redirect blob downloads to storage
+    bool follow_redirects = true;
+    // accept compressed responses
+    bool compressed = true;
+    long connect_timeout_ms = 5000;
+    // the time limit for the whole request: 0 for no limit
+    long timeout_ms = 0;
+    // abort transfers that stall, i.e. that transfer no data for this long
+    long stall_timeout_s = 60;
+};
+
+// called regularly during a transfer with the number of bytes downloaded and
+// uploaded so far. The transfer is aborted if it returns false.
+using progress_type = std::function<bool(std::uint64_t, std::uint64_t)>;
+
+// perform a request, and return the HTTP status, headers and body of the
+// response. If a sink is provided, the body of a successful response is
+// passed to the sink instead of being stored in response::body.
+// responses with an HTTP error status are not an error.
+expected<response, error> perform(const request& req,
+                                  const sink_type& sink = {},
+                                  const progress_type& progress = {});
+
 expected<std::string, error> upload(std::string url,
                                     std::filesystem::path file_name);
 
@@ -1,16 +1,26 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <deque>
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <linux/fs.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <fmt/std.h>
 #include <spdlog/spdlog.h>
 
+#include "defer.h"
 #include "expected.h"
 #include "fs.h"
 #include "subprocess.h"
@@ -135,12 +145,15 @@ file_creation_date(const std::filesystem::path& path) {
 }
 
 util::expected<file_lock, std::string>
-make_file_lock(const std::filesystem::path& path) {
-    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+make_file_lock(const std::filesystem::path& path, lock_type type) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd == -1 && type == lock_type::shared) {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
     if (fd == -1) {
         return unexpected{"unable to open file for locking"};
     }
-    if (flock(fd, LOCK_EX) != 0) {
+    if (flock(fd, type == lock_type::shared ? LOCK_SH : LOCK_EX) != 0) {
         close(fd);
         return unexpected{"unable to aquire file lock"};
     }
@@ -148,6 +161,40 @@ make_file_lock(const std::filesystem::path& path) {
     return file_lock{fd};
 }
 
+util::expected<file_lock, std::string>
+make_file_lock(const std::filesystem::path& path, lock_type type,
+               std::chrono::milliseconds timeout) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd == -1 && type == lock_type::shared) {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        return unexpected{"unable to open file for locking"};
+    }
+    const int operation =
+        (type == lock_type::shared ? LOCK_SH : LOCK_EX) | LOCK_NB;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (flock(fd, operation) != 0) {
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            close(fd);
+            return unexpected{"unable to aquire file lock"};
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            close(fd);
+            return unexpected{fmt::format(
+                "timed out after {} ms waiting for a lock on {}",
+                timeout.count(), path.string())};
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    return file_lock{fd};
+}
+
+file_lock adopt_file_lock(int fd) {
+    return file_lock{fd};
+}
+
 // Allow move semantics
 file_lock::file_lock(file_lock&& other) noexcept : fd(other.fd) {
     other.fd = -1;
@@ -174,38 +221,138 @@ void file_lock::release() {
     }
 }
 
-std::optional<std::filesystem::path> exe_path() {
-    std::error_code ec;
-    // /proc/self/exe is a symlink to the currently executing process in
-    // posix-land
-    auto p = std::filesystem::read_symlink("/proc/self/exe", ec);
+namespace {
 
-    if (ec) {
-        return std::nullopt;
+// copy the contents of the file in src to dst, which are both at offset 0
+bool copy_contents(int src, int dst) {
+    constexpr std::size_t block = 1 << 30;
+    while (true) {
+        const auto n = copy_file_range(src, nullptr, dst, nullptr, block, 0);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // copy_file_range is not supported between the file systems: copy
+        // through user space from the current offsets
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+            errno != EOPNOTSUPP) {
+            return false;
+        }
+        break;
+    }
+    std::vector<char> buffer(4 << 20);
+    while (true) {
+        const auto n = read(src, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n == 0;
+        }
+        for (ssize_t written = 0; written < n;) {
+            const auto m = write(dst, buffer.data() + written, n - written);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            if (m < 0) {
+                return false;
+            }
+            written += m;
+        }
     }
-
-    return p;
 }
 
-std::optional<std::filesystem::path> oras_path() {
+} // namespace
+
+util::expected<clone_method, std::string>
+clone_file(const std::filesystem::path& src, const std::filesystem::path& dst) {
     namespace fs = std::filesystem;
 
-    auto exe = exe_path();
-    if (!exe) {
-        return std::nullopt;
+    auto error = [&](std::string_view what) {
+        return unexpected(fmt::format("unable to {} {} to {}: {}", what, src,
+                                      dst, std::strerror(errno)));
+    };
+
+    const int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return error("open");
     }
+    auto close_in = defer([in]() { close(in); });
+
+    auto tmp = dst;
+    tmp += fmt::format(".{}.tmp", getpid());
+    std::error_code ec;
+    fs::remove(tmp, ec);
+    auto remove_tmp = defer([&tmp]() {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+    });
+    auto finish = [&](clone_method method) -> expected<clone_method, std::string> {
+        if (rename(tmp.c_str(), dst.c_str())) {
+            return error("rename");
+        }
+        return method;
+    };
 
-    const auto prefix = exe->parent_path();
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return error("create");
+    }
+    auto close_out = defer([&out]() {
+        if (out >= 0) {
+            close(out);
+        }
+    });
 
-    for (auto& path : {"../libexec/oras", "oras"}) {
-        const auto p = prefix / path;
-        if (fs::is_regular_file(p)) {
-            return fs::canonical(p);
+    if (ioctl(out, FICLONE, in) == 0) {
+        spdlog::debug("clone_file: reflinked {} to {}", src, dst);
+        if (close(std::exchange(out, -1))) {
+            return error("close");
         }
+        return finish(clone_method::reflink);
     }
 
-    // maybe this could be extended to search PATH
-    return std::nullopt;
+    // a hard link requires both files to be on the same file system, and
+    // that the user is allowed to link to src (see protected_hardlinks)
+    close(std::exchange(out, -1));
+    fs::remove(tmp, ec);
+    if (link(src.c_str(), tmp.c_str()) == 0) {
+        spdlog::debug("clone_file: hard linked {} to {}", src, dst);
+        return finish(clone_method::hardlink);
+    }
+    spdlog::debug("clone_file: unable to link {}: {}", src,
+                  std::strerror(errno));
+
+    out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return error("create");
+    }
+    if (!copy_contents(in, out)) {
+        return error("copy");
+    }
+    if (fdatasync(out) || close(std::exchange(out, -1))) {
+        return error("write");
+    }
+    spdlog::debug("clone_file: copied {} to {}", src, dst);
+    return finish(clone_method::copy);
+}
+
+std::optional<std::filesystem::path> exe_path() {
+    std::error_code ec;
+    // /proc/self/exe is a symlink to the currently executing process in
+    // posix-land
+    auto p = std::filesystem::read_symlink("/proc/self/exe", ec);
+
+    if (ec) {
+        return std::nullopt;
+    }
+
+    return p;
 }
 
 file_level file_access_level(const std::filesystem::path& path) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <ctime>
 #include <filesystem>
 #include <string>
@@ -21,6 +22,10 @@ void clear_temp_dirs();
 util::expected<std::tm, std::string>
 file_creation_date(const std::filesystem::path& path);
 
+// processes that only read the locked resource take shared locks, and
+// processes that modify it take exclusive locks
+enum class lock_type { shared, exclusive };
+
 class file_lock {
   public:
     file_lock(const file_lock&) = delete;
@@ -32,7 +37,11 @@ class file_lock {
     ~file_lock();
 
     friend util::expected<file_lock, std::string>
-    make_file_lock(const std::filesystem::path& path);
+    make_file_lock(const std::filesystem::path& path, lock_type type);
+    friend util::expected<file_lock, std::string>
+    make_file_lock(const std::filesystem::path& path, lock_type type,
+                   std::chrono::milliseconds timeout);
+    friend file_lock adopt_file_lock(int fd);
 
   private:
     int fd = -1;
@@ -42,17 +51,44 @@ class file_lock {
     void release();
 };
 
+// wait for a lock on the file path, which is created if it does not exist.
+// shared locks can be taken on existing files that can't be written, e.g. in
+// a read only repository.
 util::expected<file_lock, std::string>
-make_file_lock(const std::filesystem::path& path);
+make_file_lock(const std::filesystem::path& path,
+               lock_type type = lock_type::exclusive);
+
+// wait at most timeout for a lock on the file path
+util::expected<file_lock, std::string>
+make_file_lock(const std::filesystem::path& path, lock_type type,
+               std::chrono::milliseconds timeout);
+
+// take ownership of an open file on which the caller holds a lock, e.g. one
+// that was locked with LOCK_NB while waiting for other events
+file_lock adopt_file_lock(int fd);
+
+// the ways in which clone_file() can copy a file, from cheapest to most
+// expensive
+enum class clone_method {
+    // the copy shares the blocks of the source until either is modified
+    // (FICLONE, e.g. on btrfs and XFS)
+    reflink,
+    // the copy is a second name of the source on the same file system
+    hardlink,
+    // the contents are copied by the kernel with copy_file_range
+    copy,
+};
+
+// make dst a copy of the file src, sharing its storage if possible.
+// the copy is made in a temporary file that is renamed to dst, so that dst is
+// either complete or does not exist.
+util::expected<clone_method, std::string>
+clone_file(const std::filesystem::path& src, const std::filesystem::path& dst);
 
 // return the path of the current executable
 // returns empty if there is an error
 std::optional<std::filesystem::path> exe_path();
 
-// return the path of the oras executable
-// returns empty if it can't be found
-std::optional<std::filesystem::path> oras_path();
-
 // for determining the level of access to a file or directory
 // if there is an error, or the file does not exist `none` is
 // returned.
@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include <fmt/core.h>
+
+#include <util/defer.h>
+#include <util/expected.h>
+#include <util/sha256.h>
+
+namespace util {
+
+namespace {
+
+constexpr std::array<std::uint32_t, 64> K = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+constexpr std::uint32_t rotr(std::uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// process n 64 byte blocks
+void compress_generic(std::uint32_t* state, const std::uint8_t* blocks,
+                      std::size_t n) {
+    for (; n; --n, blocks += 64) {
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (std::uint32_t(blocks[4 * i]) << 24) |
+                   (std::uint32_t(blocks[4 * i + 1]) << 16) |
+                   (std::uint32_t(blocks[4 * i + 2]) << 8) |
+                   std::uint32_t(blocks[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const auto s0 =
+                rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const auto s1 =
+                rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            const auto S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            const auto ch = (e & f) ^ (~e & g);
+            const auto t1 = h + S1 + ch + K[i] + w[i];
+            const auto S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            const auto maj = (a & b) ^ (a & c) ^ (b & c);
+            const auto t2 = S0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(__x86_64__)
+// the SHA extensions (SHA-NI) of x86 processors, which compute two rounds per
+// instruction, with the state in the order ABEF, CDGH.
+__attribute__((target("sha,sse4.1"))) void
+compress_sha_ni(std::uint32_t* state, const std::uint8_t* blocks,
+                std::size_t n) {
+    // reverses the bytes of each word
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);                // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);          // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);       // CDGH
+
+    for (; n; --n, blocks += 64) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+
+        // the message schedule, 4 words at a time
+        __m128i w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(blocks + 16 * i)),
+                mask);
+        }
+        for (int g = 0; g < 16; ++g) {
+            auto& wg = w[g % 4];
+            __m128i msg = _mm_add_epi32(
+                wg,
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[4 * g])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (g < 12) {
+                // w[t] = s1(w[t-2]) + w[t-7] + s0(w[t-15]) + w[t-16]
+                __m128i t = _mm_sha256msg1_epu32(wg, w[(g + 1) % 4]);
+                t = _mm_add_epi32(
+                    t, _mm_alignr_epi8(w[(g + 3) % 4], w[(g + 2) % 4], 4));
+                wg = _mm_sha256msg2_epu32(t, w[(g + 3) % 4]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+bool has_sha_ni() {
+    unsigned a, b, c, d;
+    // SSSE3 and SSE4.1 are used to shuffle the state and message
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) ||
+        !(c & bit_SSE4_1)) {
+        return false;
+    }
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA);
+}
+#endif
+
+#if defined(__aarch64__)
+// the SHA2 instructions of the ARMv8 cryptographic extension, e.g. on the
+// Grace CPU of GH200 nodes, which compute four rounds per instruction.
+#if defined(__clang__)
+__attribute__((target("crypto")))
+#else
+__attribute__((target("+crypto")))
+#endif
+void compress_armv8(std::uint32_t* state, const std::uint8_t* blocks,
+                    std::size_t n) {
+    uint32x4_t state0 = vld1q_u32(state);
+    uint32x4_t state1 = vld1q_u32(state + 4);
+
+    for (; n; --n, blocks += 64) {
+        const uint32x4_t abcd = state0;
+        const uint32x4_t efgh = state1;
+
+        // the message schedule, 4 words at a time
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+        }
+        for (int g = 0; g < 16; ++g) {
+            auto& wg = w[g % 4];
+            const uint32x4_t msg = vaddq_u32(wg, vld1q_u32(&K[4 * g]));
+            if (g < 12) {
+                // w[t] = s1(w[t-2]) + w[t-7] + s0(w[t-15]) + w[t-16]
+                wg = vsha256su1q_u32(vsha256su0q_u32(wg, w[(g + 1) % 4]),
+                                     w[(g + 2) % 4], w[(g + 3) % 4]);
+            }
+            const uint32x4_t prev = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, prev, msg);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+    }
+
+    vst1q_u32(state, state0);
+    vst1q_u32(state + 4, state1);
+}
+
+bool has_armv8_sha2() {
+    return getauxval(AT_HWCAP) & HWCAP_SHA2;
+}
+#endif
+
+using compress_fn = void (*)(std::uint32_t*, const std::uint8_t*,
+                             std::size_t);
+
+compress_fn implementation(sha256_isa isa) {
+    switch (isa) {
+#if defined(__x86_64__)
+    case sha256_isa::sha_ni:
+        return compress_sha_ni;
+#endif
+#if defined(__aarch64__)
+    case sha256_isa::armv8:
+        return compress_armv8;
+#endif
+    default:
+        return compress_generic;
+    }
+}
+
+// the implementation used by all hashers, initialised on first use to the
+// fastest implementation supported by the CPU, so that hashers used during
+// static initialisation of other translation units are safe.
+std::atomic<compress_fn>& compress_impl() {
+    static std::atomic<compress_fn> impl =
+        implementation(sha256_supported_isas().back());
+    return impl;
+}
+
+} // namespace
+
+std::vector<sha256_isa> sha256_supported_isas() {
+    std::vector<sha256_isa> isas{sha256_isa::generic};
+#if defined(__x86_64__)
+    if (has_sha_ni()) {
+        isas.push_back(sha256_isa::sha_ni);
+    }
+#endif
+#if defined(__aarch64__)
+    if (has_armv8_sha2()) {
+        isas.push_back(sha256_isa::armv8);
+    }
+#endif
+    return isas;
+}
+
+bool set_sha256_isa(sha256_isa isa) {
+    const auto isas = sha256_supported_isas();
+    if (std::find(isas.begin(), isas.end(), isa) == isas.end()) {
+        return false;
+    }
+    compress_impl() = implementation(isa);
+    return true;
+}
+
+std::string_view to_string(sha256_isa isa) {
+    switch (isa) {
+    case sha256_isa::sha_ni:
+        return "sha-ni";
+    case sha256_isa::armv8:
+        return "armv8";
+    default:
+        return "generic";
+    }
+}
+
+sha256::sha256() {
+    reset();
+}
+
+void sha256::reset() {
+    state_ = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+              0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    buffered_ = 0;
+    length_ = 0;
+}
+
+// process n 64 byte blocks
+void sha256::compress(const std::uint8_t* blocks, std::size_t n) {
+    if (n) {
+        compress_impl().load(std::memory_order_relaxed)(state_.data(), blocks,
+                                                       n);
+    }
+}
+
+void sha256::update(const void* data, std::size_t n) {
+    auto p = static_cast<const std::uint8_t*>(data);
+    length_ += n;
+
+    // complete a partially filled block
+    if (buffered_) {
+        const auto m = std::min(n, buffer_.size() - buffered_);
+        std::memcpy(buffer_.data() + buffered_, p, m);
+        buffered_ += m;
+        p += m;
+        n -= m;
+        if (buffered_ < buffer_.size()) {
+            return;
+        }
+        compress(buffer_.data(), 1);
+        buffered_ = 0;
+    }
+
+    // hash whole blocks directly from the input
+    compress(p, n / 64);
+    p += n - n % 64;
+    n %= 64;
+
+    std::memcpy(buffer_.data(), p, n);
+    buffered_ = n;
+}
+
+sha256::digest_type sha256::finish() {
+    const std::uint64_t bits = length_ * 8;
+
+    // pad with a 1 bit, zeros, and the message length in bits
+    std::uint8_t padding[72] = {0x80};
+    const std::size_t pad = (buffered_ < 56 ? 56 : 120) - buffered_;
+    for (int i = 0; i < 8; ++i) {
+        padding[pad + i] = std::uint8_t(bits >> (56 - 8 * i));
+    }
+    update(padding, pad + 8);
+
+    digest_type digest;
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i] = std::uint8_t(state_[i] >> 24);
+        digest[4 * i + 1] = std::uint8_t(state_[i] >> 16);
+        digest[4 * i + 2] = std::uint8_t(state_[i] >> 8);
+        digest[4 * i + 3] = std::uint8_t(state_[i]);
+    }
+    reset();
+    return digest;
+}
+
+std::string sha256::hex_digest() {
+    std::string hex;
+    hex.reserve(64);
+    for (auto byte : finish()) {
+        fmt::format_to(std::back_inserter(hex), "{:02x}", byte);
+    }
+    return hex;
+}
+
+// the state is formatted as <state words>:<length>:<buffered bytes>, with the
+// state words and buffered bytes in hex
+std::string sha256::serialize() const {
+    std::string out;
+    for (auto w : state_) {
+        fmt::format_to(std::back_inserter(out), "{:08x}", w);
+    }
+    fmt::format_to(std::back_inserter(out), ":{}:", length_);
+    for (std::size_t i = 0; i < buffered_; ++i) {
+        fmt::format_to(std::back_inserter(out), "{:02x}", buffer_[i]);
+    }
+    return out;
+}
+
+std::optional<sha256> sha256::deserialize(std::string_view in) {
+    auto hex = [](std::string_view s, auto& value) {
+        const auto end = s.data() + s.size();
+        return std::from_chars(s.data(), end, value, 16).ptr == end;
+    };
+
+    const auto first = in.find(':');
+    const auto second = in.find(':', first + 1);
+    if (first != 64 || second == std::string_view::npos) {
+        return std::nullopt;
+    }
+    const auto length = in.substr(first + 1, second - first - 1);
+    const auto buffered = in.substr(second + 1);
+
+    sha256 h;
+    for (int i = 0; i < 8; ++i) {
+        if (!hex(in.substr(8 * i, 8), h.state_[i])) {
+            return std::nullopt;
+        }
+    }
+    const auto end = length.data() + length.size();
+    if (length.empty() ||
+        std::from_chars(length.data(), end, h.length_).ptr != end) {
+        return std::nullopt;
+    }
+    h.buffered_ = buffered.size() / 2;
+    if (buffered.size() % 2 || h.buffered_ != h.length_ % 64) {
+        return std::nullopt;
+    }
+    for (std::size_t i = 0; i < h.buffered_; ++i) {
+        if (!hex(buffered.substr(2 * i, 2), h.buffer_[i])) {
+            return std::nullopt;
+        }
+    }
+    return h;
+}
+
+std::string sha256_hex(std::string_view data) {
+    sha256 h;
+    h.update(data);
+    return h.hex_digest();
+}
+
+expected<std::string, std::string>
+sha256_file(const std::filesystem::path& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return unexpected(
+            fmt::format("unable to open {}: {}", path.string(),
+                        std::strerror(errno)));
+    }
+    auto _ = defer([fd]() { close(fd); });
+
+    // the file is read once from start to end: let the kernel read ahead
+    // aggressively
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // read in large blocks aligned to pages, which are hashed without being
+    // copied into the block buffer of the hasher
+    constexpr std::size_t buffer_size = 4 << 20;
+    std::unique_ptr<char, decltype(&std::free)> buffer(
+        static_cast<char*>(std::aligned_alloc(4096, buffer_size)), &std::free);
+    if (!buffer) {
+        return unexpected(std::string("unable to allocate read buffer"));
+    }
+
+    sha256 h;
+    while (true) {
+        const auto n = read(fd, buffer.get(), buffer_size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return unexpected(fmt::format("unable to read {}: {}",
+                                          path.string(), std::strerror(errno)));
+        }
+        if (n == 0) {
+            break;
+        }
+        h.update(buffer.get(), n);
+    }
+    return h.hex_digest();
+}
+
+} // namespace util
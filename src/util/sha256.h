@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <util/expected.h>
+
+namespace util {
+
+// A streaming SHA-256 hasher: data is passed to update() in pieces of any
+// size, and the digest is returned by finish().
+//
+//   util::sha256 h;
+//   h.update(chunk1);
+//   h.update(chunk2);
+//   auto hex = h.hex_digest(); // "e3b0c442..."
+class sha256 {
+  public:
+    using digest_type = std::array<std::uint8_t, 32>;
+
+    sha256();
+
+    void update(const void* data, std::size_t n);
+    void update(std::string_view data) {
+        update(data.data(), data.size());
+    }
+
+    // finish hashing and return the digest.
+    // the hasher is reset, ready to hash new input.
+    digest_type finish();
+
+    // finish hashing and return the digest as 64 lower case hex characters
+    std::string hex_digest();
+
+    // the number of bytes that have been hashed
+    std::uint64_t size() const {
+        return length_;
+    }
+
+    // save the state of the hasher as a string, from which it can be restored
+    // to continue hashing, e.g. when an interrupted download is resumed.
+    std::string serialize() const;
+    static std::optional<sha256> deserialize(std::string_view state);
+
+  private:
+    void reset();
+    void compress(const std::uint8_t* blocks, std::size_t n);
+
+    std::array<std::uint32_t, 8> state_;
+    std::array<std::uint8_t, 64> buffer_;
+    std::size_t buffered_ = 0;
+    std::uint64_t length_ = 0;
+};
+
+// The implementations of the SHA-256 compression function:
+// - generic: portable C++
+// - sha_ni: the SHA extensions of x86 CPUs (Intel since Ice Lake, AMD Zen)
+// - armv8: the SHA2 instructions of the ARMv8 cryptographic extension
+// The fastest implementation supported by the CPU is used by default.
+enum class sha256_isa { generic, sha_ni, armv8 };
+
+// the implementations supported by the CPU, from slowest to fastest
+std::vector<sha256_isa> sha256_supported_isas();
+
+// select the implementation used by all hashers.
+// returns false if the implementation is not supported by the CPU.
+bool set_sha256_isa(sha256_isa isa);
+
+std::string_view to_string(sha256_isa isa);
+
+// the sha256 of a string, as 64 lower case hex characters
+std::string sha256_hex(std::string_view data);
+
+// the sha256 of the contents of a file, as 64 lower case hex characters
+expected<std::string, std::string>
+sha256_file(const std::filesystem::path& path);
+
+} // namespace util
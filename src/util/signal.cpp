@@ -39,6 +39,10 @@ bool signal_raised() {
     return signal_received.exchange(false);
 }
 
+bool signal_pending() {
+    return signal_received.load();
+}
+
 int last_signal_raised() {
     return last_signal.load();
 }
@@ -13,7 +13,11 @@ class signal_exception : public std::exception {
 };
 
 void set_signal_catcher();
+// returns whether a signal was raised since the last call, and clears it
 bool signal_raised();
+// returns whether a signal was raised, without clearing it, so that every
+// thread that checks for a signal sees it
+bool signal_pending();
 int last_signal_raised();
 
 } // namespace util
@@ -0,0 +1,206 @@
+// Benchmark for downloading a blob from a registry.
+//
+// Serves a synthetic blob from a local HTTP server that limits the bandwidth
+// of each connection, as the per-stream throughput of a TCP connection over a
+// long distance link is limited. The blob is downloaded with an increasing
+// maximum number of streams:
+//   - 1: the blob is downloaded with a single request
+//   - n: the blob is downloaded in chunks, with up to n concurrent range
+//     requests
+// and the time and throughput of each download are reported.
+//
+// usage: bench-download [size-MiB] [MiB/s-per-connection] [chunk-MiB]
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/oci.h>
+#include <util/fs.h>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// A server on the loopback interface that answers every GET request with the
+// blob, or the requested range of the blob, sending at most rate bytes per
+// second on each connection.
+struct throttled_server {
+    const std::string& blob;
+    const double rate;
+    int port = 0;
+
+    throttled_server(const std::string& blob, double rate)
+        : blob(blob), rate(rate) {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        listen(fd_, 64);
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~throttled_server() {
+        shutdown(fd_, SHUT_RDWR);
+        close(fd_);
+        thread_.join();
+        {
+            std::lock_guard _(mutex_);
+            for (auto c : open_) {
+                shutdown(c, SHUT_RDWR);
+            }
+        }
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+  private:
+    int fd_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<int> open_;
+    std::vector<std::thread> workers_;
+
+    void serve() {
+        while (true) {
+            const int c = accept(fd_, nullptr, nullptr);
+            if (c < 0) {
+                return;
+            }
+            std::lock_guard _(mutex_);
+            open_.push_back(c);
+            workers_.emplace_back([this, c] { serve_connection(c); });
+        }
+    }
+
+    bool send_all(int c, const char* data, std::size_t n) {
+        while (n) {
+            const auto m = ::send(c, data, n, MSG_NOSIGNAL);
+            if (m <= 0) {
+                return false;
+            }
+            data += m;
+            n -= m;
+        }
+        return true;
+    }
+
+    void serve_connection(int c) {
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            std::size_t end;
+            while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+                const auto n = read(c, chunk, sizeof(chunk));
+                if (n <= 0) {
+                    return;
+                }
+                buffer.append(chunk, n);
+            }
+            const auto head = buffer.substr(0, end);
+            buffer.erase(0, end + 4);
+
+            std::size_t first = 0;
+            std::size_t last = blob.size();
+            std::string status = "200 OK";
+            std::string range;
+            if (auto p = head.find("Range: bytes="); p != std::string::npos) {
+                char* next;
+                first = std::strtoul(head.c_str() + p + 13, &next, 10);
+                if (std::isdigit(next[1])) {
+                    last = std::strtoul(next + 1, nullptr, 10) + 1;
+                }
+                status = "206 Partial Content";
+                range = fmt::format("Content-Range: bytes {}-{}/{}\r\n", first,
+                                    last - 1, blob.size());
+            }
+            const auto header =
+                fmt::format("HTTP/1.1 {}\r\n{}Content-Length: {}\r\n\r\n",
+                            status, range, last - first);
+            if (!send_all(c, header.data(), header.size())) {
+                return;
+            }
+
+            // send the body in slices, waiting between slices so that the
+            // average rate does not exceed the limit
+            constexpr std::size_t slice = 64 * 1024;
+            const auto start = clock_type::now();
+            for (auto pos = first; pos < last; pos += slice) {
+                const auto n = std::min(slice, last - pos);
+                if (!send_all(c, blob.data() + pos, n)) {
+                    return;
+                }
+                std::this_thread::sleep_until(
+                    start + std::chrono::duration<double>(
+                                (pos + n - first) / rate));
+            }
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t size_mb =
+        argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    const double rate_mb = argc > 2 ? std::strtod(argv[2], nullptr) : 20;
+    const std::size_t chunk_mb =
+        argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 16;
+
+    spdlog::set_level(spdlog::level::off);
+
+    std::string blob(size_mb << 20, 0);
+    for (std::size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = char((i * 2654435761u) >> 13);
+    }
+    const uenv::oci::descriptor desc{.media_type = "application/octet-stream",
+                                     .digest = uenv::oci::digest_of(blob),
+                                     .size = blob.size()};
+
+    throttled_server server(blob, rate_mb * (1 << 20));
+    fmt::println("{} MiB blob, {} MiB chunks, {} MiB/s per connection",
+                 size_mb, chunk_mb, rate_mb);
+    fmt::println("{:>8}{:>12}{:>12}", "streams", "time (s)", "MiB/s");
+
+    const auto dir = util::make_temp_dir();
+    bool ok = true;
+    for (unsigned streams : {1u, 2u, 4u, 8u, 16u}) {
+        uenv::oci::set_download_config(
+            {.chunk_size = chunk_mb << 20, .max_streams = streams});
+        uenv::oci::client client(
+            fmt::format("http://127.0.0.1:{}/bench", server.port));
+
+        const auto destination = dir / "blob";
+        const auto start = clock_type::now();
+        auto r = client.get_blob("image", desc, destination);
+        const double t =
+            std::chrono::duration<double>(clock_type::now() - start).count();
+        std::filesystem::remove(destination);
+
+        if (!r) {
+            fmt::println("error: {}", r.error().message);
+            ok = false;
+            continue;
+        }
+        fmt::println("{:>8}{:>12.2f}{:>12.1f}", streams, t, size_mb / t);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+// Benchmark for parsing registry listings.
+//
+// Generates a synthetic listing with entries spread over several namespaces,
+// then measures the time and peak memory of parsing the records in one
+// namespace:
+//   - dom: parse the whole listing into a JSON document, then parse every
+//     entry, as registry_listing did before the streaming parser
+//   - stream: feed the listing to site::listing_parser in chunks, as it is
+//     received from the listing service
+// Each parser runs in a child process, so that the peak memory of one does
+// not hide the peak memory of the other.
+//
+// usage: bench-listing [num-entries]
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <site/listing_parser.h>
+#include <uenv/parse.h>
+#include <uenv/uenv.h>
+
+namespace {
+
+std::string make_listing(std::size_t n) {
+    const std::vector<std::string> namespaces{"deploy", "build", "service",
+                                              "build"};
+    const std::vector<std::string> systems{"daint", "santis", "clariden",
+                                           "eiger"};
+    std::string listing = R"({"results": [)";
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::uint64_t h = (i + 1) * 0x9e3779b97f4a7c15ull;
+        listing += fmt::format(
+            R"({}{{"sha256": "{:016x}{:048x}", "created": "2024-{:02}-{:02}T10:{:02}:00.000000+00:00", )"
+            R"("path": "{}/{}/{}/app{}/{}.{}/v{}", "size": {}}})",
+            i ? ", " : "", h, i, 1 + i % 12, 1 + i % 28, i % 60,
+            namespaces[i % namespaces.size()], systems[(i / 4) % systems.size()],
+            i % 2 ? "gh200" : "zen2", i / 100, 20 + i % 7, i % 12, i % 5,
+            1024 * 1024 * (i % 4096));
+    }
+    listing += "]}";
+    return listing;
+}
+
+// the implementation of registry_listing before the streaming parser
+std::size_t parse_dom(const std::string& input, const std::string& nspace) {
+    std::vector<uenv::uenv_record> records;
+    auto raw = nlohmann::json::parse(input);
+    for (auto& j : raw["results"]) {
+        const std::string sha = j["sha256"];
+        const auto date = uenv::parse_uenv_date(j["created"]);
+        auto rg = uenv::parse_registry_entry(j["path"]);
+        if (rg && rg->nspace == nspace) {
+            records.push_back({
+                .system = rg->system,
+                .uarch = rg->uarch,
+                .name = rg->name,
+                .version = rg->version,
+                .tag = rg->tag,
+                .date = *date,
+                .size_byte = j["size"],
+                .sha = uenv::sha256(sha),
+                .id = uenv::uenv_id(sha.substr(0, 16)),
+            });
+        }
+    }
+    return records.size();
+}
+
+std::size_t parse_stream(const std::string& input, const std::string& nspace) {
+    // curl passes the body to the write callback in chunks of up to 16 KiB
+    constexpr std::size_t chunk = 16 * 1024;
+    site::listing_parser parser(nspace);
+    const std::string_view in(input);
+    for (std::size_t i = 0; i < in.size(); i += chunk) {
+        parser.feed(in.substr(i, chunk));
+    }
+    auto result = parser.finish();
+    return result ? result->records.size() : 0;
+}
+
+// run f in a child process, and print its run time and peak memory.
+// returns false if f did not return the expected value.
+template <typename F> bool measure(const char* name, std::size_t expected, F&& f) {
+    int fd[2];
+    if (pipe(fd)) {
+        return false;
+    }
+    const auto pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        const auto start = std::chrono::steady_clock::now();
+        const auto n = f();
+        const double t = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        write(fd[1], &t, sizeof(t));
+        _exit(n == expected ? 0 : 1);
+    }
+    close(fd[1]);
+    double t = 0;
+    read(fd[0], &t, sizeof(t));
+    close(fd[0]);
+
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    fmt::println("{:<12}{:>12.1f} ms{:>12.1f} MiB peak", name, t * 1e3,
+                 usage.ru_maxrss / 1024.0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t num_entries =
+        argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    spdlog::set_level(spdlog::level::off);
+
+    const auto listing = make_listing(num_entries);
+    const std::size_t expected = (num_entries + 3) / 4;
+    fmt::println("{} entries, {:.1f} MiB, {} in namespace deploy", num_entries,
+                 listing.size() / (1024.0 * 1024.0), expected);
+
+    // the memory used by the listing itself
+    bool ok = measure("input", expected, [&] {
+        std::size_t sum = 0;
+        for (char c : listing) {
+            sum += c == '{';
+        }
+        return sum ? expected : 0;
+    });
+    ok &= measure("dom", expected, [&] { return parse_dom(listing, "deploy"); });
+    ok &= measure("stream", expected,
+                  [&] { return parse_stream(listing, "deploy"); });
+
+    if (!ok) {
+        fmt::println("error: expected {} records", expected);
+        return 1;
+    }
+
+    return 0;
+}
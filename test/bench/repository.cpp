@@ -0,0 +1,202 @@
+// Microbenchmark for repository lookups.
+//
+// Fills an in-memory repository with a large number of records, then times
+// the lookups performed on the hot paths:
+//   - fully qualified label queries (uenv run, the Slurm plugin)
+//   - contains() checks (image pull)
+//   - sha256 and id queries (uenv image ls/rm/inspect)
+//   - listing every record with a cursor (uenv image ls @*)
+//   - resolving a label in a repository on disk with the flat index and with
+//     SQLite (the Slurm plugin)
+//
+// usage: bench-repository [num-records] [num-queries]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <uenv/flat_index.h>
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/fs.h>
+
+namespace {
+
+// generate a deterministic sha256 from an integer.
+// the leading 16 characters (the id) are unique for each i.
+uenv::sha256 make_sha(std::size_t i) {
+    const std::uint64_t h = (i + 1) * 0x9e3779b97f4a7c15ull;
+    return uenv::sha256(fmt::format("{:016x}{:048x}", h, i));
+}
+
+std::vector<uenv::uenv_record> make_records(std::size_t n) {
+    const std::vector<std::string> systems{"daint", "santis", "clariden",
+                                           "eiger"};
+    const std::vector<std::string> tags{"v1", "v2", "v3", "v4", "v5"};
+
+    std::vector<uenv::uenv_record> records;
+    records.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto sha = make_sha(i);
+        records.push_back({
+            .system = systems[i % systems.size()],
+            .uarch = i % 2 ? "gh200" : "zen2",
+            .name = fmt::format("app{}", i / 100),
+            .version = fmt::format("{}.{}", 20 + i % 7, i % 12),
+            .tag = tags[(i / 7) % tags.size()],
+            .date = {2024, 1 + static_cast<unsigned>(i % 12),
+                     1 + static_cast<unsigned>(i % 28)},
+            .size_byte = 1024 * 1024 * (i % 4096),
+            .sha = sha,
+            .id = uenv::uenv_id(sha.string().substr(0, 16)),
+        });
+    }
+    return records;
+}
+
+template <typename F> double time_s(F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t num_records =
+        argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const std::size_t num_queries =
+        argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500;
+
+    spdlog::set_level(spdlog::level::off);
+
+    auto repo = uenv::create_repository();
+    if (!repo) {
+        fmt::println("unable to create repository: {}", repo.error());
+        return 1;
+    }
+
+    const auto records = make_records(num_records);
+    const auto t_add = time_s([&] {
+        for (auto& r : records) {
+            repo->add(r);
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} records/s", "add", num_records / t_add);
+
+    {
+        auto batch_repo = uenv::create_repository();
+        const auto t_batch = time_s([&] { batch_repo->add_batch(records); });
+        fmt::println("{:<24}{:>12.0f} records/s", "add_batch",
+                     num_records / t_batch);
+    }
+
+    // pick records spread over the whole repository
+    auto sample = [&](std::size_t i) -> const uenv::uenv_record& {
+        return records[(i * 7919) % records.size()];
+    };
+
+    std::size_t hits = 0;
+    const auto t_label = time_s([&] {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            const auto& r = sample(i);
+            hits += repo->query({.name = r.name,
+                                 .version = r.version,
+                                 .tag = r.tag,
+                                 .system = r.system,
+                                 .uarch = r.uarch})
+                        ->size();
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} queries/s", "query label",
+                 num_queries / t_label);
+
+    const auto t_contains = time_s([&] {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            hits += repo->contains(sample(i));
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} queries/s", "contains",
+                 num_queries / t_contains);
+
+    const auto t_sha = time_s([&] {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            hits += repo->query({.name = sample(i).sha.string()})->size();
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} queries/s", "query sha256",
+                 num_queries / t_sha);
+
+    const auto t_id = time_s([&] {
+        for (std::size_t i = 0; i < num_queries; ++i) {
+            hits += repo->query({.name = sample(i).id.string()})->size();
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} queries/s", "query id", num_queries / t_id);
+
+    // list every record, e.g. `uenv image ls @*`
+    double t_first = 0;
+    std::size_t num_listed = 0;
+    const auto t_list = time_s([&] {
+        const auto start = std::chrono::steady_clock::now();
+        auto c = repo->cursor({});
+        for (auto& r : *c) {
+            if (num_listed++ == 0) {
+                t_first = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+            }
+            hits += r.sha.string().empty();
+        }
+    });
+    fmt::println("{:<24}{:>12.0f} records/s", "list all", num_listed / t_list);
+    fmt::println("{:<24}{:>12.3f} ms", "list first record", t_first * 1e3);
+
+    // resolve labels in a repository on disk, as the Slurm plugin does:
+    // with the flat index, and by opening and querying the database.
+    {
+        const auto path = util::make_temp_dir() / "repo";
+        auto disk_repo = uenv::create_repository(path);
+        disk_repo->add_batch(records);
+
+        auto label = [&](std::size_t i) {
+            const auto& r = sample(i);
+            return uenv::uenv_label{.name = r.name,
+                                    .version = r.version,
+                                    .tag = r.tag,
+                                    .system = r.system,
+                                    .uarch = r.uarch};
+        };
+        const auto t_index = time_s([&] {
+            for (std::size_t i = 0; i < num_queries; ++i) {
+                hits += uenv::flat_index_query(path, label(i))->size();
+            }
+        });
+        fmt::println("{:<24}{:>12.0f} queries/s", "flat index open+query",
+                     num_queries / t_index);
+
+        const auto t_open = time_s([&] {
+            for (std::size_t i = 0; i < num_queries; ++i) {
+                hits += uenv::open_repository(path)->query(label(i))->size();
+            }
+        });
+        fmt::println("{:<24}{:>12.0f} queries/s", "sqlite open+query",
+                     num_queries / t_open);
+    }
+
+    // every sampled record is in the repository, and matches exactly once per
+    // query: check so that the loops above can not be optimised away.
+    if (hits != 6 * num_queries || num_listed != num_records) {
+        fmt::println("error: expected {} matches, found {}", 6 * num_queries,
+                     hits);
+        return 1;
+    }
+
+    return 0;
+}
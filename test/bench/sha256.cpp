@@ -0,0 +1,76 @@
+// Benchmark for computing the SHA-256 digest of squashfs images.
+//
+// For every implementation of SHA-256 supported by the CPU, reports the
+// throughput of:
+//   - memory: hashing a buffer in memory
+//   - file: hashing a file with util::sha256_file, which is read from the page
+//     cache after the first pass
+//
+// usage: bench-sha256 [size-MiB]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <fmt/core.h>
+
+#include <util/fs.h>
+#include <util/sha256.h>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// run f repeatedly for at least half a second, and return the mean time of one
+// run in seconds
+template <typename F> double time(F&& f) {
+    const auto start = clock_type::now();
+    unsigned runs = 0;
+    double t = 0;
+    do {
+        f();
+        ++runs;
+        t = std::chrono::duration<double>(clock_type::now() - start).count();
+    } while (t < 0.5);
+    return t / runs;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t size_mb =
+        argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+
+    std::string data(size_mb << 20, 0);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = char((i * 2654435761u) >> 13);
+    }
+    const auto path = util::make_temp_dir() / "image.squashfs";
+    std::ofstream(path, std::ios::binary) << data;
+
+    fmt::println("{} MiB input", size_mb);
+    fmt::println("{:>10}{:>12}{:>12}", "isa", "memory GB/s", "file GB/s");
+
+    const double gb = data.size() / 1e9;
+    std::string expected;
+    bool ok = true;
+    for (auto isa : util::sha256_supported_isas()) {
+        util::set_sha256_isa(isa);
+
+        std::string digest;
+        const auto t_memory = time([&] { digest = util::sha256_hex(data); });
+        const auto t_file =
+            time([&] { digest = util::sha256_file(path).value_or(""); });
+        if (expected.empty()) {
+            expected = digest;
+        }
+        ok = ok && digest == expected;
+
+        fmt::println("{:>10}{:>12.2f}{:>12.2f}{}", util::to_string(isa),
+                     gb / t_memory, gb / t_file,
+                     digest == expected ? "" : "  wrong digest");
+    }
+
+    return ok ? 0 : 1;
+}
@@ -168,6 +168,49 @@ function teardown() {
     # - check an invalid repo
 }
 
+@test "repo update" {
+    # the test repos are created with the original (version 0) schema
+    RP=$(mktemp -d $TMP/update-XXXXXX)
+    cp -r $REPOS/apptool/. $RP
+
+    run uenv repo status $RP
+    assert_success
+    assert_line --partial "has database schema version 0 that can be upgraded to 1"
+
+    run uenv repo update --no-lustre $RP
+    assert_success
+    assert_line --partial "upgrading the database schema from version 0 to 1"
+    run sqlite3 $RP/index.db "PRAGMA user_version"
+    assert_output "1"
+
+    # the repo is still usable after the upgrade
+    run uenv --repo=$RP image ls --no-header
+    assert_success
+    assert_line --partial "app/42.0:v1"
+
+    run uenv repo status $RP
+    assert_success
+    refute_line --partial "database schema"
+
+    # toggle write-ahead logging
+    run uenv repo update --no-lustre --wal $RP
+    assert_success
+    assert_line --partial "write-ahead logging is enabled"
+    run sqlite3 $RP/index.db "PRAGMA journal_mode"
+    assert_output "wal"
+    run uenv repo status $RP
+    assert_success
+    assert_line --partial "uses write-ahead logging"
+    run uenv --repo=$RP image ls --no-header
+    assert_success
+    assert_line --partial "app/42.0:v1"
+
+    run uenv repo update --no-lustre --no-wal $RP
+    assert_success
+    run sqlite3 $RP/index.db "PRAGMA journal_mode"
+    assert_output "delete"
+}
+
 @test "repo create" {
     # using UENV_REPO_PATH env variable
     RP=$(mktemp -d $TMP/create-XXXXXX)
@@ -180,6 +223,10 @@ function teardown() {
     assert_line --partial "CREATE TABLE uenv"
     assert_line --partial "CREATE TABLE tags"
     assert_line --partial "CREATE VIEW records AS"
+    assert_line --partial "CREATE INDEX uenv_name"
+    assert_line --partial "CREATE INDEX tags_sha256"
+    run sqlite3 $RP/index.db "PRAGMA user_version"
+    assert_output "1"
 
     # create a repo in the same location
     # this should be an error
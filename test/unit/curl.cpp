@@ -0,0 +1,79 @@
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <catch2/catch_all.hpp>
+
+#include <util/curl.h>
+
+#include "http_stub.h"
+
+TEST_CASE("connection reuse", "[curl]") {
+    http_stub server(
+        [](const std::string& request) -> http_stub::response {
+            if (request.starts_with("POST")) {
+                return {200, {}, request.substr(request.find("\r\n\r\n") + 4)};
+            }
+            return {200, {"ETag: \"1\""}, "hello"};
+        },
+        true);
+
+    for (int i = 0; i < 5; ++i) {
+        auto r = util::curl::get(server.url());
+        REQUIRE(r);
+        REQUIRE(*r == "hello");
+    }
+    auto r = util::curl::get(server.url(), {"If-None-Match: \"0\""});
+    REQUIRE(r);
+    REQUIRE(r->status == 200);
+    REQUIRE(r->headers["etag"] == "\"1\"");
+    REQUIRE(r->body == "hello");
+
+    auto p = util::curl::post("{}", server.url(), "application/json", 1000);
+    REQUIRE(p);
+    REQUIRE(*p == "{}");
+
+    // all requests are made on one connection
+    REQUIRE(server.requests == 7);
+    REQUIRE(server.connections == 1);
+
+    // handles that are in use at the same time use separate connections, that
+    // are both kept for later requests
+    {
+        auto h1 = util::curl::acquire();
+        auto h2 = util::curl::acquire();
+        REQUIRE(h1);
+        REQUIRE(h2);
+        REQUIRE(h1->get() != h2->get());
+    }
+
+    // a child process does not use the connections of its parent
+    const auto pid = fork();
+    if (pid == 0) {
+        auto r = util::curl::get(server.url());
+        _exit(r && *r == "hello" ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(server.connections == 2);
+
+    REQUIRE(util::curl::get(server.url()));
+    REQUIRE(server.connections == 2);
+}
+
+TEST_CASE("compression", "[curl]") {
+    std::string last_request;
+    http_stub server([&](const std::string& request) -> http_stub::response {
+        last_request = request;
+        return {200, {}, "{}"};
+    });
+
+    REQUIRE(util::curl::get(server.url()));
+    if (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_LIBZ) {
+        REQUIRE(last_request.find("Accept-Encoding: ") != std::string::npos);
+        REQUIRE(last_request.find("gzip") != std::string::npos);
+    }
+}
@@ -0,0 +1,101 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <catch2/catch_all.hpp>
+
+#include <uenv/delta.h>
+#include <util/fs.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// pseudo-random data, without repeated blocks
+std::string make_data(std::size_t size, unsigned seed) {
+    std::string data(size, 0);
+    std::uint64_t x = seed * 2654435761u + 1;
+    for (auto& c : data) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        c = char(x);
+    }
+    return data;
+}
+
+fs::path write_file(const fs::path& path, const std::string& contents) {
+    std::ofstream(path, std::ios::binary) << contents;
+    return path;
+}
+
+} // namespace
+
+TEST_CASE("block index", "[delta]") {
+    REQUIRE(uenv::index_block_size(0) == 64 * 1024);
+    REQUIRE(uenv::index_block_size(1 << 30) == 64 * 1024);
+    REQUIRE(uenv::index_block_size((1ul << 32) + 1) == 128 * 1024);
+
+    const auto dir = util::make_temp_dir();
+    const auto data = make_data(10000, 1);
+    auto index = uenv::make_block_index(write_file(dir / "a", data), 4096);
+    REQUIRE(index);
+    REQUIRE(index->size == 10000);
+    REQUIRE(index->blocks() == 3);
+    REQUIRE(index->rolling[1] == uenv::rolling_hash(data.data() + 4096, 4096));
+    REQUIRE(index->rolling[2] == uenv::rolling_hash(data.data() + 8192, 1808));
+
+    auto parsed = uenv::parse_block_index(uenv::serialize(*index));
+    REQUIRE(parsed);
+    REQUIRE(parsed->block_size == 4096);
+    REQUIRE(parsed->size == 10000);
+    REQUIRE(parsed->rolling == index->rolling);
+    REQUIRE(parsed->strong == index->strong);
+
+    // truncated or invalid input
+    auto raw = uenv::serialize(*index);
+    REQUIRE(!uenv::parse_block_index(raw.substr(0, raw.size() - 1)));
+    REQUIRE(!uenv::parse_block_index("uenvblk1"));
+    REQUIRE(!uenv::parse_block_index(std::string(raw.size(), 'x')));
+
+    auto empty = uenv::make_block_index(write_file(dir / "empty", ""));
+    REQUIRE(empty);
+    REQUIRE(empty->blocks() == 0);
+    REQUIRE(!uenv::make_block_index(dir / "missing"));
+}
+
+TEST_CASE("find blocks", "[delta]") {
+    const auto dir = util::make_temp_dir();
+    const std::uint64_t L = 4096;
+
+    // the new version has bytes inserted and changed, which shifts the
+    // blocks that follow
+    const auto old_data = make_data(20 * L, 2);
+    auto new_data = old_data.substr(0, 5 * L + 100) + make_data(333, 3) +
+                    old_data.substr(5 * L + 100);
+    new_data[15 * L + 7] ^= 1;
+    const auto index =
+        uenv::make_block_index(write_file(dir / "new", new_data), L);
+    REQUIRE(index);
+
+    auto matches = uenv::find_blocks(*index, write_file(dir / "old", old_data));
+    REQUIRE(matches);
+    // blocks 5 and 15 changed, and the last block is partial
+    REQUIRE(matches->size() == index->blocks() - 3);
+    for (auto m : *matches) {
+        REQUIRE(m.block != 5);
+        REQUIRE(m.block != 15);
+        REQUIRE(old_data.substr(m.offset, L) == new_data.substr(m.block * L, L));
+    }
+
+    // an unrelated file has no blocks in common
+    matches = uenv::find_blocks(*index, write_file(dir / "other",
+                                                   make_data(20 * L, 4)));
+    REQUIRE(matches);
+    REQUIRE(matches->empty());
+    // nor does a file shorter than a block
+    matches = uenv::find_blocks(*index, write_file(dir / "short", "abc"));
+    REQUIRE(matches);
+    REQUIRE(matches->empty());
+    REQUIRE(!uenv::find_blocks(*index, dir / "missing"));
+}
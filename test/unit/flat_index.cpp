@@ -0,0 +1,173 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include <uenv/flat_index.h>
+#include <uenv/repository.h>
+#include <uenv/uenv.h>
+#include <util/fs.h>
+
+#include <sqlite3.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+auto msha(char c) {
+    return uenv::sha256(std::string(64, c));
+};
+auto mid(char c) {
+    return uenv::uenv_id(std::string(16, c));
+};
+
+// clang-format off
+std::vector<uenv::uenv_record> records = {
+    {"santis",  "gh200", "prgenv-gnu",   "23.11", "default", {}, 1024, msha('a'), mid('a')},
+    {"santis",  "gh200", "prgenv-gnu",   "23.11", "v2",      {}, 1024, msha('a'), mid('a')},
+    {"santis",  "gh200", "prgenv-gnu",   "23.11", "v1",      {}, 1024, msha('c'), mid('c')},
+    {"santis",  "gh200", "prgenv-gnu",   "24.2",  "default", {}, 1024, msha('b'), mid('b')},
+    {"santis",  "gh200", "icon",         "2024",  "v1",      {}, 5024, msha('1'), mid('1')},
+    {"santis",  "gh200", "netcdf-tools", "2024",  "v1",      {}, 1024, msha('w'), mid('w')},
+    {"balfrin", "a100",  "netcdf-tools", "2024",  "v1",      {}, 1024, msha('y'), mid('y')},
+    {"balfrin", "zen3",  "netcdf-tools", "2024",  "v1",      {}, 1024, msha('z'), mid('z')},
+};
+// clang-format on
+
+auto create_repo() {
+    const auto path = util::make_temp_dir() / "repo";
+    auto repo = uenv::create_repository(path);
+    REQUIRE(repo);
+    REQUIRE(repo->add_batch(records));
+    return path;
+}
+
+} // namespace
+
+TEST_CASE("generation", "[flat_index]") {
+    const auto path = create_repo();
+    const auto db = path / "index.db";
+
+    const auto g0 = uenv::database_generation(db);
+    REQUIRE(g0);
+
+    // reading the database does not change the generation
+    {
+        auto repo = uenv::open_repository(path);
+        REQUIRE(repo->query({})->size() == records.size());
+    }
+    REQUIRE(uenv::database_generation(db) == g0);
+
+    // modifying the database does
+    {
+        auto repo = uenv::open_repository(path, uenv::repo_mode::readwrite);
+        REQUIRE(repo->remove(msha('z')));
+    }
+    const auto g1 = uenv::database_generation(db);
+    REQUIRE(g1);
+    REQUIRE(*g1 != *g0);
+
+    REQUIRE(!uenv::database_generation(path / "wombat.db"));
+}
+
+TEST_CASE("query", "[flat_index]") {
+    const auto path = create_repo();
+    REQUIRE(fs::is_regular_file(uenv::flat_index_path(path)));
+
+    auto repo = uenv::open_repository(path);
+    REQUIRE(repo);
+
+    // the index returns the same results as querying the database
+    // clang-format off
+    std::vector<uenv::uenv_label> labels = {
+        {},
+        {.name = "prgenv-gnu"},
+        {.name = "prgenv-gnu", .version = "23.11"},
+        {.name = "prgenv-gnu", .version = "23.11", .tag = "v2"},
+        {.name = "prgenv-gnu", .tag = "default"},
+        {.name = "netcdf-tools", .system = "balfrin"},
+        {.name = "netcdf-tools", .uarch = "zen3"},
+        {.name = "netcdf-tools", .version = "2024", .tag = "v1",
+         .system = "santis", .uarch = "gh200"},
+        {.name = "prgenv"},
+        {.name = "wombat"},
+        {.name = "aaaaaaaaaaaaaaaa"},
+        {.name = std::string(64, 'c')},
+        {.name = std::string(16, 'y'), .system = "balfrin"},
+        {.name = std::string(16, 'y'), .system = "santis"},
+    };
+    // clang-format on
+    for (auto& label : labels) {
+        auto expected = repo->query(label);
+        REQUIRE(expected);
+        auto result = uenv::flat_index_query(path, label);
+        REQUIRE(result);
+        REQUIRE(std::equal(expected->begin(), expected->end(),
+                           result->begin(), result->end()));
+    }
+    REQUIRE(uenv::flat_index_query(path, {.name = "prgenv-gnu"})->size() ==
+            4u);
+    REQUIRE(uenv::flat_index_query(path, {.name = std::string(16, 'a')})
+                ->size() == 2u);
+}
+
+TEST_CASE("stale", "[flat_index]") {
+    const uenv::uenv_label label{.name = "icon"};
+
+    // the index is not used after the database is modified without updating
+    // the index
+    {
+        const auto path = create_repo();
+        REQUIRE(uenv::flat_index_query(path, label));
+        sqlite3* db;
+        REQUIRE(sqlite3_open((path / "index.db").c_str(), &db) == SQLITE_OK);
+        REQUIRE(sqlite3_exec(db, "DELETE FROM images WHERE sha256 LIKE '1%'",
+                             nullptr, nullptr, nullptr) == SQLITE_OK);
+        sqlite3_close(db);
+        REQUIRE(!uenv::flat_index_query(path, label));
+
+        // refreshing the index makes it current
+        auto repo = uenv::open_repository(path, uenv::repo_mode::readwrite);
+        repo->refresh_index();
+        REQUIRE(uenv::flat_index_query(path, label)->empty());
+    }
+
+    // deferred updates leave the index stale until they are resumed
+    {
+        const auto path = create_repo();
+        auto repo = uenv::open_repository(path, uenv::repo_mode::readwrite);
+        repo->defer_index_updates(true);
+        REQUIRE(repo->remove(msha('1')));
+        REQUIRE(!uenv::flat_index_query(path, label));
+        auto icon = records[4];
+        icon.tag = "v2";
+        REQUIRE(repo->add(icon));
+        REQUIRE(!uenv::flat_index_query(path, label));
+        repo->defer_index_updates(false);
+        REQUIRE(uenv::flat_index_query(path, label)->size() == 1u);
+    }
+
+    // an invalid index is not used
+    {
+        const auto path = create_repo();
+        const auto index = uenv::flat_index_path(path);
+        fs::resize_file(index, fs::file_size(index) - 1);
+        REQUIRE(!uenv::flat_index_query(path, label));
+        std::ofstream(index) << "wombat";
+        REQUIRE(!uenv::flat_index_query(path, label));
+    }
+
+    // there is no index for a database with WAL journaling
+    {
+        const auto path = create_repo();
+        auto repo = uenv::open_repository(path, uenv::repo_mode::readwrite);
+        REQUIRE(repo->set_journal(uenv::journal_mode::wal));
+        REQUIRE(!fs::exists(uenv::flat_index_path(path)));
+        REQUIRE(!uenv::flat_index_query(path, label));
+
+        REQUIRE(repo->set_journal(uenv::journal_mode::rollback));
+        REQUIRE(uenv::flat_index_query(path, label)->size() == 1u);
+    }
+}
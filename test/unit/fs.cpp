@@ -1,4 +1,10 @@
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
 
 #include <catch2/catch_all.hpp>
 #include <fmt/core.h>
@@ -149,3 +155,63 @@ TEST_CASE("is_child", "[fs]") {
         REQUIRE(!util::is_child(child, parent));
     }
 }
+
+TEST_CASE("clone_file", "[fs]") {
+    const auto dir = util::make_temp_dir();
+    const std::string content(3 << 20, 'x');
+    std::ofstream(dir / "src", std::ios::binary) << content;
+
+    auto read = [](const fs::path& p) {
+        std::ifstream in(p, std::ios::binary);
+        return std::string{std::istreambuf_iterator<char>(in), {}};
+    };
+
+    // a file is cloned or linked on the same file system
+    auto method = util::clone_file(dir / "src", dir / "dst");
+    REQUIRE(method);
+    REQUIRE(read(dir / "dst") == content);
+    REQUIRE(!fs::exists(fmt::format("{}.{}.tmp", (dir / "dst").string(),
+                                    getpid())));
+
+    // an existing destination is replaced
+    std::ofstream(dir / "other", std::ios::binary) << "abc";
+    REQUIRE(util::clone_file(dir / "src", dir / "other"));
+    REQUIRE(read(dir / "other") == content);
+
+    REQUIRE(!util::clone_file(dir / "missing", dir / "dst2"));
+    REQUIRE(!fs::exists(dir / "dst2"));
+}
+
+TEST_CASE("make_file_lock", "[fs]") {
+    const auto dir = util::make_temp_dir();
+    const auto path = dir / "lock";
+
+    // any number of processes can hold a shared lock
+    {
+        auto a = util::make_file_lock(path, util::lock_type::shared);
+        auto b = util::make_file_lock(path, util::lock_type::shared);
+        REQUIRE(a);
+        REQUIRE(b);
+    }
+    REQUIRE(util::make_file_lock(path));
+
+    // waits for a lock can be bounded
+    {
+        auto held = util::make_file_lock(path);
+        REQUIRE(held);
+        const auto timeout = std::chrono::milliseconds(200);
+        REQUIRE(!util::make_file_lock(path, util::lock_type::shared, timeout));
+        REQUIRE(
+            !util::make_file_lock(path, util::lock_type::exclusive, timeout));
+    }
+    REQUIRE(util::make_file_lock(path, util::lock_type::shared,
+                                 std::chrono::milliseconds(200)));
+
+    // shared locks can be taken on files that can't be written
+    if (getuid() != 0) {
+        fs::permissions(path, fs::perms::owner_read);
+        REQUIRE(util::make_file_lock(path, util::lock_type::shared));
+        REQUIRE(!util::make_file_lock(dir / "missing" / "lock",
+                                      util::lock_type::shared));
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+// A local stand-in for HTTP services used in tests: a server on the loopback
+// interface that answers each request with the response returned by a
+// handler, which is passed the text of the request (headers and body).
+// Each connection is served by its own thread. With keep_alive connections
+// stay open for further requests, otherwise they are closed after each
+// response.
+struct http_stub {
+    struct response {
+        int status = 200;
+        std::vector<std::string> headers;
+        std::string body;
+        // close the connection after sending only this many bytes of the
+        // body, to simulate a connection that fails during a transfer
+        std::optional<std::size_t> truncate = std::nullopt;
+    };
+    using handler_type = std::function<response(const std::string&)>;
+
+    handler_type handler;
+    bool keep_alive;
+    std::atomic<int> requests{0};
+    std::atomic<int> connections{0};
+    int port = 0;
+
+    http_stub(handler_type h, bool keep_alive = false)
+        : handler(std::move(h)), keep_alive(keep_alive) {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        listen(fd_, 64);
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~http_stub() {
+        shutdown(fd_, SHUT_RDWR);
+        close(fd_);
+        thread_.join();
+        {
+            std::lock_guard _(mutex_);
+            for (auto c : open_) {
+                shutdown(c, SHUT_RDWR);
+            }
+        }
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+    std::string url(const std::string& path = "/list") const {
+        return fmt::format("http://127.0.0.1:{}{}", port, path);
+    }
+
+  private:
+    int fd_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<int> open_;
+    std::vector<std::thread> workers_;
+
+    void serve() {
+        while (true) {
+            const int c = accept(fd_, nullptr, nullptr);
+            if (c < 0) {
+                return;
+            }
+            ++connections;
+            std::lock_guard _(mutex_);
+            open_.push_back(c);
+            workers_.emplace_back([this, c] { serve_connection(c); });
+        }
+    }
+
+    static std::string lower(std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    void serve_connection(int c) {
+        std::string buffer;
+        char chunk[4096];
+        auto fill = [&]() {
+            const auto n = read(c, chunk, sizeof(chunk));
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(chunk, n);
+            return true;
+        };
+        while (true) {
+            std::size_t end;
+            while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+                if (!fill()) {
+                    return close_connection(c);
+                }
+            }
+            end += 4;
+            const auto head = lower(buffer.substr(0, end));
+            if (head.find("expect: 100-continue") != std::string::npos) {
+                const std::string cont = "HTTP/1.1 100 Continue\r\n\r\n";
+                write(c, cont.data(), cont.size());
+            }
+            std::size_t length = 0;
+            if (auto p = head.find("content-length:"); p != std::string::npos) {
+                length = std::strtoul(head.c_str() + p + 15, nullptr, 10);
+            }
+            while (buffer.size() < end + length) {
+                if (!fill()) {
+                    return close_connection(c);
+                }
+            }
+            const auto request = buffer.substr(0, end + length);
+            buffer.erase(0, end + length);
+
+            ++requests;
+            const auto r = handler(request);
+            std::string text = fmt::format("HTTP/1.1 {} stub\r\n", r.status);
+            for (auto& h : r.headers) {
+                text += h + "\r\n";
+            }
+            text += fmt::format("Content-Length: {}\r\n", r.body.size());
+            text += keep_alive ? "\r\n" : "Connection: close\r\n\r\n";
+            if (r.truncate) {
+                text += r.body.substr(0, *r.truncate);
+                write(c, text.data(), text.size());
+                return close_connection(c);
+            }
+            text += r.body;
+            write(c, text.data(), text.size());
+            if (!keep_alive) {
+                return close_connection(c);
+            }
+        }
+    }
+
+    void close_connection(int c) {
+        std::lock_guard _(mutex_);
+        std::erase(open_, c);
+        close(c);
+    }
+};
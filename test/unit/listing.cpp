@@ -0,0 +1,381 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+#include <fmt/core.h>
+
+#include <site/listing_parser.h>
+#include <site/site.h>
+#include <uenv/repository.h>
+#include <util/fs.h>
+
+#include "http_stub.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string entry(char sha, const std::string& path) {
+    return fmt::format(
+        R"({{"sha256": "{}", "created": "2024-12-03", "path": "{}", "size": 1024}})",
+        std::string(64, sha), path);
+}
+
+const std::string entry_a = entry('a', "deploy/daint/gh200/prgenv-gnu/24.11/v1");
+const std::string entry_b = entry('b', "deploy/daint/gh200/prgenv-gnu/24.11/v2");
+const std::string entry_c = entry('c', "deploy/daint/gh200/netcdf-tools/2025/v1");
+const std::string entry_x = entry('x', "build/daint/gh200/prgenv-gnu/24.11/123");
+
+std::size_t count(site::listing_config config, bool revalidate = false) {
+    site::set_listing_config(config);
+    auto listing = site::registry_listing("deploy", {}, revalidate);
+    REQUIRE(listing);
+    return listing->query({})->size();
+}
+
+} // namespace
+
+TEST_CASE("ttl", "[listing]") {
+    http_stub server([](const std::string&) -> http_stub::response {
+        return {200, {}, fmt::format(R"({{"results": [{}, {}, {}]}})", entry_a,
+                                     entry_b, entry_x)};
+    });
+    const auto cache = util::make_temp_dir();
+    const site::listing_config config{
+        .url = server.url(), .cache = cache, .ttl = std::chrono::seconds(60)};
+
+    // only records in the namespace are cached
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 1);
+    REQUIRE(fs::is_regular_file(cache / "listings/deploy/index.db"));
+
+    // e.g. `uenv image find` followed by `uenv image pull`
+    REQUIRE(count(config) == 2);
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 1);
+
+    // force revalidation
+    REQUIRE(count(config, true) == 2);
+    REQUIRE(server.requests == 2);
+
+    // expired listings are fetched again
+    site::expire_listing("deploy");
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 3);
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 3);
+
+    // without a cache every listing is fetched
+    REQUIRE(count({.url = server.url()}) == 2);
+    REQUIRE(count({.url = server.url()}) == 2);
+    REQUIRE(server.requests == 5);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("revalidation", "[listing]") {
+    std::atomic<int> etag{1};
+    std::atomic<int> not_modified{0};
+    http_stub server([&](const std::string& request) -> http_stub::response {
+        const auto current = fmt::format("\"{}\"", etag.load());
+        if (request.find(fmt::format("If-None-Match: {}", current)) !=
+            std::string::npos) {
+            ++not_modified;
+            return {304, {}, {}};
+        }
+        const auto body =
+            etag == 1 ? fmt::format(R"({{"results": [{}, {}]}})", entry_a,
+                                    entry_b)
+                      : fmt::format(R"({{"results": [{}, {}, {}]}})", entry_a,
+                                    entry_b, entry_c);
+        return {200, {fmt::format("ETag: {}", current)}, body};
+    });
+    const auto cache = util::make_temp_dir();
+    const site::listing_config config{
+        .url = server.url(), .cache = cache, .ttl = std::chrono::seconds(0)};
+
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 1);
+    REQUIRE(not_modified == 0);
+
+    // unchanged listings are revalidated without downloading them again
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 2);
+    REQUIRE(not_modified == 1);
+
+    // changed listings are downloaded
+    etag = 2;
+    REQUIRE(count(config) == 3);
+    REQUIRE(server.requests == 3);
+    REQUIRE(not_modified == 1);
+    REQUIRE(count(config) == 3);
+    REQUIRE(not_modified == 2);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("incremental", "[listing]") {
+    http_stub server([&](const std::string& request) -> http_stub::response {
+        if (request.find("since=v1") != std::string::npos) {
+            // entry_c was added and the image with sha 'a' was deleted
+            return {200,
+                    {},
+                    fmt::format(R"({{"version": "v2", "incremental": true, )"
+                                R"("results": [{}], "deleted": ["{}"]}})",
+                                entry_c, std::string(64, 'a'))};
+        }
+        if (request.find("since=v2") != std::string::npos) {
+            return {200,
+                    {},
+                    R"({"version": "v2", "incremental": true, "results": []})"};
+        }
+        return {200,
+                {},
+                fmt::format(R"({{"version": "v1", "results": [{}, {}]}})",
+                            entry_a, entry_b)};
+    });
+    const auto cache = util::make_temp_dir();
+    const site::listing_config config{
+        .url = server.url(), .cache = cache, .ttl = std::chrono::seconds(0)};
+
+    REQUIRE(count(config) == 2);
+
+    site::set_listing_config(config);
+    auto listing = site::registry_listing("deploy");
+    REQUIRE(listing);
+    auto records = listing->query({});
+    REQUIRE(records->size() == 2);
+    for (auto& r : *records) {
+        REQUIRE(r.sha != uenv::sha256(std::string(64, 'a')));
+    }
+    REQUIRE(listing->query({.name = "netcdf-tools"})->size() == 1);
+
+    REQUIRE(count(config) == 2);
+    REQUIRE(server.requests == 3);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("filter", "[listing]") {
+    std::string last_request;
+    // a service that ignores the filters
+    http_stub server([&](const std::string& request) -> http_stub::response {
+        last_request = request.substr(0, request.find("\r\n"));
+        return {200,
+                {},
+                fmt::format(R"({{"results": [{}, {}, {}]}})", entry_a, entry_b,
+                            entry_c)};
+    });
+
+    site::set_listing_config({.url = server.url()});
+    {
+        auto listing = site::registry_listing(
+            "deploy",
+            {.name = "prgenv-gnu", .version = "24.11", .system = "daint"});
+        REQUIRE(listing);
+        REQUIRE(last_request.find("namespace=deploy&cluster=daint&app=prgenv-"
+                                  "gnu&version=24.11") != std::string::npos);
+        REQUIRE(listing->query({})->size() == 2);
+    }
+    {
+        // the name might be an id, which can't be passed to the service
+        auto listing = site::registry_listing(
+            "deploy", {.name = std::string(16, 'c'), .uarch = "gh200"});
+        REQUIRE(listing);
+        REQUIRE(last_request.find("namespace=deploy&arch=gh200 ") !=
+                std::string::npos);
+        REQUIRE(listing->query({.name = std::string(16, 'c')})->size() == 1);
+    }
+
+    // filters are not used when a cached listing is available
+    const auto cache = util::make_temp_dir();
+    const site::listing_config config{
+        .url = server.url(), .cache = cache, .ttl = std::chrono::seconds(60)};
+    REQUIRE(count(config) == 3);
+    REQUIRE(server.requests == 3);
+    auto listing = site::registry_listing("deploy", {.name = "netcdf-tools"});
+    REQUIRE(listing);
+    REQUIRE(listing->query({})->size() == 3);
+    REQUIRE(server.requests == 3);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("unavailable", "[listing]") {
+    const auto cache = util::make_temp_dir();
+    std::string url;
+    {
+        http_stub server([](const std::string&) -> http_stub::response {
+            return {200, {}, fmt::format(R"({{"results": [{}]}})", entry_a)};
+        });
+        url = server.url();
+        REQUIRE(count({.url = url, .cache = cache}) == 1);
+    }
+
+    // the cached listing is used if the service can't be reached
+    site::set_listing_config({.url = url, .cache = cache});
+    site::expire_listing("deploy");
+    REQUIRE(count({.url = url, .cache = cache}) == 1);
+
+    // which is an error if there is no cached listing
+    site::set_listing_config({.url = url});
+    REQUIRE(!site::registry_listing("deploy"));
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("invalid namespace", "[listing]") {
+    http_stub server([](const std::string&) -> http_stub::response {
+        return {200, {}, fmt::format(R"({{"results": [{}]}})", entry_a)};
+    });
+    const auto cache = util::make_temp_dir() / "cache";
+    site::set_listing_config({.url = server.url(), .cache = cache});
+
+    // namespaces are used as a directory in the cache
+    for (auto nspace : {"", ".", "..", "../deploy", "deploy/..", "a/b"}) {
+        REQUIRE(!site::registry_listing(nspace));
+        site::expire_listing(nspace);
+    }
+    REQUIRE(server.requests == 0);
+    REQUIRE(!fs::exists(cache));
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("rank endpoints", "[listing]") {
+    using namespace std::chrono_literals;
+    std::atomic<int> probes{0};
+    auto probe = [&probes](const std::string& endpoint) {
+        ++probes;
+        std::this_thread::sleep_for(endpoint == "slow" ? 200ms : 10ms);
+        return endpoint != "down";
+    };
+    const std::vector<std::string> endpoints{"down", "slow", "fast"};
+    const std::vector<std::string> ranked{"fast", "slow", "down"};
+
+    // a single endpoint is not probed
+    REQUIRE(site::rank_endpoints({"slow"}, probe) ==
+            std::vector<std::string>{"slow"});
+    REQUIRE(probes == 0);
+
+    // without a cache the endpoints are probed every time
+    REQUIRE(site::rank_endpoints(endpoints, probe) == ranked);
+    REQUIRE(site::rank_endpoints(endpoints, probe) == ranked);
+    REQUIRE(probes == 6);
+
+    // with a cache they are probed once
+    const auto cache = util::make_temp_dir();
+    site::set_listing_config({.cache = cache});
+    probes = 0;
+    REQUIRE(site::rank_endpoints(endpoints, probe) == ranked);
+    REQUIRE(site::rank_endpoints(endpoints, probe) == ranked);
+    REQUIRE(probes == 3);
+    REQUIRE(fs::is_regular_file(cache / "endpoints.json"));
+    // new endpoints are probed when they are added
+    REQUIRE(site::rank_endpoints({"slow", "new"}, probe) ==
+            std::vector<std::string>{"new", "slow"});
+    REQUIRE(probes == 4);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("mirrors", "[listing]") {
+    using namespace std::chrono_literals;
+    std::string down;
+    {
+        http_stub server([](const std::string&) -> http_stub::response {
+            return {200, {}, {}};
+        });
+        down = server.url();
+    }
+    // responds quickly to probes, but fails to provide a listing
+    http_stub broken([](const std::string& request) -> http_stub::response {
+        if (request.starts_with("HEAD")) {
+            return {200, {}, {}};
+        }
+        return {503, {}, {}};
+    });
+    http_stub mirror([](const std::string& request) -> http_stub::response {
+        if (request.starts_with("HEAD")) {
+            std::this_thread::sleep_for(100ms);
+        }
+        return {200, {}, fmt::format(R"({{"results": [{}]}})", entry_a)};
+    });
+
+    // the listing is fetched from a mirror if the service can't be reached
+    REQUIRE(count({.url = down, .mirrors = {mirror.url()}}) == 1);
+
+    // or if it returns an error
+    const auto before = broken.requests.load();
+    REQUIRE(count({.url = mirror.url(), .mirrors = {broken.url()}}) == 1);
+    REQUIRE(broken.requests == before + 2);
+
+    // which is an error if every mirror fails, naming the endpoints that were
+    // tried and the last error
+    site::set_listing_config({.url = down, .mirrors = {broken.url()}});
+    auto failed = site::registry_listing("deploy");
+    REQUIRE(!failed);
+    REQUIRE(failed.error().find(down) != std::string::npos);
+    REQUIRE(failed.error().find(broken.url()) != std::string::npos);
+    REQUIRE(failed.error().find("uenv-list.svc.cscs.ch") == std::string::npos);
+
+    site::set_listing_config({});
+}
+
+TEST_CASE("parser", "[listing]") {
+    const auto input = fmt::format(
+        R"({{"version": "vé1", "results": [{}, {}, {}, {}],)"
+        R"( "deleted": ["a\"b"], "incremental": true, "other": [1, -2.5e3, null, {{}}]}})",
+        entry_a, entry_x, entry_b, entry_c);
+
+    // parse the input split into chunks of many sizes
+    for (std::size_t chunk = 1; chunk <= input.size(); chunk += 7) {
+        site::listing_parser parser("deploy");
+        for (std::size_t i = 0; i < input.size(); i += chunk) {
+            REQUIRE(parser.feed(std::string_view(input).substr(i, chunk)));
+        }
+        auto result = parser.finish();
+        REQUIRE(result);
+        REQUIRE(result->records.size() == 3);
+        REQUIRE(result->records[0].name == "prgenv-gnu");
+        REQUIRE(result->records[0].tag == "v1");
+        REQUIRE(result->records[0].size_byte == 1024);
+        REQUIRE(result->records[0].sha == uenv::sha256(std::string(64, 'a')));
+        REQUIRE(result->records[1].tag == "v2");
+        REQUIRE(result->records[2].name == "netcdf-tools");
+        REQUIRE(result->version == "v\xc3\xa9" "1");
+        REQUIRE(result->incremental);
+        REQUIRE(result->deleted == std::vector<std::string>{"a\"b"});
+    }
+
+    // records in other namespaces and invalid records are dropped
+    {
+        site::listing_parser parser("build");
+        REQUIRE(parser.feed(fmt::format(
+            R"({{"results": [{}, {}, {{"path": "build/a/b/c/d/e"}}]}})",
+            entry_a, entry_x)));
+        auto result = parser.finish();
+        REQUIRE(result);
+        REQUIRE(result->records.size() == 1);
+        REQUIRE(result->records[0].tag == "123");
+        REQUIRE(!result->incremental);
+        REQUIRE(!result->version);
+    }
+
+    // invalid and incomplete input
+    for (auto in : {R"({"results": [}")", R"({"results" [])", R"({"a": tru})",
+                    R"({"a": 1.2.3})", R"({"a": "\x"})", R"([1, 2,])"}) {
+        site::listing_parser parser("deploy");
+        parser.feed(in);
+        REQUIRE(!parser.finish());
+    }
+    for (auto in : {R"({"results": [)", R"({"results": [{"path": "dep)", ""}) {
+        site::listing_parser parser("deploy");
+        REQUIRE(parser.feed(in));
+        REQUIRE(!parser.finish());
+    }
+}
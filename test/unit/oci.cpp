@@ -0,0 +1,923 @@
+#include <atomic>
+#include <csignal>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+#include <fmt/core.h>
+
+#include <uenv/oci.h>
+#include <uenv/oras.h>
+#include <util/defer.h>
+#include <util/fs.h>
+#include <util/sha256.h>
+#include <util/signal.h>
+
+#include "http_stub.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// A stand-in for an OCI registry, that stores manifests and blobs in memory.
+// Requests must be authorized with a bearer token, which is issued for the
+// credentials user:pw ("dXNlcjpwdw==" in base64).
+struct registry_stub {
+    // support the referrers API, otherwise referrers are found using the
+    // referrers tag schema
+    bool referrers_api;
+    // corrupt the blobs that are downloaded
+    std::atomic<bool> corrupt = false;
+    // respond to range requests for blobs
+    std::atomic<bool> ranges = true;
+    // drop the connection half way through each blob download
+    std::atomic<bool> drop = false;
+    // the range [first, last) of each range request for a blob
+    std::vector<std::pair<std::size_t, std::size_t>> range_requests;
+    // the number of chunks that are accepted before chunked uploads fail
+    std::atomic<int> patch_limit = -1;
+    // drop the connection after storing the next chunks of chunked uploads
+    std::atomic<int> drop_patches = 0;
+    // the bytes received in chunks of chunked uploads
+    std::atomic<std::size_t> patched_bytes = 0;
+    // support cross repository blob mounts
+    std::atomic<bool> mounts = true;
+    int mounted = 0;
+
+    std::mutex mutex;
+    // name@reference -> {media type, content}
+    std::map<std::string, std::pair<std::string, std::string>> manifests;
+    // name@digest -> content
+    std::map<std::string, std::string> blobs;
+    int uploads = 0;
+    // upload id -> the chunks received so far
+    std::map<std::string, std::string> sessions;
+
+    http_stub server;
+
+    registry_stub(bool referrers_api = true)
+        : referrers_api(referrers_api),
+          server([this](const std::string& r) { return handle(r); }, true) {
+    }
+
+    std::string url() const {
+        return server.url("/uenv");
+    }
+
+    http_stub::response handle(const std::string& request) {
+        const auto line_end = request.find("\r\n");
+        const auto head_end = request.find("\r\n\r\n");
+        const auto line = request.substr(0, line_end);
+        const auto headers = request.substr(line_end, head_end - line_end);
+        const auto body = request.substr(head_end + 4);
+        const auto method = line.substr(0, line.find(' '));
+        auto target = line.substr(method.size() + 1);
+        target = target.substr(0, target.find(' '));
+        const auto path = target.substr(0, target.find('?'));
+        const auto query = target.find('?') == std::string::npos
+                               ? std::string{}
+                               : target.substr(target.find('?') + 1);
+
+        if (path == "/token") {
+            if (headers.find("Authorization: Basic dXNlcjpwdw==") ==
+                std::string::npos) {
+                return {401, {}, R"({"errors": [{"code": "UNAUTHORIZED"}]})"};
+            }
+            return {200, {}, R"({"token": "secret"})"};
+        }
+        if (headers.find("Authorization: Bearer secret") == std::string::npos) {
+            return {401,
+                    {fmt::format("WWW-Authenticate: Bearer "
+                                 "realm=\"http://127.0.0.1:{}/token\","
+                                 "service=\"stub\"",
+                                 server.port)},
+                    {}};
+        }
+
+        std::lock_guard _(mutex);
+        auto split = [&path](const std::string& marker) {
+            const auto p = path.rfind(marker);
+            return std::pair{path.substr(4, p - 4),
+                             path.substr(p + marker.size())};
+        };
+        if (path.find("/manifests/") != std::string::npos) {
+            const auto [name, ref] = split("/manifests/");
+            const auto key = name + "@" + ref;
+            if (method == "PUT") {
+                const auto digest = uenv::oci::digest_of(body);
+                const auto type = header(headers, "Content-Type");
+                manifests[key] = {type, body};
+                manifests[name + "@" + digest] = {type, body};
+                std::vector<std::string> h{"Docker-Content-Digest: " + digest};
+                if (referrers_api && body.find("subject") != std::string::npos) {
+                    h.push_back("OCI-Subject: sha256:x");
+                }
+                return {201, h, {}};
+            }
+            if (!manifests.contains(key)) {
+                return {404, {}, R"({"errors": [{"code": "MANIFEST_UNKNOWN"}]})"};
+            }
+            return {200,
+                    {"Content-Type: " + manifests[key].first},
+                    manifests[key].second};
+        }
+        if (path.find("/referrers/") != std::string::npos) {
+            if (!referrers_api) {
+                return {404, {}, {}};
+            }
+            const auto [name, digest] = split("/referrers/");
+            std::string index = R"({"schemaVersion": 2, "manifests": [)";
+            std::string sep;
+            for (auto& [key, m] : manifests) {
+                const auto d = uenv::oci::digest_of(m.second);
+                if (key == name + "@" + d &&
+                    m.second.find(digest) != std::string::npos) {
+                    auto parsed = uenv::oci::parse_manifest(m.second);
+                    index += fmt::format(
+                        R"({}{{"mediaType": "{}", "digest": "{}", "size": {}, "artifactType": "{}"}})",
+                        sep, m.first, d, m.second.size(),
+                        parsed->artifact_type.value_or(""));
+                    sep = ", ";
+                }
+            }
+            return {200, {}, index + "]}"};
+        }
+        if (path.find("/blobs/uploads/") != std::string::npos) {
+            const auto [name, id] = split("/blobs/uploads/");
+            if (method == "POST") {
+                const auto digest = param(query, "mount");
+                const auto from = param(query, "from");
+                if (mounts && blobs.contains(from + "@" + digest)) {
+                    blobs[name + "@" + digest] = blobs[from + "@" + digest];
+                    ++mounted;
+                    return {201, {}, {}};
+                }
+                return {202,
+                        {fmt::format("Location: /v2/{}/blobs/uploads/{}?state=x",
+                                     name, ++uploads)},
+                        {}};
+            }
+            auto& data = sessions[id];
+            const auto range = [&data] {
+                return fmt::format("Range: 0-{}",
+                                   std::max<std::size_t>(data.size(), 1) - 1);
+            };
+            if (method == "GET") {
+                return {204, {range()}, {}};
+            }
+            if (method == "PATCH") {
+                if (patch_limit == 0) {
+                    return {500, {}, {}};
+                }
+                if (std::stoul(header(headers, "Content-Range")) !=
+                    data.size()) {
+                    return {416, {range()}, {}};
+                }
+                --patch_limit;
+                data += body;
+                patched_bytes += body.size();
+                std::vector<std::string> h{
+                    fmt::format("Location: /v2/{}/blobs/uploads/{}?state={}",
+                                name, id, data.size()),
+                    range()};
+                if (drop_patches > 0) {
+                    --drop_patches;
+                    return {202, h, "accepted", 0};
+                }
+                return {202, h, {}};
+            }
+            const auto blob = data + body;
+            sessions.erase(id);
+            const auto digest = query.substr(query.find("digest=") + 7);
+            const auto expected =
+                uenv::oci::digest_of(blob).replace(6, 1, "%3A");
+            if (digest != expected) {
+                return {400, {}, R"({"errors": [{"code": "DIGEST_INVALID"}]})"};
+            }
+            blobs[name + "@" + uenv::oci::digest_of(blob)] = blob;
+            return {201, {}, {}};
+        }
+        if (path.find("/blobs/") != std::string::npos) {
+            const auto [name, digest] = split("/blobs/");
+            const auto key = name + "@" + digest;
+            if (!blobs.contains(key)) {
+                return {404, {}, {}};
+            }
+            if (method == "HEAD") {
+                // http_stub sets the Content-Length of the empty body
+                return {200, {}, {}};
+            }
+            auto blob = blobs[key];
+            if (drop) {
+                return {200, {}, blob, blob.size() / 2};
+            }
+            if (corrupt) {
+                blob[blob.size() / 2] ^= 1;
+            }
+            if (const auto p = headers.find("Range: bytes="); p != std::string::npos) {
+                // "bytes=first-" or "bytes=first-last"
+                const auto spec = headers.substr(p + 13);
+                const auto first = std::stoul(spec);
+                const auto dash = spec.find('-');
+                const auto last = std::isdigit(spec[dash + 1])
+                                      ? std::stoul(spec.substr(dash + 1)) + 1
+                                      : blob.size();
+                range_requests.emplace_back(first, last);
+                if (ranges) {
+                    return {206,
+                            {fmt::format("Content-Range: bytes {}-{}/{}", first,
+                                         last - 1, blob.size())},
+                            blob.substr(first, last - first)};
+                }
+            }
+            return {200, {}, blob};
+        }
+        return {404, {}, {}};
+    }
+
+    // the unescaped value of a query parameter
+    static std::string param(const std::string& query, const std::string& name) {
+        const auto p = query.find(name + "=");
+        if (p == std::string::npos) {
+            return {};
+        }
+        const auto begin = p + name.size() + 1;
+        auto value = query.substr(begin, query.find('&', begin) - begin);
+        for (auto q = value.find('%'); q != std::string::npos;
+             q = value.find('%', q + 1)) {
+            value.replace(q, 3, 1, char(std::stoi(value.substr(q + 1, 2),
+                                                  nullptr, 16)));
+        }
+        return value;
+    }
+
+    static std::string header(const std::string& headers,
+                              const std::string& name) {
+        const auto p = headers.find(name + ": ");
+        const auto begin = p + name.size() + 2;
+        return headers.substr(begin, headers.find("\r\n", begin) - begin);
+    }
+};
+
+void write_file(const fs::path& path, const std::string& contents) {
+    std::ofstream(path, std::ios::binary) << contents;
+}
+
+std::string read_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+const uenv::uenv_label label{.name = "prgenv-gnu",
+                             .version = "24.11",
+                             .tag = "v1",
+                             .system = "daint",
+                             .uarch = "gh200"};
+const uenv::uenv_record record{.system = "daint",
+                               .uarch = "gh200",
+                               .name = "prgenv-gnu",
+                               .version = "24.11",
+                               .tag = "v1",
+                               .size_byte = 1 << 20};
+const uenv::oras::credentials creds{"user", "pw"};
+
+// push an image with meta data to the registry
+void push(const registry_stub& registry, const std::string& image) {
+    const auto src = util::make_temp_dir();
+    write_file(src / "store.squashfs", image);
+    fs::create_directories(src / "meta");
+    write_file(src / "meta/env.json", R"({"name": "prgenv-gnu"})");
+
+    REQUIRE(uenv::oras::push_tag(registry.url(), "build", label,
+                                 src / "store.squashfs", creds));
+    REQUIRE(uenv::oras::push_meta(registry.url(), "build", label, src / "meta",
+                                  creds));
+}
+
+// the record of an image
+uenv::uenv_record with_sha(uenv::uenv_record r, const std::string& image) {
+    r.sha = uenv::sha256(util::sha256_hex(image));
+    return r;
+}
+
+// pull the image pushed by push()
+void pull(const registry_stub& registry, const std::string& nspace,
+          const std::string& image) {
+    auto digests = uenv::oras::discover(registry.url(), nspace, record, creds);
+    REQUIRE(digests);
+    REQUIRE(digests->size() == 1);
+
+    const auto dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull_digest(registry.url(), nspace, record,
+                                    digests->front(), dst, creds));
+    REQUIRE(read_file(dst / "meta/env.json") == R"({"name": "prgenv-gnu"})");
+    REQUIRE(uenv::oras::pull_tag(registry.url(), nspace,
+                                 with_sha(record, image), dst, creds));
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+}
+
+std::string make_image(std::size_t size) {
+    std::string image(size, 0);
+    for (std::size_t i = 0; i < size; ++i) {
+        image[i] = char((i * 2654435761u) >> 13);
+    }
+    return image;
+}
+
+} // namespace
+
+TEST_CASE("push and pull", "[oci]") {
+    const auto image = make_image(3 << 20);
+    for (bool referrers_api : {true, false}) {
+        registry_stub registry(referrers_api);
+        push(registry, image);
+        pull(registry, "build", image);
+
+        // pushing the same image again does not upload the blobs again
+        const auto uploads = registry.uploads;
+        REQUIRE(uenv::oras::push_tag(registry.url(), "build", label,
+                                     util::make_temp_dir() / "missing", creds)
+                    .error()
+                    .returncode);
+        const auto src = util::make_temp_dir();
+        write_file(src / "store.squashfs", image);
+        REQUIRE(uenv::oras::push_tag(registry.url(), "build", label,
+                                     src / "store.squashfs", creds));
+        REQUIRE(registry.uploads == uploads);
+    }
+}
+
+TEST_CASE("concurrent push", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const auto src = util::make_temp_dir();
+    write_file(src / "store.squashfs", image);
+    fs::create_directories(src / "meta");
+    write_file(src / "meta/env.json", R"({"name": "prgenv-gnu"})");
+
+    // the image, meta data and block index are pushed together
+    registry_stub registry;
+    auto r = uenv::oras::push(registry.url(), "build", label,
+                              src / "store.squashfs",
+                              {.meta = src / "meta", .blocks = true}, creds);
+    REQUIRE(r);
+    REQUIRE(r->meta);
+    REQUIRE(r->blocks);
+    pull(registry, "build", image);
+    auto digests = uenv::oras::discover(registry.url(), "build", record, creds);
+    REQUIRE(digests);
+    REQUIRE(digests->size() == 1);
+
+    // blobs that are in the registry are not uploaded again, and the known
+    // digest of the image is used instead of hashing it again
+    const auto uploads = registry.uploads;
+    REQUIRE(uenv::oras::push(registry.url(), "build", label,
+                             src / "store.squashfs",
+                             {.meta = src / "meta",
+                              .blocks = true,
+                              .digest = util::sha256_hex(image)},
+                             creds));
+    REQUIRE(registry.uploads == uploads);
+
+    // missing meta data is a warning
+    registry_stub other;
+    r = uenv::oras::push(other.url(), "build", label, src / "store.squashfs",
+                         {.meta = src / "missing", .blocks = false}, creds);
+    REQUIRE(r);
+    REQUIRE(!r->meta);
+    REQUIRE(!r->blocks);
+    // a missing image is an error
+    REQUIRE(!uenv::oras::push(other.url(), "build", label, src / "missing",
+                              {}, creds));
+}
+
+TEST_CASE("chunked push", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const uenv::oci::descriptor blob{.media_type = "application/octet-stream",
+                                     .digest = uenv::oci::digest_of(image),
+                                     .size = image.size()};
+    const auto src = util::make_temp_dir() / "store.squashfs";
+    write_file(src, image);
+
+    const auto saved = uenv::oci::get_upload_config();
+    auto restore = util::defer([&] { uenv::oci::set_upload_config(saved); });
+    const auto state_dir = util::make_temp_dir();
+    uenv::oci::set_upload_config(
+        {.chunk_size = 1 << 20, .state_dir = state_dir});
+
+    // blobs larger than a chunk are uploaded in chunks
+    {
+        registry_stub registry;
+        uenv::oci::client client(registry.url(), creds);
+        REQUIRE(client.put_blob("build/a", blob, src));
+        REQUIRE(registry.patched_bytes == image.size());
+        REQUIRE(registry.blobs.at("uenv/build/a@" + blob.digest) == image);
+        REQUIRE(fs::is_empty(state_dir));
+    }
+
+    // a chunk whose response is lost is not sent again
+    {
+        registry_stub registry;
+        registry.drop_patches = 1;
+        uenv::oci::client client(registry.url(), creds);
+        REQUIRE(client.put_blob("build/a", blob, src));
+        REQUIRE(registry.patched_bytes == image.size());
+        REQUIRE(registry.blobs.at("uenv/build/a@" + blob.digest) == image);
+    }
+
+    // an interrupted upload is resumed from where it stopped
+    {
+        registry_stub registry;
+        registry.patch_limit = 2;
+        uenv::oci::client client(registry.url(), creds);
+        REQUIRE(!client.put_blob("build/a", blob, src));
+        REQUIRE(registry.patched_bytes == 2u << 20);
+        REQUIRE(!fs::is_empty(state_dir));
+
+        registry.patch_limit = -1;
+        REQUIRE(client.put_blob("build/a", blob, src));
+        REQUIRE(registry.patched_bytes == image.size());
+        REQUIRE(registry.uploads == 1);
+        REQUIRE(registry.blobs.at("uenv/build/a@" + blob.digest) == image);
+        REQUIRE(fs::is_empty(state_dir));
+    }
+}
+
+TEST_CASE("concurrent pull", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const auto r = with_sha(record, image);
+    registry_stub registry;
+    push(registry, image);
+
+    // the meta data and image are downloaded together
+    auto dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull(registry.url(), "build", r, dst,
+                             {.meta = true, .squashfs = true}, creds));
+    REQUIRE(read_file(dst / "meta/env.json") == R"({"name": "prgenv-gnu"})");
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+
+    // or one at a time
+    dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull(registry.url(), "build", r, dst,
+                             {.meta = true, .squashfs = false}, creds));
+    REQUIRE(fs::exists(dst / "meta/env.json"));
+    REQUIRE(!fs::exists(dst / "store.squashfs"));
+    REQUIRE(uenv::oras::pull(registry.url(), "build", r, dst,
+                             {.meta = false, .squashfs = true}, creds));
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+    // only the unpacked meta data is left in the destination
+    std::size_t entries = 0;
+    for ([[maybe_unused]] auto& e : fs::directory_iterator(dst)) {
+        ++entries;
+    }
+    REQUIRE(entries == 2);
+
+    // the pull fails if either download fails
+    registry_stub no_meta;
+    const auto src = util::make_temp_dir();
+    write_file(src / "store.squashfs", image);
+    REQUIRE(uenv::oras::push_tag(no_meta.url(), "build", label,
+                                 src / "store.squashfs", creds));
+    dst = util::make_temp_dir();
+    auto result = uenv::oras::pull(no_meta.url(), "build", r, dst,
+                                   {.meta = true, .squashfs = true}, creds);
+    REQUIRE(!result);
+    REQUIRE(!fs::exists(dst / "store.squashfs"));
+    REQUIRE(!fs::exists(dst / "meta"));
+}
+
+TEST_CASE("mirror failover", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const auto r = with_sha(record, image);
+    registry_stub registry;
+    registry_stub mirror;
+    push(registry, image);
+    push(mirror, image);
+    const std::string unreachable = "http://127.0.0.1:1/uenv";
+
+    REQUIRE(uenv::oci::client(registry.url()).ping(1000));
+    REQUIRE(!uenv::oci::client(unreachable).ping(1000));
+
+    // registries that can't be reached are skipped
+    auto dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull({unreachable, registry.url()}, "build", r, dst,
+                             {.meta = true, .squashfs = true}, creds));
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+    REQUIRE(fs::exists(dst / "meta/env.json"));
+
+    // the pull fails over if the connection fails during a download
+    registry.drop = true;
+    const auto before = mirror.server.requests.load();
+    dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull({registry.url(), mirror.url()}, "build", r, dst,
+                             {.meta = false, .squashfs = true}, creds));
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+    REQUIRE(mirror.server.requests > before);
+
+    // but not if the image is missing
+    registry_stub empty;
+    dst = util::make_temp_dir();
+    auto result = uenv::oras::pull({empty.url(), mirror.url()}, "build", r,
+                                   dst, {.meta = false, .squashfs = true}, creds);
+    REQUIRE(!result);
+    REQUIRE(result.error().returncode == 404);
+    REQUIRE(!result.error().network);
+
+    // or if every registry fails
+    dst = util::make_temp_dir();
+    result = uenv::oras::pull({unreachable, registry.url()}, "build", r, dst,
+                              {.meta = false, .squashfs = true}, creds);
+    REQUIRE(!result);
+    REQUIRE(result.error().network);
+}
+
+TEST_CASE("delta pull", "[oci]") {
+    // the new version of the image has data inserted in the middle
+    const auto old_image = make_image(2 << 20);
+    const auto image = old_image.substr(0, 700000) + std::string(5000, 'x') +
+                       old_image.substr(700000);
+    const auto r = with_sha(record, image);
+    const auto src = util::make_temp_dir();
+    write_file(src / "old.squashfs", old_image);
+    write_file(src / "store.squashfs", image);
+
+    registry_stub registry;
+    REQUIRE(uenv::oras::push_tag(registry.url(), "build", label,
+                                 src / "store.squashfs", creds));
+
+    // without a block index the seed is not used
+    auto dst = util::make_temp_dir();
+    auto result = uenv::oras::pull(
+        registry.url(), "build", r, dst,
+        {.meta = false, .squashfs = true, .seed = src / "old.squashfs"}, creds);
+    REQUIRE(result);
+    REQUIRE(result->seeded_bytes == 0);
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+
+    // with a block index only the blocks that changed are downloaded
+    REQUIRE(uenv::oras::push_blocks(registry.url(), "build", label,
+                                    src / "store.squashfs", creds));
+    registry.range_requests.clear();
+    dst = util::make_temp_dir();
+    result = uenv::oras::pull(
+        registry.url(), "build", r, dst,
+        {.meta = false, .squashfs = true, .seed = src / "old.squashfs"}, creds);
+    REQUIRE(result);
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+    REQUIRE(!fs::exists(dst / "store.squashfs.checkpoint"));
+    std::size_t downloaded = 0;
+    for (auto [first, last] : registry.range_requests) {
+        downloaded += last - first;
+    }
+    // the block with the insertion, and the partial last block
+    const std::size_t block_size = 64 * 1024;
+    REQUIRE(downloaded <= 3 * block_size);
+    REQUIRE(result->seeded_bytes + downloaded == image.size());
+
+    // the block index is copied with the image
+    REQUIRE(uenv::oras::copy(registry.url(), "build", r, "deploy", r, creds));
+    dst = util::make_temp_dir();
+    result = uenv::oras::pull(
+        registry.url(), "deploy", r, dst,
+        {.meta = false, .squashfs = true, .seed = src / "old.squashfs"}, creds);
+    REQUIRE(result);
+    REQUIRE(result->seeded_bytes > 0);
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+}
+
+TEST_CASE("copy", "[oci]") {
+    const auto image = make_image(1 << 20);
+    for (bool referrers_api : {true, false}) {
+        for (bool mounts : {true, false}) {
+            registry_stub registry(referrers_api);
+            registry.mounts = mounts;
+            push(registry, image);
+            const auto uploads = registry.uploads;
+            REQUIRE(uenv::oras::copy(registry.url(), "build", record,
+                                     "deploy", record, creds));
+            pull(registry, "deploy", image);
+            // the image, meta data and config blobs are mounted, or streamed
+            // through the client if the registry does not support mounts
+            REQUIRE(registry.mounted == (mounts ? 3 : 0));
+            REQUIRE((registry.uploads == uploads) == mounts);
+        }
+    }
+}
+
+TEST_CASE("copy to many destinations", "[oci]") {
+    const auto image = make_image(1 << 20);
+    registry_stub registry;
+    push(registry, image);
+
+    std::vector<uenv::oras::copy_target> targets;
+    for (auto system : {"daint", "clariden", "santis", "eiger", "bristen"}) {
+        auto r = record;
+        r.system = system;
+        targets.push_back({"deploy", r});
+    }
+    auto results = uenv::oras::copy(registry.url(), "build", record, targets,
+                                    2, creds);
+    REQUIRE(results.size() == targets.size());
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        REQUIRE(results[i]);
+        const auto dst = util::make_temp_dir();
+        REQUIRE(uenv::oras::pull_tag(registry.url(), "deploy",
+                                     with_sha(targets[i].uenv, image), dst,
+                                     creds));
+        REQUIRE(read_file(dst / "store.squashfs") == image);
+    }
+
+    // every destination fails if the source can't be resolved
+    auto missing = record;
+    missing.tag = "missing";
+    results = uenv::oras::copy(registry.url(), "build", missing, targets, 2,
+                               creds);
+    REQUIRE(results.size() == targets.size());
+    for (auto& r : results) {
+        REQUIRE(!r);
+    }
+}
+
+TEST_CASE("errors", "[oci]") {
+    const auto image = make_image(1024);
+    registry_stub registry;
+    push(registry, image);
+
+    // unknown images
+    auto missing = record;
+    missing.tag = "v2";
+    auto r = uenv::oras::discover(registry.url(), "build", missing, creds);
+    REQUIRE(!r);
+    REQUIRE(r.error().returncode == 404);
+
+    // invalid credentials
+    r = uenv::oras::discover(registry.url(), "build", record,
+                             uenv::oras::credentials{"user", "wrong"});
+    REQUIRE(!r);
+    REQUIRE(r.error().returncode == 401);
+    REQUIRE(!uenv::oras::discover(registry.url(), "build", record));
+
+    // the registry can't be contacted
+    REQUIRE(!uenv::oras::discover("http://127.0.0.1:1/uenv", "build", record,
+                                  creds));
+
+    // downloads that do not match their digest
+    registry.corrupt = true;
+    const auto dst = util::make_temp_dir();
+    REQUIRE(!uenv::oras::pull_tag(registry.url(), "build",
+                                  with_sha(record, image), dst, creds));
+    REQUIRE(!fs::exists(dst / "store.squashfs"));
+    REQUIRE(!fs::exists(dst / "store.squashfs.partial"));
+    REQUIRE(!fs::exists(dst / "store.squashfs.checkpoint"));
+
+    // images that do not match the sha256 of the record
+    registry.corrupt = false;
+    REQUIRE(!uenv::oras::pull_tag(registry.url(), "build",
+                                  with_sha(record, image + "x"), dst, creds));
+    REQUIRE(!fs::exists(dst / "store.squashfs.partial"));
+}
+
+TEST_CASE("resume", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const uenv::oci::descriptor blob{.media_type = "application/octet-stream",
+                                     .digest = uenv::oci::digest_of(image),
+                                     .size = image.size()};
+
+    for (bool ranges : {true, false}) {
+        registry_stub registry;
+        registry.ranges = ranges;
+        uenv::oci::client client(registry.url(), creds);
+        REQUIRE(client.put_blob("build/a", blob, image));
+
+        // cancel the download part way through
+        const auto dst = util::make_temp_dir() / "store.squashfs";
+        std::uint64_t cancelled_at = 0;
+        auto r = client.get_blob("build/a", blob, dst, [&](std::uint64_t n) {
+            cancelled_at = n;
+            return n < (1 << 20);
+        });
+        REQUIRE(!r);
+        REQUIRE(r.error().code == uenv::oci::errc::cancelled);
+        REQUIRE(!fs::exists(dst));
+        REQUIRE(fs::exists(fs::path(dst.string() + ".partial")));
+        REQUIRE(fs::exists(fs::path(dst.string() + ".checkpoint")));
+        REQUIRE(cancelled_at > 0);
+
+        // the next download resumes from where the first stopped, or starts
+        // again if the registry ignores the range request
+        REQUIRE(client.get_blob("build/a", blob, dst));
+        REQUIRE(read_file(dst) == image);
+        REQUIRE(!fs::exists(fs::path(dst.string() + ".partial")));
+        REQUIRE(!fs::exists(fs::path(dst.string() + ".checkpoint")));
+        REQUIRE(registry.range_requests.size() == 1);
+        REQUIRE(registry.range_requests.front().first == cancelled_at);
+    }
+
+    // a checkpoint for a different blob is ignored
+    registry_stub registry;
+    uenv::oci::client client(registry.url(), creds);
+    REQUIRE(client.put_blob("build/a", blob, image));
+    const auto dst = util::make_temp_dir() / "store.squashfs";
+    write_file(dst.string() + ".partial", "garbage");
+    write_file(dst.string() + ".checkpoint",
+               R"({"digest": "sha256:x", "size": 7, "ranges": [[0, 7]]})");
+    REQUIRE(client.get_blob("build/a", blob, dst));
+    REQUIRE(read_file(dst) == image);
+    REQUIRE(registry.range_requests.empty());
+}
+
+TEST_CASE("interrupted pull", "[oci]") {
+    const auto image = make_image(3 << 20);
+    registry_stub registry;
+    push(registry, image);
+
+    // a signal raised part way through the download cancels it, and keeps
+    // the partial download to be resumed
+    const auto dst = util::make_temp_dir();
+    util::set_signal_catcher();
+    bool raised = false;
+    REQUIRE_THROWS_AS(
+        uenv::oras::pull(registry.url(), "build", with_sha(record, image), dst,
+                         {.meta = true,
+                          .squashfs = true,
+                          .progress =
+                              [&](std::uint64_t n) {
+                                  if (n > (1 << 20) && !raised) {
+                                      raised = true;
+                                      raise(SIGINT);
+                                  }
+                                  return true;
+                              }},
+                         creds),
+        util::signal_exception);
+    REQUIRE(raised);
+    REQUIRE(util::signal_raised());
+    REQUIRE(!fs::exists(dst / "store.squashfs"));
+    REQUIRE(fs::exists(dst / "store.squashfs.partial"));
+    REQUIRE(fs::exists(dst / "store.squashfs.checkpoint"));
+
+    REQUIRE(uenv::oras::pull(registry.url(), "build", with_sha(record, image),
+                             dst, {.meta = true, .squashfs = true,
+                                   .progress = [](std::uint64_t) {
+                                       return true;
+                                   }},
+                             creds));
+    REQUIRE(read_file(dst / "store.squashfs") == image);
+}
+
+TEST_CASE("challenge", "[oci]") {
+    // registries that use basic authentication
+    http_stub server([](const std::string& request) -> http_stub::response {
+        if (request.find("Authorization: Basic dXNlcjpwdw==") ==
+            std::string::npos) {
+            return {401, {"WWW-Authenticate: Basic realm=\"stub\""}, {}};
+        }
+        return {200, {}, "{}"};
+    });
+    uenv::oci::client client(server.url("/"), creds);
+    const auto config = uenv::oci::empty_config();
+    auto blob = client.get_blob("a/b", config);
+    REQUIRE(blob);
+    REQUIRE(*blob == "{}");
+    REQUIRE(client.get_blob("a/b", config));
+    REQUIRE(server.requests == 3);
+
+    uenv::oci::client anonymous(server.url("/"));
+    REQUIRE(anonymous.get_blob("a/b", config).error().code ==
+            uenv::oci::errc::unauthorized);
+}
+
+TEST_CASE("parallel download", "[oci]") {
+    const auto image = make_image(3 << 20);
+    const uenv::oci::descriptor blob{.media_type = "application/octet-stream",
+                                     .digest = uenv::oci::digest_of(image),
+                                     .size = image.size()};
+    auto _ = util::defer([]() { uenv::oci::set_download_config({}); });
+
+    // with 64 KiB chunks, bytes that are received out of order do not all fit
+    // in the buffer of the hasher
+    for (auto [chunk, ranges] : {std::pair{256 << 10, true},
+                                 std::pair{64 << 10, true},
+                                 std::pair{256 << 10, false}}) {
+        uenv::oci::set_download_config(
+            {.chunk_size = std::uint64_t(chunk), .max_streams = 4});
+        registry_stub registry;
+        registry.ranges = ranges;
+        uenv::oci::client client(registry.url(), creds);
+        REQUIRE(client.put_blob("build/a", blob, image));
+
+        // cancel the download part way through
+        const auto dst = util::make_temp_dir() / "store.squashfs";
+        auto r = client.get_blob("build/a", blob, dst,
+                                 [](std::uint64_t n) { return n < (1 << 20); });
+        REQUIRE(!r);
+        REQUIRE(!fs::exists(dst));
+        if (ranges) {
+            // the blob is requested in chunks
+            REQUIRE(r.error().code == uenv::oci::errc::cancelled);
+            REQUIRE(fs::exists(fs::path(dst.string() + ".checkpoint")));
+            REQUIRE(fs::file_size(dst.string() + ".partial") == image.size());
+            for (auto [first, last] : registry.range_requests) {
+                REQUIRE(last - first <= std::size_t(chunk));
+            }
+        }
+
+        // resuming only requests the chunks that were not downloaded
+        {
+            std::lock_guard lock(registry.mutex);
+            registry.range_requests.clear();
+        }
+        REQUIRE(client.get_blob("build/a", blob, dst));
+        REQUIRE(read_file(dst) == image);
+        REQUIRE(!fs::exists(fs::path(dst.string() + ".partial")));
+        REQUIRE(!fs::exists(fs::path(dst.string() + ".checkpoint")));
+        if (ranges) {
+            std::size_t requested = 0;
+            for (auto [first, last] : registry.range_requests) {
+                requested += last - first;
+            }
+            REQUIRE(requested > 0);
+            REQUIRE(requested < image.size());
+        }
+    }
+
+    // corrupt downloads are rejected
+    registry_stub registry;
+    uenv::oci::client client(registry.url(), creds);
+    REQUIRE(client.put_blob("build/a", blob, image));
+    registry.corrupt = true;
+    const auto dst = util::make_temp_dir() / "store.squashfs";
+    auto r = client.get_blob("build/a", blob, dst);
+    REQUIRE(!r);
+    REQUIRE(!fs::exists(dst));
+    REQUIRE(!fs::exists(fs::path(dst.string() + ".partial")));
+}
+
+TEST_CASE("download limits", "[oci]") {
+    const auto image = make_image(2 << 20);
+    const uenv::oci::descriptor blob{.media_type = "application/octet-stream",
+                                     .digest = uenv::oci::digest_of(image),
+                                     .size = image.size()};
+    auto _ = util::defer([]() { uenv::oci::set_download_config({}); });
+
+    registry_stub registry;
+    uenv::oci::client client(registry.url(), creds);
+    REQUIRE(client.put_blob("build/a", blob, image));
+
+    // concurrent downloads share one connection and the rate limit
+    uenv::oci::set_download_config({.chunk_size = 256 << 10,
+                                    .max_streams = 4,
+                                    .max_connections = 1,
+                                    .max_rate = 8 << 20});
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> downloads;
+    std::atomic<int> ok = 0;
+    for (int i = 0; i < 2; ++i) {
+        downloads.emplace_back([&]() {
+            uenv::oci::client c(registry.url(), creds);
+            if (c.get_blob("build/a", blob,
+                           util::make_temp_dir() / "store.squashfs")) {
+                ++ok;
+            }
+        });
+    }
+    for (auto& t : downloads) {
+        t.join();
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    REQUIRE(ok == 2);
+    // 4 MiB at 8 MiB/s
+    REQUIRE(elapsed.count() > 0.4);
+
+    // the progress of a pull is reported to the caller, who can cancel it
+    uenv::oci::set_download_config({});
+    push(registry, image);
+    std::uint64_t reported = 0;
+    auto dst = util::make_temp_dir();
+    REQUIRE(uenv::oras::pull(registry.url(), "build", with_sha(record, image),
+                             dst,
+                             {.meta = true,
+                              .squashfs = true,
+                              .progress =
+                                  [&](std::uint64_t n) {
+                                      reported = n;
+                                      return true;
+                                  }},
+                             creds));
+    REQUIRE(reported >= image.size());
+    dst = util::make_temp_dir();
+    REQUIRE(!uenv::oras::pull(registry.url(), "build", with_sha(record, image),
+                              dst,
+                              {.meta = false,
+                               .squashfs = true,
+                               .progress = [](std::uint64_t) { return false; }},
+                              creds));
+    REQUIRE(!fs::exists(dst / "store.squashfs"));
+}
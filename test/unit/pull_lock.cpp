@@ -0,0 +1,159 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <catch2/catch_all.hpp>
+
+#include <uenv/pull_lock.h>
+#include <util/fs.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::int64_t now() {
+    using namespace std::chrono;
+    return duration_cast<seconds>(system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+TEST_CASE("pull status", "[pull_lock]") {
+    const auto dir = util::make_temp_dir();
+    const uenv::pull_status status{.host = "nid001234",
+                                   .pid = 42,
+                                   .state = uenv::pull_state::done,
+                                   .bytes = 100,
+                                   .total = 200,
+                                   .updated = 1700000000};
+    REQUIRE(uenv::write_pull_status(dir / "status", status));
+    auto r = uenv::read_pull_status(dir / "status");
+    REQUIRE(r);
+    REQUIRE(r->host == "nid001234");
+    REQUIRE(r->pid == 42);
+    REQUIRE(r->state == uenv::pull_state::done);
+    REQUIRE(r->bytes == 100);
+    REQUIRE(r->total == 200);
+    REQUIRE(r->updated == 1700000000);
+    REQUIRE(uenv::holder_string(*r) == "pid 42 on nid001234");
+
+    REQUIRE(!uenv::read_pull_status(dir / "missing"));
+    std::ofstream(dir / "invalid") << "{\"host\": 1}";
+    REQUIRE(!uenv::read_pull_status(dir / "invalid"));
+}
+
+TEST_CASE("pull lock", "[pull_lock]") {
+    const auto dir = util::make_temp_dir();
+    const auto store = dir / "abcd";
+    const auto status_path = fs::path(store.string() + ".status");
+
+    // the first pull of an image
+    {
+        auto lock = uenv::acquire_pull_lock(store, {.total = 1000});
+        REQUIRE(lock);
+        REQUIRE(!lock->interrupted());
+        REQUIRE(!lock->waited_for());
+        auto status = uenv::read_pull_status(status_path);
+        REQUIRE(status);
+        REQUIRE(status->state == uenv::pull_state::pulling);
+        REQUIRE(status->total == 1000);
+        lock->finish(true);
+        status = uenv::read_pull_status(status_path);
+        REQUIRE(status->state == uenv::pull_state::done);
+        REQUIRE(status->bytes == 1000);
+    }
+
+    // a pull that is not finished is recorded as failed
+    {
+        auto lock = uenv::acquire_pull_lock(store, {.total = 1000});
+        REQUIRE(lock);
+    }
+    REQUIRE(uenv::read_pull_status(status_path)->state ==
+            uenv::pull_state::failed);
+
+    // wait for another pull to finish
+    {
+        auto holder = uenv::acquire_pull_lock(store, {.total = 1000});
+        REQUIRE(holder);
+        std::thread t([lock = std::move(*holder)]() mutable {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::this_thread::sleep_for(uenv::pull_update_interval);
+            lock.update(500);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            lock.finish(true);
+        });
+        std::atomic<unsigned> calls{0};
+        auto lock = uenv::acquire_pull_lock(
+            store, {.total = 1000,
+                    .timeout = std::chrono::seconds(30),
+                    .waiting = [&](const uenv::pull_status&) { ++calls; }});
+        t.join();
+        REQUIRE(lock);
+        REQUIRE(calls > 0);
+        REQUIRE(lock->waited_for());
+        REQUIRE(lock->waited_for()->state == uenv::pull_state::done);
+        REQUIRE(!lock->interrupted());
+        lock->finish(true);
+    }
+
+    // a pull that stopped without releasing its status is resumed
+    REQUIRE(uenv::write_pull_status(
+        status_path, {.host = "nid001234", .pid = 42, .updated = now()}));
+    {
+        auto lock = uenv::acquire_pull_lock(store, {.total = 1000});
+        REQUIRE(lock);
+        REQUIRE(lock->interrupted());
+        REQUIRE(lock->interrupted()->host == "nid001234");
+        REQUIRE(!lock->waited_for());
+    }
+}
+
+TEST_CASE("pull lock stale and timeout", "[pull_lock]") {
+    const auto dir = util::make_temp_dir();
+    const auto store = dir / "abcd";
+    const auto status_path = fs::path(store.string() + ".status");
+    auto holder = util::make_file_lock(store.string() + ".lock");
+    REQUIRE(holder);
+
+    // a holder on another host that has not updated its status
+    REQUIRE(uenv::write_pull_status(
+        status_path, {.host = "nid001234", .pid = 42, .updated = now() - 60}));
+    auto lock = uenv::acquire_pull_lock(
+        store, {.timeout = std::chrono::seconds(30),
+                .stale_after = std::chrono::seconds(10)});
+    REQUIRE(!lock);
+    REQUIRE(lock.error().find("has not updated its status") !=
+            std::string::npos);
+
+    // waits are bounded
+    REQUIRE(uenv::write_pull_status(
+        status_path, {.host = "nid001234", .pid = 42, .updated = now()}));
+    auto timed_out =
+        uenv::acquire_pull_lock(store, {.timeout = std::chrono::seconds(1)});
+    REQUIRE(!timed_out);
+    REQUIRE(timed_out.error().find("timed out") != std::string::npos);
+    REQUIRE(timed_out.error().find("pid 42 on nid001234") != std::string::npos);
+
+    // a status written by a process on this host that is not running: the
+    // lock is held by another process, so removing it is not suggested
+    const pid_t child = fork();
+    if (child == 0) {
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    REQUIRE(uenv::write_pull_status(
+        status_path, {.host = host, .pid = child, .updated = now()}));
+    auto dead = uenv::acquire_pull_lock(
+        store, {.timeout = std::chrono::seconds(30)});
+    REQUIRE(!dead);
+    REQUIRE(dead.error().find("is not running") != std::string::npos);
+    REQUIRE(dead.error().find("remove") == std::string::npos);
+}
@@ -1,9 +1,22 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <catch2/catch_all.hpp>
 #include <fmt/core.h>
 
 #include <uenv/env.h>
 #include <uenv/print.h>
 #include <uenv/repository.h>
+#include <uenv/seed.h>
+#include <util/fs.h>
+
+#include <sqlite3.h>
 
 namespace {
 
@@ -147,6 +160,53 @@ TEST_CASE("search_sha", "[repository]") {
     }
 }
 
+TEST_CASE("cursor", "[repository]") {
+    auto repo = create_full_repo();
+    REQUIRE(repo);
+
+    // records are returned in sorted order, the same as query
+    {
+        auto c = repo->cursor({});
+        REQUIRE(c);
+        std::vector<uenv::uenv_record> records;
+        for (auto& r : *c) {
+            records.push_back(r);
+        }
+        REQUIRE(!c->error());
+        REQUIRE(records.size() == 12u);
+        REQUIRE(std::is_sorted(records.begin(), records.end()));
+        auto q = repo->query({});
+        REQUIRE(std::equal(records.begin(), records.end(), q->begin(),
+                           q->end()));
+    }
+
+    // a name that is also a valid id matches both names and ids
+    {
+        auto c = repo->cursor({.name = mid('1').string()});
+        REQUIRE(c);
+        auto result = c->collect();
+        REQUIRE(result);
+        REQUIRE(result->size() == 2u);
+        REQUIRE(result->begin()->name == "icon");
+    }
+
+    // the same query can be stepped by more than one cursor at a time
+    {
+        auto outer = repo->cursor({.name = "prgenv-gnu"});
+        REQUIRE(outer);
+        unsigned n = 0;
+        for (auto& r : *outer) {
+            auto inner = repo->cursor({.name = "prgenv-gnu"});
+            REQUIRE(inner);
+            REQUIRE(inner->collect()->size() == 5u);
+            REQUIRE(r.name == "prgenv-gnu");
+            ++n;
+        }
+        REQUIRE(n == 5u);
+        REQUIRE(repo->query({.name = "prgenv-gnu"})->size() == 5u);
+    }
+}
+
 TEST_CASE("remove sha", "[repository]") {
     auto repo = create_mini_repo();
     REQUIRE(repo);
@@ -228,3 +288,253 @@ TEST_CASE("remove label", "[repository]") {
     REQUIRE(repo.remove(*(uenv_a.begin() + 1)));
     REQUIRE(num_images() == 0);
 }
+
+TEST_CASE("add_batch", "[repository]") {
+    auto repo = uenv::create_repository();
+    REQUIRE(repo);
+
+    auto num_images = [&repo]() { return repo->query({})->size(); };
+
+    REQUIRE(repo->add_batch(prgenvgnu_records));
+    REQUIRE(num_images() == 5u);
+
+    // adding records that are already in the repository is a noop
+    REQUIRE(repo->add_batch(prgenvgnu_records));
+    REQUIRE(num_images() == 5u);
+
+    REQUIRE(repo->add_batch(icon_records));
+    REQUIRE(num_images() == 8u);
+
+    // an existing label is updated to point to the new image
+    {
+        auto r = prgenvgnu_records[2];
+        r.sha = msha('d');
+        r.id = mid('d');
+        REQUIRE(repo->add_batch(std::vector<uenv::uenv_record>{r}));
+        REQUIRE(num_images() == 8u);
+        auto result = *(repo->query({.name = msha('d').string()}));
+        REQUIRE(result.size() == 1u);
+        REQUIRE(result.begin()->tag == "v1");
+        // the old image has no more tags
+        REQUIRE(repo->query({.name = msha('c').string()})->empty());
+    }
+
+    // if one record can't be added, none of the records are added
+    {
+        // the id of a record with a different sha is already in the db,
+        // which violates the foreign key constraint on the tags table
+        auto r = icon_records[0];
+        r.tag = "v3";
+        r.sha = msha('3');
+        std::vector<uenv::uenv_record> batch = duplicate_records;
+        batch.push_back(r);
+        REQUIRE(!repo->add_batch(batch));
+        REQUIRE(num_images() == 8u);
+        REQUIRE(repo->query({.name = "netcdf-tools"})->empty());
+    }
+}
+
+TEST_CASE("schema migration", "[repository]") {
+    const auto path = util::make_temp_dir() / "repo";
+
+    // new repositories are created with the latest schema
+    {
+        auto repo = create_mini_repo(path);
+        REQUIRE(repo);
+        REQUIRE(repo->schema_version() == uenv::latest_schema_version());
+        // upgrading an up to date repository is a noop
+        REQUIRE(repo->upgrade_schema());
+        REQUIRE(repo->schema_version() == uenv::latest_schema_version());
+    }
+
+    // roll the database back to the original version 0 schema
+    {
+        sqlite3* db;
+        REQUIRE(sqlite3_open((path / "index.db").c_str(), &db) == SQLITE_OK);
+        for (auto stmt : {
+                 "DROP INDEX uenv_name",
+                 "DROP INDEX tags_sha256",
+                 "PRAGMA user_version = 0",
+             }) {
+            REQUIRE(sqlite3_exec(db, stmt, nullptr, nullptr, nullptr) ==
+                    SQLITE_OK);
+        }
+        sqlite3_close(db);
+    }
+
+    {
+        auto repo = uenv::open_repository(path, uenv::repo_mode::readwrite);
+        REQUIRE(repo);
+        REQUIRE(repo->schema_version() == 0);
+        REQUIRE(repo->query({})->size() == 3u);
+
+        REQUIRE(repo->upgrade_schema());
+        REQUIRE(repo->schema_version() == uenv::latest_schema_version());
+
+        // the upgraded triggers remove orphaned images and uenv
+        REQUIRE(repo->remove(msha('a')));
+        REQUIRE(repo->query({})->size() == 1u);
+        REQUIRE(repo->query({.name = "dingo"})->empty());
+    }
+}
+
+TEST_CASE("readonly repository", "[repository]") {
+    namespace fs = std::filesystem;
+    const auto path = util::make_temp_dir() / "repo";
+    const auto db_path = path / "index.db";
+    REQUIRE(create_mini_repo(path));
+
+    // lock the database: a readonly repository is opened immutable, so reads
+    // do not wait for the lock.
+    sqlite3* db;
+    REQUIRE(sqlite3_open(db_path.c_str(), &db) == SQLITE_OK);
+    REQUIRE(sqlite3_exec(db, "BEGIN EXCLUSIVE", nullptr, nullptr, nullptr) ==
+            SQLITE_OK);
+
+    const auto rw = fs::status(db_path).permissions();
+    const auto ro = fs::perms::owner_read | fs::perms::owner_exec;
+    fs::permissions(db_path, ro);
+    fs::permissions(path, ro);
+    REQUIRE(uenv::validate_repository(path) == uenv::repo_state::readonly);
+
+    uenv::set_busy_timeout(std::chrono::milliseconds(100));
+    {
+        auto repo = uenv::open_repository(path);
+        REQUIRE(repo);
+        REQUIRE(repo->is_readonly());
+        REQUIRE(repo->query({})->size() == 3u);
+        REQUIRE(!uenv::open_repository(path, uenv::repo_mode::readwrite));
+    }
+
+    fs::permissions(path, rw | fs::perms::owner_exec);
+    fs::permissions(db_path, rw);
+    sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+
+    // a readwrite repository has to wait for the lock
+    {
+        sqlite3_open(db_path.c_str(), &db);
+        sqlite3_exec(db, "BEGIN EXCLUSIVE", nullptr, nullptr, nullptr);
+        auto repo = uenv::open_repository(path);
+        REQUIRE(repo);
+        REQUIRE(!repo->query({}));
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        sqlite3_close(db);
+        REQUIRE(repo->query({})->size() == 3u);
+    }
+    uenv::set_busy_timeout(std::chrono::seconds(30));
+}
+
+// many processes add records to, and query, the same repository at the same
+// time: every operation has to succeed by waiting for the locks held by the
+// other processes.
+TEST_CASE("concurrent access", "[repository]") {
+    using uenv::journal_mode;
+    constexpr int num_procs = 16;
+    constexpr int num_records = 20;
+
+    auto make_record = [](int p, int i) {
+        const std::uint64_t h =
+            (p * num_records + i + 1) * 0x9e3779b97f4a7c15ull;
+        const auto sha = uenv::sha256(fmt::format("{:016x}{:048x}", h, 0));
+        return uenv::uenv_record{
+            .system = "santis",
+            .uarch = "gh200",
+            .name = fmt::format("app{}", p),
+            .version = "1.0",
+            .tag = fmt::format("v{}", i),
+            .date = {},
+            .size_byte = 1024,
+            .sha = sha,
+            .id = uenv::uenv_id(fmt::format("{:016x}", h)),
+        };
+    };
+
+    for (auto mode : {journal_mode::rollback, journal_mode::wal}) {
+        const auto path = util::make_temp_dir() / "repo";
+        {
+            auto repo = uenv::create_repository(path);
+            REQUIRE(repo);
+            REQUIRE(repo->set_journal(mode));
+            REQUIRE(repo->journal() == mode);
+        }
+
+        std::vector<pid_t> children;
+        for (int p = 0; p < num_procs; ++p) {
+            const pid_t pid = fork();
+            REQUIRE(pid >= 0);
+            if (pid == 0) {
+                // the child process exits with the number of failed operations
+                int failures = 0;
+                auto writer =
+                    uenv::open_repository(path, uenv::repo_mode::readwrite);
+                if (!writer) {
+                    _exit(1);
+                }
+                for (int i = 0; i < num_records; ++i) {
+                    failures += !writer->add(make_record(p, i));
+                    auto reader = uenv::open_repository(path);
+                    if (!reader) {
+                        ++failures;
+                        continue;
+                    }
+                    auto result =
+                        reader->query({.name = fmt::format("app{}", p)});
+                    failures += !result || result->size() != unsigned(i + 1);
+                }
+                _exit(std::min(failures, 255));
+            }
+            children.push_back(pid);
+        }
+
+        for (auto pid : children) {
+            int status;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+
+        auto repo = uenv::open_repository(path);
+        REQUIRE(repo);
+        REQUIRE(repo->journal() == mode);
+        REQUIRE(repo->query({})->size() == unsigned(num_procs * num_records));
+    }
+}
+
+TEST_CASE("seed_image", "[repository]") {
+    namespace fs = std::filesystem;
+
+    const auto sha = msha('a');
+    const auto site = util::make_temp_dir();
+    const auto project = util::make_temp_dir();
+    const auto user = util::make_temp_dir();
+    const auto dst = uenv::uenv_paths(user, sha);
+
+    // images that are not in any seed repository are not found
+    auto r = uenv::seed_image({site, project}, sha, 0, dst);
+    REQUIRE(r);
+    REQUIRE(!*r);
+
+    const auto src = uenv::uenv_paths(project, sha);
+    fs::create_directories(src.meta);
+    std::ofstream(src.squashfs) << "squashfs";
+    std::ofstream(src.meta / "env.json") << "{}";
+
+    // images with the wrong size are ignored
+    r = uenv::seed_image({site, project}, sha, 4, dst);
+    REQUIRE(r);
+    REQUIRE(!*r);
+
+    r = uenv::seed_image({site, project}, sha, 8, dst);
+    REQUIRE(r);
+    REQUIRE(*r);
+    REQUIRE((*r)->repo == project);
+    REQUIRE((*r)->meta);
+    REQUIRE(fs::file_size(dst.squashfs) == 8);
+    REQUIRE(fs::exists(dst.meta / "env.json"));
+
+    // the image is not copied onto itself
+    r = uenv::seed_image({user}, sha, 8, dst);
+    REQUIRE(r);
+    REQUIRE(!*r);
+}
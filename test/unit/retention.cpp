@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include <site/site.h>
+#include <uenv/repository.h>
+#include <uenv/retention.h>
+#include <uenv/uenv.h>
+#include <util/defer.h>
+
+#include "http_stub.h"
+
+namespace {
+
+uenv::uenv_record make_record(const std::string& name, const std::string& tag,
+                              uenv::uenv_date date,
+                              const std::string& system = "daint") {
+    return {.system = system,
+            .uarch = "gh200",
+            .name = name,
+            .version = "24.11",
+            .tag = tag,
+            .date = date,
+            .size_byte = 1024};
+}
+
+std::vector<std::string> tags(const std::vector<uenv::uenv_record>& records) {
+    std::vector<std::string> result;
+    for (auto& r : records) {
+        result.push_back(r.system + "/" + r.name + ":" + r.tag);
+    }
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("parse retention policy", "[retention]") {
+    using namespace std::chrono;
+
+    auto p = uenv::parse_retention_policy("5");
+    REQUIRE(p);
+    REQUIRE(p->newest == 5u);
+    REQUIRE(!p->max_age);
+
+    p = uenv::parse_retention_policy("30d");
+    REQUIRE(p);
+    REQUIRE(!p->newest);
+    REQUIRE(p->max_age == days(30));
+
+    p = uenv::parse_retention_policy("2,12h");
+    REQUIRE(p);
+    REQUIRE(p->newest == 2u);
+    REQUIRE(p->max_age == hours(12));
+    REQUIRE(uenv::parse_retention_policy("1w")->max_age == weeks(1));
+    REQUIRE(uenv::parse_retention_policy("90m")->max_age == minutes(90));
+
+    for (auto arg : {"", "x", "5x", "5dd", "-1", "1,2", "1d,2d", "d"}) {
+        REQUIRE(!uenv::parse_retention_policy(arg));
+    }
+}
+
+TEST_CASE("retention plan", "[retention]") {
+    using namespace std::chrono;
+
+    const uenv::record_set records(std::vector<uenv::uenv_record>{
+        make_record("prgenv-gnu", "101", {2025, 1, 1}),
+        make_record("prgenv-gnu", "104", {2025, 3, 1}),
+        make_record("prgenv-gnu", "102", {2025, 2, 1}),
+        make_record("prgenv-gnu", "103", {2025, 2, 1, 12, 0, 0}),
+        make_record("prgenv-gnu", "105", {2025, 1, 15}, "clariden"),
+        make_record("netcdf-tools", "201", {2024, 6, 1}),
+    });
+    const auto now = sys_days{2025y / 3 / 2};
+
+    // the newest tags are kept for each image and system
+    REQUIRE(tags(uenv::retention_plan(records, {.newest = 2}, now)) ==
+            std::vector<std::string>{"daint/prgenv-gnu:102",
+                                     "daint/prgenv-gnu:101"});
+    REQUIRE(uenv::retention_plan(records, {.newest = 4}, now).empty());
+    REQUIRE(uenv::retention_plan(records, {.newest = 0}, now).size() == 6);
+
+    // uenv older than the age are deleted
+    REQUIRE(tags(uenv::retention_plan(records, {.max_age = days(30)}, now)) ==
+            std::vector<std::string>{"daint/netcdf-tools:201",
+                                     "clariden/prgenv-gnu:105",
+                                     "daint/prgenv-gnu:101"});
+
+    // a uenv is kept if either rule keeps it
+    REQUIRE(tags(uenv::retention_plan(records,
+                                      {.newest = 1, .max_age = days(30)},
+                                      now)) ==
+            std::vector<std::string>{"daint/prgenv-gnu:101"});
+}
+
+TEST_CASE("delete uenv", "[delete]") {
+    std::mutex mutex;
+    std::vector<std::string> deleted;
+    http_stub server(
+        [&](const std::string& request) -> http_stub::response {
+            // "user:pw" in base64
+            if (!request.starts_with("DELETE ") ||
+                request.find("Authorization: Basic dXNlcjpwdw==") ==
+                    std::string::npos) {
+                return {400, {}, {}};
+            }
+            const auto path = request.substr(7, request.find(' ', 7) - 7);
+            if (path.ends_with("/missing")) {
+                return {404, {}, {}};
+            }
+            std::lock_guard _(mutex);
+            deleted.push_back(path);
+            return {204, {}, {}};
+        },
+        true);
+    site::set_registry_config({.api = server.url("/artifactory/uenv")});
+    auto restore = util::defer([] { site::set_registry_config({}); });
+
+    std::vector<uenv::uenv_record> records;
+    for (auto tag : {"1", "2", "missing", "3", "4", "5"}) {
+        records.push_back({.system = "daint",
+                           .uarch = "gh200",
+                           .name = "prgenv-gnu",
+                           .version = "24.11",
+                           .tag = tag});
+    }
+    const auto results =
+        site::delete_uenv("build", records, {"user", "pw"}, 3);
+    REQUIRE(results.size() == records.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        REQUIRE(bool(results[i]) == (records[i].tag != "missing"));
+    }
+    std::sort(deleted.begin(), deleted.end());
+    REQUIRE(deleted.size() == 5);
+    REQUIRE(deleted.front() ==
+            "/artifactory/uenv/build/daint/gh200/prgenv-gnu/24.11/1");
+}
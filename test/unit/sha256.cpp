@@ -0,0 +1,106 @@
+#include <fstream>
+#include <string>
+
+#include <catch2/catch_all.hpp>
+
+#include <util/fs.h>
+#include <util/sha256.h>
+
+
+TEST_CASE("digest", "[sha256]") {
+    // test vectors from FIPS 180-2
+    REQUIRE(util::sha256_hex("") ==
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    REQUIRE(util::sha256_hex("abc") ==
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    REQUIRE(util::sha256_hex(
+                "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    REQUIRE(util::sha256_hex(std::string(1000000, 'a')) ==
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST_CASE("streaming", "[sha256]") {
+    std::string input;
+    for (int i = 0; i < 1000; ++i) {
+        input += char(i * 7);
+    }
+    const auto expected = util::sha256_hex(input);
+
+    // the digest does not depend on how the input is split
+    for (std::size_t chunk = 1; chunk < 200; chunk += 13) {
+        util::sha256 h;
+        for (std::size_t i = 0; i < input.size(); i += chunk) {
+            h.update(std::string_view(input).substr(i, chunk));
+        }
+        REQUIRE(h.hex_digest() == expected);
+        // the hasher is reset by hex_digest
+        h.update("abc");
+        REQUIRE(h.hex_digest() == util::sha256_hex("abc"));
+    }
+
+    const auto path = util::make_temp_dir() / "input";
+    std::ofstream(path, std::ios::binary) << input;
+    REQUIRE(util::sha256_file(path).value() == expected);
+    REQUIRE(!util::sha256_file(path.parent_path() / "missing"));
+}
+
+TEST_CASE("serialize", "[sha256]") {
+    std::string input;
+    for (int i = 0; i < 1000; ++i) {
+        input += char(i * 7);
+    }
+    const auto expected = util::sha256_hex(input);
+
+    // hashing can be resumed from a saved state at any offset
+    for (std::size_t split : {0, 1, 63, 64, 65, 500, 1000}) {
+        util::sha256 h;
+        h.update(std::string_view(input).substr(0, split));
+        auto restored = util::sha256::deserialize(h.serialize());
+        REQUIRE(restored);
+        REQUIRE(restored->size() == split);
+        restored->update(std::string_view(input).substr(split));
+        REQUIRE(restored->hex_digest() == expected);
+    }
+
+    REQUIRE(!util::sha256::deserialize(""));
+    REQUIRE(!util::sha256::deserialize("abc:1:"));
+    util::sha256 h;
+    h.update("abc");
+    auto state = h.serialize();
+    REQUIRE(!util::sha256::deserialize(state.substr(0, state.size() - 2)));
+    REQUIRE(!util::sha256::deserialize(state.replace(0, 1, "x")));
+}
+
+TEST_CASE("isa", "[sha256]") {
+    const auto isas = util::sha256_supported_isas();
+    REQUIRE(!isas.empty());
+    REQUIRE(isas.front() == util::sha256_isa::generic);
+
+    std::string input;
+    for (int i = 0; i < 100000; ++i) {
+        input += char((i * 2654435761u) >> 13);
+    }
+    const auto expected = util::sha256_hex(input);
+
+    // every implementation supported by the CPU gives the same digests
+    for (auto isa : isas) {
+        INFO(util::to_string(isa));
+        REQUIRE(util::set_sha256_isa(isa));
+        REQUIRE(util::sha256_hex("abc") ==
+                "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        REQUIRE(util::sha256_hex(
+                    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+                "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+        REQUIRE(util::sha256_hex(std::string(1000000, 'a')) ==
+                "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        for (std::size_t chunk : {1, 63, 64, 65, 1000, 4096}) {
+            util::sha256 h;
+            for (std::size_t i = 0; i < input.size(); i += chunk) {
+                h.update(std::string_view(input).substr(i, chunk));
+            }
+            REQUIRE(h.hex_digest() == expected);
+        }
+    }
+    REQUIRE(util::set_sha256_isa(isas.back()));
+}
@@ -21,4 +21,14 @@ TEST_CASE("SIGINT", "[signal]") {
     raise(SIGINT);
     REQUIRE(util::signal_raised());
     REQUIRE(!util::signal_raised());
+
+    // checking for a pending signal does not clear it
+    util::set_signal_catcher();
+    REQUIRE(!util::signal_pending());
+    raise(SIGINT);
+    REQUIRE(util::signal_pending());
+    REQUIRE(util::signal_pending());
+    REQUIRE(util::last_signal_raised() == SIGINT);
+    REQUIRE(util::signal_raised());
+    REQUIRE(!util::signal_pending());
 }